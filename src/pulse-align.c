@@ -0,0 +1,184 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include <util/util_uint64.h>
+
+#include "pulse-align.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* a burst starts when the signal exceeds this after enough silence */
+#define ONSET_THRESHOLD 0.01f
+
+void pulse_align_chirp(float *chirp, size_t frames, uint32_t rate,
+		       double start_hz, double end_hz, double amplitude)
+{
+	double duration = (double)frames / rate;
+	double sweep = (end_hz - start_hz) / duration;
+
+	for (size_t n = 0; n < frames; n++) {
+		double t = (double)n / rate;
+		double phase =
+			2.0 * M_PI * (start_hz * t + sweep * t * t / 2.0);
+		double window = 0.5 - 0.5 * cos(2.0 * M_PI * n / frames);
+		chirp[n] = (float)(amplitude * window * sin(phase));
+	}
+}
+
+void pulse_align_init(struct pulse_align *a, const float *chirp,
+		      size_t chirp_frames, uint32_t rate)
+{
+	memset(a, 0, sizeof(*a));
+	a->chirp = chirp;
+	a->chirp_frames = chirp_frames;
+	a->rate = rate;
+	a->onset = UINT64_MAX;
+}
+
+void pulse_align_packet(struct pulse_align *a, uint64_t frames, uint64_t ts,
+			uint64_t delivered)
+{
+	struct pulse_align_packet *p =
+		&a->packets[a->packet_count++ % PULSE_ALIGN_PACKETS];
+	p->first = a->position;
+	p->frames = frames;
+	p->ts = ts;
+	p->delivered = delivered;
+}
+
+/**
+ * Locate a burst within a chirp length of its onset
+ */
+static bool pulse_align_locate(struct pulse_align *a, uint64_t onset,
+			       struct pulse_align_burst *burst)
+{
+	uint64_t search = a->chirp_frames;
+	uint64_t oldest = a->position > PULSE_ALIGN_HISTORY_FRAMES
+				  ? a->position - PULSE_ALIGN_HISTORY_FRAMES
+				  : 0;
+	uint64_t start = onset > search ? onset - search : 0;
+	uint64_t best_start = UINT64_MAX;
+	double best = 0.0;
+
+	if (start < oldest)
+		start = oldest;
+
+	for (uint64_t n0 = start;
+	     n0 <= onset + search && n0 + a->chirp_frames <= a->position;
+	     n0++) {
+		double sum = 0.0;
+		for (size_t n = 0; n < a->chirp_frames; n++)
+			sum += (double)a->chirp[n] *
+			       a->history[(n0 + n) &
+					  (PULSE_ALIGN_HISTORY_FRAMES - 1)];
+		if (sum > best) {
+			best = sum;
+			best_start = n0;
+		}
+	}
+
+	if (best_start == UINT64_MAX)
+		return false;
+
+	uint_fast32_t count = a->packet_count < PULSE_ALIGN_PACKETS
+				      ? a->packet_count
+				      : PULSE_ALIGN_PACKETS;
+	for (uint_fast32_t i = 0; i < count; i++) {
+		struct pulse_align_packet *p =
+			&a->packets[(a->packet_count - 1 - i) %
+				    PULSE_ALIGN_PACKETS];
+		if (best_start < p->first || best_start >= p->first + p->frames)
+			continue;
+
+		burst->start = best_start;
+		burst->ts = p->ts + util_mul_div64(best_start - p->first,
+						   NSEC_PER_SEC, a->rate);
+		burst->delivered = p->delivered;
+		return true;
+	}
+
+	return false;
+}
+
+bool pulse_align_sample(struct pulse_align *a, float value,
+			struct pulse_align_burst *burst)
+{
+	bool found = false;
+
+	a->history[a->position & (PULSE_ALIGN_HISTORY_FRAMES - 1)] = value;
+
+	if (a->onset == UINT64_MAX) {
+		if (fabsf(value) > ONSET_THRESHOLD &&
+		    a->quiet >= 2 * a->chirp_frames)
+			a->onset = a->position;
+		a->quiet = fabsf(value) > ONSET_THRESHOLD ? 0 : a->quiet + 1;
+	}
+
+	a->position++;
+
+	if (a->onset != UINT64_MAX &&
+	    a->position >= a->onset + 2 * a->chirp_frames) {
+		found = pulse_align_locate(a, a->onset, burst);
+		a->onset = UINT64_MAX;
+		a->quiet = 0;
+	}
+
+	return found;
+}
+
+void pulse_align_offset(const uint64_t *played_a, const uint64_t *ts_a,
+			size_t count_a, const uint64_t *played_b,
+			const uint64_t *ts_b, size_t count_b,
+			uint64_t window_ns, struct pulse_align_offset *offset)
+{
+	double sum = 0.0, sq = 0.0;
+	int64_t window = (int64_t)window_ns;
+	size_t j = 0;
+
+	memset(offset, 0, sizeof(*offset));
+
+	for (size_t i = 0; i < count_a; i++) {
+		int64_t a = (int64_t)played_a[i];
+
+		while (j < count_b && (int64_t)played_b[j] < a - window)
+			j++;
+		if (j == count_b)
+			break;
+		if ((int64_t)played_b[j] > a + window)
+			continue;
+
+		double diff = (double)((int64_t)(ts_b[j] - ts_a[i]) -
+				       ((int64_t)played_b[j] - a));
+		sum += diff;
+		sq += diff * diff;
+		if (fabs(diff) > offset->max_ns)
+			offset->max_ns = fabs(diff);
+		offset->paired++;
+		j++;
+	}
+
+	if (offset->paired) {
+		double n = offset->paired;
+		offset->offset_ns = sum / n;
+		offset->jitter_ns = sqrt(
+			fmax(sq / n - offset->offset_ns * offset->offset_ns,
+			     0.0));
+	}
+}
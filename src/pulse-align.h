@@ -0,0 +1,142 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#pragma once
+
+/*
+ * Burst detection and alignment of captures
+ *
+ * Locates a known chirp in a captured signal by cross-correlation and maps
+ * it to the timestamp it was captured at, then compares the timestamps two
+ * captures gave the same bursts. Used by the latency harness, free of any
+ * server so it can be tested on synthetic captures.
+ */
+
+/* captured audio kept for the correlation, a power of two */
+#define PULSE_ALIGN_HISTORY_FRAMES 4096
+/* packets kept to map positions back to timestamps */
+#define PULSE_ALIGN_PACKETS 64
+/* longest chirp, the correlation needs a chirp on either side of it */
+#define PULSE_ALIGN_MAX_CHIRP (PULSE_ALIGN_HISTORY_FRAMES / 4)
+
+/**
+ * Fill a Hann windowed linear chirp, easy to locate by correlation
+ */
+void pulse_align_chirp(float *chirp, size_t frames, uint32_t rate,
+		       double start_hz, double end_hz, double amplitude);
+
+struct pulse_align_packet {
+	uint64_t first;
+	uint64_t frames;
+	uint64_t ts;
+	uint64_t delivered;
+};
+
+/**
+ * Burst detection on one channel of a capture
+ */
+struct pulse_align {
+	const float *chirp;
+	size_t chirp_frames;
+	uint32_t rate;
+
+	float history[PULSE_ALIGN_HISTORY_FRAMES];
+	uint64_t position;
+	struct pulse_align_packet packets[PULSE_ALIGN_PACKETS];
+	uint_fast32_t packet_count;
+	uint64_t onset;
+	uint64_t quiet;
+};
+
+/**
+ * A located burst
+ */
+struct pulse_align_burst {
+	/* position of the first frame in the capture */
+	uint64_t start;
+	/* timestamp of the first frame */
+	uint64_t ts;
+	/* time the packet holding it was delivered */
+	uint64_t delivered;
+};
+
+/**
+ * Start detecting a chirp, which must outlive the detection
+ */
+void pulse_align_init(struct pulse_align *a, const float *chirp,
+		      size_t chirp_frames, uint32_t rate);
+
+/**
+ * Start a captured packet, its frames are fed with pulse_align_sample()
+ *
+ * @param ts timestamp of the first frame
+ * @param delivered time the packet was received
+ */
+void pulse_align_packet(struct pulse_align *a, uint64_t frames, uint64_t ts,
+			uint64_t delivered);
+
+/**
+ * Feed the next captured frame
+ *
+ * A burst starts where the signal rises after some silence. Once the
+ * chirp and the search range after the onset are captured, the chirp is
+ * correlated with the signal around the onset and the best match is where
+ * the burst starts.
+ *
+ * @return true if a burst was located
+ */
+bool pulse_align_sample(struct pulse_align *a, float value,
+			struct pulse_align_burst *burst);
+
+/**
+ * Offset between the timestamps of two captures of the same bursts
+ */
+struct pulse_align_offset {
+	/* bursts found in both captures */
+	uint_fast32_t paired;
+	double offset_ns;
+	double jitter_ns;
+	/* largest offset of a single pair */
+	double max_ns;
+};
+
+/**
+ * Compare the timestamps two captures gave their bursts
+ *
+ * Bursts played within window_ns of each other are paired, the play times
+ * must be ascending. The difference of the timestamps, less the difference
+ * of the play times, is how far the second capture is behind the first.
+ *
+ * @param played_a play times of the bursts of the first capture
+ * @param ts_a timestamps of the bursts of the first capture
+ */
+void pulse_align_offset(const uint64_t *played_a, const uint64_t *ts_a,
+			size_t count_a, const uint64_t *played_b,
+			const uint64_t *ts_b, size_t count_b,
+			uint64_t window_ns, struct pulse_align_offset *offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,9 +24,11 @@ MODULE_EXPORT const char *obs_module_description(void)
 }
 
 extern void register_source();
+extern void register_health_dock();
 
 bool obs_module_load(void)
 {
 	register_source();
+	register_health_dock();
 	return true;
 }
@@ -15,12 +15,26 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
+#include <math.h>
+#include <time.h>
 #include <util/platform.h>
 #include <util/bmem.h>
+#include <util/threading.h>
+#include <util/dstr.h>
 #include <util/util_uint64.h>
 #include <obs-module.h>
 #include "plugin-macros.generated.h"
 #include "pulse-wrapper.h"
+#include "pulse-control.h"
+#include "pulse-capture.h"
+#include "pulse-helper.h"
+#include "pulse-realtime.h"
+#include "pulse-peak.h"
+#include "pulse-match.h"
+#include "pulse-stats.h"
+#include "pulse-journal.h"
+#include "pulse-health.h"
 
 #define NSEC_PER_SEC 1000000000LL
 #define NSEC_PER_MSEC 1000000L
@@ -28,417 +42,597 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define PULSE_DATA(voidptr) \
 	struct pulse_data *data = (struct pulse_data *)voidptr;
 
-struct pulse_data {
-	obs_source_t *source;
-	pa_stream *stream;
+/**
+ * What happens to the capture while the source is neither active nor shown
+ */
+enum pulse_idle_policy {
+	/* keep capturing */
+	PULSE_IDLE_KEEP,
+	/* cork the stream, the binding stays as it is */
+	PULSE_IDLE_CORK,
+	/* disconnect the stream, discovery keeps tracking the binding */
+	PULSE_IDLE_DISCONNECT,
+};
 
-	/* client info */
-	uint32_t client_idx;
+/**
+ * Settings handed from the update callback to the control thread
+ */
+struct pulse_settings {
 	char *client;
+	uint_fast32_t packet_frames;
+	uint64_t event_window_ns;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	bool helper;
+	enum pulse_idle_policy idle_policy;
+	bool whole_sink;
+};
 
-	/* sink input info */
+/**
+ * Binding saved with the source at the end of the last session
+ *
+ * Indices stay valid as long as neither the server nor the application were
+ * restarted, which is the common case when only OBS is restarted.
+ */
+struct pulse_persisted {
 	uint32_t sink_input_idx;
-
-	/* sink info */
 	uint32_t sink_idx;
-	char *sink_monitor_source_name;
-
-	/* server info */
-	enum speaker_layout speakers;
-	pa_sample_format_t format;
-	uint_fast32_t samples_per_sec;
-	uint_fast32_t bytes_per_frame;
-	uint_fast8_t channels;
-	uint64_t first_ts;
-
-	/* statistics */
-	uint_fast32_t packets;
-	uint_fast64_t frames;
+	char *monitor;
+	pa_sample_spec spec;
 };
 
-static void pulse_stop_recording(struct pulse_data *data);
-
 /**
- * get obs from pulse audio format
+ * Source state
+ *
+ * Apart from the members marked otherwise this is owned by the control
+ * thread, other threads only read the published binding.
  */
-static enum audio_format pulse_to_obs_audio_format(pa_sample_format_t format)
-{
-	switch (format) {
-	case PA_SAMPLE_U8:
-		return AUDIO_FORMAT_U8BIT;
-	case PA_SAMPLE_S16LE:
-		return AUDIO_FORMAT_16BIT;
-	case PA_SAMPLE_S32LE:
-		return AUDIO_FORMAT_32BIT;
-	case PA_SAMPLE_FLOAT32LE:
-		return AUDIO_FORMAT_FLOAT;
-	default:
-		return AUDIO_FORMAT_UNKNOWN;
-	}
+struct pulse_data {
+	obs_source_t *source;
+	/* identifies the source in the journal */
+	uint32_t journal_id;
+	struct pulse_capture *capture;
+	struct pulse_helper_capture *helper_capture;
 
-	return AUDIO_FORMAT_UNKNOWN;
-}
+	/* settings */
+	char *client;
+	uint_fast32_t packet_frames;
+	uint64_t event_window_ns;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	bool helper;
+	enum pulse_idle_policy idle_policy;
+	/* record the whole sink while the sink-input is alone on it */
+	bool whole_sink;
+
+	/* visibility, set from the ui and graphics threads */
+	volatile long active;
+	volatile long showing;
+	/* policy currently applied, PULSE_IDLE_KEEP while in use */
+	enum pulse_idle_policy released;
+
+	/* settings waiting to be applied, protected by settings_mutex */
+	pthread_mutex_t settings_mutex;
+	struct pulse_settings next_settings;
+	bool settings_pending;
+
+	/* binding of the last session, consumed by the first settings */
+	struct pulse_persisted persisted;
+
+	/* binding and what the events left for the next reconciliation,
+	 * capturing_sink is set while the capture records the whole sink, see
+	 * pulse_update_whole_sink() */
+	struct pulse_match_state match;
+
+	/* binding published for other threads, see pulse_get_binding() */
+	volatile long binding_seq;
+	volatile long published_client_idx;
+	volatile long published_sink_input_idx;
+	volatile long published_sink_idx;
+	bool published_whole_sink;
+
+	/* event handling */
+	uint64_t client_seen_ns;
+	uint64_t sink_input_seen_ns;
+
+	/* stall watchdog, see pulse_watchdog() */
+	uint64_t watch_frames;
+	uint64_t watch_ns;
+	uint64_t watch_idle_until;
+	bool stall_suspected;
+	uint64_t stall_ns;
+	uint64_t stalls;
+	uint64_t recovery_total;
+	uint64_t recovery_max;
+
+	/* streams started */
+	uint64_t starts;
+	/* snapshot for the health dock, taken by the watchdog and protected
+	 * by sources_mutex */
+	struct pulse_source_health health;
+
+	/* statistics, events counts only those routed to this source */
+	volatile long events;
+	volatile long events_suppressed;
+	uint64_t reconciles;
+	uint64_t reconcile_latency_max;
+	uint64_t scanned;
+
+	/* batched discovery, protected by discovery_mutex */
+	uint64_t created_ns;
+	bool discovery_pending;
+	/* taken by the pass that is running, which resolves it here */
+	bool discovery_running;
+	struct pulse_match discovery_match;
+	struct pulse_data *discovery_next;
+
+	/* source registry, protected by sources_mutex */
+	struct pulse_data *next;
+};
 
 /**
- * Get obs speaker layout from number of channels
- *
- * @param channels number of channels reported by pulseaudio
- *
- * @return obs speaker_layout id
- *
- * @note This *might* not work for some rather unusual setups, but should work
- *       fine for the majority of cases.
+ * Snapshot of a source's binding
  */
-static enum speaker_layout
-pulse_channels_to_obs_speakers(uint_fast32_t channels)
-{
-	switch (channels) {
-	case 1:
-		return SPEAKERS_MONO;
-	case 2:
-		return SPEAKERS_STEREO;
-	case 3:
-		return SPEAKERS_2POINT1;
-	case 4:
-		return SPEAKERS_4POINT0;
-	case 5:
-		return SPEAKERS_4POINT1;
-	case 6:
-		return SPEAKERS_5POINT1;
-	case 8:
-		return SPEAKERS_7POINT1;
-	}
-
-	return SPEAKERS_UNKNOWN;
-}
-
-static pa_channel_map pulse_channel_map(enum speaker_layout layout)
-{
-	pa_channel_map ret;
-
-	ret.map[0] = PA_CHANNEL_POSITION_FRONT_LEFT;
-	ret.map[1] = PA_CHANNEL_POSITION_FRONT_RIGHT;
-	ret.map[2] = PA_CHANNEL_POSITION_FRONT_CENTER;
-	ret.map[3] = PA_CHANNEL_POSITION_LFE;
-	ret.map[4] = PA_CHANNEL_POSITION_REAR_LEFT;
-	ret.map[5] = PA_CHANNEL_POSITION_REAR_RIGHT;
-	ret.map[6] = PA_CHANNEL_POSITION_SIDE_LEFT;
-	ret.map[7] = PA_CHANNEL_POSITION_SIDE_RIGHT;
-
-	switch (layout) {
-	case SPEAKERS_MONO:
-		ret.channels = 1;
-		ret.map[0] = PA_CHANNEL_POSITION_MONO;
-		break;
-
-	case SPEAKERS_STEREO:
-		ret.channels = 2;
-		break;
-
-	case SPEAKERS_2POINT1:
-		ret.channels = 3;
-		ret.map[2] = PA_CHANNEL_POSITION_LFE;
-		break;
-
-	case SPEAKERS_4POINT0:
-		ret.channels = 4;
-		ret.map[3] = PA_CHANNEL_POSITION_REAR_CENTER;
-		break;
+struct pulse_binding {
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+};
 
-	case SPEAKERS_4POINT1:
-		ret.channels = 5;
-		ret.map[4] = PA_CHANNEL_POSITION_REAR_CENTER;
-		break;
+/* all sources, the subscription is shared by all of them */
+static pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_data *sources = NULL;
 
-	case SPEAKERS_5POINT1:
-		ret.channels = 6;
-		break;
+/* subscription events waiting for the control thread */
+struct pulse_event {
+	pa_subscription_event_type_t t;
+	uint32_t idx;
+	uint64_t ns;
+};
 
-	case SPEAKERS_7POINT1:
-		ret.channels = 8;
-		break;
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_event *event_queue = NULL;
+static size_t event_count = 0;
+static size_t event_capacity = 0;
+
+/* sources waiting for the next batched discovery pass */
+#define DISCOVERY_BATCH_NS (50 * NSEC_PER_MSEC)
+/* failed passes are retried with a backoff doubling up to this */
+#define DISCOVERY_BACKOFF_MAX_NS (5 * NSEC_PER_SEC)
+
+/* the client picker listens this long for levels, a few peak periods */
+#define PICKER_WINDOW_NS (120 * NSEC_PER_MSEC)
+/* peaks below -60 dB count as silence */
+#define PICKER_SILENCE 0.001f
+/* how long the properties wait for the levels to order the clients by */
+#define PICKER_DEADLINE_NS (200 * NSEC_PER_MSEC)
+
+/* levels of the last scan, the scans run on the control thread so metering
+ * cannot hold up the properties */
+static pthread_mutex_t picker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t picker_cond = PTHREAD_COND_INITIALIZER;
+static struct pulse_peak_client *picker_clients = NULL;
+static size_t picker_count = 0;
+static uint64_t picker_scans = 0;
+
+static pthread_mutex_t discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_data *discovery_queue = NULL;
+/* sources of the pass that is running */
+static struct pulse_data *discovery_taken = NULL;
+/* delay of the next pass after failed ones, 0 after a successful one */
+static uint64_t discovery_backoff_ns = 0;
+
+/* cost of the paths that walk the server state */
+static struct pulse_stats refresh_stats = PULSE_STATS_INIT("rebind");
+static struct pulse_stats discovery_stats = PULSE_STATS_INIT("discovery");
+static struct pulse_stats event_stats = PULSE_STATS_INIT("events");
+static struct pulse_stats properties_stats = PULSE_STATS_INIT("client list");
+
+/* the watchdog compares the frames each stream received with the time that
+ * passed, its stats double as the key of its timer */
+#define WATCHDOG_PERIOD_NS (500 * NSEC_PER_MSEC)
+/* a stream missing this much audio is suspected to have stalled */
+#define STALL_NS (300 * NSEC_PER_MSEC)
+/* how long to leave a sink-input alone that the client corked itself */
+#define STALL_BACKOFF_NS (5 * NSEC_PER_SEC)
+static struct pulse_stats watchdog_stats = PULSE_STATS_INIT("watchdog");
+/* the watchdog appends the journal to its file this often */
+#define JOURNAL_FLUSH_NS (5 * NSEC_PER_SEC)
+static uint64_t journal_flush_ns = 0;
+
+/* sources are numbered in the journal in the order they were created */
+static volatile long journal_ids = 0;
 
-	case SPEAKERS_UNKNOWN:
-	default:
-		ret.channels = 0;
-		break;
-	}
+static void pulse_stop_recording(struct pulse_data *data);
+static void pulse_discovery_request(struct pulse_data *data);
+static void pulse_discovery_remove(struct pulse_data *data);
+static void pulse_check_stall(struct pulse_data *data);
+static void pulse_update_whole_sink(struct pulse_data *data);
 
-	return ret;
+/**
+ * Publish the current binding for other threads
+ *
+ * @note called from the control thread only
+ */
+static void pulse_publish_binding(struct pulse_data *data)
+{
+	struct pulse_match_state *m = &data->match;
+
+	if ((uint32_t)data->published_sink_input_idx != m->sink_input_idx ||
+	    (uint32_t)data->published_sink_idx != m->sink_idx ||
+	    data->published_whole_sink != m->capturing_sink)
+		pulse_journal_bind(data->journal_id, m->client_idx,
+				   m->sink_input_idx, m->sink_idx,
+				   m->capturing_sink);
+	data->published_whole_sink = m->capturing_sink;
+
+	os_atomic_inc_long(&data->binding_seq);
+	os_atomic_set_long(&data->published_client_idx, m->client_idx);
+	os_atomic_set_long(&data->published_sink_input_idx, m->sink_input_idx);
+	os_atomic_set_long(&data->published_sink_idx, m->sink_idx);
+	os_atomic_inc_long(&data->binding_seq);
 }
 
-static inline uint64_t samples_to_ns(size_t frames, uint_fast32_t rate)
+/**
+ * Get a consistent snapshot of the published binding from any thread
+ */
+static void pulse_get_binding(struct pulse_data *data,
+			      struct pulse_binding *binding)
 {
-	return util_mul_div64(frames, NSEC_PER_SEC, rate);
+	long seq;
+
+	do {
+		while ((seq = os_atomic_load_long(&data->binding_seq)) & 1)
+			;
+
+		binding->client_idx = (uint32_t)os_atomic_load_long(
+			&data->published_client_idx);
+		binding->sink_input_idx = (uint32_t)os_atomic_load_long(
+			&data->published_sink_input_idx);
+		binding->sink_idx = (uint32_t)os_atomic_load_long(
+			&data->published_sink_idx);
+	} while (os_atomic_load_long(&data->binding_seq) != seq);
 }
 
-static inline uint64_t get_sample_time(size_t frames, uint_fast32_t rate)
+/**
+ * Output callback of the capture
+ */
+static void pulse_capture_output(void *param,
+				 const struct obs_source_audio *audio)
 {
-	return os_gettime_ns() - samples_to_ns(frames, rate);
+	obs_source_output_audio((obs_source_t *)param, audio);
 }
 
-#define STARTUP_TIMEOUT_NS (500 * NSEC_PER_MSEC)
-
 /**
- * Callback for pulse which gets executed when new audio data is available
+ * Start recording the bound sink-input
  *
- * @warning The function may be called even after disconnecting the stream
+ * @note called from the control thread only
  */
-static void pulse_stream_read(pa_stream *p, size_t nbytes, void *userdata)
+static void pulse_capture_params_init(struct pulse_data *data,
+				      struct pulse_capture_params *params)
 {
-	UNUSED_PARAMETER(p);
-	UNUSED_PARAMETER(nbytes);
-	PULSE_DATA(userdata);
-
-	const void *frames;
-	size_t bytes;
-
-	if (!data->stream)
-		goto exit;
-
-	pa_stream_peek(data->stream, &frames, &bytes);
-
-	// check if we got data
-	if (!bytes)
-		goto exit;
+	memset(params, 0, sizeof(*params));
+	params->name = obs_source_get_name(data->source);
+	params->client = data->client;
+	params->sink_input_idx = data->match.sink_input_idx;
+	params->sink_idx = data->match.sink_idx;
+	params->packet_frames = data->packet_frames;
+	params->max_latency_ns = data->max_latency_ns;
+	params->catchup = data->catchup;
+	params->output = pulse_capture_output;
+	params->param = data->source;
+}
 
-	if (!frames) {
-		blog(LOG_ERROR, "Got audio hole of %u bytes",
-		     (unsigned int)bytes);
-		pa_stream_drop(data->stream);
-		goto exit;
+static int_fast32_t pulse_start_recording(struct pulse_data *data,
+					  bool prearmed)
+{
+	// the stream is connected once the source is used again
+	if (data->released == PULSE_IDLE_DISCONNECT) {
+		pulse_publish_binding(data);
+		return 0;
 	}
 
-	struct obs_source_audio out;
-	out.speakers = data->speakers;
-	out.samples_per_sec = data->samples_per_sec;
-	out.format = pulse_to_obs_audio_format(data->format);
-	out.data[0] = (uint8_t *)frames;
-	out.frames = bytes / data->bytes_per_frame;
-	out.timestamp = get_sample_time(out.frames, out.samples_per_sec);
+	struct pulse_capture_params params;
+	pulse_capture_params_init(data, &params);
+	params.prearmed = prearmed;
+	params.client_seen_ns = data->client_seen_ns;
+	params.sink_input_seen_ns = data->sink_input_seen_ns;
 
-	if (!data->first_ts)
-		data->first_ts = out.timestamp + STARTUP_TIMEOUT_NS;
-
-	if (out.timestamp > data->first_ts)
-		obs_source_output_audio(data->source, &out);
+	data->capture = pulse_capture_start(&params);
+	if (!data->capture)
+		return -1;
+	data->starts++;
 
-	data->packets++;
-	data->frames += out.frames;
+	if (data->released == PULSE_IDLE_CORK)
+		pulse_capture_set_paused(data->capture, true);
 
-	pa_stream_drop(data->stream);
-exit:
-	pulse_signal(0);
+	pulse_publish_binding(data);
+	return 0;
 }
 
 /**
- * Source client callback
+ * stop recording
  *
- * We use the default stream settings for recording here unless pulse is
- * configured to something obs can't deal with.
+ * @note called from the control thread, or from destroy once the control
+ *       thread no longer references the source
  */
-static void pulse_source_info(pa_context *c, const pa_source_info *i, int eol,
-			      void *userdata)
+static void pulse_stop_recording(struct pulse_data *data)
 {
-	UNUSED_PARAMETER(c);
-	PULSE_DATA(userdata);
-	// An error occured
-	if (eol < 0) {
-		data->format = PA_SAMPLE_INVALID;
-		pulse_signal(0);
-		return;
-	}
-	// Terminating call for multi instance callbacks
-	if (eol > 0) {
-		pulse_signal(0);
-		return;
-	}
-
-	blog(LOG_INFO,
-	     "Audio format: %s, %" PRIu32 " Hz"
-	     ", %" PRIu8 " channels",
-	     pa_sample_format_to_string(i->sample_spec.format),
-	     i->sample_spec.rate, i->sample_spec.channels);
-
-	pa_sample_format_t format = i->sample_spec.format;
-	if (pulse_to_obs_audio_format(format) == AUDIO_FORMAT_UNKNOWN) {
-		format = PA_SAMPLE_FLOAT32LE;
+	pulse_capture_stop(data->capture);
+	data->capture = NULL;
+	data->match.capturing_sink = false;
+}
 
-		blog(LOG_INFO,
-		     "Sample format %s not supported by OBS,"
-		     "using %s instead for recording",
-		     pa_sample_format_to_string(i->sample_spec.format),
-		     pa_sample_format_to_string(format));
-	}
+/**
+ * Scan the clients and their levels for the client list
+ *
+ * @note called from the control thread
+ */
+static void pulse_picker_scan(void *unused, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(unused);
+	UNUSED_PARAMETER(queued_ns);
 
-	uint8_t channels = i->sample_spec.channels;
-	if (pulse_channels_to_obs_speakers(channels) == SPEAKERS_UNKNOWN) {
-		channels = 2;
+	struct pulse_peak_client *clients = NULL;
+	struct pulse_stats_probe probe;
+	size_t count = 0;
 
-		blog(LOG_INFO,
-		     "%c channels not supported by OBS,"
-		     "using %c instead for recording",
-		     i->sample_spec.channels, channels);
+	if (pulse_init() == 0) {
+		pulse_stats_begin(&probe);
+		count = pulse_peak_scan(&clients, PICKER_WINDOW_NS);
+		pulse_stats_end(&properties_stats, &probe, count);
+		pulse_unref();
 	}
 
-	data->format = format;
-	data->samples_per_sec = i->sample_spec.rate;
-	data->channels = channels;
+	pthread_mutex_lock(&picker_mutex);
+	pulse_peak_free(picker_clients, picker_count);
+	picker_clients = clients;
+	picker_count = count;
+	picker_scans++;
+	pthread_cond_broadcast(&picker_cond);
+	pthread_mutex_unlock(&picker_mutex);
 }
 
 /**
- * Start recording
+ * Get the clients for the client list
  *
- * We request the default format used by pulse here because the data will be
- * converted and possibly re-sampled by obs anyway.
+ * The clients are listed right away. A scan of their levels is requested
+ * from the control thread, they are ordered by it if it finishes within
+ * PICKER_DEADLINE_NS. Without a source there is no control thread and the
+ * clients stay unordered.
  *
- * For now we request a buffer length of 25ms although pulse seems to ignore
- * this setting for monitor streams. For "real" input streams this should work
- * fine though.
+ * @return number of clients, free them with pulse_peak_free
  */
-static int_fast32_t pulse_start_recording(struct pulse_data *data)
+static size_t pulse_picker_clients(struct pulse_data *data,
+				   struct pulse_peak_client **clients)
 {
-	//string monitor_name = "OBSPulseAppRecord" +
-	//		      string(data->sink_input_sink_name) + ".monitor";
-	if (pulse_get_source_info_by_name(pulse_source_info,
-					  data->sink_monitor_source_name,
-					  data) < 0) {
-		blog(LOG_ERROR, "Unable to get monitor source info !");
-		return -1;
-	}
+	size_t count = 0;
 
-	if (data->format == PA_SAMPLE_INVALID) {
-		blog(LOG_ERROR,
-		     "An error occurred while getting the client info!");
-		return -1;
+	*clients = NULL;
+	if (pulse_init() == 0) {
+		count = pulse_peak_list(clients);
+		pulse_unref();
 	}
 
-	pa_sample_spec spec;
-	spec.format = data->format;
-	spec.rate = data->samples_per_sec;
-	spec.channels = data->channels;
+	if (!data || !count)
+		return count;
 
-	if (!pa_sample_spec_valid(&spec)) {
-		blog(LOG_ERROR, "Sample spec is not valid");
-		return -1;
-	}
+	pthread_mutex_lock(&picker_mutex);
 
-	data->speakers = pulse_channels_to_obs_speakers(spec.channels);
-	data->bytes_per_frame = pa_frame_size(&spec);
+	uint64_t scans = picker_scans;
+	pulse_control_schedule(&picker_scans, 0, pulse_picker_scan, NULL);
 
-	pa_channel_map channel_map = pulse_channel_map(data->speakers);
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t deadline = (uint64_t)ts.tv_sec * NSEC_PER_SEC +
+			    (uint64_t)ts.tv_nsec + PICKER_DEADLINE_NS;
+	ts.tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+	ts.tv_nsec = (long)(deadline % NSEC_PER_SEC);
 
-	data->stream = pulse_stream_new(obs_source_get_name(data->source),
-					&spec, &channel_map);
-	if (!data->stream) {
-		blog(LOG_ERROR, "Unable to create stream");
-		return -1;
-	}
+	int ret = 0;
+	while (picker_scans == scans && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&picker_cond, &picker_mutex, &ts);
 
-	pulse_lock();
-	pa_stream_set_read_callback(data->stream, pulse_stream_read,
-				    (void *)data);
-	pulse_unlock();
-
-	pa_buffer_attr attr;
-	attr.fragsize = pa_usec_to_bytes(25000, &spec);
-	attr.maxlength = (uint32_t)-1;
-	attr.minreq = (uint32_t)-1;
-	attr.prebuf = (uint32_t)-1;
-	attr.tlength = (uint32_t)-1;
-
-	pa_stream_flags_t flags = PA_STREAM_ADJUST_LATENCY;
-
-	blog(LOG_INFO, "attempting to only monitor sink input %d",
-	     data->sink_input_idx);
-	int status = pa_stream_set_monitor_stream(data->stream,
-						  data->sink_input_idx);
-	if (status != 0) {
-		blog(LOG_ERROR,
-		     "Failed to only record sink input from monitor: %d",
-		     status);
-		return -1;
+	if (picker_scans != scans)
+		pulse_peak_order(*clients, count, picker_clients,
+				 picker_count);
+	else
+		blog(LOG_WARNING,
+		     "Client levels not measured within %.2f ms, listing the "
+		     "clients by name",
+		     (double)PICKER_DEADLINE_NS / NSEC_PER_MSEC);
+
+	pthread_mutex_unlock(&picker_mutex);
+
+	return count;
+}
+
+/**
+ * Fill the client list with the clients playing audio, loudest first
+ *
+ * The selected client is kept at the end of the list while it has no
+ * sink-input, so opening the properties does not lose the setting.
+ */
+static void pulse_fill_client_list(struct pulse_data *data,
+				   obs_property_t *list, const char *current)
+{
+	struct pulse_peak_client *clients = NULL;
+	struct dstr label;
+	bool found = false;
+
+	obs_property_list_clear(list);
+	dstr_init(&label);
+
+	size_t count = pulse_picker_clients(data, &clients);
+
+	for (size_t n = 0; n < count; n++) {
+		float peak = clients[n].peak;
+
+		if (peak == PULSE_PEAK_UNKNOWN)
+			dstr_copy(&label, clients[n].name);
+		else if (peak > PICKER_SILENCE)
+			dstr_printf(&label, "%s (%.0f dB)", clients[n].name,
+				    20.0 * log10(peak));
+		else
+			dstr_printf(&label, "%s (%s)", clients[n].name,
+				    obs_module_text("Client.Silent"));
+
+		obs_property_list_add_string(list, label.array,
+					     clients[n].name);
+		if (current && strcmp(current, clients[n].name) == 0)
+			found = true;
 	}
 
-	pulse_lock();
-	int_fast32_t ret = pa_stream_connect_record(
-		data->stream, data->sink_monitor_source_name, &attr, flags);
-	pulse_unlock();
-	if (ret < 0) {
-		pulse_stop_recording(data);
-		blog(LOG_ERROR, "Unable to connect to stream");
-		return -1;
+	if (current && *current && !found) {
+		dstr_printf(&label, "%s (%s)", current,
+			    obs_module_text("Client.NotPlaying"));
+		obs_property_list_add_string(list, label.array, current);
 	}
 
-	blog(LOG_INFO, "Started recording from '%s'", data->client);
-	return 0;
+	dstr_free(&label);
+	pulse_peak_free(clients, count);
 }
 
 /**
- * stop recording
+ * Describe how the audio of a source gets from the server to the plugin
+ *
+ * The transport is negotiated for the connection, so it is the same for all
+ * sources, only the copy rate is the one of this source.
  */
-static void pulse_stop_recording(struct pulse_data *data)
+static void pulse_describe_transport(struct pulse_data *data,
+				     obs_property_t *property)
 {
-	if (data->stream) {
-		pulse_lock();
-		pa_stream_disconnect(data->stream);
-		pa_stream_unref(data->stream);
-		data->stream = NULL;
-		pulse_unlock();
+	struct pulse_capture_transport info;
+	struct pulse_binding binding;
+	struct dstr text;
+
+	dstr_init_copy(&text, obs_module_text("Transport"));
+	dstr_cat(&text, ": ");
+
+	// the helper captures in its own process
+	bool helper = true;
+	if (data) {
+		obs_data_t *settings = obs_source_get_settings(data->source);
+		helper = obs_data_get_bool(settings, "helper");
+		obs_data_release(settings);
+		pulse_get_binding(data, &binding);
 	}
 
-	blog(LOG_INFO, "Stopped recording from '%s'", data->client);
-	blog(LOG_INFO,
-	     "Got %" PRIuFAST32 " packets with %" PRIuFAST64 " frames",
-	     data->packets, data->frames);
+	if (helper || binding.sink_input_idx == PA_INVALID_INDEX ||
+	    !pulse_capture_get_transport(binding.sink_input_idx, &info) ||
+	    info.transport == PULSE_TRANSPORT_UNKNOWN)
+		dstr_cat(&text, obs_module_text("Transport.Unknown"));
+	else if (info.transport == PULSE_TRANSPORT_SOCKET)
+		dstr_catf(&text, "%s %s (%.1f KiB/s %s)",
+			  pulse_transport_name(info.transport),
+			  obs_module_text("Transport.AllSources"),
+			  (double)info.copy_rate / 1024,
+			  obs_module_text("Transport.Copied"));
+	else
+		dstr_catf(&text, "%s %s", pulse_transport_name(info.transport),
+			  obs_module_text("Transport.AllSources"));
+
+	obs_property_set_description(property, text.array);
+	dstr_free(&text);
+}
+
+/**
+ * Get the client selected in the settings of a source
+ */
+static char *pulse_current_client(struct pulse_data *data)
+{
+	if (!data)
+		return NULL;
 
-	data->first_ts = 0;
-	data->packets = 0;
-	data->frames = 0;
+	obs_data_t *settings = obs_source_get_settings(data->source);
+	char *client = bstrdup(obs_data_get_string(settings, "client"));
+	obs_data_release(settings);
+
+	return client;
 }
 
 /**
- * input info callback
+ * Refresh button, measures the levels again
  */
-static void pulse_client_info_list_cb(pa_context *c, const pa_client_info *i,
-				      int eol, void *userdata)
+static bool pulse_refresh_clients(obs_properties_t *props,
+				  obs_property_t *property, void *vptr)
 {
-	UNUSED_PARAMETER(c);
-	if (eol || i->index == PA_INVALID_INDEX)
-		goto skip;
+	UNUSED_PARAMETER(property);
+	PULSE_DATA(vptr);
 
-	obs_property_list_add_string((obs_property_t *)userdata, i->name,
-				     i->name);
+	char *current = pulse_current_client(data);
+	pulse_fill_client_list(data, obs_properties_get(props, "client"),
+			       current);
+	pulse_describe_transport(data, obs_properties_get(props, "transport"));
+	bfree(current);
 
-skip:
-	pulse_signal(0);
+	return true;
 }
 
 /**
  * Get plugin properties
  */
-static obs_properties_t *pulse_properties()
+static obs_properties_t *pulse_properties(struct pulse_data *data)
 {
 	obs_properties_t *props = obs_properties_create();
 	obs_property_t *clients = obs_properties_add_list(
 		props, "client", obs_module_text("Client"), OBS_COMBO_TYPE_LIST,
 		OBS_COMBO_FORMAT_STRING);
-
-	blog(LOG_INFO, "%s", "initting");
-	pulse_init();
-	blog(LOG_INFO, "%s", "finished initting now getting client list");
-	pulse_get_client_info_list(pulse_client_info_list_cb, (void *)clients);
-	blog(LOG_INFO, "%s", "finished getting client list");
-	pulse_unref();
+	obs_properties_add_button(props, "refresh_clients",
+				  obs_module_text("RefreshClients"),
+				  pulse_refresh_clients);
+	obs_properties_add_int(props, "packet_frames",
+			       obs_module_text("PacketFrames"), 64, 8192, 64);
+	obs_property_t *window = obs_properties_add_int(
+		props, "event_window_ms", obs_module_text("EventWindow"), 0,
+		1000, 10);
+	obs_property_int_set_suffix(window, " ms");
+	obs_property_t *ceiling = obs_properties_add_int(
+		props, "max_latency_ms", obs_module_text("MaxLatency"), 0,
+		2000, 10);
+	obs_property_int_set_suffix(ceiling, " ms");
+	obs_property_t *catchup = obs_properties_add_list(
+		props, "catchup", obs_module_text("CatchUp"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(catchup, obs_module_text("CatchUp.Skip"),
+				  PULSE_CATCHUP_SKIP);
+	obs_property_list_add_int(catchup,
+				  obs_module_text("CatchUp.Compress"),
+				  PULSE_CATCHUP_COMPRESS);
+	obs_property_list_add_int(catchup, obs_module_text("CatchUp.Newest"),
+				  PULSE_CATCHUP_NEWEST);
+	obs_properties_add_bool(props, "helper",
+				obs_module_text("CaptureHelper"));
+	obs_property_t *idle = obs_properties_add_list(
+		props, "idle_policy", obs_module_text("Inactive"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(idle, obs_module_text("Inactive.Keep"),
+				  PULSE_IDLE_KEEP);
+	obs_property_list_add_int(idle, obs_module_text("Inactive.Cork"),
+				  PULSE_IDLE_CORK);
+	obs_property_list_add_int(idle,
+				  obs_module_text("Inactive.Disconnect"),
+				  PULSE_IDLE_DISCONNECT);
+	obs_properties_add_bool(props, "whole_sink",
+				obs_module_text("WholeSink"));
+
+	obs_property_t *transport = obs_properties_add_text(
+		props, "transport", obs_module_text("Transport"),
+		OBS_TEXT_INFO);
+
+	char *current = pulse_current_client(data);
+	pulse_fill_client_list(data, clients, current);
+	pulse_describe_transport(data, transport);
+	bfree(current);
 
 	return props;
 }
 
-static obs_properties_t *pulse_app_input_properties(void *unused)
+static obs_properties_t *pulse_app_input_properties(void *vptr)
 {
-	UNUSED_PARAMETER(unused);
+	PULSE_DATA(vptr);
 
-	return pulse_properties();
+	return pulse_properties(data);
 }
 
 /**
@@ -447,6 +641,14 @@ static obs_properties_t *pulse_app_input_properties(void *unused)
 static void pulse_app_input_defaults(obs_data_t *settings)
 {
 	obs_data_set_default_string(settings, "client", NULL);
+	obs_data_set_default_int(settings, "packet_frames",
+				 AUDIO_OUTPUT_FRAMES);
+	obs_data_set_default_int(settings, "event_window_ms", 50);
+	obs_data_set_default_int(settings, "max_latency_ms", 0);
+	obs_data_set_default_int(settings, "catchup", PULSE_CATCHUP_SKIP);
+	obs_data_set_default_bool(settings, "helper", false);
+	obs_data_set_default_int(settings, "idle_policy", PULSE_IDLE_KEEP);
+	obs_data_set_default_bool(settings, "whole_sink", false);
 }
 
 /**
@@ -462,256 +664,1652 @@ static void get_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
 			      int eol, void *userdata)
 {
 	UNUSED_PARAMETER(c);
-	PULSE_DATA(userdata);
+	struct pulse_match *m = (struct pulse_match *)userdata;
 
-	if (eol || i->index == PA_INVALID_INDEX ||
-	    data->sink_input_idx != PA_INVALID_INDEX) {
+	if (eol || i->index == PA_INVALID_INDEX) {
 		pulse_signal(0);
-	} else if (data->client_idx == i->client) {
+		return;
+	}
+
+	pulse_journal_sink_input(i->index, i->client, i->sink);
+	if (pulse_match_add_sink_input(m, i->index, i->client, i->sink))
 		blog(LOG_INFO,
 		     "found sink-input %s with index %d and sink index %d",
 		     i->name, i->index, i->sink);
-		data->sink_input_idx = i->index;
-		data->sink_idx = i->sink;
-	}
 }
 
-static bool get_sink_input(struct pulse_data *data)
+static void get_client_idx_cb(pa_context *c, const pa_client_info *i, int eol,
+			      void *userdata)
 {
-	// Find sink-input with corresponding client
-	data->sink_input_idx = PA_INVALID_INDEX;
-	data->sink_idx = PA_INVALID_INDEX;
-	blog(LOG_INFO, "finding sink-input for the corresponding client");
-	pulse_get_sink_input_info_list(get_sink_input_cb, data);
+	UNUSED_PARAMETER(c);
+	struct pulse_match *m = (struct pulse_match *)userdata;
 
-	if (data->sink_input_idx == PA_INVALID_INDEX) {
-		blog(LOG_INFO, "sink-input not found");
-		return false;
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
 	}
-	return true;
+
+	pulse_journal_client(i->index, i->name);
+	pulse_match_add_client(m, i->index, i->name);
 }
 
 /**
- * Destroy the plugin object and free all memory
+ * Stop a stream whose sink-input is gone, e.g. found by a stall before its
+ * removal event arrived
  */
-static void pulse_app_input_destroy(void *vptr)
+static void pulse_drop_recording(struct pulse_data *data)
 {
-	PULSE_DATA(vptr);
-
-	if (!data)
-		return;
-
-	if (data->stream)
+	if (data->capture) {
+		blog(LOG_INFO, "stopping recording");
 		pulse_stop_recording(data);
-
-	pulse_unref();
-
-	if (data->client)
-		bfree(data->client);
-
-	if (data->sink_monitor_source_name)
-		bfree(data->sink_monitor_source_name);
-
-	bfree(data);
-}
-
-static void get_client_idx_cb(pa_context *c, const pa_client_info *i, int eol,
-			      void *userdata)
-{
-	UNUSED_PARAMETER(c);
-	PULSE_DATA(userdata);
-
-	if (eol || i->index == PA_INVALID_INDEX ||
-	    data->client_idx != PA_INVALID_INDEX) {
-		pulse_signal(0);
-	} else if (strcmp(data->client, i->name) == 0) {
-		data->client_idx = i->index;
 	}
+	data->match.sink_input_idx = PA_INVALID_INDEX;
+	data->match.sink_idx = PA_INVALID_INDEX;
+	pulse_publish_binding(data);
 }
 
-static void refresh_recording(struct pulse_data *data)
+/**
+ * Full rebind against the server state
+ *
+ * @note called from the control thread only
+ */
+static void pulse_rebind(struct pulse_data *data)
 {
+	struct pulse_match m;
+	pulse_match_init(&m, data->client);
+
 	// Find client idx
-	data->client_idx = PA_INVALID_INDEX;
-	pulse_get_client_info_list(get_client_idx_cb, data);
 	blog(LOG_INFO, "searching for client index");
+	pulse_get_client_info_list(get_client_idx_cb, &m);
+	data->match.client_idx = m.client_idx;
 
-	if (data->client_idx == PA_INVALID_INDEX) {
+	if (data->match.client_idx == PA_INVALID_INDEX) {
 		blog(LOG_INFO, "client not found");
+		data->scanned += m.scanned;
+		pulse_drop_recording(data);
 		return;
 	}
 
-	uint32_t prev_sink_input_idx = data->sink_input_idx;
-	uint32_t prev_sink_idx = data->sink_idx;
-	if (!get_sink_input(data)) {
+	// Find sink-input with corresponding client
+	blog(LOG_INFO, "finding sink-input for the corresponding client");
+	pulse_get_sink_input_info_list(get_sink_input_cb, &m);
+	data->scanned += m.scanned;
+
+	uint32_t prev_sink_input_idx = data->match.sink_input_idx;
+	uint32_t prev_sink_idx = data->match.sink_idx;
+	data->match.sink_input_idx = m.sink_input_idx;
+	data->match.sink_idx = m.sink_idx;
+	if (data->match.sink_input_idx == PA_INVALID_INDEX) {
+		blog(LOG_INFO, "sink-input not found");
+		pulse_drop_recording(data);
 		return;
 	}
-	bool change = prev_sink_input_idx != data->sink_input_idx ||
-		      prev_sink_idx != data->sink_idx;
+	bool change = prev_sink_input_idx != data->match.sink_input_idx ||
+		      prev_sink_idx != data->match.sink_idx;
 
 	if (change) {
-		if (data->stream) {
+		if (data->capture) {
 			blog(LOG_INFO, "stopping recording");
 			pulse_stop_recording(data);
 		}
 
 		blog(LOG_INFO, "starting recording");
-		pulse_start_recording(data);
+		pulse_start_recording(data, false);
 	}
+
+	pulse_publish_binding(data);
 }
 
 /**
- * Update the input settings
+ * Full rebind, recording how long it took and how much it had to scan
+ *
+ * @note called from the control thread only
  */
-static void pulse_app_input_update(void *vptr, obs_data_t *settings)
+static void refresh_recording(struct pulse_data *data)
 {
-	PULSE_DATA(vptr);
-	bool restart = false;
-	const char *new_client;
+	struct pulse_stats_probe probe;
 
-	new_client = obs_data_get_string(settings, "client");
-	blog(LOG_INFO, "new client: %s", new_client);
-	if (new_client &&
-	    (!data->client || strcmp(data->client, new_client) != 0)) {
-		blog(LOG_INFO, "need to restart");
-		if (data->client)
-			bfree(data->client);
-		data->client = bstrdup(new_client);
-		data->client_idx = PA_INVALID_INDEX;
+	pulse_stats_begin(&probe);
+	data->scanned = 0;
+	pulse_rebind(data);
+	pulse_stats_end(&refresh_stats, &probe, data->scanned);
+}
 
-		restart = true;
+/**
+ * Release the capture of a source that is no longer used
+ *
+ * @note called from the control thread only
+ */
+static void pulse_idle_release(struct pulse_data *data,
+			       enum pulse_idle_policy policy)
+{
+	if (data->helper) {
+		// corking is not available through the helper
+		pulse_helper_capture_stop(data->helper_capture);
+		data->helper_capture = NULL;
+	} else if (policy == PULSE_IDLE_CORK) {
+		pulse_capture_set_paused(data->capture, true);
+	} else if (policy == PULSE_IDLE_DISCONNECT) {
+		pulse_stop_recording(data);
 	}
 
-	if (!restart)
-		return;
-
-	refresh_recording(data);
+	blog(LOG_INFO, "'%s' is inactive, %s capture", data->client,
+	     policy == PULSE_IDLE_CORK && !data->helper ? "pausing"
+							 : "stopping");
 }
 
-void update_sink_input_info_cb(pa_context *c, const pa_sink_input_info *i,
-			       int eol, void *userdata)
+/**
+ * Resume the capture of a source released by pulse_idle_release()
+ *
+ * The binding was kept up to date meanwhile, so this only has to uncork or
+ * connect the stream.
+ *
+ * @note called from the control thread only
+ */
+static void pulse_idle_resume(struct pulse_data *data,
+			      enum pulse_idle_policy policy)
 {
-	UNUSED_PARAMETER(c);
-	PULSE_DATA(userdata);
-
-	blog(LOG_INFO, "in callback");
-
-	if (eol || i->index == PA_INVALID_INDEX) {
-		pulse_signal(0);
-
-		// Checking if new sink corresponds to our client
-	} else if (data->client_idx != PA_INVALID_INDEX &&
-		   data->client_idx == i->client) {
-		// Perform a refresh
+	blog(LOG_INFO, "'%s' is active again, resuming capture",
+	     data->client);
+
+	if (data->helper) {
+		if (data->client && !data->helper_capture) {
+			struct pulse_capture_params params;
+			pulse_capture_params_init(data, &params);
+			data->helper_capture =
+				pulse_helper_capture_start(&params);
+		}
+	} else if (policy == PULSE_IDLE_CORK) {
+		pulse_capture_set_paused(data->capture, false);
+	} else if (policy == PULSE_IDLE_DISCONNECT &&
+		   data->match.sink_input_idx != PA_INVALID_INDEX &&
+		   !data->capture && pulse_start_recording(data, true) < 0) {
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
 		refresh_recording(data);
 	}
-
-	pulse_signal(0);
 }
 
-static void sink_event_cb(pa_context *c, pa_subscription_event_type_t t,
-			  uint32_t idx, void *userdata)
+/**
+ * Release or resume the capture according to visibility and policy
+ *
+ * @note called from the control thread only
+ */
+static void pulse_update_idle(struct pulse_data *data)
 {
-	PULSE_DATA(userdata);
-
-	if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) ==
-	    PA_SUBSCRIPTION_EVENT_NEW) {
+	bool idle = os_atomic_load_long(&data->active) == 0 &&
+		    os_atomic_load_long(&data->showing) == 0;
+	enum pulse_idle_policy want = idle ? data->idle_policy
+					   : PULSE_IDLE_KEEP;
+	enum pulse_idle_policy released = data->released;
 
-		if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) ==
-		    PA_SUBSCRIPTION_EVENT_SINK_INPUT) {
+	if (want == released)
+		return;
 
-			blog(LOG_INFO, "new sink-input added %d", idx);
+	data->released = PULSE_IDLE_KEEP;
+	if (released != PULSE_IDLE_KEEP)
+		pulse_idle_resume(data, released);
 
-			// Directly calling pulse function because pulse calls
-			// this callback on a helper thread and not the main
-			// thread
-			// Check if sink-input corresponds to the client
-			pa_operation *op = pa_context_get_sink_input_info(
-				c, idx, update_sink_input_info_cb, data);
-			if (!op) {
-				pulse_signal(0);
-				return;
-			}
+	data->released = want;
+	if (want != PULSE_IDLE_KEEP)
+		pulse_idle_release(data, want);
+}
 
-			pa_operation_unref(op);
-		} else if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) ==
-			   PA_SUBSCRIPTION_EVENT_SINK) {
+static void pulse_idle_cb(void *vptr, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(queued_ns);
+	PULSE_DATA(vptr);
 
-			blog(LOG_INFO, "new sink added");
+	pulse_update_idle(data);
+	pulse_update_whole_sink(data);
+}
 
-			// Perform a refresh
-			refresh_recording(data);
-		}
+/**
+ * Result of validating a restored binding
+ */
+struct pulse_restored_info {
+	uint32_t client_idx;
+	uint32_t sink_idx;
+	char *name;
+	bool found;
+};
 
-	} else if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) ==
-		   PA_SUBSCRIPTION_EVENT_REMOVE) {
+static void restored_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+				   int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_restored_info *info =
+		(struct pulse_restored_info *)userdata;
+
+	if (!eol && i->index != PA_INVALID_INDEX) {
+		pulse_journal_sink_input(i->index, i->client, i->sink);
+		info->client_idx = i->client;
+		info->sink_idx = i->sink;
+		info->found = true;
+	}
 
-		int bit = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
-		uint32_t *to_check = NULL;
+	pulse_signal(0);
+}
 
-		switch (bit) {
-		case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
-			to_check = &data->sink_input_idx;
-			break;
-		case PA_SUBSCRIPTION_EVENT_SINK:
-			to_check = &data->sink_idx;
-			break;
-		}
+static void restored_client_cb(pa_context *c, const pa_client_info *i, int eol,
+			       void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_restored_info *info =
+		(struct pulse_restored_info *)userdata;
 
-		if (to_check) {
-			// Check if ours has been removed
-			if (*to_check == idx) {
-				*to_check = PA_INVALID_INDEX;
+	if (!eol && i->index != PA_INVALID_INDEX)
+		pulse_journal_client(i->index, i->name);
 
-				// Stop Recording
-				if (data->stream) {
-					blog(LOG_INFO,
-					     "sink input has been removed; stopping recording");
-					pulse_stop_recording(data);
-				}
-			}
+	if (!eol && i->index != PA_INVALID_INDEX && i->name)
+		info->name = bstrdup(i->name);
 
-			// Perform a refresh
-			refresh_recording(data);
-		}
-	}
 	pulse_signal(0);
 }
 
 /**
- * Create the plugin object
+ * Check a restored binding against the server
+ *
+ * Runs after the optimistic connect. The sink-input has to belong to a
+ * client of the configured name and the sink must still have the monitor
+ * and format the stream was connected with, otherwise the binding is
+ * dropped and the source goes through the full discovery.
  */
-static void *pulse_create(obs_data_t *settings, obs_source_t *source)
+static void pulse_validate_restored(void *vptr, uint64_t queued_ns)
 {
-	struct pulse_data *data =
-		(struct pulse_data *)bzalloc(sizeof(struct pulse_data));
+	PULSE_DATA(vptr);
+	struct pulse_restored_info info = {};
+	struct pulse_persisted *p = &data->persisted;
+	char *monitor = NULL;
+	pa_sample_spec spec;
 
-	data->source = source;
-	data->client_idx = PA_INVALID_INDEX;
-	data->sink_input_idx = PA_INVALID_INDEX;
-	data->sink_idx = PA_INVALID_INDEX;
+	// the binding may have changed meanwhile, e.g. by new settings
+	bool valid = data->match.sink_input_idx == p->sink_input_idx &&
+		     data->match.sink_idx == p->sink_idx;
+
+	if (valid)
+		pulse_get_sink_input_info(p->sink_input_idx,
+					  restored_sink_input_cb, &info);
+	valid = valid && info.found && info.sink_idx == p->sink_idx;
+
+	if (valid)
+		pulse_get_client_info(info.client_idx, restored_client_cb,
+				      &info);
+	valid = valid && pulse_match_client(data->client, info.name);
+
+	if (valid) {
+		pulse_sink_cache_remove(p->sink_idx);
+		pulse_sink_cache_refresh();
+		valid = pulse_sink_cache_lookup(p->sink_idx, &monitor,
+						&spec) &&
+			strcmp(monitor, p->monitor) == 0 &&
+			pa_sample_spec_equal(&spec, &p->spec);
+	}
 
-	blog(LOG_INFO, "%s", "initting from create");
-	pulse_init();
-	pulse_subscribe_events(sink_event_cb, data);
-	blog(LOG_INFO, "%s",
-	     "finished initting from create now calling update");
-	pulse_app_input_update(data, settings);
-	blog(LOG_INFO, "%s", "finished updating from create");
+	if (valid) {
+		data->match.client_idx = info.client_idx;
+		pulse_publish_binding(data);
+		blog(LOG_INFO, "restored binding of '%s' validated in %.2f ms",
+		     data->client,
+		     (double)(os_gettime_ns() - queued_ns) / NSEC_PER_MSEC);
+	} else if (data->match.sink_input_idx == p->sink_input_idx) {
+		blog(LOG_INFO, "restored binding of '%s' is stale",
+		     data->client);
+		pulse_stop_recording(data);
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
+		pulse_publish_binding(data);
+		pulse_discovery_request(data);
+	}
 
-	return data;
+	bfree(monitor);
+	bfree(info.name);
+	bfree(p->monitor);
+	p->monitor = NULL;
 }
 
-static void *pulse_app_input_create(obs_data_t *settings, obs_source_t *source)
-{
+/**
+ * Connect to the binding of the last session without asking the server
+ *
+ * The sink cache is seeded with the saved monitor and format so starting the
+ * capture is a single stream connect, the binding is validated afterwards.
+ *
+ * @return false if there is nothing to restore or the connect failed
+ *
+ * @note called from the control thread only
+ */
+static bool pulse_restore_binding(struct pulse_data *data)
+{
+	struct pulse_persisted *p = &data->persisted;
+
+	if (p->sink_input_idx == PA_INVALID_INDEX || !p->monitor)
+		goto fail;
+
+	data->match.sink_input_idx = p->sink_input_idx;
+	data->match.sink_idx = p->sink_idx;
+	pulse_sink_cache_seed(p->sink_idx, p->monitor, &p->spec);
+
+	if (pulse_start_recording(data, false) < 0) {
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
+		pulse_sink_cache_remove(p->sink_idx);
+		goto fail;
+	}
+
+	blog(LOG_INFO, "'%s' restored sink-input %" PRIu32 " %.2f ms after "
+		       "the source was created",
+	     data->client, data->match.sink_input_idx,
+	     (double)(os_gettime_ns() - data->created_ns) / NSEC_PER_MSEC);
+	data->created_ns = 0;
+
+	pulse_control_schedule(&data->persisted, 0, pulse_validate_restored,
+			       data);
+	return true;
+
+fail:
+	p->sink_input_idx = PA_INVALID_INDEX;
+	bfree(p->monitor);
+	p->monitor = NULL;
+	return false;
+}
+
+/**
+ * Apply the settings handed over by the update callback
+ *
+ * @note called from the control thread only
+ */
+static void pulse_apply_settings(void *vptr, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(queued_ns);
+	PULSE_DATA(vptr);
+
+	pthread_mutex_lock(&data->settings_mutex);
+	struct pulse_settings s = data->next_settings;
+	bool pending = data->settings_pending;
+	data->next_settings.client = NULL;
+	data->settings_pending = false;
+	pthread_mutex_unlock(&data->settings_mutex);
+
+	if (!pending)
+		return;
+
+	data->event_window_ns = s.event_window_ns;
+	data->idle_policy = s.idle_policy;
+	data->whole_sink = s.whole_sink;
+	pulse_update_idle(data);
+
+	bool client_changed = s.client && *s.client &&
+			      (!data->client ||
+			       strcmp(data->client, s.client) != 0);
+	bool helper_changed = s.helper != data->helper;
+	bool restart = client_changed ||
+		       s.packet_frames != data->packet_frames ||
+		       s.max_latency_ns != data->max_latency_ns ||
+		       s.catchup != data->catchup || s.helper != data->helper;
+
+	data->packet_frames = s.packet_frames;
+	data->max_latency_ns = s.max_latency_ns;
+	data->catchup = s.catchup;
+
+	if (!restart) {
+		bfree(s.client);
+		pulse_update_whole_sink(data);
+		return;
+	}
+
+	blog(LOG_INFO, "need to restart");
+
+	pulse_stop_recording(data);
+	pulse_helper_capture_stop(data->helper_capture);
+	data->helper_capture = NULL;
+	data->helper = s.helper;
+
+	if (client_changed) {
+		bfree(data->client);
+		data->client = s.client;
+		data->match.client_idx = PA_INVALID_INDEX;
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
+	} else {
+		bfree(s.client);
+	}
+
+	if (!data->client)
+		return;
+
+	if (data->helper) {
+		// the helper does its own discovery
+		pulse_journal_watch(data->journal_id, NULL);
+		pulse_discovery_remove(data);
+		bfree(data->persisted.monitor);
+		data->persisted.monitor = NULL;
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
+		pulse_publish_binding(data);
+
+		if (data->released == PULSE_IDLE_KEEP) {
+			struct pulse_capture_params params;
+			pulse_capture_params_init(data, &params);
+			data->helper_capture =
+				pulse_helper_capture_start(&params);
+		}
+		return;
+	}
+
+	if (client_changed || helper_changed)
+		pulse_journal_watch(data->journal_id, data->client);
+
+	if (data->match.sink_input_idx != PA_INVALID_INDEX &&
+	    pulse_start_recording(data, false) == 0) {
+		pulse_update_whole_sink(data);
+		return;
+	}
+
+	// only the first settings of the source match the saved binding
+	if (client_changed && pulse_restore_binding(data))
+		return;
+
+	data->match.sink_input_idx = PA_INVALID_INDEX;
+	data->match.sink_idx = PA_INVALID_INDEX;
+	pulse_publish_binding(data);
+
+	// binding happens in the next batched discovery pass
+	pulse_discovery_request(data);
+}
+
+/**
+ * Update the input settings
+ *
+ * The settings are only copied here, they are applied on the control thread
+ * so the source state is never modified from the UI thread.
+ */
+static void pulse_app_input_update(void *vptr, obs_data_t *settings)
+{
+	PULSE_DATA(vptr);
+	struct pulse_binding binding;
+
+	uint_fast32_t packet_frames = (uint_fast32_t)obs_data_get_int(
+		settings, "packet_frames");
+	if (!packet_frames)
+		packet_frames = AUDIO_OUTPUT_FRAMES;
+
+	const char *new_client = obs_data_get_string(settings, "client");
+
+	pulse_get_binding(data, &binding);
+	blog(LOG_INFO, "new client: %s, currently bound to sink-input %" PRIu32,
+	     new_client, binding.sink_input_idx);
+
+	pthread_mutex_lock(&data->settings_mutex);
+	bfree(data->next_settings.client);
+	data->next_settings.client = bstrdup(new_client);
+	data->next_settings.packet_frames = packet_frames;
+	data->next_settings.event_window_ns =
+		(uint64_t)obs_data_get_int(settings, "event_window_ms") *
+		NSEC_PER_MSEC;
+	data->next_settings.max_latency_ns =
+		(uint64_t)obs_data_get_int(settings, "max_latency_ms") *
+		NSEC_PER_MSEC;
+	data->next_settings.catchup =
+		(enum pulse_catchup)obs_data_get_int(settings, "catchup");
+	data->next_settings.helper = obs_data_get_bool(settings, "helper");
+	data->next_settings.idle_policy = (enum pulse_idle_policy)
+		obs_data_get_int(settings, "idle_policy");
+	data->next_settings.whole_sink =
+		obs_data_get_bool(settings, "whole_sink");
+	data->settings_pending = true;
+	pthread_mutex_unlock(&data->settings_mutex);
+
+	pulse_control_schedule(&data->next_settings, 0, pulse_apply_settings,
+			       data);
+}
+
+/**
+ * Reconcile the binding with the server state
+ *
+ * Runs on the control thread once per burst of subscription events and
+ * carries out what pulse_match_reconcile() decided.
+ */
+static void pulse_reconcile(void *vptr, uint64_t queued_ns)
+{
+	PULSE_DATA(vptr);
+
+	// the capture helper does its own discovery
+	if (data->helper)
+		return;
+
+	struct pulse_match_decision d;
+	pulse_match_reconcile(&data->match, data->capture != NULL, &d);
+
+	if (d.drop) {
+		if (data->capture) {
+			blog(LOG_INFO,
+			     "sink input has been removed; stopping recording");
+			pulse_stop_recording(data);
+		}
+		pulse_publish_binding(data);
+	}
+
+	if (data->stall_suspected) {
+		data->stall_suspected = false;
+		if (data->capture)
+			pulse_check_stall(data);
+	}
+
+	if (d.step == PULSE_MATCH_CONNECT) {
+		// the sink-input and its sink are already known, so all that
+		// is left to do is to connect the stream
+		blog(LOG_INFO, "binding pre-armed sink-input %" PRIu32,
+		     d.sink_input_idx);
+		data->match.sink_input_idx = d.sink_input_idx;
+		data->match.sink_idx = d.sink_idx;
+
+		// only a sink-input that just appeared counts as pre-armed
+		int_fast32_t ret = pulse_start_recording(
+			data, data->sink_input_seen_ns != 0);
+		data->client_seen_ns = 0;
+		data->sink_input_seen_ns = 0;
+
+		if (ret == 0 && data->created_ns) {
+			blog(LOG_INFO,
+			     "'%s' bound %.2f ms after the source was created",
+			     data->client,
+			     (double)(os_gettime_ns() - data->created_ns) /
+				     NSEC_PER_MSEC);
+			data->created_ns = 0;
+		}
+
+		if (ret < 0) {
+			// fall back to a full discovery pass
+			data->match.sink_input_idx = PA_INVALID_INDEX;
+			data->match.sink_idx = PA_INVALID_INDEX;
+			refresh_recording(data);
+		}
+	} else if (d.step == PULSE_MATCH_REBIND) {
+		refresh_recording(data);
+	}
+
+	pulse_update_whole_sink(data);
+
+	uint64_t latency = os_gettime_ns() - queued_ns;
+	if (latency > data->reconcile_latency_max)
+		data->reconcile_latency_max = latency;
+	data->reconciles++;
+
+	blog(LOG_INFO,
+	     "reconciled '%s' in %.2f ms, %ld of %ld events suppressed so far",
+	     data->client, (double)latency / NSEC_PER_MSEC,
+	     os_atomic_load_long(&data->events_suppressed),
+	     os_atomic_load_long(&data->events));
+}
+
+/**
+ * Request a reconciliation pass, coalescing events within the event window
+ *
+ * Every call counts as an event routed to the source.
+ */
+static void pulse_request_reconcile(struct pulse_data *data,
+				    uint64_t delay_ns)
+{
+	os_atomic_inc_long(&data->events);
+	if (!pulse_control_schedule(data, delay_ns, pulse_reconcile, data))
+		os_atomic_inc_long(&data->events_suppressed);
+}
+
+/**
+ * Result of a single client or sink-input query
+ */
+struct pulse_event_info {
+	struct pulse_match_object object;
+	/* owns the name of the object */
+	char *name;
+};
+
+static void event_client_info_cb(pa_context *c, const pa_client_info *i,
+				 int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_event_info *info = (struct pulse_event_info *)userdata;
+
+	if (!eol && i->index != PA_INVALID_INDEX)
+		pulse_journal_client(i->index, i->name);
+
+	if (!eol && i->index != PA_INVALID_INDEX && i->name) {
+		info->name = bstrdup(i->name);
+		info->object.name = info->name;
+		info->object.found = true;
+	}
+
+	pulse_signal(0);
+}
+
+static void event_sink_input_info_cb(pa_context *c,
+				     const pa_sink_input_info *i, int eol,
+				     void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_event_info *info = (struct pulse_event_info *)userdata;
+
+	if (!eol && i->index != PA_INVALID_INDEX) {
+		pulse_journal_sink_input(i->index, i->client, i->sink);
+		info->object.client = i->client;
+		info->object.sink = i->sink;
+		info->object.corked = i->corked;
+		info->object.found = true;
+	}
+
+	pulse_signal(0);
+}
+
+/**
+ * Find out why a stream stopped delivering audio and restart it
+ *
+ * A sink-input the client corked itself is left alone for a while, one that
+ * moved to another sink is followed, anything else gets a fresh stream.
+ *
+ * @note called from pulse_reconcile() on the control thread
+ */
+static void pulse_check_stall(struct pulse_data *data)
+{
+	struct pulse_event_info info = {};
+	uint64_t now = os_gettime_ns();
+	uint32_t sink_idx = data->match.sink_idx;
+
+	pulse_get_sink_input_info(data->match.sink_input_idx,
+				  event_sink_input_info_cb, &info);
+	pulse_journal_stall(data->journal_id, data->match.sink_input_idx,
+			    info.object.found, info.object.corked,
+			    info.object.client, info.object.sink);
+
+	switch (pulse_match_stall(&data->match, &info.object)) {
+	case PULSE_MATCH_STALL_REBIND:
+		// the flags of this pass were already taken, so rebind in
+		// another one
+		blog(LOG_INFO, "sink-input %" PRIu32 " of '%s' not found",
+		     data->match.sink_input_idx, data->client);
+		pulse_control_again(data->event_window_ns);
+		return;
+	case PULSE_MATCH_STALL_CORKED:
+		data->watch_idle_until = now + STALL_BACKOFF_NS;
+		blog(LOG_INFO, "'%s' corked sink-input %" PRIu32 " itself",
+		     data->client, data->match.sink_input_idx);
+		return;
+	case PULSE_MATCH_STALL_RESTART:
+		break;
+	}
+
+	if (data->match.sink_idx != sink_idx)
+		blog(LOG_INFO,
+		     "sink-input %" PRIu32 " moved from sink %" PRIu32
+		     " to %" PRIu32,
+		     data->match.sink_input_idx, sink_idx,
+		     data->match.sink_idx);
+
+	data->stalls++;
+	data->stall_ns = now;
+	blog(LOG_WARNING, "capture of '%s' stalled, restarting the stream",
+	     data->client);
+
+	pulse_stop_recording(data);
+	if (pulse_start_recording(data, false) < 0) {
+		// forget the binding, or the rebind finds nothing changed and
+		// leaves the source without a stream
+		data->match.sink_input_idx = PA_INVALID_INDEX;
+		data->match.sink_idx = PA_INVALID_INDEX;
+		refresh_recording(data);
+	}
+}
+
+/**
+ * Append the journal to its file in the module config directory
+ *
+ * @param stop also stop recording the journal
+ */
+static void pulse_write_journal(bool stop)
+{
+	char *journal = obs_module_config_path("journal.bin");
+	char *dir = obs_module_config_path("");
+	if (dir)
+		os_mkdirs(dir);
+
+	if (stop)
+		pulse_journal_stop(journal);
+	else
+		pulse_journal_flush(journal);
+
+	bfree(dir);
+	bfree(journal);
+}
+
+/**
+ * Sink-inputs on the sink of the binding, by whether the client owns them
+ */
+struct pulse_sink_peers {
+	uint32_t client_idx;
+	uint32_t sink_idx;
+	uint32_t own;
+	uint32_t foreign;
+};
+
+static void sink_peers_cb(pa_context *c, const pa_sink_input_info *i,
+			  int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_sink_peers *peers = (struct pulse_sink_peers *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	pulse_journal_sink_input(i->index, i->client, i->sink);
+	if (i->sink != peers->sink_idx)
+		return;
+	if (pulse_match_sink_input(peers->client_idx, i->client))
+		peers->own++;
+	else
+		peers->foreign++;
+}
+
+/**
+ * Switch between recording the sink-input and the whole sink
+ *
+ * While every sink-input on the bound sink belongs to the client the sink's
+ * monitor carries exactly the client's audio, so the monitor stream of the
+ * sink-input is stopped in favour of the plain monitor of the sink, which
+ * also covers the other sink-inputs of the client there. As soon as a
+ * sink-input of another client shows up on the sink the capture goes back
+ * to the bound sink-input. Both ways the new stream takes over without a
+ * gap, see pulse_capture_handover().
+ *
+ * @note called from the control thread only
+ */
+static void pulse_update_whole_sink(struct pulse_data *data)
+{
+	if (!data->capture || data->helper ||
+	    data->released != PULSE_IDLE_KEEP)
+		return;
+	if (!data->whole_sink && !data->match.capturing_sink)
+		return;
+
+	struct pulse_sink_peers peers = {};
+	peers.client_idx = data->match.client_idx;
+	peers.sink_idx = data->match.sink_idx;
+
+	bool alone = data->whole_sink &&
+		     pulse_get_sink_input_info_list(sink_peers_cb, &peers) >=
+			     0 &&
+		     peers.foreign == 0;
+	if (alone == data->match.capturing_sink)
+		return;
+
+	if (alone)
+		blog(LOG_INFO,
+		     "'%s' owns all %" PRIu32 " sink-inputs on sink %" PRIu32
+		     ", recording the whole sink",
+		     data->client, peers.own, data->match.sink_idx);
+	else
+		blog(LOG_INFO,
+		     "'%s' shares sink %" PRIu32 ", recording its sink-input",
+		     data->client, data->match.sink_idx);
+
+	struct pulse_capture_params params;
+	pulse_capture_params_init(data, &params);
+	params.whole_sink = alone;
+
+	struct pulse_capture *capture =
+		pulse_capture_handover(data->capture, &params);
+	if (capture) {
+		data->capture = capture;
+		data->match.capturing_sink = alone;
+		pulse_publish_binding(data);
+		return;
+	}
+
+	blog(LOG_WARNING, "unable to switch the capture of '%s'",
+	     data->client);
+
+	// the next reconcile tries again, but the whole sink must not be
+	// recorded a moment longer once it is shared
+	if (!alone) {
+		pulse_stop_recording(data);
+		if (pulse_start_recording(data, false) < 0) {
+			data->match.sink_input_idx = PA_INVALID_INDEX;
+			data->match.sink_idx = PA_INVALID_INDEX;
+			refresh_recording(data);
+		}
+	}
+}
+
+/**
+ * Take the snapshot of a source shown in the health dock
+ *
+ * @note called from the watchdog with sources_mutex held
+ */
+static void pulse_update_health(struct pulse_data *data,
+				const struct pulse_capture_health *capture)
+{
+	struct pulse_source_health *h = &data->health;
+
+	if (!data->client) {
+		bfree(h->client);
+		h->client = NULL;
+	} else if (!h->client || strcmp(h->client, data->client) != 0) {
+		bfree(h->client);
+		h->client = bstrdup(data->client);
+	}
+
+	if (data->helper)
+		h->state = PULSE_SOURCE_HELPER;
+	else if (data->released == PULSE_IDLE_CORK)
+		h->state = PULSE_SOURCE_PAUSED;
+	else if (data->released == PULSE_IDLE_DISCONNECT)
+		h->state = PULSE_SOURCE_DISCONNECTED;
+	else if (data->capture)
+		h->state = PULSE_SOURCE_CAPTURING;
+	else
+		h->state = PULSE_SOURCE_WAITING;
+
+	h->id = data->journal_id;
+	h->client_idx = data->match.client_idx;
+	h->sink_input_idx = data->match.sink_input_idx;
+	h->sink_idx = data->match.sink_idx;
+	h->whole_sink = data->match.capturing_sink;
+	h->capture = *capture;
+	h->restarts = data->starts ? data->starts - 1 : 0;
+	h->stalls = data->stalls;
+}
+
+/**
+ * Look for streams that stopped delivering audio
+ *
+ * Runs on the control thread every WATCHDOG_PERIOD_NS and only reads the
+ * frame counters of the streams, the server is asked about a stream only
+ * once it fell STALL_NS behind. The snapshots of the health dock are taken
+ * on the way.
+ */
+static void pulse_watchdog(void *vptr, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(vptr);
+	UNUSED_PARAMETER(queued_ns);
+
+	struct pulse_stats_probe probe;
+	uint64_t count = 0;
+	pulse_stats_begin(&probe);
+
+	// once per connection, keeps /proc/self/maps off the mainloop thread
+	pulse_detect_transport();
+
+	pthread_mutex_lock(&sources_mutex);
+
+	uint64_t now = os_gettime_ns();
+	for (struct pulse_data *data = sources; data; data = data->next) {
+		struct pulse_capture_health counters = {};
+		if (data->capture)
+			pulse_capture_get_health(data->capture, &counters);
+		pulse_update_health(data, &counters);
+
+		if (!data->capture || data->helper ||
+		    data->released != PULSE_IDLE_KEEP)
+			continue;
+		count++;
+
+		uint64_t frames = counters.frames - data->watch_frames;
+		uint64_t elapsed = now - data->watch_ns;
+		bool fresh = counters.frames < data->watch_frames ||
+			     data->watch_ns == 0;
+		data->watch_frames = counters.frames;
+		data->watch_ns = now;
+
+		// a new stream or one that is allowed to be silent
+		if (fresh || counters.corked || now < data->watch_idle_until)
+			continue;
+
+		if (frames && data->stall_ns) {
+			uint64_t recovery = now - data->stall_ns;
+			data->stall_ns = 0;
+			data->recovery_total += recovery;
+			if (recovery > data->recovery_max)
+				data->recovery_max = recovery;
+			blog(LOG_INFO, "capture of '%s' recovered in %.2f ms",
+			     data->client, (double)recovery / NSEC_PER_MSEC);
+		}
+
+		uint64_t expected = util_mul_div64(
+			elapsed, counters.samples_per_sec, NSEC_PER_SEC);
+		uint64_t allowed = util_mul_div64(
+			STALL_NS, counters.samples_per_sec, NSEC_PER_SEC);
+		if (expected > frames + allowed && !data->stall_suspected) {
+			data->stall_suspected = true;
+			pulse_control_schedule(data, 0, pulse_reconcile, data);
+		}
+	}
+
+	// destroy cancels the timer after the last source is gone
+	if (sources)
+		pulse_control_again(WATCHDOG_PERIOD_NS);
+
+	pthread_mutex_unlock(&sources_mutex);
+
+	// the journal must survive a crash or a hang of OBS
+	if (now - journal_flush_ns >= JOURNAL_FLUSH_NS) {
+		journal_flush_ns = now;
+		pulse_write_journal(false);
+	}
+
+	pulse_stats_end(&watchdog_stats, &probe, count);
+}
+
+size_t pulse_get_source_health(struct pulse_source_health **health)
+{
+	size_t count = 0;
+
+	pthread_mutex_lock(&sources_mutex);
+
+	for (struct pulse_data *data = sources; data; data = data->next)
+		count++;
+
+	*health = (struct pulse_source_health *)bzalloc(
+		sizeof(struct pulse_source_health) * (count ? count : 1));
+
+	size_t i = 0;
+	for (struct pulse_data *data = sources; data; data = data->next) {
+		struct pulse_source_health *h = &(*health)[i++];
+		*h = data->health;
+		h->id = data->journal_id;
+		h->name = bstrdup(obs_source_get_name(data->source));
+		h->client = data->health.client
+				    ? bstrdup(data->health.client)
+				    : NULL;
+	}
+
+	pthread_mutex_unlock(&sources_mutex);
+
+	return count;
+}
+
+void pulse_source_health_free(struct pulse_source_health *health,
+			      size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		bfree(health[i].name);
+		bfree(health[i].client);
+	}
+	bfree(health);
+}
+
+/**
+ * Query the client or sink-input an event is about
+ *
+ * @return false if the event needs no query
+ */
+static bool pulse_event_query(const struct pulse_event *ev,
+			      struct pulse_event_info *info)
+{
+	bool capturing_sink = false;
+
+	pthread_mutex_lock(&sources_mutex);
+	for (struct pulse_data *data = sources; data; data = data->next)
+		capturing_sink = capturing_sink || data->match.capturing_sink;
+	pthread_mutex_unlock(&sources_mutex);
+
+	if (!pulse_match_event_query(ev->t, capturing_sink))
+		return false;
+
+	if ((ev->t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) ==
+	    PA_SUBSCRIPTION_EVENT_CLIENT)
+		pulse_get_client_info(ev->idx, event_client_info_cb, info);
+	else
+		pulse_get_sink_input_info(ev->idx, event_sink_input_info_cb,
+					  info);
+	return true;
+}
+
+/**
+ * Apply a single subscription event to all sources
+ *
+ * What an event means for a source is decided by pulse_match_event(), this
+ * only queries the object the event is about and schedules the
+ * reconciliations. A client that connected fills the sink cache right away,
+ * so its first sink-input can be bound without another round trip.
+ *
+ * @note called from the control thread only
+ */
+static void pulse_process_event(const struct pulse_event *ev)
+{
+	int facility = ev->t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	int type = ev->t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+	struct pulse_event_info info = {};
+	bool client_seen = false;
+
+	if (facility == PA_SUBSCRIPTION_EVENT_SINK &&
+	    (type == PA_SUBSCRIPTION_EVENT_NEW ||
+	     type == PA_SUBSCRIPTION_EVENT_REMOVE))
+		pulse_sink_cache_remove(ev->idx);
+	if (type == PA_SUBSCRIPTION_EVENT_NEW &&
+	    facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT)
+		blog(LOG_INFO, "new sink-input added %" PRIu32, ev->idx);
+	else if (type == PA_SUBSCRIPTION_EVENT_NEW &&
+		 facility == PA_SUBSCRIPTION_EVENT_SINK)
+		blog(LOG_INFO, "new sink added");
+
+	pulse_event_query(ev, &info);
+
+	pthread_mutex_lock(&sources_mutex);
+	for (struct pulse_data *data = sources; data; data = data->next) {
+		switch (pulse_match_event(&data->match, data->client, ev->t,
+					  ev->idx, &info.object)) {
+		case PULSE_MATCH_NONE:
+			break;
+		case PULSE_MATCH_CLIENT:
+			blog(LOG_INFO,
+			     "client '%s' connected with index %" PRIu32,
+			     info.name, ev->idx);
+			os_atomic_inc_long(&data->events);
+			data->client_seen_ns = ev->ns;
+			client_seen = true;
+			break;
+		case PULSE_MATCH_NOW:
+			if (data->match.pending_sink_input_idx == ev->idx &&
+			    !data->sink_input_seen_ns)
+				data->sink_input_seen_ns = ev->ns;
+			pulse_request_reconcile(data, 0);
+			break;
+		case PULSE_MATCH_LATER:
+			pulse_request_reconcile(data, data->event_window_ns);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sources_mutex);
+
+	if (client_seen)
+		pulse_sink_cache_refresh();
+
+	bfree(info.name);
+}
+
+/**
+ * Process all queued subscription events
+ *
+ * Runs on the control thread, which is free to block on the server.
+ */
+static void pulse_process_events(void *unused, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(unused);
+	UNUSED_PARAMETER(queued_ns);
+
+	struct pulse_stats_probe probe;
+	pulse_stats_begin(&probe);
+
+	pthread_mutex_lock(&event_mutex);
+	struct pulse_event *events = event_queue;
+	size_t count = event_count;
+	event_queue = NULL;
+	event_count = 0;
+	event_capacity = 0;
+	pthread_mutex_unlock(&event_mutex);
+
+	for (size_t i = 0; i < count; i++) {
+		pulse_journal_event(events[i].ns, events[i].t, events[i].idx);
+		pulse_process_event(&events[i]);
+	}
+
+	bfree(events);
+
+	pulse_stats_end(&event_stats, &probe, count);
+}
+
+/**
+ * Subscription callback shared by all sources
+ *
+ * Runs on the mainloop thread, so it only queues the event for the control
+ * thread and never talks to the server itself.
+ */
+static void pulse_events_cb(pa_context *c, pa_subscription_event_type_t t,
+			    uint32_t idx, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(userdata);
+
+	pthread_mutex_lock(&event_mutex);
+
+	if (event_count == event_capacity) {
+		event_capacity = event_capacity ? event_capacity * 2 : 16;
+		event_queue = (struct pulse_event *)brealloc(
+			event_queue,
+			sizeof(struct pulse_event) * event_capacity);
+	}
+
+	struct pulse_event *ev = &event_queue[event_count++];
+	ev->t = t;
+	ev->idx = idx;
+	ev->ns = os_gettime_ns();
+
+	pthread_mutex_unlock(&event_mutex);
+
+	pulse_control_schedule(&event_queue, 0, pulse_process_events, NULL);
+}
+
+/**
+ * Server snapshot used by a batched discovery pass
+ */
+struct pulse_discovery {
+	uint_fast32_t clients;
+	uint_fast32_t sink_inputs;
+	uint_fast32_t bound;
+};
+
+static void discovery_client_cb(pa_context *c, const pa_client_info *i,
+				int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_discovery *d = (struct pulse_discovery *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	pulse_journal_client(i->index, i->name);
+
+	d->clients++;
+	pthread_mutex_lock(&discovery_mutex);
+	for (struct pulse_data *data = discovery_taken; data;
+	     data = data->discovery_next)
+		pulse_match_add_client(&data->discovery_match, i->index,
+				       i->name);
+	pthread_mutex_unlock(&discovery_mutex);
+}
+
+static void discovery_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+				    int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_discovery *d = (struct pulse_discovery *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	pulse_journal_sink_input(i->index, i->client, i->sink);
+
+	d->sink_inputs++;
+	pthread_mutex_lock(&discovery_mutex);
+	for (struct pulse_data *data = discovery_taken; data;
+	     data = data->discovery_next) {
+		if (pulse_match_add_sink_input(&data->discovery_match,
+					       i->index, i->client, i->sink))
+			d->bound++;
+	}
+	pthread_mutex_unlock(&discovery_mutex);
+}
+
+/**
+ * Batched discovery pass
+ *
+ * Resolves every queued source with a single client list, sink-input list
+ * and sink list query and hands the results to the per source
+ * reconciliation, which then only has to connect the stream.
+ */
+static void pulse_discovery_pass(void *unused, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(unused);
+
+	struct pulse_discovery d = {};
+	struct pulse_stats_probe probe;
+	uint64_t start = os_gettime_ns();
+
+	pulse_stats_begin(&probe);
+
+	// the taken sources stay on a list of their own while the server is
+	// queried, destroy unlinks a source from it without waiting for the
+	// pass
+	pthread_mutex_lock(&discovery_mutex);
+
+	discovery_taken = discovery_queue;
+	discovery_queue = NULL;
+
+	for (struct pulse_data *data = discovery_taken; data;
+	     data = data->discovery_next) {
+		data->discovery_pending = false;
+		data->discovery_running = true;
+		pulse_match_init(&data->discovery_match, data->client);
+	}
+
+	pthread_mutex_unlock(&discovery_mutex);
+
+	bool failed =
+		pulse_get_client_info_list(discovery_client_cb, &d) < 0 ||
+		pulse_get_sink_input_info_list(discovery_sink_input_cb, &d) <
+			0;
+	if (!failed)
+		pulse_sink_cache_refresh();
+
+	pthread_mutex_lock(&discovery_mutex);
+
+	// sources whose client is not running yet are bound by the
+	// subscription events once it shows up, after a failed query the
+	// unbound ones are queued again instead
+	uint_fast32_t count = 0;
+	struct pulse_data *data = discovery_taken;
+	discovery_taken = NULL;
+	while (data) {
+		struct pulse_data *next = data->discovery_next;
+		count++;
+		data->discovery_running = false;
+		data->match.client_idx = data->discovery_match.client_idx;
+		data->match.pending_sink_input_idx =
+			data->discovery_match.sink_input_idx;
+		data->match.pending_sink_idx = data->discovery_match.sink_idx;
+
+		// a source requested again while the pass ran, e.g. for
+		// another client, needs a pass of its own
+		if (!data->discovery_pending &&
+		    data->match.pending_sink_input_idx != PA_INVALID_INDEX)
+			pulse_control_schedule(data, 0, pulse_reconcile, data);
+		else if (failed)
+			data->discovery_pending = true;
+
+		if (data->discovery_pending) {
+			data->discovery_next = discovery_queue;
+			discovery_queue = data;
+		}
+		data = next;
+	}
+
+	if (failed) {
+		discovery_backoff_ns = discovery_backoff_ns
+					       ? discovery_backoff_ns * 2
+					       : DISCOVERY_BATCH_NS;
+		if (discovery_backoff_ns > DISCOVERY_BACKOFF_MAX_NS)
+			discovery_backoff_ns = DISCOVERY_BACKOFF_MAX_NS;
+	} else {
+		discovery_backoff_ns = 0;
+	}
+	uint64_t backoff = discovery_backoff_ns;
+	if (discovery_queue)
+		pulse_control_again(failed ? backoff : DISCOVERY_BATCH_NS);
+
+	pthread_mutex_unlock(&discovery_mutex);
+
+	if (failed)
+		blog(LOG_WARNING,
+		     "batched discovery failed, retrying in %.2f ms",
+		     (double)backoff / NSEC_PER_MSEC);
+
+	pulse_stats_end(&discovery_stats, &probe, d.clients + d.sink_inputs);
+
+	uint64_t end = os_gettime_ns();
+	blog(LOG_INFO,
+	     "batched discovery resolved %" PRIuFAST32 " of %" PRIuFAST32
+	     " sources against %" PRIuFAST32 " clients and %" PRIuFAST32
+	     " sink-inputs in %.2f ms, %.2f ms after the first request",
+	     d.bound, count, d.clients, d.sink_inputs,
+	     (double)(end - start) / NSEC_PER_MSEC,
+	     (double)(end - queued_ns) / NSEC_PER_MSEC);
+}
+
+/**
+ * Queue a source for the next batched discovery pass
+ *
+ * All sources queued within DISCOVERY_BATCH_NS of the first one share a
+ * single pass, which keeps loading a scene collection with many sources down
+ * to a handful of server round trips.
+ */
+static void pulse_discovery_request(struct pulse_data *data)
+{
+	pthread_mutex_lock(&discovery_mutex);
+
+	// a source taken by the running pass is queued again by the pass
+	if (!data->discovery_pending) {
+		data->discovery_pending = true;
+		if (!data->discovery_running) {
+			data->discovery_next = discovery_queue;
+			discovery_queue = data;
+		}
+	}
+
+	pthread_mutex_unlock(&discovery_mutex);
+
+	pulse_control_schedule(&discovery_queue, DISCOVERY_BATCH_NS,
+			       pulse_discovery_pass, NULL);
+}
+
+/**
+ * Unlink a source from a discovery list
+ *
+ * @note discovery_mutex must be held
+ */
+static void pulse_discovery_unlink(struct pulse_data **list,
+				   struct pulse_data *data)
+{
+	struct pulse_data **pos = list;
+	while (*pos) {
+		if (*pos == data) {
+			*pos = data->discovery_next;
+			break;
+		}
+		pos = &(*pos)->discovery_next;
+	}
+}
+
+/**
+ * Take a source out of discovery, also out of a pass that is running
+ *
+ * Never waits for the server, the pass only touches the sources still on
+ * its list with discovery_mutex held.
+ */
+static void pulse_discovery_remove(struct pulse_data *data)
+{
+	pthread_mutex_lock(&discovery_mutex);
+
+	pulse_discovery_unlink(&discovery_queue, data);
+	pulse_discovery_unlink(&discovery_taken, data);
+	data->discovery_pending = false;
+	data->discovery_running = false;
+
+	pthread_mutex_unlock(&discovery_mutex);
+}
+
+/**
+ * Destroy the plugin object and free all memory
+ */
+static void pulse_app_input_destroy(void *vptr)
+{
+	PULSE_DATA(vptr);
+
+	if (!data)
+		return;
+
+	// make sure the control thread lets go of the source: pending
+	// settings could queue it for discovery and events or discovery could
+	// schedule a reconciliation
+	pulse_control_cancel(&data->next_settings);
+	pulse_control_cancel(&data->released);
+	pulse_control_cancel(&data->persisted);
+
+	pthread_mutex_lock(&sources_mutex);
+	struct pulse_data **pos = &sources;
+	while (*pos && *pos != data)
+		pos = &(*pos)->next;
+	if (*pos)
+		*pos = data->next;
+	bool last = sources == NULL;
+	pthread_mutex_unlock(&sources_mutex);
+
+	if (last)
+		pulse_control_cancel(&watchdog_stats);
+
+	pulse_discovery_remove(data);
+	pulse_control_cancel(data);
+
+	pulse_stop_recording(data);
+	pulse_helper_capture_stop(data->helper_capture);
+	pulse_journal_watch(data->journal_id, NULL);
+
+	blog(LOG_INFO,
+	     "'%s': %ld events, %ld suppressed, %" PRIu64
+	     " reconciliations, max latency %.2f ms",
+	     data->client, os_atomic_load_long(&data->events),
+	     os_atomic_load_long(&data->events_suppressed), data->reconciles,
+	     (double)data->reconcile_latency_max / NSEC_PER_MSEC);
+	if (data->stalls)
+		blog(LOG_INFO,
+		     "'%s': %" PRIu64 " stalls, recovered in %.2f ms on "
+		     "average, %.2f ms at most",
+		     data->client, data->stalls,
+		     (double)data->recovery_total / data->stalls /
+			     NSEC_PER_MSEC,
+		     (double)data->recovery_max / NSEC_PER_MSEC);
+
+	if (last) {
+		pulse_unsubscribe_events(pulse_events_cb, NULL);
+		pulse_control_cancel(&event_queue);
+		pulse_control_cancel(&discovery_queue);
+		pulse_control_cancel(&picker_scans);
+		pulse_sink_cache_clear();
+
+		pthread_mutex_lock(&picker_mutex);
+		pulse_peak_free(picker_clients, picker_count);
+		picker_clients = NULL;
+		picker_count = 0;
+		pthread_mutex_unlock(&picker_mutex);
+
+		pthread_mutex_lock(&event_mutex);
+		bfree(event_queue);
+		event_queue = NULL;
+		event_count = 0;
+		event_capacity = 0;
+		pthread_mutex_unlock(&event_mutex);
+
+		pulse_stats_log(&refresh_stats);
+		pulse_stats_log(&discovery_stats);
+		pulse_stats_log(&event_stats);
+		pulse_stats_log(&properties_stats);
+		pulse_stats_log(&watchdog_stats);
+
+		pulse_write_journal(true);
+
+		struct pulse_operation_stats ops;
+		pulse_get_operation_stats(&ops);
+		blog(LOG_INFO,
+		     "%" PRIu64 " blocking calls, %" PRIu64 " slow, %" PRIu64
+		     " timed out, max %.2f ms",
+		     ops.operations, ops.slow, ops.timeouts,
+		     (double)ops.max_ns / NSEC_PER_MSEC);
+	}
+
+	pulse_control_unref();
+	pulse_unref();
+
+	pthread_mutex_destroy(&data->settings_mutex);
+
+	bfree(data->next_settings.client);
+	bfree(data->persisted.monitor);
+	bfree(data->health.client);
+
+	if (data->client)
+		bfree(data->client);
+
+	bfree(data);
+}
+
+/**
+ * Read the binding saved by pulse_app_input_save()
+ */
+static void pulse_load_persisted(struct pulse_data *data,
+				 obs_data_t *settings)
+{
+	struct pulse_persisted *p = &data->persisted;
+	const char *monitor = obs_data_get_string(settings, "bound_monitor");
+
+	p->sink_input_idx = PA_INVALID_INDEX;
+	if (!*monitor)
+		return;
+
+	p->spec.format = (pa_sample_format_t)obs_data_get_int(
+		settings, "bound_format");
+	p->spec.rate = (uint32_t)obs_data_get_int(settings, "bound_rate");
+	p->spec.channels =
+		(uint8_t)obs_data_get_int(settings, "bound_channels");
+	if (!pa_sample_spec_valid(&p->spec))
+		return;
+
+	p->sink_input_idx =
+		(uint32_t)obs_data_get_int(settings, "bound_sink_input");
+	p->sink_idx = (uint32_t)obs_data_get_int(settings, "bound_sink");
+	p->monitor = bstrdup(monitor);
+}
+
+/**
+ * Save the current binding with the source
+ *
+ * Read back when the source is created in the next session, see
+ * pulse_restore_binding().
+ */
+static void pulse_app_input_save(void *vptr, obs_data_t *settings)
+{
+	PULSE_DATA(vptr);
+	struct pulse_binding binding;
+	char *monitor = NULL;
+	pa_sample_spec spec;
+
+	pulse_get_binding(data, &binding);
+
+	if (binding.sink_input_idx == PA_INVALID_INDEX ||
+	    !pulse_sink_cache_lookup(binding.sink_idx, &monitor, &spec)) {
+		obs_data_erase(settings, "bound_sink_input");
+		obs_data_erase(settings, "bound_sink");
+		obs_data_erase(settings, "bound_monitor");
+		obs_data_erase(settings, "bound_format");
+		obs_data_erase(settings, "bound_rate");
+		obs_data_erase(settings, "bound_channels");
+		return;
+	}
+
+	obs_data_set_int(settings, "bound_sink_input", binding.sink_input_idx);
+	obs_data_set_int(settings, "bound_sink", binding.sink_idx);
+	obs_data_set_string(settings, "bound_monitor", monitor);
+	obs_data_set_int(settings, "bound_format", spec.format);
+	obs_data_set_int(settings, "bound_rate", spec.rate);
+	obs_data_set_int(settings, "bound_channels", spec.channels);
+
+	bfree(monitor);
+}
+
+/**
+ * Create the plugin object
+ */
+static void *pulse_create(obs_data_t *settings, obs_source_t *source)
+{
+	struct pulse_data *data =
+		(struct pulse_data *)bzalloc(sizeof(struct pulse_data));
+
+	data->source = source;
+	data->journal_id = (uint32_t)os_atomic_inc_long(&journal_ids);
+	pulse_match_state_init(&data->match);
+	data->health.client_idx = PA_INVALID_INDEX;
+	data->health.sink_input_idx = PA_INVALID_INDEX;
+	data->health.sink_idx = PA_INVALID_INDEX;
+	pthread_mutex_init(&data->settings_mutex, NULL);
+	data->created_ns = os_gettime_ns();
+	pulse_publish_binding(data);
+
+	blog(LOG_INFO, "%s", "initting from create");
+	if (pulse_init() < 0) {
+		blog(LOG_ERROR, "PulseAudio is not available");
+		pthread_mutex_destroy(&data->settings_mutex);
+		bfree(data);
+		return NULL;
+	}
+	pulse_control_init();
+	pulse_load_persisted(data, settings);
+
+	pthread_mutex_lock(&sources_mutex);
+	bool first = sources == NULL;
+	data->next = sources;
+	sources = data;
+	pthread_mutex_unlock(&sources_mutex);
+
+	if (first) {
+		pulse_journal_start();
+		pulse_subscribe_events(pulse_events_cb, NULL);
+		pulse_control_schedule(&watchdog_stats, WATCHDOG_PERIOD_NS,
+				       pulse_watchdog, NULL);
+	}
+
+	blog(LOG_INFO, "%s",
+	     "finished initting from create now calling update");
+	pulse_app_input_update(data, settings);
+	blog(LOG_INFO, "%s", "finished updating from create");
+
+	return data;
+}
+
+/**
+ * Visibility callbacks
+ *
+ * These run on the ui and graphics threads, the capture is released and
+ * resumed on the control thread.
+ */
+static void pulse_app_input_set_visibility(struct pulse_data *data,
+					   volatile long *flag, long value)
+{
+	os_atomic_set_long(flag, value);
+	pulse_control_schedule(&data->released, 0, pulse_idle_cb, data);
+}
+
+static void pulse_app_input_activate(void *vptr)
+{
+	PULSE_DATA(vptr);
+	pulse_app_input_set_visibility(data, &data->active, 1);
+}
+
+static void pulse_app_input_deactivate(void *vptr)
+{
+	PULSE_DATA(vptr);
+	pulse_app_input_set_visibility(data, &data->active, 0);
+}
+
+static void pulse_app_input_show(void *vptr)
+{
+	PULSE_DATA(vptr);
+	pulse_app_input_set_visibility(data, &data->showing, 1);
+}
+
+static void pulse_app_input_hide(void *vptr)
+{
+	PULSE_DATA(vptr);
+	pulse_app_input_set_visibility(data, &data->showing, 0);
+}
+
+static void *pulse_app_input_create(obs_data_t *settings, obs_source_t *source)
+{
 	blog(LOG_INFO, "%s", "creating");
 	return pulse_create(settings, source);
 }
 
+/**
+ * Load the opt-in mainloop scheduling config
+ *
+ * Read from realtime.json in the module config directory, e.g.
+ * {"policy": "fifo:10", "cpus": "2-3", "lock_memory": true}. Runs the first
+ * time a source connects or spawns the capture helper, not at module load.
+ */
+static void pulse_load_realtime_config(struct pulse_realtime_config *config)
+{
+	char *path = obs_module_config_path("realtime.json");
+	if (!path)
+		return;
+
+	obs_data_t *settings = os_file_exists(path)
+				       ? obs_data_create_from_json_file(path)
+				       : NULL;
+	if (!settings) {
+		bfree(path);
+		return;
+	}
+
+	const char *policy = obs_data_get_string(settings, "policy");
+	if (*policy && !pulse_realtime_parse_policy(config, policy))
+		blog(LOG_WARNING, "Invalid policy '%s' in '%s'", policy, path);
+
+	const char *cpus = obs_data_get_string(settings, "cpus");
+	if (*cpus && !pulse_realtime_parse_cpus(config, cpus))
+		blog(LOG_WARNING, "Invalid cpu list '%s' in '%s'", cpus, path);
+
+	config->lock_memory = obs_data_get_bool(settings, "lock_memory");
+
+	obs_data_release(settings);
+	bfree(path);
+}
+
 extern "C" void register_source();
 
 void register_source()
 {
+	pulse_realtime_set_loader(pulse_load_realtime_config);
+
 	struct obs_source_info info = {};
 	info.id = "pulse_app_capture";
 	info.type = OBS_SOURCE_TYPE_INPUT;
@@ -722,7 +2320,13 @@ void register_source()
 	info.get_defaults = pulse_app_input_defaults;
 	info.get_properties = pulse_app_input_properties;
 	info.update = pulse_app_input_update;
+	info.save = pulse_app_input_save;
+	info.activate = pulse_app_input_activate;
+	info.deactivate = pulse_app_input_deactivate;
+	info.show = pulse_app_input_show;
+	info.hide = pulse_app_input_hide;
 	info.icon_type = OBS_ICON_TYPE_AUDIO_INPUT;
 
 	obs_register_source(&info);
 }
+
@@ -0,0 +1,1341 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Headless capture tool
+ *
+ * Captures the audio of a single application with the same capture engine
+ * the plugin uses, without starting obs. The audio is written as WAV or raw
+ * interleaved samples and the throughput, delivery latency and holes of the
+ * stream are printed once per second, which makes it easy to reproduce
+ * capture problems and to soak test the capture path on a bare server.
+ *
+ * With -T it measures the end to end latency of the capture path instead,
+ * by playing a test signal into a private null sink and capturing it again,
+ * see pulse-latency.h.
+ *
+ * With -S it soak tests the plugin's churn instead: the client is bound,
+ * captured briefly and released again over and over, the way a source goes
+ * through rebinds, restarts and client list refreshes over days of
+ * streaming, and the tool fails if memory or references grow.
+ *
+ * With -R it replays a journal written by the plugin, see pulse-journal.h.
+ * This needs no server at all.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-wrapper.h"
+#include "pulse-capture.h"
+#include "pulse-journal.h"
+#include "pulse-latency.h"
+#include "pulse-match.h"
+#include "pulse-peak.h"
+#include "pulse-realtime.h"
+#include "pulse-shm-ring.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+/* subscription events within this window are handled by a single rescan */
+#define RESCAN_DELAY_NS (50 * NSEC_PER_MSEC)
+/* the ring between the mainloop and the writer holds this many packets */
+#define RING_PACKETS 64
+/* a gap between packets larger than this is counted as a hole */
+#define HOLE_THRESHOLD_NS (2 * NSEC_PER_MSEC)
+#define WAV_HEADER_SIZE 44
+/* default time each latency measurement runs */
+#define LATENCY_DURATION_NS (5 * NSEC_PER_SEC)
+/* each soak cycle captures this long, the default soak runs 5 minutes */
+#define SOAK_CYCLE_NS (40 * NSEC_PER_MSEC)
+#define SOAK_DURATION_NS (300 * NSEC_PER_SEC)
+/* memory is sampled every this many cycles, the first sample is the
+ * baseline so lazily allocated pools do not count as growth */
+#define SOAK_SAMPLE_CYCLES 100
+/* malloc keeps some freed memory, the rss may grow this much */
+#define SOAK_RSS_SLACK_KIB 2048
+/* each whole sink comparison run lasts this long by default, both modes
+ * run this many times in turns */
+#define SINK_BENCH_DURATION_NS (10 * NSEC_PER_SEC)
+#define SINK_BENCH_ROUNDS 3
+/* skipped at the start of each run, a new stream drops its first audio */
+#define SINK_BENCH_WARMUP_NS (1 * NSEC_PER_SEC)
+/* sink-inputs of the client recorded one by one at most */
+#define SINK_BENCH_STREAMS 32
+
+enum cli_format {
+	CLI_FORMAT_WAV,
+	CLI_FORMAT_RAW,
+};
+
+/**
+ * Statistics of one reporting interval
+ */
+struct cli_stats {
+	uint64_t packets;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t latency_total;
+	uint64_t latency_max;
+	uint64_t holes;
+	uint64_t hole_ns;
+};
+
+struct cli_data {
+	/* options */
+	const char *client;
+	const char *path;
+	enum cli_format format;
+	uint_fast32_t packet_frames;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	uint64_t duration_ns;
+	const char *journal;
+
+	/* binding */
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	struct pulse_capture *capture;
+
+	/* audio handed over from the mainloop thread */
+	struct pulse_shm_ring *ring;
+
+	/* output */
+	FILE *file;
+	enum audio_format audio_format;
+	enum speaker_layout speakers;
+	uint32_t samples_per_sec;
+	uint64_t data_bytes;
+	uint64_t next_ts;
+	uint64_t format_changes;
+
+	struct cli_stats interval;
+	struct cli_stats total;
+};
+
+static volatile sig_atomic_t stop = 0;
+static int wake_fd = -1;
+
+static void cli_log(int lvl, const char *msg, va_list args, void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	if (lvl > LOG_INFO)
+		return;
+
+	vfprintf(stderr, msg, args);
+	fprintf(stderr, "\n");
+}
+
+static void cli_signal(int sig)
+{
+	UNUSED_PARAMETER(sig);
+	stop = 1;
+}
+
+static void cli_wake()
+{
+	uint64_t one = 1;
+	if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to wake main loop: %s",
+		     strerror(errno));
+}
+
+/**
+ * Output callback, runs on the mainloop thread
+ *
+ * Only hands the packet over, the file is written by the main thread so a
+ * slow disk can not stall the stream.
+ */
+static void cli_output(void *param, const struct obs_source_audio *audio)
+{
+	struct cli_data *cli = (struct cli_data *)param;
+
+	pulse_shm_ring_write(cli->ring, audio);
+}
+
+static void cli_events_cb(pa_context *c, pa_subscription_event_type_t t,
+			  uint32_t idx, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(t);
+	UNUSED_PARAMETER(idx);
+	UNUSED_PARAMETER(userdata);
+
+	cli_wake();
+}
+
+static void cli_client_cb(pa_context *c, const pa_client_info *i, int eol,
+			  void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_match *m = (struct pulse_match *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	pulse_match_add_client(m, i->index, i->name);
+}
+
+static void cli_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+			      int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_match *m = (struct pulse_match *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	pulse_match_add_sink_input(m, i->index, i->client, i->sink);
+}
+
+static void cli_capture_params(struct cli_data *cli,
+			       struct pulse_capture_params *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->name = "obs-pulse-capture";
+	params->client = cli->client;
+	params->sink_input_idx = cli->sink_input_idx;
+	params->sink_idx = cli->sink_idx;
+	params->packet_frames = cli->packet_frames;
+	params->max_latency_ns = cli->max_latency_ns;
+	params->catchup = cli->catchup;
+	params->output = cli_output;
+	params->param = cli;
+}
+
+/**
+ * Bind the capture to the current sink-input of the client
+ *
+ * @return false if the server is gone
+ */
+static bool cli_rescan(struct cli_data *cli)
+{
+	uint32_t sink_input_idx = cli->sink_input_idx;
+	uint32_t sink_idx = cli->sink_idx;
+	struct pulse_match m;
+
+	pulse_match_init(&m, cli->client);
+	if (pulse_get_client_info_list(cli_client_cb, &m) < 0)
+		return false;
+	if (m.client_idx != PA_INVALID_INDEX &&
+	    pulse_get_sink_input_info_list(cli_sink_input_cb, &m) < 0)
+		return false;
+
+	cli->client_idx = m.client_idx;
+	cli->sink_input_idx = m.sink_input_idx;
+	cli->sink_idx = m.sink_idx;
+
+	bool change = sink_input_idx != cli->sink_input_idx ||
+		      sink_idx != cli->sink_idx;
+	if (!change && (cli->capture ||
+			cli->sink_input_idx == PA_INVALID_INDEX))
+		return true;
+
+	pulse_capture_stop(cli->capture);
+	cli->capture = NULL;
+	pulse_sink_cache_clear();
+
+	if (cli->sink_input_idx == PA_INVALID_INDEX) {
+		blog(LOG_INFO, "waiting for '%s'", cli->client);
+		return true;
+	}
+
+	struct pulse_capture_params params;
+	cli_capture_params(cli, &params);
+
+	cli->capture = pulse_capture_start(&params);
+	if (!cli->capture)
+		blog(LOG_ERROR, "unable to capture sink-input %" PRIu32,
+		     cli->sink_input_idx);
+
+	return true;
+}
+
+static void cli_put_le(uint8_t *p, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		p[i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * Write the WAV header, again with the final sizes once the data is done
+ */
+static bool cli_write_wav_header(struct cli_data *cli)
+{
+	uint32_t channels = get_audio_channels(cli->speakers);
+	uint32_t sample_bytes =
+		(uint32_t)get_audio_bytes_per_channel(cli->audio_format);
+	uint32_t data_bytes = cli->data_bytes > UINT32_MAX - WAV_HEADER_SIZE
+				      ? UINT32_MAX - WAV_HEADER_SIZE
+				      : (uint32_t)cli->data_bytes;
+	uint8_t h[WAV_HEADER_SIZE];
+
+	memcpy(h, "RIFF", 4);
+	cli_put_le(h + 4, data_bytes + WAV_HEADER_SIZE - 8, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	cli_put_le(h + 16, 16, 4);
+	cli_put_le(h + 20, cli->audio_format == AUDIO_FORMAT_FLOAT ? 3 : 1,
+		   2);
+	cli_put_le(h + 22, channels, 2);
+	cli_put_le(h + 24, cli->samples_per_sec, 4);
+	cli_put_le(h + 28, cli->samples_per_sec * channels * sample_bytes, 4);
+	cli_put_le(h + 32, channels * sample_bytes, 2);
+	cli_put_le(h + 34, sample_bytes * 8, 2);
+	memcpy(h + 36, "data", 4);
+	cli_put_le(h + 40, data_bytes, 4);
+
+	return fseek(cli->file, 0, SEEK_SET) == 0 &&
+	       fwrite(h, sizeof(h), 1, cli->file) == 1;
+}
+
+static bool cli_open_output(struct cli_data *cli,
+			    const struct obs_source_audio *audio)
+{
+	cli->audio_format = audio->format;
+	cli->speakers = audio->speakers;
+	cli->samples_per_sec = audio->samples_per_sec;
+
+	blog(LOG_INFO, "format: %" PRIu32 " Hz, %" PRIu32 " channels, %d bit",
+	     audio->samples_per_sec, get_audio_channels(audio->speakers),
+	     (int)get_audio_bytes_per_channel(audio->format) * 8);
+
+	if (!cli->path)
+		return true;
+
+	if (strcmp(cli->path, "-") == 0) {
+		if (cli->format == CLI_FORMAT_WAV) {
+			blog(LOG_ERROR, "WAV can not be written to stdout");
+			return false;
+		}
+		cli->file = stdout;
+		return true;
+	}
+
+	cli->file = fopen(cli->path, "wb");
+	if (!cli->file) {
+		blog(LOG_ERROR, "unable to open '%s': %s", cli->path,
+		     strerror(errno));
+		return false;
+	}
+
+	if (cli->format == CLI_FORMAT_WAV && !cli_write_wav_header(cli)) {
+		blog(LOG_ERROR, "unable to write '%s'", cli->path);
+		return false;
+	}
+
+	return true;
+}
+
+static void cli_close_output(struct cli_data *cli)
+{
+	if (!cli->file || cli->file == stdout)
+		return;
+
+	if (cli->format == CLI_FORMAT_WAV && !cli_write_wav_header(cli))
+		blog(LOG_ERROR, "unable to finish '%s'", cli->path);
+
+	fclose(cli->file);
+	cli->file = NULL;
+}
+
+/**
+ * Account and write one packet
+ *
+ * @return false if writing the output failed
+ */
+static bool cli_packet(struct cli_data *cli,
+		       const struct obs_source_audio *audio, uint64_t now)
+{
+	if (!cli->samples_per_sec && !cli_open_output(cli, audio))
+		return false;
+
+	// the file can only hold one format, a rebind to a sink with a
+	// different one is skipped
+	if (audio->format != cli->audio_format ||
+	    audio->speakers != cli->speakers ||
+	    audio->samples_per_sec != cli->samples_per_sec) {
+		if (cli->format_changes++ == 0)
+			blog(LOG_WARNING,
+			     "stream format changed, skipping audio");
+		return true;
+	}
+
+	size_t bytes = audio->frames * get_audio_channels(audio->speakers) *
+		       get_audio_bytes_per_channel(audio->format);
+	uint64_t latency = now > audio->timestamp ? now - audio->timestamp : 0;
+	struct cli_stats *s = &cli->interval;
+
+	s->packets++;
+	s->frames += audio->frames;
+	s->bytes += bytes;
+	s->latency_total += latency;
+	if (latency > s->latency_max)
+		s->latency_max = latency;
+
+	if (cli->next_ts &&
+	    audio->timestamp > cli->next_ts + HOLE_THRESHOLD_NS) {
+		s->holes++;
+		s->hole_ns += audio->timestamp - cli->next_ts;
+	}
+	cli->next_ts = audio->timestamp + (uint64_t)audio->frames *
+						  NSEC_PER_SEC /
+						  audio->samples_per_sec;
+
+	if (cli->file) {
+		if (fwrite(audio->data[0], 1, bytes, cli->file) != bytes) {
+			blog(LOG_ERROR, "unable to write output: %s",
+			     strerror(errno));
+			return false;
+		}
+		cli->data_bytes += bytes;
+	}
+
+	return true;
+}
+
+static void cli_stats_add(struct cli_stats *total, const struct cli_stats *s)
+{
+	total->packets += s->packets;
+	total->frames += s->frames;
+	total->bytes += s->bytes;
+	total->latency_total += s->latency_total;
+	if (s->latency_max > total->latency_max)
+		total->latency_max = s->latency_max;
+	total->holes += s->holes;
+	total->hole_ns += s->hole_ns;
+}
+
+static void cli_stats_print(struct cli_data *cli, const char *label,
+			    const struct cli_stats *s, uint64_t elapsed_ns)
+{
+	struct pulse_capture_transport transport = {0};
+	double secs = (double)elapsed_ns / NSEC_PER_SEC;
+	if (secs <= 0.0)
+		secs = 1.0;
+
+	pulse_detect_transport();
+	if (cli->sink_input_idx != PA_INVALID_INDEX)
+		pulse_capture_get_transport(cli->sink_input_idx, &transport);
+
+	fprintf(stderr,
+		"%s: %.0f frames/s, %.1f KiB/s, latency avg %.2f ms max "
+		"%.2f ms, %" PRIu64 " holes (%.2f ms), %" PRIu64
+		" dropped, %s (%.1f KiB/s copied)\n",
+		label, (double)s->frames / secs, (double)s->bytes / secs / 1024,
+		s->packets ? (double)s->latency_total / s->packets /
+				     NSEC_PER_MSEC
+			   : 0.0,
+		(double)s->latency_max / NSEC_PER_MSEC, s->holes,
+		(double)s->hole_ns / NSEC_PER_MSEC,
+		pulse_shm_ring_dropped(cli->ring),
+		pulse_transport_name(transport.transport),
+		(double)transport.copy_rate / 1024);
+}
+
+static void cli_client_list_cb(pa_context *c, const pa_client_info *i,
+			       int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(userdata);
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	printf("%s\n", i->name);
+}
+
+/* formats and ceilings the latency measurement goes through */
+static const pa_sample_format_t latency_formats[] = {
+	PA_SAMPLE_S16LE,
+	PA_SAMPLE_S32LE,
+	PA_SAMPLE_FLOAT32LE,
+};
+static const uint64_t latency_ceilings_ms[] = {0, 50, 200};
+
+/**
+ * Measure the loopback latency for every format and ceiling
+ *
+ * One line per measurement is printed to stdout, tab separated so the
+ * numbers can be collected and compared over time.
+ *
+ * @return false if any of the measurements failed
+ */
+static bool cli_measure_latency(struct cli_data *cli, bool ceiling_set)
+{
+	size_t ceilings = ceiling_set ? 1
+				      : sizeof(latency_ceilings_ms) /
+						sizeof(latency_ceilings_ms[0]);
+	bool ok = true;
+
+	printf("format\tceiling_ms\tpacket_frames\tbursts\tdetected\t"
+	       "exact\tlatency_ms\tlatency_max_ms\tjitter_ms\t"
+	       "ts_error_ms\tts_jitter_ms\tpaired\toffset_ms\t"
+	       "offset_jitter_ms\toffset_max_ms\n");
+
+	for (size_t f = 0;
+	     f < sizeof(latency_formats) / sizeof(latency_formats[0]); f++) {
+		for (size_t c = 0; c < ceilings; c++) {
+			struct pulse_latency_params params;
+			struct pulse_latency_result r;
+
+			params.format = latency_formats[f];
+			params.packet_frames = cli->packet_frames;
+			params.max_latency_ns =
+				ceiling_set ? cli->max_latency_ns
+					    : latency_ceilings_ms[c] *
+						      NSEC_PER_MSEC;
+			params.catchup = cli->catchup;
+			params.duration_ns = cli->duration_ns
+						     ? cli->duration_ns
+						     : LATENCY_DURATION_NS;
+
+			if (!pulse_latency_measure(&params, &r))
+				ok = false;
+
+			printf("%s\t%" PRIu64 "\t%" PRIuFAST32
+			       "\t%" PRIuFAST32 "\t%" PRIuFAST32
+			       "\t%" PRIuFAST32
+			       "\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%" PRIuFAST32
+			       "\t%.3f\t%.3f\t%.3f\n",
+			       pa_sample_format_to_string(params.format),
+			       params.max_latency_ns / NSEC_PER_MSEC,
+			       params.packet_frames, r.bursts, r.detected,
+			       r.exact, r.latency_ns / NSEC_PER_MSEC,
+			       r.latency_max_ns / NSEC_PER_MSEC,
+			       r.jitter_ns / NSEC_PER_MSEC,
+			       r.ts_error_ns / NSEC_PER_MSEC,
+			       r.ts_jitter_ns / NSEC_PER_MSEC, r.paired,
+			       r.offset_ns / NSEC_PER_MSEC,
+			       r.offset_jitter_ns / NSEC_PER_MSEC,
+			       r.offset_max_ns / NSEC_PER_MSEC);
+			fflush(stdout);
+		}
+	}
+
+	return ok;
+}
+
+/**
+ * Resident set size of the process in KiB
+ */
+static uint64_t cli_rss_kib()
+{
+	unsigned long long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f) {
+		if (fscanf(f, "%*u %llu", &pages) != 1)
+			pages = 0;
+		fclose(f);
+	}
+
+	return pages * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/**
+ * One soak cycle: bind like a new source, capture briefly and release
+ *
+ * The subscription, the sink cache and the peak streams of the client list
+ * go through the same churn as the capture itself.
+ *
+ * @return false if the server is gone
+ */
+static bool cli_soak_cycle(struct cli_data *cli)
+{
+	struct pulse_peak_client *clients;
+	size_t count = pulse_peak_scan(&clients, SOAK_CYCLE_NS / 4);
+	pulse_peak_free(clients, count);
+
+	pulse_subscribe_events(cli_events_cb, NULL);
+
+	bool ok = cli_rescan(cli);
+
+	uint64_t deadline = os_gettime_ns() + SOAK_CYCLE_NS;
+	while (ok && !stop && os_gettime_ns() < deadline) {
+		struct obs_source_audio audio;
+		os_sleep_ms(5);
+		pulse_shm_ring_clear_event(cli->ring);
+		while (pulse_shm_ring_read(cli->ring, &audio)) {
+			cli->total.packets++;
+			cli->total.frames += audio.frames;
+			pulse_shm_ring_consume(cli->ring);
+		}
+	}
+
+	uint64_t value;
+	if (read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to reset wake up: %s",
+		     strerror(errno));
+
+	pulse_capture_stop(cli->capture);
+	cli->capture = NULL;
+	cli->sink_input_idx = PA_INVALID_INDEX;
+	cli->sink_idx = PA_INVALID_INDEX;
+	pulse_unsubscribe_events(cli_events_cb, NULL);
+	pulse_sink_cache_clear();
+
+	return ok;
+}
+
+/**
+ * Repeat soak cycles and watch for growth
+ *
+ * Prints one tab separated line per sample. Between cycles nothing may be
+ * left over, so any growth of the bmem allocations or held references over
+ * the baseline is a leak; the rss gets some slack for the allocator.
+ *
+ * @return false if anything grew or the server went away
+ */
+static bool cli_soak(struct cli_data *cli)
+{
+	uint64_t duration = cli->duration_ns ? cli->duration_ns
+					     : SOAK_DURATION_NS;
+	uint64_t start = os_gettime_ns();
+	long base_allocs = 0;
+	uint64_t base_rss = 0;
+	bool ok = true;
+	bool grew = false;
+
+	printf("cycle\telapsed_s\tframes\tallocs\trss_kib\tstreams\t"
+	       "operations\n");
+
+	for (uint64_t cycle = 1; ok && !stop; cycle++) {
+		ok = cli_soak_cycle(cli);
+
+		bool done = os_gettime_ns() - start >= duration;
+		if (cycle % SOAK_SAMPLE_CYCLES != 0 && !done)
+			continue;
+
+		struct pulse_ref_stats refs;
+		pulse_get_ref_stats(&refs);
+		long allocs = bnum_allocs();
+		uint64_t rss = cli_rss_kib();
+
+		printf("%" PRIu64 "\t%.1f\t%" PRIu64 "\t%ld\t%" PRIu64
+		       "\t%" PRId64 "\t%" PRId64 "\n",
+		       cycle, (double)(os_gettime_ns() - start) / NSEC_PER_SEC,
+		       cli->total.frames, allocs, rss, refs.streams,
+		       refs.operations);
+		fflush(stdout);
+
+		if (cycle <= SOAK_SAMPLE_CYCLES) {
+			base_allocs = allocs;
+			base_rss = rss;
+		} else if (allocs > base_allocs ||
+			   rss > base_rss + SOAK_RSS_SLACK_KIB) {
+			grew = true;
+		}
+		if (refs.streams || refs.operations)
+			grew = true;
+
+		if (done)
+			break;
+	}
+
+	if (grew)
+		blog(LOG_ERROR, "memory or references grew during the soak");
+	return ok && !grew;
+}
+
+/**
+ * CPU time of a process and context switches of all of its threads
+ */
+struct cli_cpu {
+	uint64_t cpu_ns;
+	uint64_t switches;
+};
+
+/**
+ * Cost of one comparison run, per second of capture
+ */
+struct cli_sink_bench {
+	double reads;
+	double cpu_ms;
+	double switches;
+	double server_cpu_ms;
+	double server_switches;
+};
+
+/**
+ * Pid of a local pulseaudio server from the pid file it writes
+ *
+ * @return 0 if unknown, e.g. with pipewire or a remote server
+ */
+static pid_t cli_server_pid()
+{
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	char path[512];
+	long pid = 0;
+
+	if (!runtime)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/pulse/pid", runtime);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%ld", &pid) != 1)
+		pid = 0;
+	fclose(f);
+
+	return (pid_t)pid;
+}
+
+/**
+ * Sample the cpu time and context switches of a process
+ *
+ * Every voluntary switch is a thread going to sleep, so together with the
+ * involuntary ones they count how often the process was woken up.
+ *
+ * @return false if the process can not be read
+ */
+static bool cli_cpu_sample(pid_t pid, struct cli_cpu *cpu)
+{
+	char path[64];
+	char buf[1024];
+	unsigned long long utime, stime;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = 0;
+
+	// the command name may contain anything, the fields start after it
+	char *fields = strrchr(buf, ')');
+	if (!fields || sscanf(fields + 1,
+			      " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+			      "%llu %llu",
+			      &utime, &stime) != 2)
+		return false;
+	cpu->cpu_ns = (uint64_t)(utime + stime) * NSEC_PER_SEC /
+		      (uint64_t)sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+	DIR *dir = opendir(path);
+	if (!dir)
+		return false;
+
+	cpu->switches = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char status[320];
+
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(status, sizeof(status), "%s/%s/status", path,
+			 entry->d_name);
+		f = fopen(status, "r");
+		// the thread exited meanwhile
+		if (!f)
+			continue;
+
+		while (fgets(buf, sizeof(buf), f)) {
+			unsigned long long n;
+			if (sscanf(buf, "voluntary_ctxt_switches: %llu", &n) ==
+				    1 ||
+			    sscanf(buf, "nonvoluntary_ctxt_switches: %llu",
+				   &n) == 1)
+				cpu->switches += n;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return true;
+}
+
+/**
+ * Consume the captured audio for a while, waking up only for packets
+ */
+static void cli_drain(struct cli_data *cli, uint64_t duration_ns)
+{
+	uint64_t deadline = os_gettime_ns() + duration_ns;
+	uint64_t now;
+
+	while (!stop && (now = os_gettime_ns()) < deadline) {
+		struct pollfd fd;
+		fd.fd = pulse_shm_ring_eventfd(cli->ring);
+		fd.events = POLLIN;
+
+		int timeout = (int)((deadline - now) / NSEC_PER_MSEC) + 1;
+		if (poll(&fd, 1, timeout) < 0 && errno != EINTR)
+			break;
+
+		struct obs_source_audio audio;
+		pulse_shm_ring_clear_event(cli->ring);
+		while (pulse_shm_ring_read(cli->ring, &audio)) {
+			cli->total.packets++;
+			cli->total.frames += audio.frames;
+			pulse_shm_ring_consume(cli->ring);
+		}
+	}
+}
+
+/**
+ * Sink-inputs on the sink of the client, see cli_sink_inputs_cb()
+ */
+struct cli_sink_inputs {
+	uint32_t client_idx;
+	uint32_t sink_idx;
+	uint32_t idx[SINK_BENCH_STREAMS];
+	size_t count;
+	size_t foreign;
+};
+
+static void cli_sink_inputs_cb(pa_context *c, const pa_sink_input_info *i,
+			       int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct cli_sink_inputs *inputs = (struct cli_sink_inputs *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	if (i->sink != inputs->sink_idx)
+		return;
+
+	if (!pulse_match_sink_input(inputs->client_idx, i->client))
+		inputs->foreign++;
+	else if (inputs->count < SINK_BENCH_STREAMS)
+		inputs->idx[inputs->count++] = i->index;
+}
+
+/**
+ * Capture the client in one mode and measure the cost
+ *
+ * Without whole_sink every sink-input of the client on the sink gets its
+ * own monitor stream, the way separate sources would record them, with it
+ * a single plain monitor of the sink records them all.
+ *
+ * @return false if the client could not be captured
+ */
+static bool cli_sink_bench_run(struct cli_data *cli, bool whole_sink,
+			       const struct cli_sink_inputs *inputs,
+			       pid_t server, uint64_t duration_ns,
+			       struct cli_sink_bench *b)
+{
+	struct pulse_capture *captures[SINK_BENCH_STREAMS];
+	size_t count = whole_sink ? 1 : inputs->count;
+	struct cli_cpu self_start, self_end;
+	struct cli_cpu server_start = {0}, server_end = {0};
+	uint64_t reads_start = 0, reads_end = 0;
+	bool ok = true;
+
+	memset(captures, 0, sizeof(captures));
+	for (size_t i = 0; ok && i < count; i++) {
+		struct pulse_capture_params params;
+		cli_capture_params(cli, &params);
+		params.sink_input_idx = inputs->idx[i];
+		params.sink_idx = inputs->sink_idx;
+		params.whole_sink = whole_sink;
+
+		captures[i] = pulse_capture_start(&params);
+		if (!captures[i]) {
+			blog(LOG_ERROR, "unable to capture sink-input %" PRIu32,
+			     inputs->idx[i]);
+			ok = false;
+		}
+	}
+
+	if (ok)
+		cli_drain(cli, SINK_BENCH_WARMUP_NS);
+
+	for (size_t i = 0; ok && i < count; i++) {
+		struct pulse_capture_health health;
+		pulse_capture_get_health(captures[i], &health);
+		reads_start += health.reads;
+	}
+	bool server_ok = ok && server && cli_cpu_sample(server, &server_start);
+	ok = ok && cli_cpu_sample(getpid(), &self_start);
+	uint64_t start_ns = os_gettime_ns();
+
+	if (ok)
+		cli_drain(cli, duration_ns);
+
+	for (size_t i = 0; ok && i < count; i++) {
+		struct pulse_capture_health health;
+		pulse_capture_get_health(captures[i], &health);
+		reads_end += health.reads;
+	}
+	server_ok = server_ok && cli_cpu_sample(server, &server_end);
+	ok = ok && cli_cpu_sample(getpid(), &self_end);
+	double secs = (double)(os_gettime_ns() - start_ns) / NSEC_PER_SEC;
+
+	for (size_t i = 0; i < count; i++)
+		pulse_capture_stop(captures[i]);
+	pulse_sink_cache_clear();
+	if (!ok)
+		return false;
+
+	memset(b, 0, sizeof(*b));
+	b->reads = (double)(reads_end - reads_start) / secs;
+	b->cpu_ms = (double)(self_end.cpu_ns - self_start.cpu_ns) /
+		    NSEC_PER_MSEC / secs;
+	b->switches = (double)(self_end.switches - self_start.switches) / secs;
+	if (server_ok) {
+		b->server_cpu_ms =
+			(double)(server_end.cpu_ns - server_start.cpu_ns) /
+			NSEC_PER_MSEC / secs;
+		b->server_switches =
+			(double)(server_end.switches - server_start.switches) /
+			secs;
+	}
+
+	return true;
+}
+
+static double cli_change(double before, double after)
+{
+	return before > 0.0 ? (after - before) * 100.0 / before : 0.0;
+}
+
+/**
+ * Compare recording the sink-inputs one by one with recording the whole sink
+ *
+ * The modes take turns so drift in the load of the system hits both. Prints
+ * one tab separated line per run and the change of the averages to stderr.
+ *
+ * @return false if the client could not be captured
+ */
+static bool cli_sink_bench(struct cli_data *cli)
+{
+	uint64_t duration = cli->duration_ns ? cli->duration_ns
+					     : SINK_BENCH_DURATION_NS;
+	struct cli_sink_bench sum[2];
+	struct cli_sink_inputs inputs;
+	int runs = 0;
+	bool ok = true;
+
+	// only to find the client and its sink
+	if (!cli_rescan(cli))
+		return false;
+	pulse_capture_stop(cli->capture);
+	cli->capture = NULL;
+	if (cli->sink_input_idx == PA_INVALID_INDEX) {
+		blog(LOG_ERROR, "'%s' is not playing", cli->client);
+		return false;
+	}
+
+	memset(&inputs, 0, sizeof(inputs));
+	inputs.client_idx = cli->client_idx;
+	inputs.sink_idx = cli->sink_idx;
+	if (pulse_get_sink_input_info_list(cli_sink_inputs_cb, &inputs) < 0 ||
+	    !inputs.count)
+		return false;
+	if (inputs.foreign)
+		blog(LOG_WARNING,
+		     "%zu sink-inputs of other clients play on the same "
+		     "sink, the whole sink runs record them too",
+		     inputs.foreign);
+	blog(LOG_INFO, "'%s' plays %zu sink-inputs on sink %" PRIu32,
+	     cli->client, inputs.count, inputs.sink_idx);
+
+	pid_t server = cli_server_pid();
+	if (!server)
+		blog(LOG_WARNING, "no pid file of a local pulseaudio server, "
+				  "only measuring this process");
+
+	memset(sum, 0, sizeof(sum));
+	printf("mode\tstreams\treads_per_s\tcpu_ms_per_s\tswitches_per_s\t"
+	       "server_cpu_ms_per_s\tserver_switches_per_s\n");
+
+	for (int round = 0; ok && !stop && round < SINK_BENCH_ROUNDS;
+	     round++) {
+		for (int whole = 0; ok && !stop && whole < 2; whole++) {
+			struct cli_sink_bench b;
+			ok = cli_sink_bench_run(cli, whole, &inputs, server,
+						duration, &b);
+			if (!ok)
+				break;
+			runs++;
+
+			printf("%s\t%zu\t%.1f\t%.2f\t%.1f\t%.2f\t%.1f\n",
+			       whole ? "sink" : "sink-inputs",
+			       whole ? (size_t)1 : inputs.count, b.reads,
+			       b.cpu_ms, b.switches, b.server_cpu_ms,
+			       b.server_switches);
+			fflush(stdout);
+
+			sum[whole].reads += b.reads;
+			sum[whole].cpu_ms += b.cpu_ms;
+			sum[whole].switches += b.switches;
+			sum[whole].server_cpu_ms += b.server_cpu_ms;
+			sum[whole].server_switches += b.server_switches;
+		}
+	}
+
+	if (ok && runs == 2 * SINK_BENCH_ROUNDS)
+		fprintf(stderr,
+			"whole sink against %zu sink-input streams: read "
+			"callbacks %+.1f%%, cpu %+.1f%%, context switches "
+			"%+.1f%%, server cpu %+.1f%%, server context "
+			"switches %+.1f%%\n",
+			inputs.count, cli_change(sum[0].reads, sum[1].reads),
+			cli_change(sum[0].cpu_ms, sum[1].cpu_ms),
+			cli_change(sum[0].switches, sum[1].switches),
+			cli_change(sum[0].server_cpu_ms, sum[1].server_cpu_ms),
+			cli_change(sum[0].server_switches,
+				   sum[1].server_switches));
+
+	return ok;
+}
+
+/**
+ * Replay a journal and summarize it
+ *
+ * @return false if the journal could not be read or had mismatches
+ */
+static bool cli_replay(struct cli_data *cli)
+{
+	struct pulse_journal_replay r;
+
+	if (!pulse_journal_replay(cli->journal, stdout, &r))
+		return false;
+
+	fprintf(stderr,
+		"%" PRIu64 " records over %.3f s replayed in %.3f ms, "
+		"%" PRIu64 " bindings, %" PRIu64 " checked, %" PRIu64
+		" mismatches, %" PRIu64 " ignored changes\n",
+		r.records, (double)r.span_ns / NSEC_PER_SEC,
+		(double)r.replay_ns / NSEC_PER_MSEC, r.bindings, r.checked,
+		r.mismatches, r.ignored);
+
+	return r.mismatches == 0;
+}
+
+static void cli_usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] <client>\n"
+		"       %s -L\n"
+		"       %s -T [-d <secs>] [-p <frames>] [-l <ms>]\n"
+		"       %s -S [-d <secs>] <client>\n"
+		"       %s -W [-d <secs>] <client>\n"
+		"       %s -R <journal>\n"
+		"\n"
+		"  -o <file>    write the audio to file, - for stdout\n"
+		"  -f wav|raw   output format, defaults to wav\n"
+		"  -d <secs>    stop after this many seconds\n"
+		"  -p <frames>  frames per packet, defaults to %d\n"
+		"  -l <ms>      latency ceiling, defaults to none\n"
+		"  -c skip|compress|newest\n"
+		"               catch up strategy for the ceiling\n"
+		"  -r other|fifo:<prio>|rr:<prio>\n"
+		"               scheduling of the mainloop thread\n"
+		"  -a <cpus>    pin the mainloop thread, e.g. 2,4-5\n"
+		"  -m           lock the audio buffers into memory\n"
+		"  -L           list the clients and exit\n"
+		"  -T           measure the capture latency through a null\n"
+		"               sink for every format, -d per measurement\n"
+		"  -S           rebind and release the client over and over\n"
+		"               for -d, failing if memory or references grow\n"
+		"  -W           compare the cost of recording the client's\n"
+		"               sink-inputs one by one and its whole sink,\n"
+		"               -d per run\n"
+		"  -R <journal> check the binding decisions of a journal\n",
+		name, name, name, name, name, name, AUDIO_OUTPUT_FRAMES);
+}
+
+static bool cli_parse(struct cli_data *cli, int argc, char *argv[],
+		      bool *list, bool *latency, bool *soak,
+		      bool *sink_bench, bool *ceiling_set)
+{
+	struct pulse_realtime_config realtime;
+	int opt;
+
+	pulse_realtime_get(&realtime);
+
+	while ((opt = getopt(argc, argv, "o:f:d:p:l:c:r:a:mLTSWR:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			cli->path = optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "wav") == 0)
+				cli->format = CLI_FORMAT_WAV;
+			else if (strcmp(optarg, "raw") == 0)
+				cli->format = CLI_FORMAT_RAW;
+			else
+				return false;
+			break;
+		case 'd':
+			cli->duration_ns = (uint64_t)(strtod(optarg, NULL) *
+						      NSEC_PER_SEC);
+			break;
+		case 'p':
+			cli->packet_frames = strtoul(optarg, NULL, 10);
+			if (cli->packet_frames < 64 ||
+			    cli->packet_frames > 8192)
+				return false;
+			break;
+		case 'l':
+			cli->max_latency_ns =
+				strtoull(optarg, NULL, 10) * NSEC_PER_MSEC;
+			*ceiling_set = true;
+			break;
+		case 'c':
+			if (strcmp(optarg, "skip") == 0)
+				cli->catchup = PULSE_CATCHUP_SKIP;
+			else if (strcmp(optarg, "compress") == 0)
+				cli->catchup = PULSE_CATCHUP_COMPRESS;
+			else if (strcmp(optarg, "newest") == 0)
+				cli->catchup = PULSE_CATCHUP_NEWEST;
+			else
+				return false;
+			break;
+		case 'r':
+			if (!pulse_realtime_parse_policy(&realtime, optarg))
+				return false;
+			break;
+		case 'a':
+			if (!pulse_realtime_parse_cpus(&realtime, optarg))
+				return false;
+			break;
+		case 'm':
+			realtime.lock_memory = true;
+			break;
+		case 'L':
+			*list = true;
+			break;
+		case 'T':
+			*latency = true;
+			break;
+		case 'S':
+			*soak = true;
+			break;
+		case 'W':
+			*sink_bench = true;
+			break;
+		case 'R':
+			cli->journal = optarg;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	pulse_realtime_configure(&realtime);
+
+	if (cli->journal)
+		return optind == argc && !*list && !*latency && !*soak &&
+		       !*sink_bench;
+	if (*list || *latency)
+		return optind == argc && !(*list && *latency);
+	if (optind != argc - 1 || ((*soak || *sink_bench) && cli->path) ||
+	    (*soak && *sink_bench))
+		return false;
+
+	cli->client = argv[optind];
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cli_data cli;
+	bool list = false;
+	bool latency = false;
+	bool soak = false;
+	bool sink_bench = false;
+	bool ceiling_set = false;
+	int ret = 0;
+
+	memset(&cli, 0, sizeof(cli));
+	cli.format = CLI_FORMAT_WAV;
+	cli.packet_frames = AUDIO_OUTPUT_FRAMES;
+	cli.catchup = PULSE_CATCHUP_SKIP;
+	cli.client_idx = PA_INVALID_INDEX;
+	cli.sink_input_idx = PA_INVALID_INDEX;
+	cli.sink_idx = PA_INVALID_INDEX;
+
+	if (!cli_parse(&cli, argc, argv, &list, &latency, &soak, &sink_bench,
+		       &ceiling_set)) {
+		cli_usage(argv[0]);
+		return 2;
+	}
+
+	base_set_log_handler(cli_log, NULL);
+
+	if (cli.journal)
+		return cli_replay(&cli) ? 0 : 1;
+
+	if (pulse_init() < 0)
+		return 1;
+
+	if (list) {
+		if (pulse_get_client_info_list(cli_client_list_cb, NULL) < 0)
+			ret = 1;
+		pulse_unref();
+		return ret;
+	}
+
+	if (latency) {
+		if (!cli_measure_latency(&cli, ceiling_set))
+			ret = 1;
+		pulse_unref();
+		return ret;
+	}
+
+	// room for the largest packets obs accepts
+	size_t packet_bytes =
+		cli.packet_frames * MAX_AUDIO_CHANNELS * sizeof(float) + 64;
+	cli.ring = pulse_shm_ring_create(packet_bytes * RING_PACKETS);
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (!cli.ring || wake_fd < 0) {
+		blog(LOG_ERROR, "Unable to create the audio ring");
+		pulse_shm_ring_destroy(cli.ring);
+		if (wake_fd >= 0)
+			close(wake_fd);
+		pulse_unref();
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cli_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (soak || sink_bench) {
+		if (!(soak ? cli_soak(&cli) : cli_sink_bench(&cli)))
+			ret = 1;
+		pulse_unref();
+		pulse_shm_ring_destroy(cli.ring);
+		close(wake_fd);
+		return ret;
+	}
+
+	pulse_subscribe_events(cli_events_cb, NULL);
+
+	uint64_t start = os_gettime_ns();
+	uint64_t report_ns = start + NSEC_PER_SEC;
+	uint64_t interval_start = start;
+	uint64_t rescan_ns = start;
+
+	while (!stop) {
+		uint64_t now = os_gettime_ns();
+
+		if (cli.duration_ns && now - start >= cli.duration_ns)
+			break;
+
+		if (now >= rescan_ns) {
+			if (!cli_rescan(&cli)) {
+				blog(LOG_ERROR,
+				     "lost connection to the server");
+				ret = 1;
+				break;
+			}
+			rescan_ns = UINT64_MAX;
+		}
+
+		if (now >= report_ns) {
+			cli_stats_print(&cli, "capture", &cli.interval,
+					now - interval_start);
+			cli_stats_add(&cli.total, &cli.interval);
+			memset(&cli.interval, 0, sizeof(cli.interval));
+			interval_start = now;
+			report_ns = now + NSEC_PER_SEC;
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = pulse_shm_ring_eventfd(cli.ring);
+		fds[0].events = POLLIN;
+		fds[1].fd = wake_fd;
+		fds[1].events = POLLIN;
+
+		uint64_t deadline = report_ns < rescan_ns ? report_ns
+							  : rescan_ns;
+		if (cli.duration_ns && start + cli.duration_ns < deadline)
+			deadline = start + cli.duration_ns;
+		int timeout = 0;
+		if (deadline > now)
+			timeout = (int)((deadline - now) / NSEC_PER_MSEC) + 1;
+
+		if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+			blog(LOG_ERROR, "poll failed: %s", strerror(errno));
+			ret = 1;
+			break;
+		}
+
+		if (fds[1].revents) {
+			uint64_t value;
+			if (read(wake_fd, &value, sizeof(value)) > 0 &&
+			    rescan_ns == UINT64_MAX)
+				rescan_ns = os_gettime_ns() + RESCAN_DELAY_NS;
+		}
+
+		pulse_shm_ring_clear_event(cli.ring);
+
+		struct obs_source_audio audio;
+		bool ok = true;
+		while (ok && pulse_shm_ring_read(cli.ring, &audio)) {
+			ok = cli_packet(&cli, &audio, os_gettime_ns());
+			pulse_shm_ring_consume(cli.ring);
+		}
+		if (!ok) {
+			ret = 1;
+			break;
+		}
+	}
+
+	pulse_capture_stop(cli.capture);
+	pulse_unsubscribe_events(cli_events_cb, NULL);
+	pulse_sink_cache_clear();
+	pulse_unref();
+
+	cli_stats_add(&cli.total, &cli.interval);
+	cli_stats_print(&cli, "total", &cli.total, os_gettime_ns() - start);
+	if (cli.format_changes)
+		fprintf(stderr, "%" PRIu64 " packets skipped after a format "
+				"change\n",
+			cli.format_changes);
+
+	cli_close_output(&cli);
+	pulse_shm_ring_destroy(cli.ring);
+	close(wake_fd);
+
+	return ret;
+}
@@ -0,0 +1,424 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Out of process capture helper
+ *
+ * Owns the pulseaudio connection and all capture streams of the sources
+ * running in helper mode and passes the audio to the plugin through shared
+ * memory rings. A stalled sound server can only ever stall this process, the
+ * plugin restarts it when it goes away.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-wrapper.h"
+#include "pulse-capture.h"
+#include "pulse-helper-protocol.h"
+#include "pulse-match.h"
+#include "pulse-realtime.h"
+#include "pulse-shm-ring.h"
+
+#define NSEC_PER_MSEC 1000000L
+
+/* subscription events within this window are handled by a single rescan */
+#define RESCAN_DELAY_NS (50 * NSEC_PER_MSEC)
+/* rescan periodically as well, this also notices a lost server */
+#define RESCAN_INTERVAL_NS (5000 * NSEC_PER_MSEC)
+/* the ring holds at least this many packets */
+#define RING_PACKETS 16
+
+struct helper_capture {
+	uint32_t id;
+	char *client;
+	uint_fast32_t packet_frames;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	struct pulse_shm_ring *ring;
+	struct pulse_capture *capture;
+
+	/* current binding */
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+
+	/* binding found by the running rescan */
+	struct pulse_match scan;
+
+	struct helper_capture *next;
+};
+
+static struct helper_capture *captures = NULL;
+static int wake_fd = -1;
+
+static void helper_log(int lvl, const char *msg, va_list args, void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	if (lvl > LOG_INFO)
+		return;
+
+	fprintf(stderr, "capture-helper: ");
+	vfprintf(stderr, msg, args);
+	fprintf(stderr, "\n");
+}
+
+/**
+ * Output callback of all captures, runs on the mainloop thread
+ */
+static void helper_output(void *param, const struct obs_source_audio *audio)
+{
+	struct helper_capture *hc = (struct helper_capture *)param;
+
+	pulse_shm_ring_write(hc->ring, audio);
+}
+
+/**
+ * Subscription callback, wakes up the main loop for a rescan
+ */
+static void helper_events_cb(pa_context *c, pa_subscription_event_type_t t,
+			     uint32_t idx, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(t);
+	UNUSED_PARAMETER(idx);
+	UNUSED_PARAMETER(userdata);
+
+	uint64_t one = 1;
+	if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to wake main loop: %s",
+		     strerror(errno));
+}
+
+static void helper_client_cb(pa_context *c, const pa_client_info *i, int eol,
+			     void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(userdata);
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	for (struct helper_capture *hc = captures; hc; hc = hc->next)
+		pulse_match_add_client(&hc->scan, i->index, i->name);
+}
+
+static void helper_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+				 int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(userdata);
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	for (struct helper_capture *hc = captures; hc; hc = hc->next)
+		pulse_match_add_sink_input(&hc->scan, i->index, i->client,
+					   i->sink);
+}
+
+/**
+ * Publish the binding of a capture to the plugin
+ */
+static void helper_publish(struct helper_capture *hc)
+{
+	struct pulse_shm_ring_state state;
+
+	if (hc->capture)
+		state.status = PULSE_SHM_RING_BOUND;
+	else if (hc->sink_input_idx != PA_INVALID_INDEX)
+		state.status = PULSE_SHM_RING_FAILED;
+	else
+		state.status = PULSE_SHM_RING_WAITING;
+
+	state.client_idx = hc->client_idx;
+	state.sink_input_idx = hc->sink_input_idx;
+	state.sink_idx = hc->sink_idx;
+
+	pulse_shm_ring_set_state(hc->ring, &state);
+}
+
+/**
+ * Bind all captures with one client and one sink-input query
+ *
+ * @return false if the server is gone
+ */
+static bool helper_rescan()
+{
+	for (struct helper_capture *hc = captures; hc; hc = hc->next)
+		pulse_match_init(&hc->scan, hc->client);
+
+	if (pulse_get_client_info_list(helper_client_cb, NULL) < 0 ||
+	    pulse_get_sink_input_info_list(helper_sink_input_cb, NULL) < 0)
+		return false;
+
+	// sinks may have changed, the cache is filled again on demand
+	pulse_sink_cache_clear();
+
+	for (struct helper_capture *hc = captures; hc; hc = hc->next) {
+		bool retry = hc->scan.sink_input_idx != PA_INVALID_INDEX &&
+			     !hc->capture;
+		bool change = hc->scan.client_idx != hc->client_idx ||
+			      hc->scan.sink_input_idx != hc->sink_input_idx ||
+			      hc->scan.sink_idx != hc->sink_idx;
+
+		if (!retry && !change)
+			continue;
+
+		pulse_capture_stop(hc->capture);
+		hc->capture = NULL;
+
+		hc->client_idx = hc->scan.client_idx;
+		hc->sink_input_idx = hc->scan.sink_input_idx;
+		hc->sink_idx = hc->scan.sink_idx;
+
+		if (hc->sink_input_idx != PA_INVALID_INDEX) {
+			struct pulse_capture_params params;
+			memset(&params, 0, sizeof(params));
+			params.name = hc->client;
+			params.client = hc->client;
+			params.sink_input_idx = hc->sink_input_idx;
+			params.sink_idx = hc->sink_idx;
+			params.packet_frames = hc->packet_frames;
+			params.max_latency_ns = hc->max_latency_ns;
+			params.catchup = hc->catchup;
+			params.output = helper_output;
+			params.param = hc;
+
+			hc->capture = pulse_capture_start(&params);
+		}
+
+		helper_publish(hc);
+	}
+
+	return true;
+}
+
+static void helper_start(int sock, const struct pulse_helper_msg *msg)
+{
+	uint_fast32_t packet_frames = msg->packet_frames;
+	if (!packet_frames || packet_frames > 8192)
+		packet_frames = AUDIO_OUTPUT_FRAMES;
+
+	// room for the largest packets obs accepts
+	size_t packet_bytes =
+		packet_frames * MAX_AUDIO_CHANNELS * sizeof(float) + 64;
+	struct pulse_shm_ring *ring =
+		pulse_shm_ring_create(packet_bytes * RING_PACKETS);
+	if (!ring)
+		return;
+
+	int fds[2] = {pulse_shm_ring_memfd(ring), pulse_shm_ring_eventfd(ring)};
+	struct pulse_helper_msg reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.type = PULSE_HELPER_RING;
+	reply.id = msg->id;
+	if (!pulse_helper_send(sock, &reply, fds, 2)) {
+		pulse_shm_ring_destroy(ring);
+		return;
+	}
+
+	struct helper_capture *hc =
+		(struct helper_capture *)bzalloc(sizeof(struct helper_capture));
+	hc->id = msg->id;
+	hc->client = bstrdup(msg->client);
+	hc->packet_frames = packet_frames;
+	hc->max_latency_ns = (uint64_t)msg->max_latency_ms * NSEC_PER_MSEC;
+	hc->catchup = msg->catchup <= PULSE_CATCHUP_NEWEST
+			      ? (enum pulse_catchup)msg->catchup
+			      : PULSE_CATCHUP_SKIP;
+	hc->ring = ring;
+	hc->client_idx = PA_INVALID_INDEX;
+	hc->sink_input_idx = PA_INVALID_INDEX;
+	hc->sink_idx = PA_INVALID_INDEX;
+	hc->next = captures;
+	captures = hc;
+
+	helper_publish(hc);
+	blog(LOG_INFO, "capturing '%s' for source %" PRIu32, hc->client,
+	     hc->id);
+}
+
+static void helper_free(struct helper_capture *hc)
+{
+	pulse_capture_stop(hc->capture);
+	pulse_shm_ring_destroy(hc->ring);
+	bfree(hc->client);
+	bfree(hc);
+}
+
+static void helper_stop(uint32_t id)
+{
+	struct helper_capture **pos = &captures;
+	while (*pos && (*pos)->id != id)
+		pos = &(*pos)->next;
+
+	if (!*pos)
+		return;
+
+	struct helper_capture *hc = *pos;
+	*pos = hc->next;
+	helper_free(hc);
+}
+
+/**
+ * Parse the scheduling config passed by the plugin
+ */
+static bool helper_parse(int argc, char *argv[])
+{
+	struct pulse_realtime_config config;
+	int opt;
+
+	pulse_realtime_get(&config);
+
+	while ((opt = getopt(argc, argv, "r:a:m")) != -1) {
+		switch (opt) {
+		case 'r':
+			if (!pulse_realtime_parse_policy(&config, optarg))
+				return false;
+			break;
+		case 'a':
+			if (!pulse_realtime_parse_cpus(&config, optarg))
+				return false;
+			break;
+		case 'm':
+			config.lock_memory = true;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	pulse_realtime_configure(&config);
+	return optind == argc;
+}
+
+int main(int argc, char *argv[])
+{
+	int sock = PULSE_HELPER_CONTROL_FD;
+	int ret = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+	base_set_log_handler(helper_log, NULL);
+
+	if (!helper_parse(argc, argv)) {
+		blog(LOG_ERROR, "invalid arguments");
+		return 1;
+	}
+
+	if (fcntl(sock, F_GETFD) < 0) {
+		blog(LOG_ERROR, "this helper is started by the obs plugin");
+		return 1;
+	}
+
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		blog(LOG_ERROR, "Unable to create eventfd: %s",
+		     strerror(errno));
+		return 1;
+	}
+
+	if (pulse_init() < 0) {
+		close(wake_fd);
+		return 1;
+	}
+	pulse_subscribe_events(helper_events_cb, NULL);
+
+	uint64_t rescan_ns = os_gettime_ns() + RESCAN_INTERVAL_NS;
+
+	for (;;) {
+		struct pollfd fds[2];
+		fds[0].fd = sock;
+		fds[0].events = POLLIN;
+		fds[1].fd = wake_fd;
+		fds[1].events = POLLIN;
+
+		uint64_t now = os_gettime_ns();
+		int timeout = rescan_ns > now
+				      ? (int)((rescan_ns - now) / NSEC_PER_MSEC)
+				      : 0;
+
+		if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+			blog(LOG_ERROR, "poll failed: %s", strerror(errno));
+			ret = 1;
+			break;
+		}
+
+		if (fds[0].revents) {
+			struct pulse_helper_msg msg;
+			int passed[2];
+
+			// the plugin is gone
+			if (!pulse_helper_recv(sock, &msg, passed))
+				break;
+
+			if (msg.type == PULSE_HELPER_START) {
+				helper_start(sock, &msg);
+				rescan_ns = 0;
+			} else if (msg.type == PULSE_HELPER_STOP) {
+				helper_stop(msg.id);
+			}
+		}
+
+		if (fds[1].revents) {
+			uint64_t value;
+			if (read(wake_fd, &value, sizeof(value)) > 0 &&
+			    rescan_ns > os_gettime_ns() + RESCAN_DELAY_NS)
+				rescan_ns = os_gettime_ns() + RESCAN_DELAY_NS;
+		}
+
+		if (os_gettime_ns() < rescan_ns)
+			continue;
+
+		if (!helper_rescan()) {
+			// let the plugin start a fresh helper
+			blog(LOG_ERROR, "lost connection to the server");
+			ret = 1;
+			break;
+		}
+		rescan_ns = os_gettime_ns() + RESCAN_INTERVAL_NS;
+	}
+
+	while (captures) {
+		struct helper_capture *hc = captures;
+		captures = hc->next;
+		helper_free(hc);
+	}
+
+	pulse_unsubscribe_events(helper_events_cb, NULL);
+	pulse_unref();
+	close(wake_fd);
+
+	return ret;
+}
@@ -0,0 +1,1556 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <pthread.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/util_uint64.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-wrapper.h"
+#include "pulse-clock.h"
+#include "pulse-realtime.h"
+#include "pulse-trace.h"
+#include "pulse-capture.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+/**
+ * Subscriber of a capture stream, this is what pulse_capture_start() hands
+ * out
+ */
+struct pulse_capture {
+	struct pulse_capture_stream *stream;
+	pulse_capture_output_t output;
+	void *param;
+	bool paused;
+	struct pulse_capture *next;
+
+	/* handover, see pulse_capture_handover(), changed with the mainloop
+	 * locked */
+	struct pulse_capture *handover;
+	os_event_t *handed_over;
+	bool replaced;
+	/* end of the last packet delivered */
+	uint64_t end_ts;
+};
+
+/**
+ * Per stream capture state
+ *
+ * Created before the stream is connected and handed to the mainloop as
+ * stream userdata. Once connected only the mainloop thread touches it, until
+ * the stream is disconnected again. The subscriber list is only changed with
+ * the mainloop locked.
+ */
+struct pulse_capture_stream {
+	pa_stream *stream;
+	char *client;
+	char *monitor;
+	struct pulse_capture *subscribers;
+
+	/* registry, protected by capture_mutex */
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	bool whole_sink;
+	uint_fast32_t refs;
+	uint_fast32_t paused;
+	bool corked;
+	struct pulse_capture_stream *next;
+
+	/* timing reference shared with the other captures on the sink */
+	struct pulse_sink_clock *clock;
+	uint64_t clock_offset;
+	bool clock_synced;
+	uint64_t position;
+
+	/* format */
+	enum speaker_layout speakers;
+	pa_sample_format_t format;
+	uint_fast32_t samples_per_sec;
+	uint_fast32_t bytes_per_frame;
+	uint_fast8_t channels;
+	uint64_t first_ts;
+	bool prearmed;
+
+	/* latency ceiling */
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	uint64_t compress_frames;
+	uint64_t compress_gap;
+	uint64_t compress_lag;
+	uint8_t *scratch;
+	size_t scratch_size;
+
+	/* packetizer */
+	uint_fast32_t packet_frames;
+	uint8_t *packet;
+	size_t packet_fill;
+	uint64_t packet_ts;
+	uint64_t packet_offset;
+
+	/* time to first audio */
+	uint64_t client_seen_ns;
+	uint64_t sink_input_seen_ns;
+
+	/* statistics */
+	uint64_t packets;
+	uint_fast64_t frames;
+	uint64_t clock_resyncs;
+	uint64_t overflows;
+	uint64_t catchups;
+	uint_fast64_t frames_skipped;
+	uint_fast64_t frames_compressed;
+	uint64_t reads;
+	uint64_t late_reads;
+	uint64_t backlog_max;
+
+	/* frames the server delivered and holes in the stream */
+	uint64_t received;
+	uint64_t holes;
+
+	/* snapshot for other threads, see pulse_publish_health() */
+	volatile long health_seq;
+	struct pulse_capture_health health;
+
+	/* bytes copied through the socket */
+	uint64_t copied_bytes;
+	uint64_t copy_rate;
+	uint64_t rate_start_ns;
+	uint64_t rate_bytes;
+};
+
+/* sink monitor cache, shared by all captures */
+struct pulse_sink_entry {
+	uint32_t idx;
+	char *monitor;
+	pa_sample_spec spec;
+	struct pulse_sink_entry *next;
+};
+
+/* streams shared by all subscribers capturing the same sink-input */
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_capture_stream *capture_streams = NULL;
+
+static pthread_mutex_t sink_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_sink_entry *sink_cache = NULL;
+
+/**
+ * Timing reference of a sink
+ *
+ * Maps a position on the sink timeline, in frames, to the time it was
+ * captured at. Every capture on the sink is placed on this timeline once,
+ * rounded to a whole frame, and then derives its timestamps from its own
+ * frame count. Captures sharing a sink therefore stay aligned to the sample
+ * no matter when their read callbacks run. All captures feed their latency
+ * based observations into the same reference, which slowly follows them.
+ * Observations are taken from pulse_clock_now().
+ */
+struct pulse_sink_clock {
+	uint32_t sink_idx;
+	uint_fast32_t rate;
+	uint_fast32_t refs;
+
+	bool anchored;
+	uint64_t anchor_pos;
+	uint64_t anchor_ns;
+
+	struct pulse_sink_clock *next;
+};
+
+/* fraction of the observed error the reference follows per update */
+#define CLOCK_GAIN 32
+/* larger errors are discontinuities, e.g. a suspended sink */
+#define CLOCK_RESYNC_NS (20 * NSEC_PER_MSEC)
+
+/* excess latency is removed down to this fraction of the ceiling */
+#define CATCHUP_TARGET_DIV 2
+/* compressing drops blocks this long, crossfaded over the same length */
+#define COMPRESS_BLOCK_MS 5
+/* and keeps at least this much audio between two blocks, which speeds the
+ * stream up by less than 5 % */
+#define COMPRESS_SPACING_MS 100
+
+/* fragment size requested from the server */
+#define FRAGMENT_USEC 25000
+/* a read callback finding more fragments than this readable ran late */
+#define LATE_FRAGMENTS 2
+/* period of the copy rate */
+#define COPY_RATE_NS NSEC_PER_SEC
+
+static pthread_mutex_t clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_sink_clock *sink_clocks = NULL;
+
+/**
+ * get obs from pulse audio format
+ */
+static enum audio_format pulse_to_obs_audio_format(pa_sample_format_t format)
+{
+	switch (format) {
+	case PA_SAMPLE_U8:
+		return AUDIO_FORMAT_U8BIT;
+	case PA_SAMPLE_S16LE:
+		return AUDIO_FORMAT_16BIT;
+	case PA_SAMPLE_S32LE:
+		return AUDIO_FORMAT_32BIT;
+	case PA_SAMPLE_FLOAT32LE:
+		return AUDIO_FORMAT_FLOAT;
+	default:
+		return AUDIO_FORMAT_UNKNOWN;
+	}
+
+	return AUDIO_FORMAT_UNKNOWN;
+}
+
+/**
+ * Get obs speaker layout from number of channels
+ *
+ * @param channels number of channels reported by pulseaudio
+ *
+ * @return obs speaker_layout id
+ *
+ * @note This *might* not work for some rather unusual setups, but should work
+ *       fine for the majority of cases.
+ */
+static enum speaker_layout
+pulse_channels_to_obs_speakers(uint_fast32_t channels)
+{
+	switch (channels) {
+	case 1:
+		return SPEAKERS_MONO;
+	case 2:
+		return SPEAKERS_STEREO;
+	case 3:
+		return SPEAKERS_2POINT1;
+	case 4:
+		return SPEAKERS_4POINT0;
+	case 5:
+		return SPEAKERS_4POINT1;
+	case 6:
+		return SPEAKERS_5POINT1;
+	case 8:
+		return SPEAKERS_7POINT1;
+	}
+
+	return SPEAKERS_UNKNOWN;
+}
+
+static pa_channel_map pulse_channel_map(enum speaker_layout layout)
+{
+	pa_channel_map ret;
+
+	ret.map[0] = PA_CHANNEL_POSITION_FRONT_LEFT;
+	ret.map[1] = PA_CHANNEL_POSITION_FRONT_RIGHT;
+	ret.map[2] = PA_CHANNEL_POSITION_FRONT_CENTER;
+	ret.map[3] = PA_CHANNEL_POSITION_LFE;
+	ret.map[4] = PA_CHANNEL_POSITION_REAR_LEFT;
+	ret.map[5] = PA_CHANNEL_POSITION_REAR_RIGHT;
+	ret.map[6] = PA_CHANNEL_POSITION_SIDE_LEFT;
+	ret.map[7] = PA_CHANNEL_POSITION_SIDE_RIGHT;
+
+	switch (layout) {
+	case SPEAKERS_MONO:
+		ret.channels = 1;
+		ret.map[0] = PA_CHANNEL_POSITION_MONO;
+		break;
+
+	case SPEAKERS_STEREO:
+		ret.channels = 2;
+		break;
+
+	case SPEAKERS_2POINT1:
+		ret.channels = 3;
+		ret.map[2] = PA_CHANNEL_POSITION_LFE;
+		break;
+
+	case SPEAKERS_4POINT0:
+		ret.channels = 4;
+		ret.map[3] = PA_CHANNEL_POSITION_REAR_CENTER;
+		break;
+
+	case SPEAKERS_4POINT1:
+		ret.channels = 5;
+		ret.map[4] = PA_CHANNEL_POSITION_REAR_CENTER;
+		break;
+
+	case SPEAKERS_5POINT1:
+		ret.channels = 6;
+		break;
+
+	case SPEAKERS_7POINT1:
+		ret.channels = 8;
+		break;
+
+	case SPEAKERS_UNKNOWN:
+	default:
+		ret.channels = 0;
+		break;
+	}
+
+	return ret;
+}
+
+static inline uint64_t samples_to_ns(size_t frames, uint_fast32_t rate)
+{
+	return util_mul_div64(frames, NSEC_PER_SEC, rate);
+}
+
+static inline uint64_t get_sample_time(size_t frames, uint_fast32_t rate)
+{
+	return pulse_clock_now() - samples_to_ns(frames, rate);
+}
+
+static struct pulse_sink_clock *pulse_sink_clock_get(uint32_t sink_idx,
+						     uint_fast32_t rate)
+{
+	pthread_mutex_lock(&clock_mutex);
+
+	struct pulse_sink_clock *clock = sink_clocks;
+	while (clock && (clock->sink_idx != sink_idx || clock->rate != rate))
+		clock = clock->next;
+
+	if (!clock) {
+		clock = (struct pulse_sink_clock *)bzalloc(
+			sizeof(struct pulse_sink_clock));
+		clock->sink_idx = sink_idx;
+		clock->rate = rate;
+		clock->next = sink_clocks;
+		sink_clocks = clock;
+	}
+	clock->refs++;
+
+	pthread_mutex_unlock(&clock_mutex);
+	return clock;
+}
+
+static void pulse_sink_clock_release(struct pulse_sink_clock *clock)
+{
+	if (!clock)
+		return;
+
+	pthread_mutex_lock(&clock_mutex);
+
+	if (--clock->refs == 0) {
+		struct pulse_sink_clock **pos = &sink_clocks;
+		while (*pos != clock)
+			pos = &(*pos)->next;
+		*pos = clock->next;
+		bfree(clock);
+	}
+
+	pthread_mutex_unlock(&clock_mutex);
+}
+
+/**
+ * Time of a position on the sink timeline
+ *
+ * @note clock_mutex must be held
+ */
+static uint64_t pulse_sink_clock_ns(struct pulse_sink_clock *clock,
+				    uint64_t pos)
+{
+	if (pos >= clock->anchor_pos)
+		return clock->anchor_ns +
+		       samples_to_ns(pos - clock->anchor_pos, clock->rate);
+	return clock->anchor_ns -
+	       samples_to_ns(clock->anchor_pos - pos, clock->rate);
+}
+
+/**
+ * Update the sink clock with an observation of a capture
+ *
+ * @param pos position of the oldest readable frame in the stream
+ * @param observed_ns time that frame was captured at according to the
+ *                    stream latency
+ *
+ * @return time of the frame on the shared sink timeline
+ */
+static uint64_t pulse_sink_clock_sync(struct pulse_capture_stream *c,
+				      uint64_t pos, uint64_t observed_ns)
+{
+	struct pulse_sink_clock *clock = c->clock;
+
+	pthread_mutex_lock(&clock_mutex);
+
+	if (!clock->anchored) {
+		clock->anchor_pos = pos;
+		clock->anchor_ns = observed_ns;
+		clock->anchored = true;
+	}
+
+	if (!c->clock_synced) {
+		// place the stream on the sink timeline, to the nearest frame
+		uint64_t anchor_ns = clock->anchor_ns;
+		uint64_t delta = observed_ns > anchor_ns
+					 ? observed_ns - anchor_ns
+					 : anchor_ns - observed_ns;
+		uint64_t frames = util_mul_div64(
+			delta + NSEC_PER_SEC / clock->rate / 2, clock->rate,
+			NSEC_PER_SEC);
+		uint64_t sink_pos = observed_ns > anchor_ns
+					    ? clock->anchor_pos + frames
+					    : clock->anchor_pos - frames;
+
+		c->clock_offset = sink_pos - pos;
+		c->clock_synced = true;
+	}
+
+	uint64_t sink_pos = c->clock_offset + pos;
+	uint64_t predicted = pulse_sink_clock_ns(clock, sink_pos);
+	int64_t error = (int64_t)(observed_ns - predicted);
+
+	if (error > CLOCK_RESYNC_NS || error < -CLOCK_RESYNC_NS) {
+		// the sink jumped, the captures keep their relative alignment
+		// because they all derive their time from the same anchor
+		clock->anchor_ns = observed_ns;
+		c->clock_resyncs++;
+	} else {
+		clock->anchor_ns = predicted + error / CLOCK_GAIN;
+	}
+	clock->anchor_pos = sink_pos;
+
+	uint64_t ts = clock->anchor_ns;
+
+	pthread_mutex_unlock(&clock_mutex);
+
+	return ts;
+}
+
+/**
+ * Latency of the oldest readable frame of a stream
+ *
+ * Derived from the stream timing info if available, otherwise the newest
+ * readable frame is assumed to have been captured just now.
+ */
+static uint64_t pulse_stream_latency_ns(pa_stream *p,
+					struct pulse_capture_stream *c,
+					size_t readable_bytes)
+{
+	pa_usec_t latency;
+	int negative;
+
+	if (pa_stream_get_latency(p, &latency, &negative) == 0)
+		return negative ? 0 : latency * 1000;
+
+	return samples_to_ns(readable_bytes / c->bytes_per_frame,
+			     c->samples_per_sec);
+}
+
+#define STARTUP_TIMEOUT_NS (500 * NSEC_PER_MSEC)
+/* a new stream skips its startup first, give it well beyond that to take
+ * over */
+#define HANDOVER_TIMEOUT_MS 2000
+
+/**
+ * Hand a packet to a subscriber
+ *
+ * During a handover the packets of the new capture are held back until they
+ * reach the end of what the old one delivered, the first one is trimmed so
+ * the audio continues without a gap or overlap. The old capture goes quiet
+ * from then on.
+ */
+static void pulse_capture_deliver(struct pulse_capture *sub,
+				  const struct obs_source_audio *audio)
+{
+	struct pulse_capture *from = sub->handover;
+	struct obs_source_audio out = *audio;
+	uint64_t end = out.timestamp +
+		       samples_to_ns(out.frames, out.samples_per_sec);
+
+	if (sub->paused || sub->replaced)
+		return;
+
+	if (from) {
+		if (from->end_ts && end <= from->end_ts)
+			return;
+
+		if (from->end_ts > out.timestamp) {
+			uint32_t skip = (uint32_t)util_mul_div64(
+				from->end_ts - out.timestamp,
+				out.samples_per_sec, NSEC_PER_SEC);
+			size_t frame_size =
+				get_audio_channels(out.speakers) *
+				get_audio_bytes_per_channel(out.format);
+
+			if (skip >= out.frames)
+				return;
+			out.data[0] += skip * frame_size;
+			out.frames -= skip;
+			out.timestamp += samples_to_ns(skip,
+						       out.samples_per_sec);
+		}
+
+		from->replaced = true;
+		sub->handover = NULL;
+		os_event_signal(sub->handed_over);
+	}
+
+	sub->end_ts = end;
+	sub->output(sub->param, &out);
+}
+
+/**
+ * Hand one packet to obs
+ *
+ * The timestamp is derived from the anchor taken at the start of the current
+ * read callback plus the number of frames already emitted since then, so
+ * consecutive packets are spaced exactly by their length.
+ */
+static void pulse_output_packet(struct pulse_capture_stream *c,
+				const uint8_t *frames)
+{
+	struct obs_source_audio out;
+	out.speakers = c->speakers;
+	out.samples_per_sec = c->samples_per_sec;
+	out.format = pulse_to_obs_audio_format(c->format);
+	out.data[0] = frames;
+	out.frames = c->packet_frames;
+	out.timestamp = c->packet_ts +
+			samples_to_ns(c->packet_offset, out.samples_per_sec);
+
+	c->packet_offset += out.frames;
+
+	// a pre-armed sink-input is brand new and has no backlog to skip
+	if (!c->first_ts)
+		c->first_ts = out.timestamp +
+			      (c->prearmed ? 0 : STARTUP_TIMEOUT_NS);
+
+	if (out.timestamp < c->first_ts)
+		goto skip;
+
+	// every subscriber gets the same packet, obs copies it anyway
+	for (struct pulse_capture *sub = c->subscribers; sub; sub = sub->next)
+		pulse_capture_deliver(sub, &out);
+
+	if (c->sink_input_seen_ns) {
+		uint64_t now = os_gettime_ns();
+		uint64_t first_audio = now - c->sink_input_seen_ns;
+
+		if (c->client_seen_ns)
+			blog(LOG_INFO,
+			     "first audio from '%s' %.2f ms after its "
+			     "sink-input and %.2f ms after the client appeared",
+			     c->client, (double)first_audio / NSEC_PER_MSEC,
+			     (double)(now - c->client_seen_ns) /
+				     NSEC_PER_MSEC);
+		else
+			blog(LOG_INFO,
+			     "first audio from '%s' %.2f ms after its "
+			     "sink-input appeared",
+			     c->client, (double)first_audio / NSEC_PER_MSEC);
+
+		c->sink_input_seen_ns = 0;
+		c->client_seen_ns = 0;
+	}
+
+skip:
+	c->packets++;
+	c->frames += out.frames;
+}
+
+/**
+ * Split a fragment into fixed size packets
+ *
+ * Whole packets are passed to obs straight from the fragment, only a partial
+ * packet at either end is copied into the packet buffer.
+ */
+static void pulse_packetize(struct pulse_capture_stream *c,
+			    const uint8_t *frames, size_t bytes)
+{
+	size_t packet_bytes = c->packet_frames * c->bytes_per_frame;
+
+	if (c->packet_fill) {
+		size_t take = packet_bytes - c->packet_fill;
+		if (take > bytes)
+			take = bytes;
+
+		memcpy(c->packet + c->packet_fill, frames, take);
+		c->packet_fill += take;
+		frames += take;
+		bytes -= take;
+
+		if (c->packet_fill < packet_bytes)
+			return;
+
+		pulse_output_packet(c, c->packet);
+		c->packet_fill = 0;
+	}
+
+	while (bytes >= packet_bytes) {
+		pulse_output_packet(c, frames);
+		frames += packet_bytes;
+		bytes -= packet_bytes;
+	}
+
+	if (bytes) {
+		memcpy(c->packet, frames, bytes);
+		c->packet_fill = bytes;
+	}
+}
+
+/**
+ * Get back under the latency ceiling
+ *
+ * Skipping and dropping to the newest data discard whole fragments from the
+ * stream right away, the skipped frames still advance the position so the
+ * timestamps after the gap stay correct. Compressing only sets the number of
+ * frames the following fragments are shortened by, the timestamps follow the
+ * shortened output until it is done.
+ */
+static void pulse_catch_up(struct pulse_capture_stream *c, pa_stream *p,
+			   uint64_t latency)
+{
+	uint64_t target = c->max_latency_ns / CATCHUP_TARGET_DIV;
+	uint64_t excess = util_mul_div64(latency - target, c->samples_per_sec,
+					 NSEC_PER_SEC);
+	uint64_t skipped = 0;
+	const void *frames;
+	size_t bytes;
+
+	c->catchups++;
+
+	if (c->catchup == PULSE_CATCHUP_COMPRESS) {
+		c->compress_frames = excess;
+		blog(LOG_WARNING,
+		     "'%s' latency %.1f ms above ceiling of %.1f ms, "
+		     "compressing %" PRIu64 " frames (%" PRIu64
+		     " catch-ups so far)",
+		     c->client, (double)latency / NSEC_PER_MSEC,
+		     (double)c->max_latency_ns / NSEC_PER_MSEC, excess,
+		     c->catchups);
+		return;
+	}
+
+	for (;;) {
+		size_t readable = pa_stream_readable_size(p);
+		if (readable == (size_t)-1 || !readable)
+			break;
+		if (c->catchup == PULSE_CATCHUP_SKIP && skipped >= excess)
+			break;
+		if (pa_stream_peek(p, &frames, &bytes) != 0 || !bytes)
+			break;
+
+		// keep the newest fragment, it is read right after this
+		if (c->catchup == PULSE_CATCHUP_NEWEST && bytes >= readable)
+			break;
+
+		size_t count = bytes / c->bytes_per_frame;
+		c->position += count;
+		skipped += count;
+		pa_stream_drop(p);
+	}
+
+	// the partial packet does not continue with the remaining audio
+	if (skipped)
+		c->packet_fill = 0;
+	c->frames_skipped += skipped;
+
+	blog(LOG_WARNING,
+	     "'%s' latency %.1f ms above ceiling of %.1f ms, skipped %.1f ms "
+	     "(%" PRIu64 " catch-ups so far)",
+	     c->client, (double)latency / NSEC_PER_MSEC,
+	     (double)c->max_latency_ns / NSEC_PER_MSEC,
+	     (double)samples_to_ns(skipped, c->samples_per_sec) /
+		     NSEC_PER_MSEC,
+	     c->catchups);
+}
+
+/**
+ * Crossfade from one run of frames into another
+ */
+static void pulse_crossfade(const struct pulse_capture_stream *c, uint8_t *dst,
+			    const uint8_t *a, const uint8_t *b, size_t frames)
+{
+	for (size_t f = 0; f < frames; f++) {
+		double w = (double)(f + 1) / (double)(frames + 1);
+
+		for (size_t i = f * c->channels; i < (f + 1) * c->channels;
+		     i++) {
+			switch (c->format) {
+			case PA_SAMPLE_U8:
+				dst[i] = (uint8_t)lrint(a[i] +
+							w * (b[i] - a[i]));
+				break;
+			case PA_SAMPLE_S16LE: {
+				const int16_t *sa = (const int16_t *)a;
+				const int16_t *sb = (const int16_t *)b;
+				((int16_t *)dst)[i] = (int16_t)lrint(
+					sa[i] + w * (sb[i] - sa[i]));
+				break;
+			}
+			case PA_SAMPLE_S32LE: {
+				const int32_t *sa = (const int32_t *)a;
+				const int32_t *sb = (const int32_t *)b;
+				((int32_t *)dst)[i] = (int32_t)llrint(
+					sa[i] + w * ((double)sb[i] - sa[i]));
+				break;
+			}
+			default: {
+				const float *sa = (const float *)a;
+				const float *sb = (const float *)b;
+				((float *)dst)[i] =
+					(float)(sa[i] + w * (sb[i] - sa[i]));
+				break;
+			}
+			}
+		}
+	}
+}
+
+/**
+ * Packetize a fragment with short blocks cut out until the excess latency
+ * has been compressed away
+ *
+ * Each cut replaces two blocks with a crossfade from the first into the
+ * second, so the audio stays continuous. Cuts are spaced
+ * COMPRESS_SPACING_MS apart, a cut that does not fit into the rest of the
+ * fragment moves to the next one.
+ */
+static void pulse_compress(struct pulse_capture_stream *c,
+			   const uint8_t *frames, size_t bytes)
+{
+	if (bytes > c->scratch_size) {
+		pulse_realtime_unlock(c->scratch, c->scratch_size);
+		c->scratch = (uint8_t *)brealloc(c->scratch, bytes);
+		c->scratch_size = bytes;
+		pulse_realtime_lock(c->scratch, c->scratch_size);
+	}
+
+	size_t bpf = c->bytes_per_frame;
+	size_t count = bytes / bpf;
+	uint64_t block = c->samples_per_sec * COMPRESS_BLOCK_MS / 1000;
+	uint64_t spacing = c->samples_per_sec * COMPRESS_SPACING_MS / 1000;
+	size_t in = 0;
+	size_t out = 0;
+
+	while (c->compress_frames) {
+		size_t wait = c->compress_gap < spacing
+				      ? (size_t)(spacing - c->compress_gap)
+				      : 0;
+		// short fragments get shorter blocks so the cuts keep up
+		size_t drop = (size_t)(c->compress_frames < block
+					       ? c->compress_frames
+					       : block);
+		if (drop > count / 2)
+			drop = count / 2;
+		if (!drop || in + wait + 2 * drop > count)
+			break;
+
+		memcpy(c->scratch + out * bpf, frames + in * bpf, wait * bpf);
+		in += wait;
+		out += wait;
+
+		pulse_crossfade(c, c->scratch + out * bpf, frames + in * bpf,
+				frames + (in + drop) * bpf, drop);
+		in += 2 * drop;
+		out += drop;
+
+		c->compress_gap = 0;
+		c->compress_frames -= drop;
+		c->compress_lag += drop;
+		c->frames_compressed += drop;
+	}
+
+	memcpy(c->scratch + out * bpf, frames + in * bpf, (count - in) * bpf);
+	c->compress_gap += count - in;
+	out += count - in;
+
+	pulse_packetize(c, c->scratch, out * bpf);
+}
+
+/**
+ * Callback for pulse when the server had to drop recorded data
+ */
+static void pulse_stream_overflow(pa_stream *p, void *userdata)
+{
+	UNUSED_PARAMETER(p);
+	struct pulse_capture_stream *c =
+		(struct pulse_capture_stream *)userdata;
+
+	c->overflows++;
+	blog(LOG_WARNING,
+	     "'%s' record buffer overflowed (%" PRIu64 " overflows so far)",
+	     c->client, c->overflows);
+
+	pulse_signal(0);
+}
+
+/**
+ * Account audio received by the read callback
+ *
+ * The transport itself is detected off the audio path, see
+ * pulse_detect_transport(), this only counts the copies once it is known.
+ */
+static void pulse_account_transport(struct pulse_capture_stream *c,
+				    size_t bytes, uint64_t now)
+{
+	enum pulse_transport transport = pulse_get_transport();
+	if (transport == PULSE_TRANSPORT_UNKNOWN)
+		pulse_mark_audio_received();
+
+	if (!c->rate_start_ns)
+		c->rate_start_ns = now;
+
+	if (transport == PULSE_TRANSPORT_SOCKET) {
+		c->copied_bytes += bytes;
+		c->rate_bytes += bytes;
+	}
+
+	if (now - c->rate_start_ns >= COPY_RATE_NS) {
+		c->copy_rate = util_mul_div64(c->rate_bytes, NSEC_PER_SEC,
+					      now - c->rate_start_ns);
+		c->rate_bytes = 0;
+		c->rate_start_ns = now;
+	}
+}
+
+/**
+ * Publish the counters for pulse_capture_get_health()
+ *
+ * Readers retry while the sequence number is odd or changed under them, so
+ * the mainloop thread never waits for one.
+ */
+static void pulse_publish_health(struct pulse_capture_stream *c,
+				 uint64_t latency)
+{
+	os_atomic_inc_long(&c->health_seq);
+
+	c->health.format = c->format;
+	c->health.samples_per_sec = c->samples_per_sec;
+	c->health.channels = c->channels;
+	c->health.frames = c->received;
+	c->health.reads = c->reads;
+	c->health.latency_ns = latency;
+	c->health.holes = c->holes;
+	c->health.overflows = c->overflows;
+	c->health.catchups = c->catchups;
+
+	os_atomic_inc_long(&c->health_seq);
+}
+
+/**
+ * Callback for pulse which gets executed when new audio data is available
+ *
+ * All fragments that are readable are drained in one go and re-chunked into
+ * packets of packet_frames frames.
+ */
+static void pulse_stream_read(pa_stream *p, size_t nbytes, void *userdata)
+{
+	UNUSED_PARAMETER(nbytes);
+	struct pulse_capture_stream *c =
+		(struct pulse_capture_stream *)userdata;
+
+	uint64_t trace_start = pulse_trace_now();
+	const void *frames;
+	size_t bytes;
+
+	bytes = pa_stream_readable_size(p);
+	if (bytes == (size_t)-1 || !bytes)
+		goto exit;
+
+	// the server wakes us up once per fragment, a larger backlog means
+	// the mainloop thread did not get to run in time
+	uint64_t backlog =
+		samples_to_ns(bytes / c->bytes_per_frame, c->samples_per_sec);
+	c->received += bytes / c->bytes_per_frame;
+	c->reads++;
+	if (backlog > LATE_FRAGMENTS * FRAGMENT_USEC * 1000ULL)
+		c->late_reads++;
+	if (backlog > c->backlog_max)
+		c->backlog_max = backlog;
+
+	if (c->max_latency_ns && !c->compress_frames) {
+		uint64_t latency = pulse_stream_latency_ns(p, c, bytes);
+		if (latency > c->max_latency_ns) {
+			pulse_catch_up(c, p, latency);
+
+			bytes = pa_stream_readable_size(p);
+			if (bytes == (size_t)-1 || !bytes)
+				goto exit;
+		}
+	}
+
+	uint64_t now = pulse_clock_now();
+	pulse_account_transport(c, bytes, now);
+
+	// the partial packet in front of the readable data is older
+	uint64_t latency = pulse_stream_latency_ns(p, c, bytes);
+	uint64_t observed = now - latency;
+
+	// while compressing the timestamps advance by the shortened output
+	// instead of jumping ahead at every cut, the frames cut so far are
+	// skipped in one step once the catch-up is done
+	if (!c->compress_frames)
+		c->compress_lag = 0;
+
+	c->packet_ts = pulse_sink_clock_sync(c, c->position, observed) -
+		       samples_to_ns(c->packet_fill / c->bytes_per_frame +
+					     c->compress_lag,
+				     c->samples_per_sec);
+	c->packet_offset = 0;
+
+	while (pa_stream_peek(p, &frames, &bytes) == 0 && bytes) {
+		if (!frames) {
+			blog(LOG_ERROR, "Got audio hole of %u bytes",
+			     (unsigned int)bytes);
+			c->holes++;
+
+			// skip over the hole and whatever was partially
+			// buffered in front of it
+			c->packet_offset += (c->packet_fill + bytes) /
+					    c->bytes_per_frame;
+			c->packet_fill = 0;
+		} else if (c->compress_frames) {
+			pulse_compress(c, (const uint8_t *)frames, bytes);
+		} else {
+			pulse_packetize(c, (const uint8_t *)frames, bytes);
+		}
+
+		c->position += bytes / c->bytes_per_frame;
+		pa_stream_drop(p);
+	}
+
+	pulse_publish_health(c, latency);
+
+exit:
+	pulse_trace_span("callback", "read", __func__, trace_start,
+			 pulse_trace_now());
+	pulse_signal(0);
+}
+
+/**
+ * Pick the recording format
+ *
+ * We use the default stream settings for recording here unless pulse is
+ * configured to something obs can't deal with.
+ */
+static void pulse_set_sample_spec(struct pulse_capture_stream *c,
+				  const pa_sample_spec *ss)
+{
+	blog(LOG_INFO,
+	     "Audio format: %s, %" PRIu32 " Hz"
+	     ", %" PRIu8 " channels",
+	     pa_sample_format_to_string(ss->format), ss->rate, ss->channels);
+
+	pa_sample_format_t format = ss->format;
+	if (pulse_to_obs_audio_format(format) == AUDIO_FORMAT_UNKNOWN) {
+		format = PA_SAMPLE_FLOAT32LE;
+
+		blog(LOG_INFO,
+		     "Sample format %s not supported by OBS,"
+		     "using %s instead for recording",
+		     pa_sample_format_to_string(ss->format),
+		     pa_sample_format_to_string(format));
+	}
+
+	uint8_t channels = ss->channels;
+	if (pulse_channels_to_obs_speakers(channels) == SPEAKERS_UNKNOWN) {
+		channels = 2;
+
+		blog(LOG_INFO,
+		     "%" PRIu8 " channels not supported by OBS,"
+		     "using %" PRIu8 " instead for recording",
+		     ss->channels, channels);
+	}
+
+	c->format = format;
+	c->samples_per_sec = ss->rate;
+	c->channels = channels;
+}
+
+/**
+ * Sink info callback, adds or replaces the sink in the cache
+ */
+static void sink_cache_info_cb(pa_context *c, const pa_sink_info *i, int eol,
+			       void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(userdata);
+
+	if (eol || i->index == PA_INVALID_INDEX || !i->monitor_source_name) {
+		pulse_signal(0);
+		return;
+	}
+
+	pthread_mutex_lock(&sink_cache_mutex);
+
+	struct pulse_sink_entry *e = sink_cache;
+	while (e && e->idx != i->index)
+		e = e->next;
+
+	if (!e) {
+		e = (struct pulse_sink_entry *)bzalloc(sizeof(*e));
+		e->idx = i->index;
+		e->next = sink_cache;
+		sink_cache = e;
+	}
+
+	bfree(e->monitor);
+	e->monitor = bstrdup(i->monitor_source_name);
+	e->spec = i->sample_spec;
+
+	pthread_mutex_unlock(&sink_cache_mutex);
+}
+
+void pulse_sink_cache_seed(uint32_t idx, const char *monitor,
+			   const pa_sample_spec *spec)
+{
+	pthread_mutex_lock(&sink_cache_mutex);
+
+	struct pulse_sink_entry *e = sink_cache;
+	while (e && e->idx != idx)
+		e = e->next;
+
+	if (!e) {
+		e = (struct pulse_sink_entry *)bzalloc(sizeof(*e));
+		e->idx = idx;
+		e->monitor = bstrdup(monitor);
+		e->spec = *spec;
+		e->next = sink_cache;
+		sink_cache = e;
+	}
+
+	pthread_mutex_unlock(&sink_cache_mutex);
+}
+
+bool pulse_sink_cache_lookup(uint32_t idx, char **monitor,
+			     pa_sample_spec *spec)
+{
+	pthread_mutex_lock(&sink_cache_mutex);
+
+	struct pulse_sink_entry *e = sink_cache;
+	while (e && e->idx != idx)
+		e = e->next;
+
+	if (e) {
+		*monitor = bstrdup(e->monitor);
+		*spec = e->spec;
+	}
+
+	pthread_mutex_unlock(&sink_cache_mutex);
+
+	return e != NULL;
+}
+
+/**
+ * Look up the monitor source and sample spec of a sink
+ *
+ * On a cache miss the sink is queried from the server.
+ *
+ * @return false if the sink does not exist
+ *
+ * @warning blocks on a cache miss, never call from the mainloop thread
+ */
+static bool pulse_sink_cache_get(uint32_t idx, char **monitor,
+				 pa_sample_spec *spec)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		pthread_mutex_lock(&sink_cache_mutex);
+
+		struct pulse_sink_entry *e = sink_cache;
+		while (e && e->idx != idx)
+			e = e->next;
+
+		if (e) {
+			bfree(*monitor);
+			*monitor = bstrdup(e->monitor);
+			*spec = e->spec;
+		}
+
+		pthread_mutex_unlock(&sink_cache_mutex);
+
+		if (e)
+			return true;
+		if (pulse_get_sink_name_by_index(idx, sink_cache_info_cb,
+						 NULL) < 0)
+			return false;
+	}
+
+	return false;
+}
+
+void pulse_sink_cache_remove(uint32_t idx)
+{
+	pthread_mutex_lock(&sink_cache_mutex);
+
+	struct pulse_sink_entry **pos = &sink_cache;
+	while (*pos) {
+		struct pulse_sink_entry *e = *pos;
+		if (e->idx == idx) {
+			*pos = e->next;
+			bfree(e->monitor);
+			bfree(e);
+			break;
+		}
+		pos = &e->next;
+	}
+
+	pthread_mutex_unlock(&sink_cache_mutex);
+}
+
+void pulse_sink_cache_clear()
+{
+	pthread_mutex_lock(&sink_cache_mutex);
+
+	while (sink_cache) {
+		struct pulse_sink_entry *e = sink_cache;
+		sink_cache = e->next;
+		bfree(e->monitor);
+		bfree(e);
+	}
+
+	pthread_mutex_unlock(&sink_cache_mutex);
+}
+
+void pulse_sink_cache_refresh()
+{
+	pulse_get_sink_info_list(sink_cache_info_cb, NULL);
+}
+
+static void pulse_capture_stream_free(struct pulse_capture_stream *c);
+
+/**
+ * Create and connect a new capture stream
+ *
+ * We request the default format used by pulse here because the data will be
+ * converted and possibly re-sampled by obs anyway.
+ *
+ * For now we request a buffer length of 25ms although pulse seems to ignore
+ * this setting for monitor streams. For "real" input streams this should work
+ * fine though.
+ *
+ * The first subscriber is added before the stream is connected so it does
+ * not miss the first packets.
+ */
+static struct pulse_capture_stream *
+pulse_capture_stream_new(const struct pulse_capture_params *params,
+			 struct pulse_capture *sub)
+{
+	struct pulse_capture_stream *c = (struct pulse_capture_stream *)bzalloc(
+		sizeof(struct pulse_capture_stream));
+
+	pa_sample_spec spec;
+	if (!pulse_sink_cache_get(params->sink_idx, &c->monitor, &spec)) {
+		blog(LOG_ERROR, "Unable to get monitor source info !");
+		bfree(c);
+		return NULL;
+	}
+
+	c->client = bstrdup(params->client);
+	c->subscribers = sub;
+	c->sink_input_idx = params->sink_input_idx;
+	c->sink_idx = params->sink_idx;
+	c->whole_sink = params->whole_sink;
+	c->prearmed = params->prearmed;
+	c->packet_frames = params->packet_frames;
+	c->max_latency_ns = params->max_latency_ns;
+	c->catchup = params->catchup;
+	if (params->prearmed) {
+		c->client_seen_ns = params->client_seen_ns;
+		c->sink_input_seen_ns = params->sink_input_seen_ns;
+	}
+
+	pulse_set_sample_spec(c, &spec);
+
+	spec.format = c->format;
+	spec.rate = c->samples_per_sec;
+	spec.channels = c->channels;
+
+	if (!pa_sample_spec_valid(&spec)) {
+		blog(LOG_ERROR, "Sample spec is not valid");
+		goto fail;
+	}
+
+	c->speakers = pulse_channels_to_obs_speakers(spec.channels);
+	c->bytes_per_frame = pa_frame_size(&spec);
+	c->packet = (uint8_t *)bmalloc(c->packet_frames * c->bytes_per_frame);
+	pulse_realtime_lock(c->packet, c->packet_frames * c->bytes_per_frame);
+	c->clock = pulse_sink_clock_get(params->sink_idx, c->samples_per_sec);
+	pulse_publish_health(c, 0);
+
+	pa_channel_map channel_map = pulse_channel_map(c->speakers);
+
+	c->stream = pulse_stream_new(params->name, &spec, &channel_map);
+	if (!c->stream) {
+		blog(LOG_ERROR, "Unable to create stream");
+		goto fail;
+	}
+
+	pulse_lock();
+	pa_stream_set_read_callback(c->stream, pulse_stream_read, (void *)c);
+	pa_stream_set_overflow_callback(c->stream, pulse_stream_overflow,
+					(void *)c);
+	pulse_unlock();
+
+	pa_buffer_attr attr;
+	attr.fragsize = pa_usec_to_bytes(FRAGMENT_USEC, &spec);
+	// with a ceiling the server buffer is only a backstop for when the
+	// catch-up in the read callback can not keep up
+	attr.maxlength =
+		c->max_latency_ns
+			? (uint32_t)pa_usec_to_bytes(
+				  2 * c->max_latency_ns / 1000, &spec)
+			: (uint32_t)-1;
+	attr.minreq = (uint32_t)-1;
+	attr.prebuf = (uint32_t)-1;
+	attr.tlength = (uint32_t)-1;
+
+	// timing updates let the read callback use the stream latency
+	pa_stream_flags_t flags = PA_STREAM_ADJUST_LATENCY |
+				  PA_STREAM_INTERPOLATE_TIMING |
+				  PA_STREAM_AUTO_TIMING_UPDATE;
+
+	// a sink-input alone on its sink gets the plain monitor, which spares
+	// the server from feeding a separate monitor stream
+	int status = 0;
+	if (c->whole_sink) {
+		blog(LOG_INFO, "monitoring all of sink %" PRIu32
+			       " for sink input %" PRIu32,
+		     params->sink_idx, params->sink_input_idx);
+	} else {
+		blog(LOG_INFO, "attempting to only monitor sink input %d",
+		     params->sink_input_idx);
+		status = pa_stream_set_monitor_stream(c->stream,
+						      params->sink_input_idx);
+	}
+	if (status != 0) {
+		blog(LOG_ERROR,
+		     "Failed to only record sink input from monitor: %d",
+		     status);
+		pulse_capture_stream_free(c);
+		return NULL;
+	}
+
+	pulse_lock();
+	int_fast32_t ret = pa_stream_connect_record(c->stream, c->monitor,
+						    &attr, flags);
+	pulse_unlock();
+	if (ret < 0) {
+		pulse_capture_stream_free(c);
+		blog(LOG_ERROR, "Unable to connect to stream");
+		return NULL;
+	}
+
+	blog(LOG_INFO, "Started recording from '%s'", c->client);
+	return c;
+
+fail:
+	pulse_sink_clock_release(c->clock);
+	pulse_realtime_unlock(c->packet, c->packet_frames * c->bytes_per_frame);
+	bfree(c->packet);
+	bfree(c->monitor);
+	bfree(c->client);
+	bfree(c);
+	return NULL;
+}
+
+static void pulse_capture_stream_free(struct pulse_capture_stream *c)
+{
+	pulse_lock();
+	pa_stream_set_read_callback(c->stream, NULL, NULL);
+	pa_stream_set_overflow_callback(c->stream, NULL, NULL);
+	pa_stream_disconnect(c->stream);
+	pulse_stream_release(c->stream);
+	pulse_unlock();
+
+	blog(LOG_INFO, "Stopped recording from '%s'", c->client);
+	blog(LOG_INFO,
+	     "Got %" PRIu64 " packets with %" PRIuFAST64
+	     " frames, %" PRIu64 " sink clock resyncs",
+	     c->packets, c->frames, c->clock_resyncs);
+	if (c->max_latency_ns)
+		blog(LOG_INFO,
+		     "%" PRIu64 " overflows, %" PRIu64
+		     " catch-ups, %" PRIuFAST64 " frames skipped, %" PRIuFAST64
+		     " frames compressed",
+		     c->overflows, c->catchups, c->frames_skipped,
+		     c->frames_compressed);
+	blog(LOG_INFO,
+	     "%" PRIu64 " of %" PRIu64
+	     " read callbacks late, max backlog %.2f ms",
+	     c->late_reads, c->reads, (double)c->backlog_max / NSEC_PER_MSEC);
+	blog(LOG_INFO, "Transport of all streams %s, %" PRIu64 " bytes copied",
+	     pulse_transport_name(pulse_get_transport()), c->copied_bytes);
+
+	pulse_sink_clock_release(c->clock);
+	pulse_realtime_unlock(c->scratch, c->scratch_size);
+	pulse_realtime_unlock(c->packet, c->packet_frames * c->bytes_per_frame);
+	bfree(c->scratch);
+	bfree(c->packet);
+	bfree(c->monitor);
+	bfree(c->client);
+	bfree(c);
+}
+
+/**
+ * Find a running stream the params can share
+ *
+ * @note capture_mutex must be held
+ */
+static struct pulse_capture_stream *
+pulse_capture_stream_find(const struct pulse_capture_params *params)
+{
+	struct pulse_capture_stream *c = capture_streams;
+
+	while (c && (c->sink_input_idx != params->sink_input_idx ||
+		     c->sink_idx != params->sink_idx ||
+		     c->whole_sink != params->whole_sink ||
+		     c->packet_frames != params->packet_frames ||
+		     c->max_latency_ns != params->max_latency_ns ||
+		     c->catchup != params->catchup))
+		c = c->next;
+
+	return c;
+}
+
+/**
+ * Cork the stream while all of its subscribers are paused
+ *
+ * The stream is flushed before it is uncorked, so capturing resumes with
+ * fresh audio instead of whatever was buffered before.
+ *
+ * @note capture_mutex must be held
+ */
+static void pulse_capture_stream_update_cork(struct pulse_capture_stream *c)
+{
+	bool cork = c->refs && c->paused == c->refs;
+	if (cork == c->corked)
+		return;
+
+	c->corked = cork;
+
+	pulse_lock();
+	if (!cork) {
+		pa_operation *op = pulse_operation_track(
+			pa_stream_flush(c->stream, NULL, NULL));
+		if (op)
+			pulse_operation_release(op);
+	}
+	pa_operation *op = pulse_operation_track(
+		pa_stream_cork(c->stream, cork, NULL, NULL));
+	if (op)
+		pulse_operation_release(op);
+	pulse_unlock();
+
+	blog(LOG_INFO, "%s the stream of sink input %" PRIu32,
+	     cork ? "Corked" : "Uncorked", c->sink_input_idx);
+}
+
+/**
+ * Start a capture, optionally taking over from another one
+ *
+ * The handover is set up before the subscriber is linked, so the first
+ * packet it sees already goes through it.
+ */
+static struct pulse_capture *
+pulse_capture_start_from(const struct pulse_capture_params *params,
+			 struct pulse_capture *from)
+{
+	struct pulse_capture *sub =
+		(struct pulse_capture *)bzalloc(sizeof(struct pulse_capture));
+	sub->output = params->output;
+	sub->param = params->param;
+	if (from && os_event_init(&sub->handed_over, OS_EVENT_TYPE_MANUAL) == 0)
+		sub->handover = from;
+
+	pthread_mutex_lock(&capture_mutex);
+
+	struct pulse_capture_stream *c = pulse_capture_stream_find(params);
+	if (c) {
+		pulse_lock();
+		sub->next = c->subscribers;
+		c->subscribers = sub;
+		pulse_unlock();
+
+		blog(LOG_INFO, "Sharing the stream of sink input %" PRIu32
+			       " with %" PRIuFAST32 " other sources",
+		     c->sink_input_idx, c->refs);
+	} else {
+		c = pulse_capture_stream_new(params, sub);
+		if (!c) {
+			pthread_mutex_unlock(&capture_mutex);
+			if (sub->handed_over)
+				os_event_destroy(sub->handed_over);
+			bfree(sub);
+			return NULL;
+		}
+
+		c->next = capture_streams;
+		capture_streams = c;
+	}
+
+	c->refs++;
+	sub->stream = c;
+	pulse_capture_stream_update_cork(c);
+
+	pthread_mutex_unlock(&capture_mutex);
+
+	return sub;
+}
+
+struct pulse_capture *
+pulse_capture_start(const struct pulse_capture_params *params)
+{
+	return pulse_capture_start_from(params, NULL);
+}
+
+struct pulse_capture *
+pulse_capture_handover(struct pulse_capture *from,
+		       const struct pulse_capture_params *params)
+{
+	if (!from)
+		return pulse_capture_start(params);
+
+	struct pulse_capture *sub = pulse_capture_start_from(params, from);
+	if (!sub)
+		return NULL;
+
+	uint64_t start = os_gettime_ns();
+	bool handed_over = !sub->handed_over ||
+			   os_event_timedwait(sub->handed_over,
+					      HANDOVER_TIMEOUT_MS) == 0;
+
+	// the signal is sent with the mainloop locked, once the lock is
+	// taken here the event is no longer used
+	pulse_lock();
+	sub->handover = NULL;
+	pulse_unlock();
+	if (sub->handed_over)
+		os_event_destroy(sub->handed_over);
+	sub->handed_over = NULL;
+
+	if (handed_over)
+		blog(LOG_INFO, "'%s' handed over to the new stream in %.2f ms",
+		     params->client,
+		     (double)(os_gettime_ns() - start) / NSEC_PER_MSEC);
+	else
+		blog(LOG_WARNING,
+		     "new stream of '%s' delivered nothing within %d ms, "
+		     "switching anyway",
+		     params->client, HANDOVER_TIMEOUT_MS);
+
+	pulse_capture_stop(from);
+	return sub;
+}
+
+void pulse_capture_stop(struct pulse_capture *sub)
+{
+	if (!sub)
+		return;
+
+	pthread_mutex_lock(&capture_mutex);
+
+	struct pulse_capture_stream *c = sub->stream;
+
+	// once unlinked under the mainloop lock no callback can reach it
+	pulse_lock();
+	struct pulse_capture **pos = &c->subscribers;
+	while (*pos != sub)
+		pos = &(*pos)->next;
+	*pos = sub->next;
+	pulse_unlock();
+
+	if (sub->paused)
+		c->paused--;
+	if (--c->refs == 0) {
+		struct pulse_capture_stream **s = &capture_streams;
+		while (*s != c)
+			s = &(*s)->next;
+		*s = c->next;
+
+		pulse_capture_stream_free(c);
+	} else {
+		pulse_capture_stream_update_cork(c);
+	}
+
+	pthread_mutex_unlock(&capture_mutex);
+
+	bfree(sub);
+}
+
+void pulse_capture_set_paused(struct pulse_capture *sub, bool paused)
+{
+	if (!sub)
+		return;
+
+	pthread_mutex_lock(&capture_mutex);
+
+	struct pulse_capture_stream *c = sub->stream;
+	if (sub->paused != paused) {
+		pulse_lock();
+		sub->paused = paused;
+		pulse_unlock();
+
+		if (paused)
+			c->paused++;
+		else
+			c->paused--;
+		pulse_capture_stream_update_cork(c);
+	}
+
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+bool pulse_capture_get_transport(uint32_t sink_input_idx,
+				 struct pulse_capture_transport *info)
+{
+	// the mutex is held while a stream connects, do not wait for the server
+	if (pthread_mutex_trylock(&capture_mutex) != 0)
+		return false;
+
+	struct pulse_capture_stream *c = capture_streams;
+	while (c && c->sink_input_idx != sink_input_idx)
+		c = c->next;
+
+	if (c) {
+		pulse_lock();
+		info->transport = pulse_get_transport();
+		info->copied_bytes = c->copied_bytes;
+		info->copy_rate = c->copy_rate;
+		pulse_unlock();
+	}
+
+	pthread_mutex_unlock(&capture_mutex);
+
+	return c != NULL;
+}
+
+void pulse_capture_get_health(struct pulse_capture *sub,
+			      struct pulse_capture_health *health)
+{
+	pthread_mutex_lock(&capture_mutex);
+
+	struct pulse_capture_stream *c = sub->stream;
+	long seq;
+
+	do {
+		while ((seq = os_atomic_load_long(&c->health_seq)) & 1)
+			;
+		*health = c->health;
+		// keep the copy from moving past the check of the sequence
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (os_atomic_load_long(&c->health_seq) != seq);
+
+	health->corked = c->corked;
+
+	pthread_mutex_unlock(&capture_mutex);
+}
@@ -0,0 +1,224 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <obs.h>
+#include <pulse/sample.h>
+
+#include "pulse-wrapper.h"
+
+#pragma once
+
+struct pulse_capture;
+
+/**
+ * How a capture gets back under its latency ceiling
+ */
+enum pulse_catchup {
+	/* drop the oldest audio until half the ceiling is left */
+	PULSE_CATCHUP_SKIP,
+	/* play the excess faster by dropping single frames */
+	PULSE_CATCHUP_COMPRESS,
+	/* drop everything but the newest fragment */
+	PULSE_CATCHUP_NEWEST,
+};
+
+/**
+ * Callback receiving the captured audio packets
+ *
+ * @note called from the pulseaudio mainloop thread
+ */
+typedef void (*pulse_capture_output_t)(void *param,
+				       const struct obs_source_audio *audio);
+
+/**
+ * Parameters of a capture stream
+ */
+struct pulse_capture_params {
+	/* stream name shown by pulseaudio */
+	const char *name;
+	/* client name, only used for logging */
+	const char *client;
+
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	/* record the whole monitor of the sink, only for a sink-input that is
+	 * alone on it */
+	bool whole_sink;
+	uint_fast32_t packet_frames;
+
+	/* latency ceiling, 0 lets the server buffer grow unbounded */
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+
+	/* set for a sink-input that just appeared and has no backlog */
+	bool prearmed;
+	uint64_t client_seen_ns;
+	uint64_t sink_input_seen_ns;
+
+	pulse_capture_output_t output;
+	void *param;
+};
+
+/**
+ * Start capturing a single sink-input from the monitor of its sink
+ *
+ * Captures of the same sink-input with the same packet size and latency
+ * ceiling share a single stream, every packet is handed to all of them. The
+ * stream is disconnected when the last capture is stopped.
+ *
+ * @return the capture or NULL on failure
+ *
+ * @warning blocks on the server, never call from the mainloop thread
+ */
+struct pulse_capture *
+pulse_capture_start(const struct pulse_capture_params *params);
+
+/**
+ * Replace a capture by a new one without a gap or overlap in the audio
+ *
+ * The new capture is started right away but only delivers once its audio
+ * reaches the end of what the old one delivered, its first packet is trimmed
+ * to fit. The old capture is stopped then, or after a timeout if the new
+ * stream does not deliver anything.
+ *
+ * @param c the capture to replace, may be NULL
+ *
+ * @return the new capture or NULL on failure, c keeps running then
+ *
+ * @warning blocks until the handover, never call from the mainloop thread
+ */
+struct pulse_capture *
+pulse_capture_handover(struct pulse_capture *c,
+		       const struct pulse_capture_params *params);
+
+/**
+ * Stop a capture and free it
+ *
+ * No output callback is running or will run once this function returned.
+ */
+void pulse_capture_stop(struct pulse_capture *c);
+
+/**
+ * Pause or resume delivering audio to a capture
+ *
+ * A stream is corked while all of its captures are paused, so it costs
+ * neither the server nor the mainloop anything until one resumes.
+ */
+void pulse_capture_set_paused(struct pulse_capture *c, bool paused);
+
+/**
+ * Health of a capture stream, see pulse_capture_get_health()
+ */
+struct pulse_capture_health {
+	/* format the stream records in */
+	pa_sample_format_t format;
+	uint_fast32_t samples_per_sec;
+	uint_fast8_t channels;
+
+	/* frames the server delivered to the stream so far */
+	uint64_t frames;
+	/* read callbacks so far */
+	uint64_t reads;
+	/* age of the newest audio at the last read callback */
+	uint64_t latency_ns;
+	uint64_t holes;
+	uint64_t overflows;
+	uint64_t catchups;
+
+	/* corked because all captures of the stream are paused */
+	bool corked;
+};
+
+/**
+ * Get a snapshot of the counters of the stream of a capture
+ *
+ * The counters are published by the read callback without a lock, so this
+ * never stalls the audio. Comparing the frames with the time passed shows
+ * whether a stream stalled while the server keeps it connected.
+ */
+void pulse_capture_get_health(struct pulse_capture *c,
+			      struct pulse_capture_health *health);
+
+/**
+ * Transport statistics of a capture stream
+ */
+struct pulse_capture_transport {
+	/* shared by all streams of the process */
+	enum pulse_transport transport;
+	/* bytes copied through the socket, 0 with shared memory */
+	uint64_t copied_bytes;
+	/* copied bytes per second over the last second */
+	uint64_t copy_rate;
+};
+
+/**
+ * Get the transport statistics of the stream capturing a sink-input
+ *
+ * This does not wait while another thread starts or stops a stream, so it
+ * can be called from the ui thread.
+ *
+ * @return false if no stream captures the sink-input or the streams are
+ *         being changed
+ */
+bool pulse_capture_get_transport(uint32_t sink_input_idx,
+				 struct pulse_capture_transport *info);
+
+/**
+ * Query all sinks and add them to the sink cache
+ *
+ * @warning blocks on the server, never call from the mainloop thread
+ */
+void pulse_sink_cache_refresh();
+
+/**
+ * Add a sink remembered from an earlier session to the cache
+ *
+ * This lets a capture start without asking the server first. The entry is
+ * replaced by the next refresh.
+ */
+void pulse_sink_cache_seed(uint32_t idx, const char *monitor,
+			   const pa_sample_spec *spec);
+
+/**
+ * Look up a sink in the cache without querying the server
+ *
+ * @param monitor receives a copy of the monitor source name, free with bfree
+ *
+ * @return false if the sink is not cached
+ */
+bool pulse_sink_cache_lookup(uint32_t idx, char **monitor,
+			     pa_sample_spec *spec);
+
+/**
+ * Remove a sink from the cache, e.g. when it was changed or removed
+ */
+void pulse_sink_cache_remove(uint32_t idx);
+
+/**
+ * Remove all sinks from the cache
+ */
+void pulse_sink_cache_clear();
+
+#ifdef __cplusplus
+}
+#endif
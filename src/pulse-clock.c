@@ -0,0 +1,32 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <util/platform.h>
+
+#include "pulse-clock.h"
+
+static pulse_clock_fn clock_now = NULL;
+
+uint64_t pulse_clock_now()
+{
+	return clock_now ? clock_now() : os_gettime_ns();
+}
+
+void pulse_clock_set(pulse_clock_fn now)
+{
+	clock_now = now;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+#pragma once
+
+/**
+ * Time source of the control thread and the sink clock
+ */
+typedef uint64_t (*pulse_clock_fn)(void);
+
+/**
+ * Get the current time in nanoseconds, os_gettime_ns() unless replaced
+ */
+uint64_t pulse_clock_now();
+
+/**
+ * Replace the time source
+ *
+ * Lets tests run the control thread's timers and the capture timestamps
+ * from a scripted clock without a server.
+ *
+ * @param now the new time source, NULL for os_gettime_ns()
+ *
+ * @warning set it before anything reads the clock, it is not synchronized
+ */
+void pulse_clock_set(pulse_clock_fn now);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,330 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <time.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-clock.h"
+#include "pulse-control.h"
+#include "pulse-trace.h"
+
+/* a pending call, the list is kept sorted by deadline */
+struct pulse_control_timer {
+	const void *key;
+	uint64_t queued;
+	uint64_t deadline;
+	pulse_control_cb_t cb;
+	void *param;
+	struct pulse_control_timer *next;
+};
+
+/* a key with a pending cancel, further calls for it are refused */
+struct pulse_control_cancel {
+	const void *key;
+	struct pulse_control_cancel *next;
+};
+
+/* global data */
+static uint_fast32_t control_refs = 0;
+static pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t control_cond;
+static pthread_t control_thread;
+static bool control_stop = false;
+static struct pulse_control_timer *control_timers = NULL;
+static const void *control_running = NULL;
+static struct pulse_control_cancel *control_cancels = NULL;
+
+/* only touched by the thread running the callbacks */
+static bool control_again = false;
+static uint64_t control_again_ns = 0;
+
+static bool pulse_control_cancelling(const void *key)
+{
+	for (struct pulse_control_cancel *c = control_cancels; c; c = c->next) {
+		if (c->key == key)
+			return true;
+	}
+	return false;
+}
+
+/* unlink the pending call for a key */
+static struct pulse_control_timer *pulse_control_take(const void *key)
+{
+	struct pulse_control_timer **pos = &control_timers;
+	while (*pos) {
+		struct pulse_control_timer *t = *pos;
+		if (t->key == key) {
+			*pos = t->next;
+			return t;
+		}
+		pos = &t->next;
+	}
+	return NULL;
+}
+
+static void pulse_control_insert(struct pulse_control_timer *t)
+{
+	struct pulse_control_timer **pos = &control_timers;
+	while (*pos && (*pos)->deadline <= t->deadline)
+		pos = &(*pos)->next;
+	t->next = *pos;
+	*pos = t;
+}
+
+/* run a call again unless a call for its key is pending already */
+static void pulse_control_rerun(struct pulse_control_timer *t,
+				uint64_t delay_ns)
+{
+	uint64_t now = pulse_clock_now();
+	struct pulse_control_timer *pending = pulse_control_take(t->key);
+
+	if (pending) {
+		if (now + delay_ns < pending->deadline)
+			pending->deadline = now + delay_ns;
+		bfree(t);
+		t = pending;
+	} else {
+		t->queued = now;
+		t->deadline = now + delay_ns;
+	}
+
+	pulse_control_insert(t);
+}
+
+static void pulse_control_remove(const void *key)
+{
+	struct pulse_control_timer **pos = &control_timers;
+	while (*pos) {
+		struct pulse_control_timer *t = *pos;
+		if (t->key == key) {
+			*pos = t->next;
+			bfree(t);
+		} else {
+			pos = &t->next;
+		}
+	}
+}
+
+static void pulse_control_timed_wait(uint64_t delay_ns)
+{
+	/* os_gettime_ns() is based on the monotonic clock, the time source
+	 * may not be */
+	uint64_t deadline = os_gettime_ns() + delay_ns;
+
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+	ts.tv_nsec = (long)(deadline % 1000000000ULL);
+
+	pthread_cond_timedwait(&control_cond, &control_mutex, &ts);
+}
+
+/* run the first call, with the mutex locked */
+static void pulse_control_run_first(void)
+{
+	struct pulse_control_timer *t = control_timers;
+
+	control_timers = t->next;
+	control_running = t->key;
+	pthread_mutex_unlock(&control_mutex);
+
+	uint64_t start = pulse_trace_now();
+	control_again = false;
+	t->cb(t->param, t->queued);
+	pulse_trace_span("control", "run", __func__, start, pulse_trace_now());
+
+	pthread_mutex_lock(&control_mutex);
+	if (control_again && !pulse_control_cancelling(t->key))
+		pulse_control_rerun(t, control_again_ns);
+	else
+		bfree(t);
+	control_running = NULL;
+	pthread_cond_broadcast(&control_cond);
+}
+
+static void *pulse_control_thread(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	os_set_thread_name("pulse-control");
+
+	pthread_mutex_lock(&control_mutex);
+
+	while (!control_stop) {
+		struct pulse_control_timer *t = control_timers;
+
+		if (!t) {
+			pthread_cond_wait(&control_cond, &control_mutex);
+			continue;
+		}
+
+		uint64_t now = pulse_clock_now();
+		if (now < t->deadline) {
+			pulse_control_timed_wait(t->deadline - now);
+			continue;
+		}
+
+		pulse_control_run_first();
+	}
+
+	pthread_mutex_unlock(&control_mutex);
+	return NULL;
+}
+
+int_fast32_t pulse_control_init()
+{
+	int_fast32_t ret = 0;
+
+	pthread_mutex_lock(&control_mutex);
+
+	if (control_refs == 0) {
+		/* os_gettime_ns() is based on the monotonic clock */
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&control_cond, &attr);
+		pthread_condattr_destroy(&attr);
+
+		control_stop = false;
+		if (pthread_create(&control_thread, NULL, pulse_control_thread,
+				   NULL) != 0) {
+			blog(LOG_ERROR, "Unable to start control thread");
+			pthread_cond_destroy(&control_cond);
+			ret = -1;
+		}
+	}
+
+	if (ret == 0)
+		control_refs++;
+
+	pthread_mutex_unlock(&control_mutex);
+
+	return ret;
+}
+
+void pulse_control_unref()
+{
+	pthread_mutex_lock(&control_mutex);
+
+	if (--control_refs == 0) {
+		control_stop = true;
+		pthread_cond_broadcast(&control_cond);
+		pthread_mutex_unlock(&control_mutex);
+
+		pthread_join(control_thread, NULL);
+
+		pthread_mutex_lock(&control_mutex);
+		while (control_timers) {
+			struct pulse_control_timer *t = control_timers;
+			control_timers = t->next;
+			bfree(t);
+		}
+		pthread_cond_destroy(&control_cond);
+	}
+
+	pthread_mutex_unlock(&control_mutex);
+}
+
+bool pulse_control_schedule(const void *key, uint64_t delay_ns,
+			    pulse_control_cb_t cb, void *param)
+{
+	pthread_mutex_lock(&control_mutex);
+
+	if (pulse_control_cancelling(key)) {
+		pthread_mutex_unlock(&control_mutex);
+		return false;
+	}
+
+	uint64_t now = pulse_clock_now();
+	bool scheduled = true;
+
+	struct pulse_control_timer *t = pulse_control_take(key);
+	if (t) {
+		/* coalesce, a pending deadline is only ever pulled in */
+		scheduled = false;
+		if (now + delay_ns < t->deadline)
+			t->deadline = now + delay_ns;
+	} else {
+		t = (struct pulse_control_timer *)bzalloc(
+			sizeof(struct pulse_control_timer));
+		t->key = key;
+		t->queued = now;
+		t->deadline = now + delay_ns;
+		t->cb = cb;
+		t->param = param;
+	}
+
+	pulse_control_insert(t);
+
+	pthread_cond_broadcast(&control_cond);
+	pthread_mutex_unlock(&control_mutex);
+
+	return scheduled;
+}
+
+size_t pulse_control_run_due()
+{
+	size_t count = 0;
+
+	pthread_mutex_lock(&control_mutex);
+
+	while (control_timers &&
+	       control_timers->deadline <= pulse_clock_now()) {
+		pulse_control_run_first();
+		count++;
+	}
+
+	pthread_mutex_unlock(&control_mutex);
+
+	return count;
+}
+
+void pulse_control_again(uint64_t delay_ns)
+{
+	control_again = true;
+	control_again_ns = delay_ns;
+}
+
+void pulse_control_cancel(const void *key)
+{
+	struct pulse_control_cancel cancel = {key, NULL};
+
+	pthread_mutex_lock(&control_mutex);
+
+	/* a running callback may schedule its own key again, refuse that
+	 * until it returned and sweep until the key is neither pending nor
+	 * running */
+	cancel.next = control_cancels;
+	control_cancels = &cancel;
+
+	pulse_control_remove(key);
+	while (control_running == key) {
+		pthread_cond_wait(&control_cond, &control_mutex);
+		pulse_control_remove(key);
+	}
+
+	struct pulse_control_cancel **pos = &control_cancels;
+	while (*pos != &cancel)
+		pos = &(*pos)->next;
+	*pos = cancel.next;
+
+	pthread_mutex_unlock(&control_mutex);
+}
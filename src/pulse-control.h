@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#pragma once
+
+/**
+ * Callback executed on the control thread
+ *
+ * @param param the pointer passed to pulse_control_schedule()
+ * @param queued_ns time at which the call was first scheduled
+ */
+typedef void (*pulse_control_cb_t)(void *param, uint64_t queued_ns);
+
+/**
+ * Start the control thread and increase the reference count
+ *
+ * The control thread runs deferred work outside of the pulseaudio mainloop
+ * thread, which makes it safe to use the blocking pulse_ wrapper functions
+ * from there. Deadlines are taken from pulse_clock_now().
+ */
+int_fast32_t pulse_control_init();
+
+/**
+ * Decrease the reference count, the thread is stopped when it reaches zero
+ */
+void pulse_control_unref();
+
+/**
+ * Run a callback on the control thread after a delay
+ *
+ * Calls are coalesced by key: while a call for the key is pending, further
+ * calls are merged into it. A shorter delay pulls the pending deadline in,
+ * a longer one never pushes it out.
+ *
+ * @param key identifies the pending call, usually the owning object
+ * @param delay_ns time to wait before running the callback
+ *
+ * @return true if a new call was scheduled, false if it was coalesced or
+ *         the key is being cancelled
+ */
+bool pulse_control_schedule(const void *key, uint64_t delay_ns,
+			    pulse_control_cb_t cb, void *param);
+
+/**
+ * Run the calls that are due on the calling thread
+ *
+ * Lets tests drive the timers from a scripted clock, see pulse_clock_set(),
+ * without starting the control thread.
+ *
+ * @return number of calls that ran
+ */
+size_t pulse_control_run_due();
+
+/**
+ * Run the current callback again after a delay
+ *
+ * The call is put back by the control thread once the callback returned,
+ * like pulse_control_schedule() with the same key, callback and parameter
+ * would. Unlike scheduling its own key from inside the callback it is
+ * dropped when the key is cancelled meanwhile.
+ *
+ * @warning only call from a running callback
+ */
+void pulse_control_again(uint64_t delay_ns);
+
+/**
+ * Remove the pending call for a key
+ *
+ * If the callback for the key is currently running this function blocks
+ * until it returned. Calls scheduled for the key in the meantime, also from
+ * the callback itself, are refused, so no call for the key is pending or
+ * running once this returns.
+ *
+ * @warning do not call from the control thread
+ */
+void pulse_control_cancel(const void *key);
+
+#ifdef __cplusplus
+}
+#endif
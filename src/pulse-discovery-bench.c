@@ -0,0 +1,376 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Discovery scaling benchmark
+ *
+ * Drives the client and sink-input list callbacks of a rebind and of a
+ * batched discovery pass over synthetic server states of growing size,
+ * without a server, and prints the latency, CPU time and allocations of
+ * each. It sizes the discovery paths for busy multi-seat hosts and gives
+ * changes to them numbers to be held to.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pulse/introspect.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-journal.h"
+#include "pulse-match.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+/* each size is measured for at least this long */
+#define BENCH_DURATION_NS (200 * NSEC_PER_MSEC)
+/* client names share a long prefix, like the reverse domain names of
+ * flatpak apps, so the compares do not end at the first character */
+#define BENCH_NAME_FORMAT "org.example.application-%05zu"
+#define BENCH_NAME_MAX 32
+
+static const size_t bench_clients[] = {10, 100, 1000, 10000};
+static const size_t bench_sink_inputs[] = {1, 10, 100, 500};
+static const size_t bench_sources[] = {1, 8, 64};
+
+/**
+ * Synthetic server state
+ *
+ * The clients the sources want and their sink-inputs come last in the lists,
+ * so every source scans all of both.
+ */
+struct bench_server {
+	pa_client_info *clients;
+	char (*names)[BENCH_NAME_MAX];
+	size_t client_count;
+	pa_sink_input_info *sink_inputs;
+	size_t sink_input_count;
+};
+
+struct bench_source {
+	char client[BENCH_NAME_MAX];
+	struct pulse_match match;
+	struct bench_source *next;
+};
+
+/**
+ * Sources resolved by one batched discovery pass
+ */
+struct bench_discovery {
+	struct bench_source *sources;
+	size_t bound;
+};
+
+/**
+ * Cost of the paths at one size
+ */
+struct bench_result {
+	uint64_t rebinds;
+	uint64_t rebind_ns;
+	uint64_t rebind_max_ns;
+	uint64_t rebind_cpu_ns;
+	uint64_t rebind_allocs;
+	uint64_t passes;
+	uint64_t discovery_ns;
+	uint64_t discovery_cpu_ns;
+	uint64_t discovery_allocs;
+};
+
+/* the callbacks below do what those of the same name in pulse-app-input.cpp
+ * do, without the logging and the signal of the mainloop */
+
+static pthread_mutex_t discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void get_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+			      int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_match *m = (struct pulse_match *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX)
+		return;
+
+	pulse_journal_sink_input(i->index, i->client, i->sink);
+	pulse_match_add_sink_input(m, i->index, i->client, i->sink);
+}
+
+static void get_client_idx_cb(pa_context *c, const pa_client_info *i, int eol,
+			      void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_match *m = (struct pulse_match *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX)
+		return;
+
+	pulse_journal_client(i->index, i->name);
+	pulse_match_add_client(m, i->index, i->name);
+}
+
+static void discovery_client_cb(pa_context *c, const pa_client_info *i,
+				int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct bench_discovery *d = (struct bench_discovery *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX)
+		return;
+
+	pulse_journal_client(i->index, i->name);
+
+	pthread_mutex_lock(&discovery_mutex);
+	for (struct bench_source *s = d->sources; s; s = s->next)
+		pulse_match_add_client(&s->match, i->index, i->name);
+	pthread_mutex_unlock(&discovery_mutex);
+}
+
+static void discovery_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+				    int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct bench_discovery *d = (struct bench_discovery *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX)
+		return;
+
+	pulse_journal_sink_input(i->index, i->client, i->sink);
+
+	pthread_mutex_lock(&discovery_mutex);
+	for (struct bench_source *s = d->sources; s; s = s->next) {
+		if (pulse_match_add_sink_input(&s->match, i->index, i->client,
+					       i->sink))
+			d->bound++;
+	}
+	pthread_mutex_unlock(&discovery_mutex);
+}
+
+/**
+ * Hand the lists to a callback the way the server does, entry by entry
+ */
+static void bench_list_clients(const struct bench_server *srv,
+			       pa_client_info_cb_t cb, void *userdata)
+{
+	for (size_t i = 0; i < srv->client_count; i++)
+		cb(NULL, &srv->clients[i], 0, userdata);
+	cb(NULL, NULL, 1, userdata);
+}
+
+static void bench_list_sink_inputs(const struct bench_server *srv,
+				   pa_sink_input_info_cb_t cb, void *userdata)
+{
+	for (size_t i = 0; i < srv->sink_input_count; i++)
+		cb(NULL, &srv->sink_inputs[i], 0, userdata);
+	cb(NULL, NULL, 1, userdata);
+}
+
+static void bench_server_init(struct bench_server *srv, size_t clients,
+			      size_t sink_inputs)
+{
+	srv->client_count = clients;
+	srv->clients =
+		(pa_client_info *)bzalloc(sizeof(pa_client_info) * clients);
+	srv->names = (char(*)[BENCH_NAME_MAX])bzalloc(BENCH_NAME_MAX *
+						      clients);
+	for (size_t i = 0; i < clients; i++) {
+		snprintf(srv->names[i], BENCH_NAME_MAX, BENCH_NAME_FORMAT, i);
+		srv->clients[i].index = (uint32_t)i;
+		srv->clients[i].name = srv->names[i];
+	}
+
+	// the last sink-input belongs to the last client, the one before
+	// to the client before and so on
+	srv->sink_input_count = sink_inputs;
+	srv->sink_inputs = (pa_sink_input_info *)bzalloc(
+		sizeof(pa_sink_input_info) * sink_inputs);
+	for (size_t i = 0; i < sink_inputs; i++) {
+		pa_sink_input_info *si = &srv->sink_inputs[i];
+		size_t from_end = sink_inputs - 1 - i;
+		si->index = (uint32_t)i;
+		si->client = (uint32_t)(clients - 1 - from_end % clients);
+		si->sink = (uint32_t)(i % 4);
+	}
+}
+
+static void bench_server_free(struct bench_server *srv)
+{
+	bfree(srv->clients);
+	bfree(srv->names);
+	bfree(srv->sink_inputs);
+}
+
+static uint64_t bench_cpu_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Rebind a single source, mirrors pulse_rebind()
+ */
+static void bench_rebind(const struct bench_server *srv,
+			 struct bench_source *s, struct bench_result *r)
+{
+	long allocs = bnum_allocs();
+	uint64_t cpu = bench_cpu_ns();
+	uint64_t start = os_gettime_ns();
+
+	pulse_match_init(&s->match, s->client);
+	bench_list_clients(srv, get_client_idx_cb, &s->match);
+	if (s->match.client_idx != PA_INVALID_INDEX)
+		bench_list_sink_inputs(srv, get_sink_input_cb, &s->match);
+
+	uint64_t elapsed = os_gettime_ns() - start;
+	r->rebinds++;
+	r->rebind_ns += elapsed;
+	if (elapsed > r->rebind_max_ns)
+		r->rebind_max_ns = elapsed;
+	r->rebind_cpu_ns += bench_cpu_ns() - cpu;
+	r->rebind_allocs += (uint64_t)(bnum_allocs() - allocs);
+}
+
+/**
+ * Resolve all sources at once, mirrors pulse_discovery_pass()
+ *
+ * @return the sources bound
+ */
+static size_t bench_discovery(const struct bench_server *srv,
+			      struct bench_source *sources,
+			      struct bench_result *r)
+{
+	struct bench_discovery d = {sources, 0};
+	long allocs = bnum_allocs();
+	uint64_t cpu = bench_cpu_ns();
+	uint64_t start = os_gettime_ns();
+
+	for (struct bench_source *s = sources; s; s = s->next)
+		pulse_match_init(&s->match, s->client);
+	bench_list_clients(srv, discovery_client_cb, &d);
+	bench_list_sink_inputs(srv, discovery_sink_input_cb, &d);
+
+	r->passes++;
+	r->discovery_ns += os_gettime_ns() - start;
+	r->discovery_cpu_ns += bench_cpu_ns() - cpu;
+	r->discovery_allocs += (uint64_t)(bnum_allocs() - allocs);
+	return d.bound;
+}
+
+/**
+ * Measure one size
+ *
+ * @return false if the sources were not bound the way the rules bind them
+ */
+static bool bench_size(size_t clients, size_t sink_inputs, size_t sources)
+{
+	struct bench_server srv;
+	struct bench_result r;
+	bool ok = true;
+
+	bench_server_init(&srv, clients, sink_inputs);
+	memset(&r, 0, sizeof(r));
+
+	// the sources want the last clients, those with sink-inputs first
+	struct bench_source *list = (struct bench_source *)bzalloc(
+		sizeof(struct bench_source) * sources);
+	size_t expected = 0;
+	for (size_t i = 0; i < sources; i++) {
+		snprintf(list[i].client, BENCH_NAME_MAX, BENCH_NAME_FORMAT,
+			 clients - 1 - i % clients);
+		list[i].next = i + 1 < sources ? &list[i + 1] : NULL;
+		if (i % clients < sink_inputs)
+			expected++;
+	}
+
+	uint64_t deadline = os_gettime_ns() + BENCH_DURATION_NS;
+	while (ok && (r.passes < 3 || os_gettime_ns() < deadline)) {
+		for (size_t i = 0; i < sources; i++)
+			bench_rebind(&srv, &list[i], &r);
+		ok = bench_discovery(&srv, list, &r) == expected;
+	}
+
+	if (!ok)
+		blog(LOG_ERROR,
+		     "%zu clients, %zu sink-inputs, %zu sources: discovery "
+		     "bound the wrong sources",
+		     clients, sink_inputs, sources);
+	else
+		printf("%zu\t%zu\t%zu\t%.4f\t%.4f\t%.4f\t%.1f\t%.4f\t%.4f\t"
+		       "%.1f\n",
+		       clients, sink_inputs, sources,
+		       (double)r.rebind_ns / r.rebinds / NSEC_PER_MSEC,
+		       (double)r.rebind_max_ns / NSEC_PER_MSEC,
+		       (double)r.rebind_cpu_ns / r.rebinds / NSEC_PER_MSEC,
+		       (double)r.rebind_allocs / r.rebinds,
+		       (double)r.discovery_ns / r.passes / NSEC_PER_MSEC,
+		       (double)r.discovery_cpu_ns / r.passes / NSEC_PER_MSEC,
+		       (double)r.discovery_allocs / r.passes);
+	fflush(stdout);
+
+	bfree(list);
+	bench_server_free(&srv);
+	return ok;
+}
+
+static void bench_log(int lvl, const char *msg, va_list args, void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	if (lvl > LOG_WARNING)
+		return;
+
+	vfprintf(stderr, msg, args);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	UNUSED_PARAMETER(argv);
+	bool ok = true;
+
+	if (argc > 1) {
+		fprintf(stderr, "usage: obs-pulse-discovery-bench\n");
+		return 2;
+	}
+
+	base_set_log_handler(bench_log, NULL);
+
+	// the plugin journals every list entry, which is part of the cost
+	pulse_journal_start();
+
+	printf("clients\tsink_inputs\tsources\trebind_ms\trebind_max_ms\t"
+	       "rebind_cpu_ms\trebind_allocs\tdiscovery_ms\t"
+	       "discovery_cpu_ms\tdiscovery_allocs\n");
+
+	for (size_t c = 0; c < sizeof(bench_clients) / sizeof(size_t); c++)
+		for (size_t s = 0;
+		     s < sizeof(bench_sink_inputs) / sizeof(size_t); s++)
+			for (size_t n = 0;
+			     n < sizeof(bench_sources) / sizeof(size_t); n++)
+				ok = bench_size(bench_clients[c],
+						bench_sink_inputs[s],
+						bench_sources[n]) &&
+				     ok;
+
+	pulse_journal_stop(NULL);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBrush>
+#include <QDockWidget>
+#include <QHash>
+#include <QHeaderView>
+#include <QMainWindow>
+#include <QTableWidget>
+#include <QTimer>
+
+#include <obs-module.h>
+#include <obs-frontend-api.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-health.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+/* the snapshots are taken twice a second, there is no point in refreshing
+ * faster than that */
+#define DOCK_REFRESH_MS 1000
+
+enum {
+	COLUMN_SOURCE,
+	COLUMN_CLIENT,
+	COLUMN_STATE,
+	COLUMN_SINK_INPUT,
+	COLUMN_SINK,
+	COLUMN_FORMAT,
+	COLUMN_LATENCY,
+	COLUMN_RATE,
+	COLUMN_HOLES,
+	COLUMN_RESTARTS,
+	COLUMN_COUNT,
+};
+
+static const char *column_keys[COLUMN_COUNT] = {
+	"Health.Source",    "Health.Client",   "Health.State",
+	"Health.SinkInput", "Health.Sink",     "Health.Format",
+	"Health.Latency",   "Health.Callbacks", "Health.Holes",
+	"Health.Restarts",
+};
+
+/**
+ * Counters of the previous refresh, to turn them into rates
+ */
+struct pulse_dock_sample {
+	uint64_t reads;
+	uint64_t holes;
+	uint64_t restarts;
+	uint64_t ns;
+};
+
+/**
+ * Dock listing the health of all app capture sources
+ *
+ * Only reads the snapshots the stall watchdog takes, so refreshing it never
+ * touches the server or the audio path.
+ */
+class PulseHealthDock : public QDockWidget {
+public:
+	PulseHealthDock(QWidget *parent)
+		: QDockWidget(parent), table(new QTableWidget(this))
+	{
+		setObjectName("PulseAppCaptureHealth");
+		setWindowTitle(obs_module_text("Health.Title"));
+		setFeatures(QDockWidget::DockWidgetClosable |
+			    QDockWidget::DockWidgetMovable |
+			    QDockWidget::DockWidgetFloatable);
+
+		table->setColumnCount(COLUMN_COUNT);
+		QStringList labels;
+		for (const char *key : column_keys)
+			labels << obs_module_text(key);
+		table->setHorizontalHeaderLabels(labels);
+		table->horizontalHeader()->setSectionResizeMode(
+			QHeaderView::ResizeToContents);
+		table->verticalHeader()->setVisible(false);
+		table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+		table->setSelectionMode(QAbstractItemView::NoSelection);
+		setWidget(table);
+
+		QTimer *timer = new QTimer(this);
+		connect(timer, &QTimer::timeout, [this]() {
+			if (isVisible())
+				refresh();
+		});
+		timer->start(DOCK_REFRESH_MS);
+	}
+
+private:
+	QTableWidget *table;
+	QHash<uint32_t, struct pulse_dock_sample> previous;
+
+	void setCell(int row, int column, const QString &text, bool degraded)
+	{
+		QTableWidgetItem *item = table->item(row, column);
+		if (!item) {
+			item = new QTableWidgetItem();
+			table->setItem(row, column, item);
+		}
+		item->setText(text);
+		item->setForeground(degraded ? QBrush(Qt::red) : QBrush());
+	}
+
+	static const char *stateText(enum pulse_source_state state)
+	{
+		switch (state) {
+		case PULSE_SOURCE_CAPTURING:
+			return obs_module_text("Health.Capturing");
+		case PULSE_SOURCE_HELPER:
+			return obs_module_text("Health.Helper");
+		case PULSE_SOURCE_PAUSED:
+			return obs_module_text("Health.Paused");
+		case PULSE_SOURCE_DISCONNECTED:
+			return obs_module_text("Health.Disconnected");
+		default:
+			return obs_module_text("Health.Waiting");
+		}
+	}
+
+	static QString indexText(uint32_t idx)
+	{
+		return idx == PA_INVALID_INDEX ? QString("-")
+					       : QString::number(idx);
+	}
+
+	void refresh()
+	{
+		struct pulse_source_health *health;
+		size_t count = pulse_get_source_health(&health);
+		uint64_t now = os_gettime_ns();
+		QHash<uint32_t, struct pulse_dock_sample> current;
+
+		table->setRowCount((int)count);
+
+		for (size_t i = 0; i < count; i++) {
+			const struct pulse_source_health *h = &health[i];
+			const struct pulse_capture_health *c = &h->capture;
+			bool capturing = h->state == PULSE_SOURCE_CAPTURING;
+			int row = (int)i;
+
+			struct pulse_dock_sample sample;
+			sample.reads = c->reads;
+			sample.holes = c->holes + c->overflows;
+			sample.restarts = h->restarts;
+			sample.ns = now;
+			current.insert(h->id, sample);
+
+			// a new stream starts its counters over
+			bool known = previous.contains(h->id) &&
+				     previous[h->id].restarts == h->restarts &&
+				     previous[h->id].reads <= c->reads;
+			const struct pulse_dock_sample &last =
+				known ? previous[h->id] : sample;
+
+			double secs = (double)(now - last.ns) / NSEC_PER_SEC;
+			double rate = secs > 0.0 ? (double)(c->reads -
+							    last.reads) /
+							   secs
+						 : 0.0;
+
+			// no audio while capturing, or audio lost or a
+			// restart since the last refresh
+			bool stalled = capturing && known && !c->corked &&
+				       rate == 0.0;
+			bool holes = known && sample.holes > last.holes;
+			bool restarted = previous.contains(h->id) &&
+					 previous[h->id].restarts < h->restarts;
+
+			QString format("-");
+			QString latency("-");
+			QString callbacks("-");
+			if (capturing) {
+				const char *fmt =
+					pa_sample_format_to_string(c->format);
+				format = QString("%1 %2 Hz %3 ch")
+						 .arg(fmt)
+						 .arg(c->samples_per_sec)
+						 .arg(c->channels);
+				latency = QString::number(
+						  (double)c->latency_ns /
+							  NSEC_PER_MSEC,
+						  'f', 1) +
+					  " ms";
+			}
+			if (capturing && known)
+				callbacks = QString::number(rate, 'f', 1);
+
+			setCell(row, COLUMN_SOURCE, h->name, false);
+			setCell(row, COLUMN_CLIENT, h->client ? h->client : "",
+				false);
+			setCell(row, COLUMN_STATE,
+				capturing && h->whole_sink
+					? obs_module_text("Health.WholeSink")
+					: stateText(h->state),
+				stalled);
+			setCell(row, COLUMN_SINK_INPUT,
+				indexText(h->sink_input_idx), false);
+			setCell(row, COLUMN_SINK, indexText(h->sink_idx),
+				false);
+			setCell(row, COLUMN_FORMAT, format, false);
+			setCell(row, COLUMN_LATENCY, latency, false);
+			setCell(row, COLUMN_RATE, callbacks, stalled);
+			setCell(row, COLUMN_HOLES,
+				QString::number(sample.holes), holes);
+			setCell(row, COLUMN_RESTARTS,
+				QString("%1 (%2 %3)")
+					.arg(h->restarts)
+					.arg(h->stalls)
+					.arg(obs_module_text("Health.Stalls")),
+				restarted);
+		}
+
+		previous = current;
+		pulse_source_health_free(health, count);
+	}
+};
+
+extern "C" void register_health_dock();
+
+void register_health_dock()
+{
+	QMainWindow *main =
+		static_cast<QMainWindow *>(obs_frontend_get_main_window());
+	if (!main)
+		return;
+
+	PulseHealthDock *dock = new PulseHealthDock(main);
+	dock->setFloating(true);
+	dock->hide();
+	obs_frontend_add_dock(dock);
+}
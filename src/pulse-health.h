@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pulse-capture.h"
+
+#pragma once
+
+enum pulse_source_state {
+	/* the client or its sink-input is not there */
+	PULSE_SOURCE_WAITING,
+	PULSE_SOURCE_CAPTURING,
+	/* captured by the helper process, no counters available */
+	PULSE_SOURCE_HELPER,
+	/* released while the source is not in use */
+	PULSE_SOURCE_PAUSED,
+	PULSE_SOURCE_DISCONNECTED,
+};
+
+/**
+ * Health of one app capture source
+ *
+ * Taken by the stall watchdog twice a second, so it is at most that old.
+ */
+struct pulse_source_health {
+	/* numbered in creation order, stable for the lifetime of the source */
+	uint32_t id;
+	char *name;
+	char *client;
+	enum pulse_source_state state;
+
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	/* recording the whole sink, the sink-input is alone on it */
+	bool whole_sink;
+
+	/* counters of the current stream */
+	struct pulse_capture_health capture;
+
+	/* streams started after the first one, and the share of those that
+	 * were restarted by the watchdog */
+	uint64_t restarts;
+	uint64_t stalls;
+};
+
+/**
+ * Get the health of all app capture sources
+ *
+ * @return number of sources, free the array with pulse_source_health_free()
+ */
+size_t pulse_get_source_health(struct pulse_source_health **health);
+
+void pulse_source_health_free(struct pulse_source_health *health,
+			      size_t count);
+
+#ifdef __cplusplus
+}
+#endif
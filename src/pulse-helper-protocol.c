@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pulse-helper-protocol.h"
+
+bool pulse_helper_send(int sock, const struct pulse_helper_msg *msg,
+		       const int *fds, int nfds)
+{
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov;
+	struct msghdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	iov.iov_base = (void *)msg;
+	iov.iov_len = sizeof(*msg);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		memset(&control, 0, sizeof(control));
+		hdr.msg_control = control.buf;
+		hdr.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	ssize_t ret;
+	do {
+		ret = sendmsg(sock, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret == (ssize_t)sizeof(*msg);
+}
+
+bool pulse_helper_recv(int sock, struct pulse_helper_msg *msg, int *fds)
+{
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov;
+	struct msghdr hdr;
+
+	fds[0] = -1;
+	fds[1] = -1;
+
+	memset(&control, 0, sizeof(control));
+	memset(&hdr, 0, sizeof(hdr));
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control.buf;
+	hdr.msg_controllen = sizeof(control.buf);
+
+	ssize_t ret;
+	do {
+		ret = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+
+	// nothing was received, the control buffer holds no descriptors
+	if (ret <= 0)
+		return false;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+	     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		int *passed = (int *)CMSG_DATA(cmsg);
+		for (size_t i = 0; i < n; i++) {
+			if (i < 2)
+				fds[i] = passed[i];
+			else
+				close(passed[i]);
+		}
+	}
+
+	// descriptors that did not fit were closed by the kernel, the message
+	// is useless without them
+	if (ret != (ssize_t)sizeof(*msg) ||
+	    (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		for (int i = 0; i < 2; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+			fds[i] = -1;
+		}
+		return false;
+	}
+
+	msg->client[PULSE_HELPER_CLIENT_MAX - 1] = 0;
+	return true;
+}
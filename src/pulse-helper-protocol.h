@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#pragma once
+
+/*
+ * Messages exchanged between the plugin and the capture helper over a
+ * SOCK_SEQPACKET socket pair, the helper finds its end on a fixed fd.
+ */
+#define PULSE_HELPER_CONTROL_FD 3
+#define PULSE_HELPER_CLIENT_MAX 256
+
+enum pulse_helper_msg_type {
+	/* plugin -> helper: capture a client into a new ring */
+	PULSE_HELPER_START = 1,
+	/* plugin -> helper: stop a capture */
+	PULSE_HELPER_STOP,
+	/* helper -> plugin: ring for a capture, carries memfd and eventfd */
+	PULSE_HELPER_RING,
+};
+
+struct pulse_helper_msg {
+	uint32_t type;
+	uint32_t id;
+	uint32_t packet_frames;
+	uint32_t max_latency_ms;
+	uint32_t catchup;
+	char client[PULSE_HELPER_CLIENT_MAX];
+};
+
+/**
+ * Send a message, optionally passing up to two file descriptors
+ *
+ * The socket is never allowed to block, a peer that does not keep up is
+ * treated like a dead one.
+ *
+ * @return false if the message could not be sent
+ */
+bool pulse_helper_send(int sock, const struct pulse_helper_msg *msg,
+		       const int *fds, int nfds);
+
+/**
+ * Receive a message and the file descriptors passed with it
+ *
+ * @param fds receives up to two file descriptors, unused slots are set to -1
+ *
+ * @return false on error or if the peer closed the socket
+ */
+bool pulse_helper_recv(int sock, struct pulse_helper_msg *msg, int *fds);
+
+#ifdef __cplusplus
+}
+#endif
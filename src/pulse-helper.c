@@ -0,0 +1,566 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-helper.h"
+#include "pulse-helper-protocol.h"
+#include "pulse-realtime.h"
+
+#define NSEC_PER_MSEC 1000000L
+
+#define HELPER_NAME "obs-pulse-capture-helper"
+#define HELPER_RING_SIZE (1024 * 1024)
+#define HELPER_RESPAWN_NS (1000 * NSEC_PER_MSEC)
+/* killed helpers waiting to be reaped, and how often the reader thread
+ * looks for them */
+#define HELPER_ZOMBIES 8
+#define HELPER_REAP_MS 20
+/* the last capture waits this many rounds for the helper it killed */
+#define HELPER_FINAL_REAPS 5
+
+extern char **environ;
+
+struct pulse_helper_capture {
+	uint32_t id;
+	char *client;
+	uint_fast32_t packet_frames;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+	pulse_capture_output_t output;
+	void *param;
+
+	/* provided by the helper, NULL while it is (re)starting */
+	struct pulse_shm_ring *ring;
+
+	struct pulse_helper_capture *next;
+};
+
+/* serializes starting and stopping the reader thread */
+static pthread_mutex_t helper_lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* everything below is protected by helper_mutex */
+static pthread_mutex_t helper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_helper_capture *helper_captures = NULL;
+static uint32_t helper_next_id = 1;
+static pthread_t helper_thread;
+static bool helper_stop = false;
+static int helper_wake = -1;
+static int helper_sock = -1;
+static pid_t helper_pid = -1;
+static uint64_t helper_respawn_ns = 0;
+static uint_fast32_t helper_restarts = 0;
+static pid_t helper_zombies[HELPER_ZOMBIES];
+static size_t helper_zombie_count = 0;
+
+static void pulse_helper_signal()
+{
+	uint64_t one = 1;
+	if (write(helper_wake, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to wake helper thread: %s",
+		     strerror(errno));
+}
+
+/**
+ * Get the path of the helper executable, it is installed next to the plugin
+ */
+static char *pulse_helper_path()
+{
+	const char *module = obs_get_module_binary_path(obs_current_module());
+	const char *slash = module ? strrchr(module, '/') : NULL;
+	size_t dir_len = slash ? (size_t)(slash - module) + 1 : 0;
+
+	char *path = (char *)bmalloc(dir_len + sizeof(HELPER_NAME));
+	memcpy(path, module, dir_len);
+	memcpy(path + dir_len, HELPER_NAME, sizeof(HELPER_NAME));
+	return path;
+}
+
+static void pulse_helper_send_start(struct pulse_helper_capture *hc);
+
+/**
+ * Start the helper process and request all captures from it
+ *
+ * @note helper_mutex must be held
+ */
+static bool pulse_helper_spawn()
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		blog(LOG_ERROR, "Unable to create helper socket: %s",
+		     strerror(errno));
+		return false;
+	}
+
+	// dup2() onto itself keeps the close-on-exec flag
+	if (sv[1] == PULSE_HELPER_CONTROL_FD)
+		fcntl(sv[1], F_SETFD, 0);
+
+	// the helper runs its own mainloop, hand it the scheduling config
+	struct pulse_realtime_config config;
+	char policy[16];
+	char cpus[192];
+	pulse_realtime_get(&config);
+	pulse_realtime_format(&config, policy, sizeof(policy), cpus,
+			      sizeof(cpus));
+
+	char *path = pulse_helper_path();
+	char *argv[8];
+	int argc = 0;
+	argv[argc++] = path;
+	argv[argc++] = (char *)"-r";
+	argv[argc++] = policy;
+	if (*cpus) {
+		argv[argc++] = (char *)"-a";
+		argv[argc++] = cpus;
+	}
+	if (config.lock_memory)
+		argv[argc++] = (char *)"-m";
+	argv[argc] = NULL;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, sv[1],
+					 PULSE_HELPER_CONTROL_FD);
+
+	int ret = posix_spawn(&helper_pid, path, &actions, NULL, argv,
+			      environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	close(sv[1]);
+
+	if (ret != 0) {
+		blog(LOG_ERROR, "Unable to start '%s': %s", path,
+		     strerror(ret));
+		bfree(path);
+		close(sv[0]);
+		helper_pid = -1;
+		return false;
+	}
+
+	blog(LOG_INFO, "Started capture helper '%s' with pid %d", path,
+	     (int)helper_pid);
+	bfree(path);
+
+	helper_sock = sv[0];
+	for (struct pulse_helper_capture *hc = helper_captures; hc;
+	     hc = hc->next)
+		pulse_helper_send_start(hc);
+
+	return helper_sock >= 0;
+}
+
+/**
+ * Reap killed helpers that exited meanwhile
+ *
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_reap()
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < helper_zombie_count; i++) {
+		int status;
+		if (waitpid(helper_zombies[i], &status, WNOHANG) == 0)
+			helper_zombies[n++] = helper_zombies[i];
+	}
+	helper_zombie_count = n;
+}
+
+/**
+ * Stop the helper process and drop all rings
+ *
+ * The helper is killed right away, it holds nothing worth a clean exit. It
+ * is reaped later by the reader thread, so a helper stuck in the kernel
+ * never blocks the caller or anyone waiting for helper_mutex.
+ *
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_kill()
+{
+	if (helper_sock >= 0) {
+		close(helper_sock);
+		helper_sock = -1;
+	}
+
+	for (struct pulse_helper_capture *hc = helper_captures; hc;
+	     hc = hc->next) {
+		pulse_shm_ring_destroy(hc->ring);
+		hc->ring = NULL;
+	}
+
+	if (helper_pid < 0)
+		return;
+
+	kill(helper_pid, SIGKILL);
+
+	pulse_helper_reap();
+	if (helper_zombie_count == HELPER_ZOMBIES) {
+		// helpers that do not die even when killed, rather leave
+		// a zombie than block
+		blog(LOG_WARNING, "%d capture helpers did not exit",
+		     HELPER_ZOMBIES);
+		helper_zombie_count--;
+	}
+	helper_zombies[helper_zombie_count++] = helper_pid;
+	helper_pid = -1;
+}
+
+/**
+ * Handle a failed helper, it is restarted after HELPER_RESPAWN_NS
+ *
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_failed(const char *reason)
+{
+	blog(LOG_WARNING, "Capture helper %s, restarting it", reason);
+
+	pulse_helper_kill();
+	helper_respawn_ns = os_gettime_ns() + HELPER_RESPAWN_NS;
+	helper_restarts++;
+}
+
+/**
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_request(const struct pulse_helper_msg *msg)
+{
+	if (helper_sock < 0)
+		return;
+
+	if (!pulse_helper_send(helper_sock, msg, NULL, 0))
+		pulse_helper_failed("is not responding");
+}
+
+static void pulse_helper_send_start(struct pulse_helper_capture *hc)
+{
+	struct pulse_helper_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = PULSE_HELPER_START;
+	msg.id = hc->id;
+	msg.packet_frames = (uint32_t)hc->packet_frames;
+	msg.max_latency_ms = (uint32_t)(hc->max_latency_ns / NSEC_PER_MSEC);
+	msg.catchup = (uint32_t)hc->catchup;
+	snprintf(msg.client, sizeof(msg.client), "%s", hc->client);
+
+	pulse_helper_request(&msg);
+}
+
+static struct pulse_helper_capture *pulse_helper_find(uint32_t id)
+{
+	struct pulse_helper_capture *hc = helper_captures;
+	while (hc && hc->id != id)
+		hc = hc->next;
+	return hc;
+}
+
+/**
+ * Handle one message from the helper
+ *
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_receive()
+{
+	struct pulse_helper_msg msg;
+	int fds[2];
+
+	if (!pulse_helper_recv(helper_sock, &msg, fds)) {
+		pulse_helper_failed("exited");
+		return;
+	}
+
+	struct pulse_helper_capture *hc = pulse_helper_find(msg.id);
+
+	if (msg.type != PULSE_HELPER_RING || !hc || fds[0] < 0 ||
+	    fds[1] < 0) {
+		// a capture that was stopped in the meantime
+		if (fds[0] >= 0)
+			close(fds[0]);
+		if (fds[1] >= 0)
+			close(fds[1]);
+		return;
+	}
+
+	pulse_shm_ring_destroy(hc->ring);
+	hc->ring = pulse_shm_ring_open(fds[0], fds[1]);
+}
+
+/**
+ * Pass all packets in a ring on to obs
+ *
+ * @note helper_mutex must be held
+ */
+static void pulse_helper_drain(struct pulse_helper_capture *hc)
+{
+	struct obs_source_audio audio;
+
+	pulse_shm_ring_clear_event(hc->ring);
+
+	while (pulse_shm_ring_read(hc->ring, &audio)) {
+		hc->output(hc->param, &audio);
+		pulse_shm_ring_consume(hc->ring);
+	}
+}
+
+/**
+ * Reader thread, waits on the helper socket and all rings
+ *
+ * Holding helper_mutex while calling the output callbacks guarantees no
+ * callback runs for a capture after it was stopped.
+ */
+static void *pulse_helper_thread(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	os_set_thread_name("pulse-helper");
+
+	struct pollfd *fds = NULL;
+	uint32_t *ids = NULL;
+	size_t capacity = 0;
+
+	pthread_mutex_lock(&helper_mutex);
+
+	while (!helper_stop) {
+		uint64_t now = os_gettime_ns();
+		if (helper_sock < 0 && now >= helper_respawn_ns &&
+		    !pulse_helper_spawn()) {
+			helper_respawn_ns = now + HELPER_RESPAWN_NS;
+			helper_restarts++;
+		}
+
+		size_t count = 2;
+		for (struct pulse_helper_capture *hc = helper_captures; hc;
+		     hc = hc->next)
+			count++;
+
+		if (count > capacity) {
+			capacity = count;
+			fds = (struct pollfd *)brealloc(
+				fds, sizeof(struct pollfd) * capacity);
+			ids = (uint32_t *)brealloc(ids,
+						   sizeof(uint32_t) * capacity);
+		}
+
+		size_t n = 0;
+		fds[n].fd = helper_wake;
+		fds[n++].events = POLLIN;
+		fds[n].fd = helper_sock;
+		fds[n++].events = POLLIN;
+		for (struct pulse_helper_capture *hc = helper_captures; hc;
+		     hc = hc->next) {
+			if (!hc->ring)
+				continue;
+			ids[n] = hc->id;
+			fds[n].fd = pulse_shm_ring_eventfd(hc->ring);
+			fds[n++].events = POLLIN;
+		}
+
+		pulse_helper_reap();
+
+		int timeout = -1;
+		if (helper_sock < 0)
+			timeout = (int)((helper_respawn_ns - now) /
+					NSEC_PER_MSEC) +
+				  1;
+		if (helper_zombie_count &&
+		    (timeout < 0 || timeout > HELPER_REAP_MS))
+			timeout = HELPER_REAP_MS;
+
+		pthread_mutex_unlock(&helper_mutex);
+		int ret = poll(fds, n, timeout);
+		pthread_mutex_lock(&helper_mutex);
+
+		if (ret <= 0)
+			continue;
+
+		if (fds[0].revents) {
+			uint64_t value;
+			if (read(helper_wake, &value, sizeof(value)) < 0 &&
+			    errno != EAGAIN)
+				blog(LOG_WARNING, "Unable to clear wakeup: %s",
+				     strerror(errno));
+		}
+
+		// rings may have been replaced while polling, so only drain
+		// the ones that are still around
+		for (size_t i = 2; i < n; i++) {
+			if (!fds[i].revents)
+				continue;
+
+			struct pulse_helper_capture *hc =
+				pulse_helper_find(ids[i]);
+			if (hc && hc->ring &&
+			    pulse_shm_ring_eventfd(hc->ring) == fds[i].fd)
+				pulse_helper_drain(hc);
+		}
+
+		if (fds[1].revents && helper_sock >= 0 &&
+		    helper_sock == fds[1].fd)
+			pulse_helper_receive();
+	}
+
+	pthread_mutex_unlock(&helper_mutex);
+
+	bfree(fds);
+	bfree(ids);
+	return NULL;
+}
+
+struct pulse_helper_capture *
+pulse_helper_capture_start(const struct pulse_capture_params *params)
+{
+	struct pulse_helper_capture *hc = NULL;
+
+	pthread_mutex_lock(&helper_lifecycle_mutex);
+	pthread_mutex_lock(&helper_mutex);
+
+	if (!helper_captures) {
+		helper_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (helper_wake < 0) {
+			blog(LOG_ERROR, "Unable to create eventfd: %s",
+			     strerror(errno));
+			goto exit;
+		}
+
+		helper_stop = false;
+		helper_respawn_ns = 0;
+		helper_restarts = 0;
+		if (pthread_create(&helper_thread, NULL, pulse_helper_thread,
+				   NULL) != 0) {
+			blog(LOG_ERROR, "Unable to start helper thread");
+			close(helper_wake);
+			helper_wake = -1;
+			goto exit;
+		}
+	}
+
+	hc = (struct pulse_helper_capture *)bzalloc(
+		sizeof(struct pulse_helper_capture));
+	hc->id = helper_next_id++;
+	hc->client = bstrdup(params->client);
+	hc->packet_frames = params->packet_frames;
+	hc->max_latency_ns = params->max_latency_ns;
+	hc->catchup = params->catchup;
+	hc->output = params->output;
+	hc->param = params->param;
+	hc->next = helper_captures;
+	helper_captures = hc;
+
+	// a helper that is not running yet requests it when it starts
+	pulse_helper_send_start(hc);
+	pulse_helper_signal();
+
+exit:
+	pthread_mutex_unlock(&helper_mutex);
+	pthread_mutex_unlock(&helper_lifecycle_mutex);
+
+	return hc;
+}
+
+void pulse_helper_capture_stop(struct pulse_helper_capture *hc)
+{
+	if (!hc)
+		return;
+
+	pthread_mutex_lock(&helper_lifecycle_mutex);
+	pthread_mutex_lock(&helper_mutex);
+
+	struct pulse_helper_capture **pos = &helper_captures;
+	while (*pos && *pos != hc)
+		pos = &(*pos)->next;
+	if (*pos)
+		*pos = hc->next;
+
+	struct pulse_helper_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = PULSE_HELPER_STOP;
+	msg.id = hc->id;
+	pulse_helper_request(&msg);
+
+	pulse_shm_ring_destroy(hc->ring);
+	bool last = helper_captures == NULL;
+	if (last) {
+		helper_stop = true;
+		pulse_helper_signal();
+	}
+
+	pthread_mutex_unlock(&helper_mutex);
+
+	if (last) {
+		pthread_join(helper_thread, NULL);
+
+		pthread_mutex_lock(&helper_mutex);
+		pulse_helper_kill();
+		close(helper_wake);
+		helper_wake = -1;
+		if (helper_restarts)
+			blog(LOG_INFO,
+			     "Capture helper was restarted %" PRIuFAST32
+			     " times",
+			     helper_restarts);
+
+		pthread_mutex_unlock(&helper_mutex);
+
+		// the reader thread is gone, give the killed helper a moment
+		// to exit, without holding the mutex meanwhile; one that is
+		// still around is reaped by the next reader thread
+		for (int i = 0; i < HELPER_FINAL_REAPS; i++) {
+			pthread_mutex_lock(&helper_mutex);
+			pulse_helper_reap();
+			bool reaped = helper_zombie_count == 0;
+			pthread_mutex_unlock(&helper_mutex);
+
+			if (reaped)
+				break;
+			os_sleep_ms(HELPER_REAP_MS);
+		}
+	}
+
+	pthread_mutex_unlock(&helper_lifecycle_mutex);
+
+	bfree(hc->client);
+	bfree(hc);
+}
+
+bool pulse_helper_capture_get_state(struct pulse_helper_capture *hc,
+				    struct pulse_shm_ring_state *state)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&helper_mutex);
+	if (hc->ring)
+		ret = pulse_shm_ring_get_state(hc->ring, state);
+	pthread_mutex_unlock(&helper_mutex);
+
+	return ret;
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "pulse-capture.h"
+#include "pulse-shm-ring.h"
+
+#pragma once
+
+struct pulse_helper_capture;
+
+/**
+ * Capture a client through the out of process capture helper
+ *
+ * The helper owns the pulseaudio connection, finds the client and its
+ * sink-input on its own and passes the audio back through a shared memory
+ * ring. The helper is started with the first capture and restarted if it
+ * dies, all captures are then re-created transparently.
+ *
+ * Only the client, packet size, latency ceiling and output callback are
+ * used from the parameters, the output callback is called from the helper
+ * reader thread.
+ *
+ * @return the capture or NULL if the helper could not be started
+ *
+ * @note this never blocks on the pulseaudio server
+ */
+struct pulse_helper_capture *
+pulse_helper_capture_start(const struct pulse_capture_params *params);
+
+/**
+ * Stop a helper capture and free it
+ *
+ * No output callback is running or will run once this function returned.
+ */
+void pulse_helper_capture_stop(struct pulse_helper_capture *hc);
+
+/**
+ * Get the discovery state the helper published for a capture
+ *
+ * @return false if the helper has not provided a ring for it (yet) or left
+ *         the state half written
+ */
+bool pulse_helper_capture_get_state(struct pulse_helper_capture *hc,
+				    struct pulse_shm_ring_state *state);
+
+#ifdef __cplusplus
+}
+#endif
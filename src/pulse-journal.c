@@ -0,0 +1,768 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pulse/subscribe.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-journal.h"
+#include "pulse-match.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+#define PULSE_JOURNAL_MAGIC "PAJ"
+#define PULSE_JOURNAL_VERSION 2
+
+/* a source left unbound this long after the rules would have bound it
+ * missed the binding */
+#define REPLAY_BIND_GRACE_NS (1 * NSEC_PER_SEC)
+
+/**
+ * Header of a journal file, followed by the records oldest first
+ */
+struct pulse_journal_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t records;
+	/* records overwritten in the ring before they were written */
+	uint64_t dropped;
+};
+
+#ifdef PULSE_JOURNAL
+
+/* the most recent records are kept, older ones are overwritten */
+#define PULSE_JOURNAL_RECORDS 4096
+/* a journal file is moved aside once it holds this many records */
+#define PULSE_JOURNAL_FILE_RECORDS (64 * PULSE_JOURNAL_RECORDS)
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_journal_record *journal_records = NULL;
+static uint64_t journal_count = 0;
+/* records up to here are in the file */
+static uint64_t journal_flushed = 0;
+
+void pulse_journal_start()
+{
+	pthread_mutex_lock(&journal_mutex);
+
+	if (!journal_records) {
+		journal_records = (struct pulse_journal_record *)bzalloc(
+			sizeof(struct pulse_journal_record) *
+			PULSE_JOURNAL_RECORDS);
+		journal_count = 0;
+		journal_flushed = 0;
+	}
+
+	pthread_mutex_unlock(&journal_mutex);
+}
+
+void pulse_journal_add(uint32_t type, uint64_t ns, uint32_t source,
+		       uint32_t idx, uint32_t client, uint32_t sink,
+		       uint32_t event, const char *name)
+{
+	if (!ns)
+		ns = os_gettime_ns();
+
+	pthread_mutex_lock(&journal_mutex);
+
+	if (journal_records) {
+		struct pulse_journal_record *r =
+			&journal_records[journal_count++ %
+					 PULSE_JOURNAL_RECORDS];
+		memset(r, 0, sizeof(*r));
+		r->ns = ns;
+		r->type = type;
+		r->source = source;
+		r->idx = idx;
+		r->client = client;
+		r->sink = sink;
+		r->event = event;
+		if (name)
+			strncpy(r->name, name, PULSE_JOURNAL_NAME - 1);
+	}
+
+	pthread_mutex_unlock(&journal_mutex);
+}
+
+/**
+ * Open the journal file for appending, with its header read
+ *
+ * A full file, or one that is not a journal, is moved to path.1 and a new
+ * file is started in its place.
+ */
+static FILE *pulse_journal_open(const char *path,
+				struct pulse_journal_header *header)
+{
+	FILE *f = fopen(path, "r+b");
+
+	if (f && (fread(header, sizeof(*header), 1, f) != 1 ||
+		  memcmp(header->magic, PULSE_JOURNAL_MAGIC, 4) != 0 ||
+		  header->version != PULSE_JOURNAL_VERSION ||
+		  header->records >= PULSE_JOURNAL_FILE_RECORDS)) {
+		fclose(f);
+		f = NULL;
+
+		struct dstr rotated = {0};
+		dstr_printf(&rotated, "%s.1", path);
+		if (rename(path, rotated.array) < 0)
+			blog(LOG_WARNING, "Unable to rotate journal file '%s'",
+			     path);
+		dstr_free(&rotated);
+	}
+
+	if (!f) {
+		memset(header, 0, sizeof(*header));
+		memcpy(header->magic, PULSE_JOURNAL_MAGIC, 4);
+		header->version = PULSE_JOURNAL_VERSION;
+		f = fopen(path, "w+b");
+	}
+
+	return f;
+}
+
+/**
+ * Append the records added since the last flush to the journal file
+ */
+static bool pulse_journal_write(const char *path)
+{
+	pthread_mutex_lock(&journal_mutex);
+
+	if (!journal_records || journal_count == journal_flushed) {
+		pthread_mutex_unlock(&journal_mutex);
+		return true;
+	}
+
+	uint64_t first = journal_flushed;
+	if (journal_count - first > PULSE_JOURNAL_RECORDS)
+		first = journal_count - PULSE_JOURNAL_RECORDS;
+	uint64_t dropped = first - journal_flushed;
+	uint64_t count = journal_count - first;
+
+	// copied so records can be added while the file is written
+	struct pulse_journal_record *records =
+		(struct pulse_journal_record *)bmalloc(
+			sizeof(struct pulse_journal_record) * count);
+	for (uint64_t i = 0; i < count; i++)
+		records[i] =
+			journal_records[(first + i) % PULSE_JOURNAL_RECORDS];
+	journal_flushed = journal_count;
+
+	pthread_mutex_unlock(&journal_mutex);
+
+	struct pulse_journal_header header;
+	FILE *f = path ? pulse_journal_open(path, &header) : NULL;
+	bool ok = f != NULL;
+
+	if (ok) {
+		long offset = (long)(sizeof(header) +
+				     header.records * sizeof(*records));
+		header.records += count;
+		header.dropped += dropped;
+
+		ok = fseek(f, 0, SEEK_SET) == 0 &&
+		     fwrite(&header, sizeof(header), 1, f) == 1 &&
+		     fseek(f, offset, SEEK_SET) == 0 &&
+		     fwrite(records, sizeof(*records), count, f) == count;
+		ok = fclose(f) == 0 && ok;
+	}
+
+	bfree(records);
+	return ok;
+}
+
+static const char *pulse_journal_path(const char *path)
+{
+	const char *env = getenv("OBS_PULSE_JOURNAL_FILE");
+	return env && *env ? env : path;
+}
+
+void pulse_journal_flush(const char *path)
+{
+	path = pulse_journal_path(path);
+	if (!pulse_journal_write(path))
+		blog(LOG_ERROR, "Unable to write journal file '%s'",
+		     path ? path : "");
+}
+
+void pulse_journal_stop(const char *path)
+{
+	path = pulse_journal_path(path);
+	bool ok = path && pulse_journal_write(path);
+
+	pthread_mutex_lock(&journal_mutex);
+
+	struct pulse_journal_record *records = journal_records;
+	journal_records = NULL;
+	journal_count = 0;
+	journal_flushed = 0;
+
+	pthread_mutex_unlock(&journal_mutex);
+
+	if (!records || !path) {
+		bfree(records);
+		return;
+	}
+
+	if (ok)
+		blog(LOG_INFO, "Wrote the journal to '%s'", path);
+	else
+		blog(LOG_ERROR, "Unable to write journal file '%s'", path);
+
+	bfree(records);
+}
+
+#endif
+
+/* server state and sources rebuilt from a journal, the lists are kept in the
+ * order the server reported them */
+struct replay_client {
+	uint32_t idx;
+	char name[PULSE_JOURNAL_NAME];
+};
+
+struct replay_sink_input {
+	uint32_t idx;
+	uint32_t client;
+	uint32_t sink;
+};
+
+struct replay_source {
+	uint32_t id;
+	char name[PULSE_JOURNAL_NAME];
+	bool watched;
+
+	/* the binding the source published last and what the next
+	 * reconciliation acts on, kept by the same rules as the plugin */
+	struct pulse_match_state match;
+	uint64_t trigger_ns;
+};
+
+struct replay {
+	struct replay_client *clients;
+	size_t client_count;
+	struct replay_sink_input *sink_inputs;
+	size_t sink_input_count;
+	struct replay_source *sources;
+	size_t source_count;
+
+	/* an event waiting for the result of its query */
+	struct pulse_journal_record query;
+	bool querying;
+
+	uint64_t epoch;
+	uint64_t event_ns;
+	FILE *out;
+	struct pulse_journal_replay *result;
+};
+
+static struct replay_client *replay_client(struct replay *r, uint32_t idx)
+{
+	for (size_t i = 0; i < r->client_count; i++)
+		if (r->clients[i].idx == idx)
+			return &r->clients[i];
+	return NULL;
+}
+
+static struct replay_sink_input *replay_sink_input(struct replay *r,
+						   uint32_t idx)
+{
+	for (size_t i = 0; i < r->sink_input_count; i++)
+		if (r->sink_inputs[i].idx == idx)
+			return &r->sink_inputs[i];
+	return NULL;
+}
+
+static struct replay_source *replay_source(struct replay *r, uint32_t id)
+{
+	for (size_t i = 0; i < r->source_count; i++)
+		if (r->sources[i].id == id)
+			return &r->sources[i];
+
+	r->sources = (struct replay_source *)brealloc(
+		r->sources, sizeof(struct replay_source) * ++r->source_count);
+	struct replay_source *s = &r->sources[r->source_count - 1];
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	pulse_match_state_init(&s->match);
+	return s;
+}
+
+static void replay_print(struct replay *r, uint64_t ns,
+			 const struct replay_source *s, uint32_t sink_input,
+			 uint32_t sink, const char *verdict)
+{
+	fprintf(r->out, "%.3f\t%" PRIu32 "\t%s\t%" PRId32 "\t%" PRId32
+			"\t%.3f\t%s\n",
+		(double)(ns - r->epoch) / NSEC_PER_MSEC, s->id, s->name,
+		(int32_t)sink_input, (int32_t)sink,
+		r->event_ns && ns > r->event_ns
+			? (double)(ns - r->event_ns) / NSEC_PER_MSEC
+			: 0.0,
+		verdict);
+}
+
+/**
+ * Apply a subscription event to all sources, mirrors pulse_process_event()
+ *
+ * @param obj the query result of the event, not found if it was not queried
+ */
+static void replay_apply(struct replay *r,
+			 const struct pulse_journal_record *rec,
+			 const struct pulse_match_object *obj)
+{
+	uint32_t facility = rec->event & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	uint32_t type = rec->event & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+	for (size_t i = 0; i < r->source_count; i++) {
+		struct replay_source *s = &r->sources[i];
+		if (!s->watched)
+			continue;
+
+		enum pulse_match_action action = pulse_match_event(
+			&s->match, s->name, rec->event, rec->idx, obj);
+		if (action == PULSE_MATCH_NOW || action == PULSE_MATCH_LATER)
+			s->trigger_ns = rec->ns;
+
+		// a move of a bound sink-input shows up as a change only
+		if (action == PULSE_MATCH_NONE &&
+		    facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT &&
+		    type == PA_SUBSCRIPTION_EVENT_CHANGE &&
+		    s->match.sink_input_idx == rec->idx) {
+			r->result->ignored++;
+			replay_print(r, rec->ns, s, s->match.sink_input_idx,
+				     s->match.sink_idx, "change ignored");
+		}
+	}
+}
+
+/**
+ * Apply the event still waiting for its query, which failed
+ */
+static void replay_query_failed(struct replay *r)
+{
+	if (!r->querying)
+		return;
+
+	struct pulse_match_object obj;
+	memset(&obj, 0, sizeof(obj));
+	r->querying = false;
+	replay_apply(r, &r->query, &obj);
+}
+
+/**
+ * Apply the event waiting for a query with its result
+ */
+static void replay_query_done(struct replay *r, uint32_t facility,
+			      uint32_t idx,
+			      const struct pulse_match_object *obj)
+{
+	if (!r->querying || r->query.idx != idx ||
+	    (r->query.event & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != facility)
+		return;
+
+	r->querying = false;
+	replay_apply(r, &r->query, obj);
+}
+
+static void replay_set_client(struct replay *r,
+			      const struct pulse_journal_record *rec)
+{
+	struct replay_client *c = replay_client(r, rec->idx);
+	if (!c) {
+		r->clients = (struct replay_client *)brealloc(
+			r->clients,
+			sizeof(struct replay_client) * ++r->client_count);
+		c = &r->clients[r->client_count - 1];
+		c->idx = rec->idx;
+	}
+	memcpy(c->name, rec->name, PULSE_JOURNAL_NAME);
+	c->name[PULSE_JOURNAL_NAME - 1] = '\0';
+
+	struct pulse_match_object obj;
+	memset(&obj, 0, sizeof(obj));
+	obj.found = true;
+	obj.name = c->name;
+	replay_query_done(r, PA_SUBSCRIPTION_EVENT_CLIENT, rec->idx, &obj);
+}
+
+static void replay_set_sink_input(struct replay *r,
+				  const struct pulse_journal_record *rec)
+{
+	struct replay_sink_input *si = replay_sink_input(r, rec->idx);
+	if (!si) {
+		r->sink_inputs = (struct replay_sink_input *)brealloc(
+			r->sink_inputs, sizeof(struct replay_sink_input) *
+						++r->sink_input_count);
+		si = &r->sink_inputs[r->sink_input_count - 1];
+		si->idx = rec->idx;
+	}
+	si->client = rec->client;
+	si->sink = rec->sink;
+
+	struct pulse_match_object obj;
+	memset(&obj, 0, sizeof(obj));
+	obj.found = true;
+	obj.client = si->client;
+	obj.sink = si->sink;
+	replay_query_done(r, PA_SUBSCRIPTION_EVENT_SINK_INPUT, rec->idx,
+			  &obj);
+}
+
+/**
+ * Take a subscription event
+ *
+ * Events the plugin queried wait for the query result, which is journaled
+ * right after the event by the same thread. If it is missing when the next
+ * event comes, the query failed.
+ */
+static void replay_event(struct replay *r,
+			 const struct pulse_journal_record *rec)
+{
+	uint32_t facility = rec->event & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	uint32_t type = rec->event & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+	bool capturing_sink = false;
+
+	replay_query_failed(r);
+	r->event_ns = rec->ns;
+
+	if (type == PA_SUBSCRIPTION_EVENT_REMOVE &&
+	    facility == PA_SUBSCRIPTION_EVENT_CLIENT) {
+		struct replay_client *c = replay_client(r, rec->idx);
+		if (c)
+			memmove(c, c + 1,
+				(r->clients + --r->client_count - c) *
+					sizeof(*c));
+	} else if (type == PA_SUBSCRIPTION_EVENT_REMOVE &&
+		   facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT) {
+		struct replay_sink_input *si = replay_sink_input(r, rec->idx);
+		if (si)
+			memmove(si, si + 1,
+				(r->sink_inputs + --r->sink_input_count -
+				 si) * sizeof(*si));
+	}
+
+	for (size_t i = 0; i < r->source_count; i++)
+		capturing_sink = capturing_sink ||
+				 r->sources[i].match.capturing_sink;
+
+	if (pulse_match_event_query(rec->event, capturing_sink)) {
+		r->query = *rec;
+		r->querying = true;
+		return;
+	}
+
+	struct pulse_match_object obj;
+	memset(&obj, 0, sizeof(obj));
+	replay_apply(r, rec, &obj);
+}
+
+/**
+ * Full rebind against the rebuilt server state, mirrors pulse_rebind()
+ *
+ * Both lists are fed to the shared matching in the order the server
+ * reported them.
+ */
+static void replay_rebind(struct replay *r, const struct replay_source *s,
+			  uint32_t *sink_input, uint32_t *sink)
+{
+	struct pulse_match m;
+	pulse_match_init(&m, s->name);
+
+	for (size_t i = 0; i < r->client_count; i++)
+		pulse_match_add_client(&m, r->clients[i].idx,
+				       r->clients[i].name);
+	if (m.client_idx == PULSE_JOURNAL_NONE)
+		return;
+
+	for (size_t i = 0; i < r->sink_input_count; i++)
+		pulse_match_add_sink_input(&m, r->sink_inputs[i].idx,
+					   r->sink_inputs[i].client,
+					   r->sink_inputs[i].sink);
+	*sink_input = m.sink_input_idx;
+	*sink = m.sink_idx;
+}
+
+/**
+ * What the next reconciliation would bind, mirrors pulse_reconcile()
+ *
+ * Decides on a copy, the state moves on with what the plugin published.
+ */
+static void replay_decide(struct replay *r, const struct replay_source *s,
+			  uint32_t *sink_input, uint32_t *sink)
+{
+	struct pulse_match_state m = s->match;
+	struct pulse_match_decision d;
+
+	pulse_match_reconcile(&m, m.sink_input_idx != PULSE_JOURNAL_NONE,
+			      &d);
+
+	*sink_input = m.sink_input_idx;
+	*sink = m.sink_idx;
+	if (d.step == PULSE_MATCH_CONNECT) {
+		*sink_input = d.sink_input_idx;
+		*sink = d.sink_idx;
+	} else if (d.step == PULSE_MATCH_REBIND) {
+		replay_rebind(r, s, sink_input, sink);
+	}
+}
+
+/**
+ * Check a recorded binding against the rules and the server state
+ */
+static void replay_bind(struct replay *r,
+			const struct pulse_journal_record *rec)
+{
+	struct replay_source *s = replay_source(r, rec->source);
+	r->result->bindings++;
+	replay_query_failed(r);
+
+	// dropping the binding is a step on the way, the reconciliation
+	// that follows publishes the outcome
+	if (rec->idx == PULSE_JOURNAL_NONE) {
+		s->match.client_idx = rec->client;
+		s->match.sink_input_idx = PULSE_JOURNAL_NONE;
+		s->match.sink_idx = PULSE_JOURNAL_NONE;
+		s->match.capturing_sink = false;
+		if (s->match.lost) {
+			s->match.lost = false;
+			s->match.refresh = true;
+		}
+		replay_print(r, rec->ns, s, rec->idx, rec->sink, "unbound");
+		return;
+	}
+
+	uint32_t sink_input, sink;
+	replay_decide(r, s, &sink_input, &sink);
+
+	const struct replay_sink_input *si = replay_sink_input(r, rec->idx);
+	const struct replay_client *owner =
+		si ? replay_client(r, si->client) : NULL;
+	char verdict[128];
+
+	if (!s->watched || (!si && sink_input == PULSE_JOURNAL_NONE)) {
+		snprintf(verdict, sizeof(verdict), "unverified");
+	} else if (owner && !pulse_match_client(s->name, owner->name)) {
+		snprintf(verdict, sizeof(verdict),
+			 "mismatch: sink-input belongs to '%s'", owner->name);
+	} else if (si && si->sink != rec->sink) {
+		snprintf(verdict, sizeof(verdict),
+			 "mismatch: sink-input is on sink %" PRIu32, si->sink);
+	} else if (sink_input != PULSE_JOURNAL_NONE &&
+		   sink_input != rec->idx) {
+		snprintf(verdict, sizeof(verdict),
+			 "mismatch: rules chose sink-input %" PRIu32,
+			 sink_input);
+	} else {
+		snprintf(verdict, sizeof(verdict), "ok");
+	}
+
+	if (strcmp(verdict, "unverified") != 0)
+		r->result->checked++;
+	if (strncmp(verdict, "mismatch", 8) == 0)
+		r->result->mismatches++;
+	replay_print(r, rec->ns, s, rec->idx, rec->sink, verdict);
+
+	// continue from what actually happened
+	s->match.client_idx = rec->client;
+	s->match.sink_input_idx = rec->idx;
+	s->match.sink_idx = rec->sink;
+	s->match.capturing_sink = rec->event & PULSE_JOURNAL_WHOLE_SINK;
+	s->match.pending_sink_input_idx = PULSE_JOURNAL_NONE;
+	s->match.pending_sink_idx = PULSE_JOURNAL_NONE;
+	s->match.lost = false;
+	s->match.refresh = false;
+}
+
+/**
+ * Run the watchdog's verdict on a stalled stream, mirrors pulse_check_stall()
+ */
+static void replay_stall(struct replay *r,
+			 const struct pulse_journal_record *rec)
+{
+	struct replay_source *s = replay_source(r, rec->source);
+	struct pulse_match_object obj;
+	const char *verdict = "stall: restart";
+
+	replay_query_failed(r);
+
+	memset(&obj, 0, sizeof(obj));
+	obj.found = rec->event & PULSE_JOURNAL_FOUND;
+	obj.corked = rec->event & PULSE_JOURNAL_CORKED;
+	obj.client = rec->client;
+	obj.sink = rec->sink;
+
+	switch (pulse_match_stall(&s->match, &obj)) {
+	case PULSE_MATCH_STALL_REBIND:
+		s->trigger_ns = rec->ns;
+		verdict = "stall: rebind";
+		break;
+	case PULSE_MATCH_STALL_CORKED:
+		verdict = "stall: corked";
+		break;
+	case PULSE_MATCH_STALL_RESTART:
+		break;
+	}
+
+	replay_print(r, rec->ns, s, rec->idx, rec->sink, verdict);
+}
+
+/**
+ * A source that stays unbound although the rules bind it missed a binding
+ */
+static void replay_check_unbound(struct replay *r, struct replay_source *s,
+				 uint64_t ns)
+{
+	if (!s->watched || s->match.sink_input_idx != PULSE_JOURNAL_NONE ||
+	    ns < s->trigger_ns + REPLAY_BIND_GRACE_NS)
+		return;
+
+	uint32_t sink_input, sink;
+	replay_decide(r, s, &sink_input, &sink);
+	if (sink_input == PULSE_JOURNAL_NONE)
+		return;
+
+	char verdict[128];
+	snprintf(verdict, sizeof(verdict),
+		 "mismatch: never bound, rules chose sink-input %" PRIu32,
+		 sink_input);
+	r->result->checked++;
+	r->result->mismatches++;
+	replay_print(r, ns, s, PULSE_JOURNAL_NONE, PULSE_JOURNAL_NONE,
+		     verdict);
+}
+
+static void replay_watch(struct replay *r,
+			 const struct pulse_journal_record *rec)
+{
+	struct replay_source *s = replay_source(r, rec->source);
+
+	if (s->watched)
+		replay_check_unbound(r, s, rec->ns);
+
+	memcpy(s->name, rec->name, PULSE_JOURNAL_NAME);
+	s->name[PULSE_JOURNAL_NAME - 1] = '\0';
+	s->watched = *s->name != '\0';
+
+	// a new client starts with a batched discovery pass
+	pulse_match_state_init(&s->match);
+	s->match.refresh = s->watched;
+	s->trigger_ns = rec->ns;
+}
+
+static bool replay_read_header(FILE *f, const char *path)
+{
+	struct pulse_journal_header header;
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, PULSE_JOURNAL_MAGIC, 4) != 0 ||
+	    header.version != PULSE_JOURNAL_VERSION) {
+		blog(LOG_ERROR, "'%s' is not a journal", path);
+		return false;
+	}
+
+	if (header.dropped)
+		blog(LOG_WARNING,
+		     "the journal lost %" PRIu64 " records, bindings "
+		     "right after a gap may be flagged wrongly",
+		     header.dropped);
+	return true;
+}
+
+bool pulse_journal_replay(const char *path, FILE *out,
+			  struct pulse_journal_replay *result)
+{
+	memset(result, 0, sizeof(*result));
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		blog(LOG_ERROR, "Unable to open journal '%s'", path);
+		return false;
+	}
+	if (!replay_read_header(f, path)) {
+		fclose(f);
+		return false;
+	}
+
+	struct replay r;
+	memset(&r, 0, sizeof(r));
+	r.out = out;
+	r.result = result;
+
+	fprintf(out, "time_ms\tsource\tclient\tsink_input\tsink\t"
+		     "since_event_ms\tverdict\n");
+
+	uint64_t start = os_gettime_ns();
+	uint64_t last_ns = 0;
+	struct pulse_journal_record rec;
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (!result->records++)
+			r.epoch = rec.ns;
+		last_ns = rec.ns;
+		rec.name[PULSE_JOURNAL_NAME - 1] = '\0';
+
+		switch (rec.type) {
+		case PULSE_JOURNAL_EVENT:
+			replay_event(&r, &rec);
+			break;
+		case PULSE_JOURNAL_CLIENT:
+			replay_set_client(&r, &rec);
+			break;
+		case PULSE_JOURNAL_SINK_INPUT:
+			replay_set_sink_input(&r, &rec);
+			break;
+		case PULSE_JOURNAL_WATCH:
+			replay_watch(&r, &rec);
+			break;
+		case PULSE_JOURNAL_BIND:
+			replay_bind(&r, &rec);
+			break;
+		case PULSE_JOURNAL_STALL:
+			replay_stall(&r, &rec);
+			break;
+		default:
+			blog(LOG_WARNING, "skipping unknown record %" PRIu32,
+			     rec.type);
+			break;
+		}
+	}
+
+	replay_query_failed(&r);
+	for (size_t i = 0; i < r.source_count; i++)
+		replay_check_unbound(&r, &r.sources[i], last_ns);
+
+	result->replay_ns = os_gettime_ns() - start;
+	result->span_ns = last_ns - r.epoch;
+
+	bool ok = !ferror(f);
+	fclose(f);
+
+	bfree(r.clients);
+	bfree(r.sink_inputs);
+	bfree(r.sources);
+
+	return ok;
+}
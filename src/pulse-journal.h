@@ -0,0 +1,225 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#pragma once
+
+/*
+ * Journal of the server state the binding decisions were based on
+ *
+ * Subscription events, the results of the client and sink-input queries and
+ * every binding a source published are kept in a ring of fixed size records
+ * and appended to a file every few seconds and when the last source goes
+ * away. A full file is moved to <file>.1. The file can be replayed with
+ * obs-pulse-capture -R, which runs the binding rules against the recorded
+ * server state and checks every recorded decision.
+ */
+
+/* client names are truncated to fit a record */
+#define PULSE_JOURNAL_NAME 32
+
+enum pulse_journal_type {
+	/* subscription event: event, idx */
+	PULSE_JOURNAL_EVENT = 1,
+	/* client query result: idx, name */
+	PULSE_JOURNAL_CLIENT,
+	/* sink-input query result: idx, client, sink */
+	PULSE_JOURNAL_SINK_INPUT,
+	/* a source wants a client: source, name, or none if name is empty */
+	PULSE_JOURNAL_WATCH,
+	/* a source published a binding: source, client, idx, sink, and
+	 * PULSE_JOURNAL_WHOLE_SINK in event while it records the whole sink */
+	PULSE_JOURNAL_BIND,
+	/* the watchdog queried the sink-input of a stalled stream: source,
+	 * idx, client, sink, PULSE_JOURNAL_FOUND and PULSE_JOURNAL_CORKED in
+	 * event */
+	PULSE_JOURNAL_STALL,
+};
+
+/* flags of the event field */
+#define PULSE_JOURNAL_WHOLE_SINK 1
+#define PULSE_JOURNAL_FOUND 2
+#define PULSE_JOURNAL_CORKED 4
+
+/**
+ * One journal record, stored in host byte order
+ */
+struct pulse_journal_record {
+	uint64_t ns;
+	uint32_t type;
+	uint32_t source;
+	uint32_t idx;
+	uint32_t client;
+	uint32_t sink;
+	uint32_t event;
+	char name[PULSE_JOURNAL_NAME];
+};
+
+#ifdef PULSE_JOURNAL
+
+/**
+ * Start recording, the most recent records are kept
+ */
+void pulse_journal_start();
+
+/**
+ * Append the records added since the last flush to the journal file
+ *
+ * The file name is taken from the OBS_PULSE_JOURNAL_FILE environment
+ * variable and defaults to path. Records the ring overwrote in between are
+ * counted as dropped in the file header.
+ */
+void pulse_journal_flush(const char *path);
+
+/**
+ * Flush the journal and stop recording
+ *
+ * Without a path the records not flushed yet are dropped.
+ */
+void pulse_journal_stop(const char *path);
+
+/**
+ * Add a record, a no-op while not recording
+ *
+ * @param ns timestamp, 0 for now
+ */
+void pulse_journal_add(uint32_t type, uint64_t ns, uint32_t source,
+		       uint32_t idx, uint32_t client, uint32_t sink,
+		       uint32_t event, const char *name);
+
+#else
+
+static inline void pulse_journal_start() {}
+static inline void pulse_journal_flush(const char *path)
+{
+	(void)path;
+}
+static inline void pulse_journal_stop(const char *path)
+{
+	(void)path;
+}
+static inline void pulse_journal_add(uint32_t type, uint64_t ns,
+				     uint32_t source, uint32_t idx,
+				     uint32_t client, uint32_t sink,
+				     uint32_t event, const char *name)
+{
+	(void)type;
+	(void)ns;
+	(void)source;
+	(void)idx;
+	(void)client;
+	(void)sink;
+	(void)event;
+	(void)name;
+}
+
+#endif
+
+/* unused fields are set to PA_INVALID_INDEX */
+#define PULSE_JOURNAL_NONE UINT32_MAX
+
+static inline void pulse_journal_event(uint64_t ns, uint32_t event,
+				       uint32_t idx)
+{
+	pulse_journal_add(PULSE_JOURNAL_EVENT, ns, PULSE_JOURNAL_NONE, idx,
+			  PULSE_JOURNAL_NONE, PULSE_JOURNAL_NONE, event, NULL);
+}
+
+static inline void pulse_journal_client(uint32_t idx, const char *name)
+{
+	pulse_journal_add(PULSE_JOURNAL_CLIENT, 0, PULSE_JOURNAL_NONE, idx,
+			  PULSE_JOURNAL_NONE, PULSE_JOURNAL_NONE,
+			  PULSE_JOURNAL_NONE, name);
+}
+
+static inline void pulse_journal_sink_input(uint32_t idx, uint32_t client,
+					    uint32_t sink)
+{
+	pulse_journal_add(PULSE_JOURNAL_SINK_INPUT, 0, PULSE_JOURNAL_NONE,
+			  idx, client, sink, PULSE_JOURNAL_NONE, NULL);
+}
+
+static inline void pulse_journal_watch(uint32_t source, const char *client)
+{
+	pulse_journal_add(PULSE_JOURNAL_WATCH, 0, source, PULSE_JOURNAL_NONE,
+			  PULSE_JOURNAL_NONE, PULSE_JOURNAL_NONE,
+			  PULSE_JOURNAL_NONE, client);
+}
+
+static inline void pulse_journal_bind(uint32_t source, uint32_t client,
+				      uint32_t sink_input, uint32_t sink,
+				      bool whole_sink)
+{
+	pulse_journal_add(PULSE_JOURNAL_BIND, 0, source, sink_input, client,
+			  sink, whole_sink ? PULSE_JOURNAL_WHOLE_SINK : 0,
+			  NULL);
+}
+
+static inline void pulse_journal_stall(uint32_t source, uint32_t sink_input,
+				       bool found, bool corked,
+				       uint32_t client, uint32_t sink)
+{
+	pulse_journal_add(PULSE_JOURNAL_STALL, 0, source, sink_input, client,
+			  sink,
+			  (found ? PULSE_JOURNAL_FOUND : 0) |
+				  (corked ? PULSE_JOURNAL_CORKED : 0),
+			  NULL);
+}
+
+/**
+ * Outcome of a replay
+ */
+struct pulse_journal_replay {
+	uint64_t records;
+	/* time covered by the journal */
+	uint64_t span_ns;
+	/* bindings recorded, those checked against the rules and those the
+	 * rules disagree with */
+	uint64_t bindings;
+	uint64_t checked;
+	uint64_t mismatches;
+	/* sink-input changes of a bound stream nothing reacted to */
+	uint64_t ignored;
+	/* time the replay took */
+	uint64_t replay_ns;
+};
+
+/**
+ * Replay a journal through the binding rules
+ *
+ * Rebuilds the server state from the recorded events and query results and
+ * runs them through the same binding rules as the plugin, see pulse-match.h,
+ * including the verdicts of the watchdog on stalled streams. Each recorded
+ * binding is compared with the decision of the rules and with the recorded
+ * owner of the sink-input. The outcome is printed as one tab separated line
+ * per binding to out.
+ *
+ * @return false if the file could not be read
+ */
+bool pulse_journal_replay(const char *path, FILE *out,
+			  struct pulse_journal_replay *result);
+
+#ifdef __cplusplus
+}
+#endif
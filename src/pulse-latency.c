@@ -0,0 +1,669 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/util_uint64.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-wrapper.h"
+#include "pulse-shm-ring.h"
+#include "pulse-align.h"
+#include "pulse-latency.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+#define SINK_NAME "obs_pulse_latency"
+#define LATENCY_RATE 48000
+#define LATENCY_CHANNELS 2
+
+/* one 10 ms chirp every half second */
+#define BURST_PERIOD_FRAMES (LATENCY_RATE / 2)
+#define CHIRP_FRAMES 480
+#define CHIRP_START_HZ 500.0
+#define CHIRP_END_HZ 8000.0
+#define CHIRP_AMPLITUDE 0.5
+
+/* the first burst is played this long after the capture got going */
+#define ARM_DELAY_FRAMES (LATENCY_RATE / 10)
+
+#define MAX_BURSTS 4096
+#define RING_PACKETS 64
+
+/* playback buffer, small so the bursts are played soon after writing */
+#define PLAYBACK_USEC 20000
+/* time allowed for the first audio to arrive */
+#define START_TIMEOUT_NS (2 * NSEC_PER_SEC)
+
+/* two players share the sink, the second one only to check the alignment
+ * of the captures against the first */
+#define LATENCY_STREAMS 2
+/* bursts of the two players played this close together are paired */
+#define PAIR_WINDOW_NS (NSEC_PER_SEC / 4)
+
+struct pulse_latency;
+
+/**
+ * A player on the null sink and the capture of its sink-input
+ */
+struct latency_stream {
+	struct pulse_latency *l;
+
+	/* playback, owned by the mainloop thread */
+	pa_stream *player;
+	uint32_t player_idx;
+	uint64_t written;
+	uint64_t next_burst;
+	uint8_t *scratch;
+	size_t scratch_size;
+
+	/* play times of the bursts, protected by the mainloop lock */
+	uint64_t played[MAX_BURSTS];
+	uint_fast32_t bursts;
+
+	/* capture */
+	struct pulse_capture *capture;
+	struct pulse_shm_ring *ring;
+	bool started;
+
+	/* analysis, channel 0 of the captured audio, the raw samples are
+	 * kept at the same positions as the ones of the burst detection */
+	struct pulse_align align;
+	uint8_t *history_raw;
+	uint_fast32_t next_match;
+
+	/* detected bursts, to pair them across the streams */
+	uint64_t detected_played[MAX_BURSTS];
+	uint64_t detected_ts[MAX_BURSTS];
+
+	/* accumulated results */
+	uint_fast32_t detected;
+	uint_fast32_t exact;
+	double latency_sum;
+	double latency_sq;
+	double latency_max;
+	double ts_sum;
+	double ts_sq;
+};
+
+struct pulse_latency {
+	struct pulse_latency_params params;
+	pa_sample_spec spec;
+	enum audio_format audio_format;
+	size_t sample_bytes;
+
+	/* sink */
+	uint32_t module_idx;
+	uint32_t sink_idx;
+
+	/* the chirp, as float and as played in the sink format */
+	float chirp[CHIRP_FRAMES];
+	uint8_t *chirp_raw;
+
+	/* set once every capture delivers audio */
+	volatile long armed;
+
+	struct latency_stream streams[LATENCY_STREAMS];
+};
+
+static enum audio_format latency_audio_format(pa_sample_format_t format)
+{
+	switch (format) {
+	case PA_SAMPLE_S16LE:
+		return AUDIO_FORMAT_16BIT;
+	case PA_SAMPLE_S32LE:
+		return AUDIO_FORMAT_32BIT;
+	case PA_SAMPLE_FLOAT32LE:
+		return AUDIO_FORMAT_FLOAT;
+	default:
+		return AUDIO_FORMAT_UNKNOWN;
+	}
+}
+
+/**
+ * Convert a sample to the sink format
+ *
+ * @note the formats are little endian, like the hosts we run on
+ */
+static void latency_encode(struct pulse_latency *l, float value, uint8_t *out)
+{
+	if (l->audio_format == AUDIO_FORMAT_16BIT) {
+		int16_t v = (int16_t)lrintf(value * INT16_MAX);
+		memcpy(out, &v, sizeof(v));
+	} else if (l->audio_format == AUDIO_FORMAT_32BIT) {
+		int32_t v = (int32_t)lrint((double)value * INT32_MAX);
+		memcpy(out, &v, sizeof(v));
+	} else {
+		memcpy(out, &value, sizeof(value));
+	}
+}
+
+static float latency_decode(struct pulse_latency *l, const uint8_t *in)
+{
+	if (l->audio_format == AUDIO_FORMAT_16BIT) {
+		int16_t v;
+		memcpy(&v, in, sizeof(v));
+		return (float)v / INT16_MAX;
+	} else if (l->audio_format == AUDIO_FORMAT_32BIT) {
+		int32_t v;
+		memcpy(&v, in, sizeof(v));
+		return (float)((double)v / INT32_MAX);
+	}
+
+	float v;
+	memcpy(&v, in, sizeof(v));
+	return v;
+}
+
+static void latency_make_chirp(struct pulse_latency *l)
+{
+	l->chirp_raw = (uint8_t *)bmalloc(CHIRP_FRAMES * l->sample_bytes);
+	pulse_align_chirp(l->chirp, CHIRP_FRAMES, LATENCY_RATE, CHIRP_START_HZ,
+			  CHIRP_END_HZ, CHIRP_AMPLITUDE);
+
+	for (size_t n = 0; n < CHIRP_FRAMES; n++) {
+		latency_encode(l, l->chirp[n],
+			       l->chirp_raw + n * l->sample_bytes);
+		// correlate against what actually ends up in the sink
+		l->chirp[n] =
+			latency_decode(l, l->chirp_raw + n * l->sample_bytes);
+	}
+}
+
+static void latency_module_cb(pa_context *c, uint32_t idx, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_latency *l = (struct pulse_latency *)userdata;
+
+	l->module_idx = idx;
+	pulse_signal(0);
+}
+
+static void latency_sink_cb(pa_context *c, const pa_sink_info *i, int eol,
+			    void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_latency *l = (struct pulse_latency *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	if (i->owner_module == l->module_idx && strcmp(i->name, SINK_NAME) == 0)
+		l->sink_idx = i->index;
+}
+
+static void latency_unload_cb(pa_context *c, int success, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	UNUSED_PARAMETER(success);
+	UNUSED_PARAMETER(userdata);
+
+	pulse_signal(0);
+}
+
+/**
+ * Load the null sink the test signal is played into
+ */
+static bool latency_load_sink(struct pulse_latency *l)
+{
+	struct dstr args;
+
+	dstr_init(&args);
+	dstr_printf(&args,
+		    "sink_name=" SINK_NAME " format=%s rate=%d channels=%d "
+		    "sink_properties=device.description=obs-pulse-latency",
+		    pa_sample_format_to_string(l->spec.format), LATENCY_RATE,
+		    LATENCY_CHANNELS);
+
+	l->module_idx = PA_INVALID_INDEX;
+	l->sink_idx = PA_INVALID_INDEX;
+	pulse_load_new_module("module-null-sink", args.array,
+			      latency_module_cb, l);
+	dstr_free(&args);
+
+	if (l->module_idx == PA_INVALID_INDEX) {
+		blog(LOG_ERROR, "Unable to load the null sink");
+		return false;
+	}
+
+	pulse_get_sink_list(latency_sink_cb, l);
+	if (l->sink_idx == PA_INVALID_INDEX) {
+		blog(LOG_ERROR, "Null sink did not show up");
+		return false;
+	}
+
+	return true;
+}
+
+static void latency_player_state(pa_stream *p, void *userdata)
+{
+	UNUSED_PARAMETER(p);
+	UNUSED_PARAMETER(userdata);
+
+	pulse_signal(0);
+}
+
+/**
+ * Write callback of a player, silence with a burst every period
+ *
+ * The time a burst is played is estimated from the playback position of the
+ * stream when it is written.
+ */
+static void latency_player_write(pa_stream *p, size_t nbytes, void *userdata)
+{
+	struct latency_stream *s = (struct latency_stream *)userdata;
+	struct pulse_latency *l = s->l;
+	size_t frame_bytes = l->sample_bytes * LATENCY_CHANNELS;
+	size_t frames = nbytes / frame_bytes;
+	pa_usec_t played_usec = 0;
+
+	if (!frames)
+		return;
+
+	if (frames * frame_bytes > s->scratch_size) {
+		s->scratch_size = frames * frame_bytes;
+		s->scratch = (uint8_t *)brealloc(s->scratch, s->scratch_size);
+	}
+	memset(s->scratch, 0, frames * frame_bytes);
+
+	if (s->next_burst == UINT64_MAX && os_atomic_load_long(&l->armed))
+		s->next_burst = s->written + ARM_DELAY_FRAMES;
+
+	bool timed = pa_stream_get_time(p, &played_usec) == 0;
+	uint64_t now = os_gettime_ns();
+
+	for (size_t f = 0; f < frames; f++) {
+		uint64_t pos = s->written + f;
+		if (pos < s->next_burst)
+			continue;
+
+		uint64_t phase = pos - s->next_burst;
+		if (phase == 0 && s->bursts < MAX_BURSTS) {
+			uint64_t at = util_mul_div64(pos, NSEC_PER_SEC,
+						     LATENCY_RATE);
+			uint64_t played_ns = played_usec * 1000;
+			s->played[s->bursts++] =
+				timed && at >= played_ns
+					? now + (at - played_ns)
+					: 0;
+		}
+
+		for (int ch = 0; ch < LATENCY_CHANNELS; ch++)
+			memcpy(s->scratch + f * frame_bytes +
+				       ch * l->sample_bytes,
+			       l->chirp_raw + phase * l->sample_bytes,
+			       l->sample_bytes);
+
+		if (phase == CHIRP_FRAMES - 1)
+			s->next_burst += BURST_PERIOD_FRAMES;
+	}
+
+	pa_stream_write(p, s->scratch, frames * frame_bytes, NULL, 0,
+			PA_SEEK_RELATIVE);
+	s->written += frames;
+}
+
+/**
+ * Connect a player to the null sink and wait for its sink-input
+ */
+static bool latency_start_player(struct latency_stream *s)
+{
+	struct pulse_latency *l = s->l;
+
+	s->next_burst = UINT64_MAX;
+	s->player = pulse_stream_new("obs-pulse-latency", &l->spec, NULL);
+	if (!s->player)
+		return false;
+
+	pa_buffer_attr attr;
+	attr.maxlength = (uint32_t)-1;
+	attr.tlength = (uint32_t)pa_usec_to_bytes(PLAYBACK_USEC, &l->spec);
+	attr.prebuf = (uint32_t)-1;
+	attr.minreq = (uint32_t)-1;
+	attr.fragsize = (uint32_t)-1;
+
+	// the signal has to reach the sink unscaled to be bit exact
+	pa_cvolume volume;
+	volume.channels = LATENCY_CHANNELS;
+	for (int ch = 0; ch < LATENCY_CHANNELS; ch++)
+		volume.values[ch] = PA_VOLUME_NORM;
+
+	pa_stream_flags_t flags =
+		PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE |
+		PA_STREAM_ADJUST_LATENCY | PA_STREAM_START_UNMUTED;
+
+	pulse_lock();
+
+	pa_stream_set_state_callback(s->player, latency_player_state, s);
+	pa_stream_set_write_callback(s->player, latency_player_write, s);
+
+	bool ok = pa_stream_connect_playback(s->player, SINK_NAME, &attr,
+					     flags, &volume, NULL) == 0;
+	while (ok && pa_stream_get_state(s->player) == PA_STREAM_CREATING)
+		pulse_wait();
+
+	ok = ok && pa_stream_get_state(s->player) == PA_STREAM_READY;
+	if (ok)
+		s->player_idx = pa_stream_get_index(s->player);
+
+	pulse_unlock();
+
+	if (!ok)
+		blog(LOG_ERROR, "Unable to connect the player");
+	return ok;
+}
+
+static void latency_stop_player(struct latency_stream *s)
+{
+	if (!s->player)
+		return;
+
+	pulse_lock();
+	pa_stream_set_state_callback(s->player, NULL, NULL);
+	pa_stream_set_write_callback(s->player, NULL, NULL);
+	pa_stream_disconnect(s->player);
+	pulse_stream_release(s->player);
+	pulse_unlock();
+
+	s->player = NULL;
+}
+
+static void latency_output(void *param, const struct obs_source_audio *audio)
+{
+	struct latency_stream *s = (struct latency_stream *)param;
+
+	pulse_shm_ring_write(s->ring, audio);
+}
+
+/**
+ * Account a located burst
+ *
+ * The burst is matched with the play time of the last burst played before
+ * the packet holding it was delivered.
+ */
+static void latency_burst(struct latency_stream *s,
+			  const struct pulse_align_burst *burst)
+{
+	struct pulse_latency *l = s->l;
+
+	bool exact = true;
+	for (size_t n = 0; n < CHIRP_FRAMES && exact; n++) {
+		size_t slot = (burst->start + n) &
+			      (PULSE_ALIGN_HISTORY_FRAMES - 1);
+		exact = memcmp(s->history_raw + slot * l->sample_bytes,
+			       l->chirp_raw + n * l->sample_bytes,
+			       l->sample_bytes) == 0;
+	}
+
+	// the last burst played before the packet was delivered
+	uint64_t played = 0;
+	pulse_lock();
+	for (uint_fast32_t k = s->next_match; k < s->bursts; k++) {
+		if (!s->played[k] || s->played[k] > burst->delivered)
+			continue;
+		played = s->played[k];
+		s->next_match = k + 1;
+	}
+	pulse_unlock();
+
+	if (!played || s->detected >= MAX_BURSTS)
+		return;
+
+	double latency = (double)(burst->delivered - played);
+	double ts_error = (double)(int64_t)(burst->ts - played);
+
+	s->detected_played[s->detected] = played;
+	s->detected_ts[s->detected] = burst->ts;
+	s->detected++;
+	if (exact)
+		s->exact++;
+	s->latency_sum += latency;
+	s->latency_sq += latency * latency;
+	if (latency > s->latency_max)
+		s->latency_max = latency;
+	s->ts_sum += ts_error;
+	s->ts_sq += ts_error * ts_error;
+}
+
+/**
+ * Feed a captured packet to the burst detection
+ */
+static bool latency_packet(struct latency_stream *s,
+			   const struct obs_source_audio *audio, uint64_t now)
+{
+	struct pulse_latency *l = s->l;
+
+	if (audio->format != l->audio_format ||
+	    audio->samples_per_sec != LATENCY_RATE) {
+		blog(LOG_ERROR, "Captured audio is not in the sink format");
+		return false;
+	}
+
+	size_t frame_bytes =
+		get_audio_channels(audio->speakers) * l->sample_bytes;
+	pulse_align_packet(&s->align, audio->frames, audio->timestamp, now);
+
+	for (uint32_t f = 0; f < audio->frames; f++) {
+		const uint8_t *in = audio->data[0] + f * frame_bytes;
+		size_t slot =
+			s->align.position & (PULSE_ALIGN_HISTORY_FRAMES - 1);
+		struct pulse_align_burst burst;
+
+		memcpy(s->history_raw + slot * l->sample_bytes, in,
+		       l->sample_bytes);
+		if (pulse_align_sample(&s->align, latency_decode(l, in),
+				       &burst))
+			latency_burst(s, &burst);
+	}
+
+	return true;
+}
+
+static bool latency_start_capture(struct latency_stream *s)
+{
+	struct pulse_latency *l = s->l;
+	struct pulse_capture_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.name = "obs-pulse-latency-capture";
+	params.client = "obs-pulse-latency";
+	params.sink_input_idx = s->player_idx;
+	params.sink_idx = l->sink_idx;
+	params.packet_frames = l->params.packet_frames;
+	params.max_latency_ns = l->params.max_latency_ns;
+	params.catchup = l->params.catchup;
+	params.output = latency_output;
+	params.param = s;
+
+	s->capture = pulse_capture_start(&params);
+	return s->capture != NULL;
+}
+
+/**
+ * Capture the players until the duration is over
+ *
+ * The bursts start once every capture delivers audio.
+ */
+static bool latency_run(struct pulse_latency *l)
+{
+	for (int i = 0; i < LATENCY_STREAMS; i++)
+		if (!latency_start_capture(&l->streams[i]))
+			return false;
+
+	uint64_t deadline = os_gettime_ns() + START_TIMEOUT_NS;
+	bool started = false;
+
+	for (;;) {
+		uint64_t now = os_gettime_ns();
+		if (now >= deadline)
+			break;
+
+		struct pollfd fds[LATENCY_STREAMS];
+		for (int i = 0; i < LATENCY_STREAMS; i++) {
+			fds[i].fd = pulse_shm_ring_eventfd(l->streams[i].ring);
+			fds[i].events = POLLIN;
+		}
+		poll(fds, LATENCY_STREAMS,
+		     (int)((deadline - now) / NSEC_PER_MSEC) + 1);
+
+		for (int i = 0; i < LATENCY_STREAMS; i++) {
+			struct latency_stream *s = &l->streams[i];
+			struct obs_source_audio audio;
+
+			pulse_shm_ring_clear_event(s->ring);
+			while (pulse_shm_ring_read(s->ring, &audio)) {
+				bool ok = latency_packet(s, &audio,
+							 os_gettime_ns());
+				pulse_shm_ring_consume(s->ring);
+				if (!ok)
+					return false;
+				s->started = true;
+			}
+		}
+
+		if (started)
+			continue;
+
+		started = true;
+		for (int i = 0; i < LATENCY_STREAMS; i++)
+			started = started && l->streams[i].started;
+		if (started) {
+			os_atomic_set_long(&l->armed, 1);
+			deadline = os_gettime_ns() + l->params.duration_ns;
+		}
+	}
+
+	if (!started)
+		blog(LOG_ERROR, "No audio captured from the players");
+	return started;
+}
+
+/**
+ * Offset between the timestamps of the two captures
+ */
+static void latency_offset(struct pulse_latency *l,
+			   struct pulse_latency_result *result)
+{
+	const struct latency_stream *a = &l->streams[0];
+	const struct latency_stream *b = &l->streams[1];
+	struct pulse_align_offset offset;
+
+	pulse_align_offset(a->detected_played, a->detected_ts, a->detected,
+			   b->detected_played, b->detected_ts, b->detected,
+			   PAIR_WINDOW_NS, &offset);
+
+	result->paired = offset.paired;
+	result->offset_ns = offset.offset_ns;
+	result->offset_jitter_ns = offset.jitter_ns;
+	result->offset_max_ns = offset.max_ns;
+}
+
+bool pulse_latency_measure(const struct pulse_latency_params *params,
+			   struct pulse_latency_result *result)
+{
+	memset(result, 0, sizeof(*result));
+
+	struct pulse_latency *l =
+		(struct pulse_latency *)bzalloc(sizeof(struct pulse_latency));
+	l->params = *params;
+	l->spec.format = params->format;
+	l->spec.rate = LATENCY_RATE;
+	l->spec.channels = LATENCY_CHANNELS;
+	l->audio_format = latency_audio_format(params->format);
+	l->module_idx = PA_INVALID_INDEX;
+
+	bool ok = l->audio_format != AUDIO_FORMAT_UNKNOWN;
+	if (!ok) {
+		blog(LOG_ERROR, "Unsupported sample format %s",
+		     pa_sample_format_to_string(params->format));
+		bfree(l);
+		return false;
+	}
+
+	l->sample_bytes = get_audio_bytes_per_channel(l->audio_format);
+	latency_make_chirp(l);
+
+	size_t packet_bytes = params->packet_frames * LATENCY_CHANNELS *
+				      l->sample_bytes +
+			      64;
+	for (int i = 0; i < LATENCY_STREAMS; i++) {
+		struct latency_stream *s = &l->streams[i];
+		s->l = l;
+		pulse_align_init(&s->align, l->chirp, CHIRP_FRAMES,
+				 LATENCY_RATE);
+		s->history_raw = (uint8_t *)bzalloc(PULSE_ALIGN_HISTORY_FRAMES *
+						    l->sample_bytes);
+		s->ring = pulse_shm_ring_create(packet_bytes * RING_PACKETS);
+		ok = ok && s->ring;
+	}
+
+	ok = ok && latency_load_sink(l);
+	for (int i = 0; ok && i < LATENCY_STREAMS; i++)
+		ok = latency_start_player(&l->streams[i]);
+	ok = ok && latency_run(l);
+
+	for (int i = 0; i < LATENCY_STREAMS; i++) {
+		pulse_capture_stop(l->streams[i].capture);
+		latency_stop_player(&l->streams[i]);
+	}
+	if (l->module_idx != PA_INVALID_INDEX)
+		pulse_unload_module(l->module_idx, latency_unload_cb, NULL);
+	if (l->sink_idx != PA_INVALID_INDEX)
+		pulse_sink_cache_remove(l->sink_idx);
+
+	// the first stream is the one measured, the second one only checks
+	// the alignment
+	struct latency_stream *s = &l->streams[0];
+	result->bursts = s->bursts;
+	result->detected = s->detected;
+	result->exact = s->exact;
+	if (s->detected) {
+		double n = s->detected;
+		result->latency_ns = s->latency_sum / n;
+		result->latency_max_ns = s->latency_max;
+		result->jitter_ns = sqrt(fmax(
+			s->latency_sq / n - result->latency_ns *
+						    result->latency_ns,
+			0.0));
+		result->ts_error_ns = s->ts_sum / n;
+		result->ts_jitter_ns = sqrt(fmax(
+			s->ts_sq / n - result->ts_error_ns *
+					       result->ts_error_ns,
+			0.0));
+	}
+	latency_offset(l, result);
+
+	for (int i = 0; i < LATENCY_STREAMS; i++) {
+		pulse_shm_ring_destroy(l->streams[i].ring);
+		bfree(l->streams[i].scratch);
+		bfree(l->streams[i].history_raw);
+	}
+	bfree(l->chirp_raw);
+	bfree(l);
+
+	return ok;
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pulse/sample.h>
+
+#include "pulse-capture.h"
+
+#pragma once
+
+/**
+ * Settings of one loopback measurement
+ */
+struct pulse_latency_params {
+	/* format of the null sink and the test signal */
+	pa_sample_format_t format;
+
+	/* capture settings, see struct pulse_capture_params */
+	uint_fast32_t packet_frames;
+	uint64_t max_latency_ns;
+	enum pulse_catchup catchup;
+
+	/* how long to measure once the first audio arrived */
+	uint64_t duration_ns;
+};
+
+/**
+ * Outcome of one loopback measurement
+ *
+ * The latency is the time from a burst being played by the sink to the
+ * packet holding it being handed to the output, the timestamp error is the
+ * difference between the timestamp of the burst and the time it was played.
+ * The offset is how far the timestamps of a second capture on the same sink
+ * are from those of the first, for bursts played at the same time.
+ */
+struct pulse_latency_result {
+	/* bursts played, found in the capture and found unaltered */
+	uint_fast32_t bursts;
+	uint_fast32_t detected;
+	uint_fast32_t exact;
+
+	double latency_ns;
+	double latency_max_ns;
+	double jitter_ns;
+
+	double ts_error_ns;
+	double ts_jitter_ns;
+
+	/* bursts of both captures paired for the offset */
+	uint_fast32_t paired;
+	double offset_ns;
+	double offset_jitter_ns;
+	double offset_max_ns;
+};
+
+/**
+ * Measure the capture latency through a private null sink
+ *
+ * Loads a null sink in the requested format, plays a chirp twice a second
+ * into it from two streams and captures both through the capture engine,
+ * like two sources on the same sink. Every burst is located in the captures
+ * by cross-correlation with the chirp and compared sample by sample with
+ * what was played. The latency is measured on the first capture, the second
+ * one checks that the captures share the timing of the sink. The sink is
+ * unloaded again afterwards.
+ *
+ * Only s16le, s32le and float32le are supported.
+ *
+ * @return false if the measurement could not be set up or no audio arrived
+ *
+ * @warning blocks for the duration, never call from the mainloop thread
+ */
+bool pulse_latency_measure(const struct pulse_latency_params *params,
+			   struct pulse_latency_result *result);
+
+#ifdef __cplusplus
+}
+#endif
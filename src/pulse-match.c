@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <pulse/def.h>
+#include <pulse/subscribe.h>
+
+#include "pulse-match.h"
+
+bool pulse_match_client(const char *want, const char *name)
+{
+	return want && name && strcmp(want, name) == 0;
+}
+
+bool pulse_match_sink_input(uint32_t client_idx, uint32_t client)
+{
+	return client_idx != PA_INVALID_INDEX && client_idx == client;
+}
+
+void pulse_match_init(struct pulse_match *m, const char *client)
+{
+	m->client = client;
+	m->client_idx = PA_INVALID_INDEX;
+	m->sink_input_idx = PA_INVALID_INDEX;
+	m->sink_idx = PA_INVALID_INDEX;
+	m->scanned = 0;
+}
+
+bool pulse_match_add_client(struct pulse_match *m, uint32_t idx,
+			    const char *name)
+{
+	if (m->client_idx != PA_INVALID_INDEX)
+		return false;
+
+	m->scanned++;
+	if (!pulse_match_client(m->client, name))
+		return false;
+
+	m->client_idx = idx;
+	return true;
+}
+
+bool pulse_match_add_sink_input(struct pulse_match *m, uint32_t idx,
+				uint32_t client, uint32_t sink)
+{
+	if (m->sink_input_idx != PA_INVALID_INDEX)
+		return false;
+
+	m->scanned++;
+	if (!pulse_match_sink_input(m->client_idx, client))
+		return false;
+
+	m->sink_input_idx = idx;
+	m->sink_idx = sink;
+	return true;
+}
+
+void pulse_match_state_init(struct pulse_match_state *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->client_idx = PA_INVALID_INDEX;
+	s->sink_input_idx = PA_INVALID_INDEX;
+	s->sink_idx = PA_INVALID_INDEX;
+	s->pending_sink_input_idx = PA_INVALID_INDEX;
+	s->pending_sink_idx = PA_INVALID_INDEX;
+}
+
+bool pulse_match_event_query(uint32_t event, bool capturing_sink)
+{
+	uint32_t facility = event & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	uint32_t type = event & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+	if (type == PA_SUBSCRIPTION_EVENT_NEW)
+		return facility == PA_SUBSCRIPTION_EVENT_CLIENT ||
+		       facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT;
+
+	// changes are frequent, e.g. with every volume change, they only
+	// matter while a whole sink is recorded
+	return type == PA_SUBSCRIPTION_EVENT_CHANGE &&
+	       facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT && capturing_sink;
+}
+
+/**
+ * Whether a sink-input of another client is on the sink recorded as a whole
+ */
+static bool pulse_match_sink_shared(const struct pulse_match_state *s,
+				    const struct pulse_match_object *obj)
+{
+	return s->capturing_sink && s->sink_idx == obj->sink &&
+	       !pulse_match_sink_input(s->client_idx, obj->client);
+}
+
+static enum pulse_match_action
+pulse_match_client_event(struct pulse_match_state *s, const char *client,
+			 uint32_t type, uint32_t idx,
+			 const struct pulse_match_object *obj)
+{
+	if (type == PA_SUBSCRIPTION_EVENT_REMOVE) {
+		if (s->client_idx == idx)
+			s->client_idx = PA_INVALID_INDEX;
+		return PULSE_MATCH_NONE;
+	}
+
+	// a later client of the same name does not replace the first one
+	if (type != PA_SUBSCRIPTION_EVENT_NEW || !obj->found ||
+	    s->client_idx != PA_INVALID_INDEX ||
+	    !pulse_match_client(client, obj->name))
+		return PULSE_MATCH_NONE;
+
+	s->client_idx = idx;
+	return PULSE_MATCH_CLIENT;
+}
+
+static enum pulse_match_action
+pulse_match_sink_input_event(struct pulse_match_state *s, uint32_t type,
+			     uint32_t idx,
+			     const struct pulse_match_object *obj)
+{
+	enum pulse_match_action action = PULSE_MATCH_NONE;
+
+	switch (type) {
+	case PA_SUBSCRIPTION_EVENT_NEW:
+		if (!obj->found)
+			break;
+		if (pulse_match_sink_input(s->client_idx, obj->client)) {
+			s->pending_sink_input_idx = idx;
+			s->pending_sink_idx = obj->sink;
+			action = PULSE_MATCH_NOW;
+		}
+		if (pulse_match_sink_shared(s, obj))
+			action = PULSE_MATCH_NOW;
+		break;
+	case PA_SUBSCRIPTION_EVENT_CHANGE:
+		if (!obj->found)
+			break;
+		// a move shows up as a change only, the whole sink of the
+		// old sink is no longer ours
+		if (s->capturing_sink && s->sink_input_idx == idx &&
+		    s->sink_idx != obj->sink) {
+			s->refresh = true;
+			action = PULSE_MATCH_NOW;
+		}
+		if (pulse_match_sink_shared(s, obj))
+			action = PULSE_MATCH_NOW;
+		break;
+	case PA_SUBSCRIPTION_EVENT_REMOVE:
+		if (s->sink_input_idx == idx)
+			s->lost = true;
+		s->refresh = true;
+		action = PULSE_MATCH_LATER;
+		break;
+	}
+
+	return action;
+}
+
+enum pulse_match_action pulse_match_event(struct pulse_match_state *s,
+					  const char *client, uint32_t event,
+					  uint32_t idx,
+					  const struct pulse_match_object *obj)
+{
+	uint32_t facility = event & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	uint32_t type = event & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+	switch (facility) {
+	case PA_SUBSCRIPTION_EVENT_CLIENT:
+		return pulse_match_client_event(s, client, type, idx, obj);
+	case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+		return pulse_match_sink_input_event(s, type, idx, obj);
+	case PA_SUBSCRIPTION_EVENT_SINK:
+		if (type == PA_SUBSCRIPTION_EVENT_REMOVE &&
+		    s->sink_idx == idx)
+			s->lost = true;
+		else if (type != PA_SUBSCRIPTION_EVENT_NEW &&
+			 type != PA_SUBSCRIPTION_EVENT_REMOVE)
+			return PULSE_MATCH_NONE;
+		s->refresh = true;
+		return PULSE_MATCH_LATER;
+	default:
+		return PULSE_MATCH_NONE;
+	}
+}
+
+void pulse_match_reconcile(struct pulse_match_state *s, bool capturing,
+			   struct pulse_match_decision *d)
+{
+	bool refresh = s->refresh;
+
+	d->drop = s->lost;
+	d->step = PULSE_MATCH_KEEP;
+	d->sink_input_idx = s->pending_sink_input_idx;
+	d->sink_idx = s->pending_sink_idx;
+
+	s->pending_sink_input_idx = PA_INVALID_INDEX;
+	s->pending_sink_idx = PA_INVALID_INDEX;
+	s->refresh = false;
+
+	if (s->lost) {
+		s->lost = false;
+		s->sink_input_idx = PA_INVALID_INDEX;
+		s->sink_idx = PA_INVALID_INDEX;
+		s->capturing_sink = false;
+		capturing = false;
+		refresh = true;
+	}
+
+	if (d->sink_input_idx != PA_INVALID_INDEX && !capturing)
+		d->step = PULSE_MATCH_CONNECT;
+	else if (refresh)
+		d->step = PULSE_MATCH_REBIND;
+}
+
+enum pulse_match_stall
+pulse_match_stall(struct pulse_match_state *s,
+		  const struct pulse_match_object *sink_input)
+{
+	// the removal event may still be on its way, or the query timed out
+	if (!sink_input->found) {
+		s->refresh = true;
+		return PULSE_MATCH_STALL_REBIND;
+	}
+
+	if (sink_input->corked)
+		return PULSE_MATCH_STALL_CORKED;
+
+	s->sink_idx = sink_input->sink;
+	return PULSE_MATCH_STALL_RESTART;
+}
@@ -0,0 +1,214 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#pragma once
+
+/*
+ * Client and sink-input matching
+ *
+ * The rules that bind a source to the server state, shared by the plugin,
+ * the capture helper, the command line tool and the journal replay. A source
+ * wants a client by name, the first client of that name in server order and
+ * the first sink-input of that client win.
+ *
+ * The decisions the plugin takes on subscription events, reconciliations and
+ * stalls are pure functions of the source's state and the queried objects,
+ * so the journal replay runs exactly the same rules.
+ */
+
+/**
+ * Whether a client is the one a source wants
+ */
+bool pulse_match_client(const char *want, const char *name);
+
+/**
+ * Whether a sink-input belongs to the client a source is bound to
+ *
+ * Sink-inputs without a client never match, not even a source that has not
+ * found its client yet.
+ */
+bool pulse_match_sink_input(uint32_t client_idx, uint32_t client);
+
+/**
+ * Resolution of a client name against the client and sink-input lists
+ */
+struct pulse_match {
+	const char *client;
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	/* list entries looked at until the match was found */
+	uint64_t scanned;
+};
+
+/**
+ * Start resolving a client name, client must outlive the match
+ */
+void pulse_match_init(struct pulse_match *m, const char *client);
+
+/**
+ * Feed the next client of the client list
+ *
+ * @return true if this is the client
+ */
+bool pulse_match_add_client(struct pulse_match *m, uint32_t idx,
+			    const char *name);
+
+/**
+ * Feed the next sink-input of the sink-input list, after the clients
+ *
+ * @return true if this is the sink-input
+ */
+bool pulse_match_add_sink_input(struct pulse_match *m, uint32_t idx,
+				uint32_t client, uint32_t sink);
+
+/**
+ * Binding of a source as the binding rules see it
+ */
+struct pulse_match_state {
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+	/* the stream records the whole sink of the sink-input */
+	bool capturing_sink;
+
+	/* left by the events for the next reconciliation */
+	uint32_t pending_sink_input_idx;
+	uint32_t pending_sink_idx;
+	bool lost;
+	bool refresh;
+};
+
+/**
+ * Start without a binding
+ */
+void pulse_match_state_init(struct pulse_match_state *s);
+
+/**
+ * The client or sink-input an event is about, as queried after the event
+ */
+struct pulse_match_object {
+	/* false if the query failed or was not made */
+	bool found;
+	/* client */
+	const char *name;
+	/* sink-input */
+	uint32_t client;
+	uint32_t sink;
+	bool corked;
+};
+
+/**
+ * What a source has to do after an event
+ */
+enum pulse_match_action {
+	PULSE_MATCH_NONE,
+	/* the client of the source connected */
+	PULSE_MATCH_CLIENT,
+	/* reconcile right away */
+	PULSE_MATCH_NOW,
+	/* reconcile once the event window passed */
+	PULSE_MATCH_LATER,
+};
+
+/**
+ * Whether the object an event is about has to be queried for
+ * pulse_match_event()
+ *
+ * @param capturing_sink any source records a whole sink
+ */
+bool pulse_match_event_query(uint32_t event, bool capturing_sink);
+
+/**
+ * Apply a subscription event to the state of a source
+ *
+ * A new sink-input of the client is left for the next reconciliation,
+ * losing the sink-input or its sink and any other relevant event ask for a
+ * full rebind. While the whole sink is recorded a new or moved sink-input
+ * of another client on it, or the bound sink-input moving away, reconcile
+ * right away.
+ *
+ * @param client the client the source wants, NULL for none
+ * @param obj the queried object, see pulse_match_event_query()
+ */
+enum pulse_match_action pulse_match_event(struct pulse_match_state *s,
+					  const char *client, uint32_t event,
+					  uint32_t idx,
+					  const struct pulse_match_object *obj);
+
+/**
+ * Steps of a reconciliation
+ */
+enum pulse_match_step {
+	PULSE_MATCH_KEEP,
+	/* connect the sink-input that was handed over by an event */
+	PULSE_MATCH_CONNECT,
+	/* full rebind against the server state */
+	PULSE_MATCH_REBIND,
+};
+
+struct pulse_match_decision {
+	/* drop the lost binding and its stream first */
+	bool drop;
+	enum pulse_match_step step;
+	/* the sink-input to connect */
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+};
+
+/**
+ * Decide what a reconciliation does, consuming what the events left
+ *
+ * A pending sink-input binds a source without a stream right away, anything
+ * else that changed needs a full rebind. A dropped binding is cleared in
+ * the state.
+ *
+ * @param capturing a stream records the binding
+ */
+void pulse_match_reconcile(struct pulse_match_state *s, bool capturing,
+			   struct pulse_match_decision *d);
+
+/**
+ * What the watchdog does with a stalled stream
+ */
+enum pulse_match_stall {
+	/* the sink-input is gone or the query failed, rebind in another
+	 * reconciliation */
+	PULSE_MATCH_STALL_REBIND,
+	/* the client corked the sink-input itself, leave it alone */
+	PULSE_MATCH_STALL_CORKED,
+	/* restart the stream, on the sink the sink-input is on now */
+	PULSE_MATCH_STALL_RESTART,
+};
+
+/**
+ * Decide about a stalled stream from the queried sink-input
+ */
+enum pulse_match_stall
+pulse_match_stall(struct pulse_match_state *s,
+		  const struct pulse_match_object *sink_input);
+
+#ifdef __cplusplus
+}
+#endif
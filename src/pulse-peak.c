@@ -0,0 +1,327 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-wrapper.h"
+#include "pulse-peak.h"
+
+#define NSEC_PER_MSEC 1000000L
+
+/* rate of the peak streams, the server sends one peak per period */
+#define PEAK_RATE 25
+
+/**
+ * A sink-input being metered
+ */
+struct pulse_peak_stream {
+	uint32_t idx;
+	uint32_t client;
+	uint32_t sink;
+	/* position of the client in the result */
+	size_t slot;
+	pa_stream *stream;
+	float peak;
+	struct pulse_peak_stream *next;
+};
+
+/**
+ * A sink and the index of its monitor source
+ */
+struct pulse_peak_sink {
+	uint32_t idx;
+	uint32_t monitor;
+	struct pulse_peak_sink *next;
+};
+
+struct pulse_peak_scan {
+	struct pulse_peak_stream *streams;
+	struct pulse_peak_sink *sinks;
+	struct pulse_peak_client *clients;
+	size_t count;
+	/* level the clients start with */
+	float peak;
+};
+
+static void peak_sink_input_cb(pa_context *c, const pa_sink_input_info *i,
+			       int eol, void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_peak_scan *scan = (struct pulse_peak_scan *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	if (i->client == PA_INVALID_INDEX)
+		return;
+
+	struct pulse_peak_stream *s = (struct pulse_peak_stream *)bzalloc(
+		sizeof(struct pulse_peak_stream));
+	s->idx = i->index;
+	s->client = i->client;
+	s->sink = i->sink;
+	s->slot = (size_t)-1;
+	s->next = scan->streams;
+	scan->streams = s;
+}
+
+static void peak_sink_cb(pa_context *c, const pa_sink_info *i, int eol,
+			 void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_peak_scan *scan = (struct pulse_peak_scan *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	struct pulse_peak_sink *s = (struct pulse_peak_sink *)bzalloc(
+		sizeof(struct pulse_peak_sink));
+	s->idx = i->index;
+	s->monitor = i->monitor_source;
+	s->next = scan->sinks;
+	scan->sinks = s;
+}
+
+static void peak_client_cb(pa_context *c, const pa_client_info *i, int eol,
+			   void *userdata)
+{
+	UNUSED_PARAMETER(c);
+	struct pulse_peak_scan *scan = (struct pulse_peak_scan *)userdata;
+
+	if (eol || i->index == PA_INVALID_INDEX) {
+		pulse_signal(0);
+		return;
+	}
+
+	uint_fast32_t sink_inputs = 0;
+	for (struct pulse_peak_stream *s = scan->streams; s; s = s->next) {
+		if (s->client == i->index)
+			sink_inputs++;
+	}
+	if (!sink_inputs)
+		return;
+
+	// several connections of one app show up as clients with the same
+	// name, the picker can not tell them apart anyway
+	size_t slot = 0;
+	while (slot < scan->count &&
+	       strcmp(scan->clients[slot].name, i->name) != 0)
+		slot++;
+
+	if (slot == scan->count) {
+		scan->clients = (struct pulse_peak_client *)brealloc(
+			scan->clients,
+			sizeof(struct pulse_peak_client) * (scan->count + 1));
+		scan->clients[slot].name = bstrdup(i->name);
+		scan->clients[slot].sink_inputs = 0;
+		scan->clients[slot].peak = scan->peak;
+		scan->count++;
+	}
+
+	scan->clients[slot].sink_inputs += sink_inputs;
+	for (struct pulse_peak_stream *s = scan->streams; s; s = s->next) {
+		if (s->client == i->index)
+			s->slot = slot;
+	}
+}
+
+/**
+ * Read callback of the peak streams, every sample is a peak value
+ */
+static void peak_stream_read(pa_stream *p, size_t nbytes, void *userdata)
+{
+	UNUSED_PARAMETER(nbytes);
+	struct pulse_peak_stream *s = (struct pulse_peak_stream *)userdata;
+	const void *data;
+	size_t bytes;
+
+	while (pa_stream_peek(p, &data, &bytes) == 0 && bytes) {
+		if (data) {
+			const float *peaks = (const float *)data;
+			for (size_t n = 0; n < bytes / sizeof(float); n++) {
+				if (peaks[n] > s->peak)
+					s->peak = peaks[n];
+			}
+		}
+		pa_stream_drop(p);
+	}
+}
+
+/**
+ * Connect a peak detect stream to the monitor of a sink-input
+ */
+static void peak_stream_connect(struct pulse_peak_scan *scan,
+				struct pulse_peak_stream *s)
+{
+	struct pulse_peak_sink *sink = scan->sinks;
+	while (sink && sink->idx != s->sink)
+		sink = sink->next;
+	if (!sink)
+		return;
+
+	pa_sample_spec spec;
+	spec.format = PA_SAMPLE_FLOAT32LE;
+	spec.rate = PEAK_RATE;
+	spec.channels = 1;
+
+	s->stream = pulse_stream_new("peak", &spec, NULL);
+	if (!s->stream)
+		return;
+
+	pa_buffer_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.maxlength = (uint32_t)-1;
+	attr.fragsize = sizeof(float);
+
+	char dev[16];
+	snprintf(dev, sizeof(dev), "%" PRIu32, sink->monitor);
+
+	pulse_lock();
+	pa_stream_set_read_callback(s->stream, peak_stream_read, s);
+	pa_stream_set_monitor_stream(s->stream, s->idx);
+	if (pa_stream_connect_record(s->stream, dev, &attr,
+				     PA_STREAM_DONT_MOVE |
+					     PA_STREAM_PEAK_DETECT |
+					     PA_STREAM_ADJUST_LATENCY) < 0) {
+		pa_stream_set_read_callback(s->stream, NULL, NULL);
+		pulse_stream_release(s->stream);
+		s->stream = NULL;
+	}
+	pulse_unlock();
+}
+
+static int peak_client_compare(const void *a, const void *b)
+{
+	const struct pulse_peak_client *ca =
+		(const struct pulse_peak_client *)a;
+	const struct pulse_peak_client *cb =
+		(const struct pulse_peak_client *)b;
+
+	if (ca->peak != cb->peak)
+		return ca->peak < cb->peak ? 1 : -1;
+	return strcmp(ca->name, cb->name);
+}
+
+size_t pulse_peak_scan(struct pulse_peak_client **clients, uint64_t window_ns)
+{
+	struct pulse_peak_scan scan;
+	memset(&scan, 0, sizeof(scan));
+	*clients = NULL;
+
+	if (pulse_get_sink_input_info_list(peak_sink_input_cb, &scan) < 0 ||
+	    pulse_get_client_info_list(peak_client_cb, &scan) < 0 ||
+	    pulse_get_sink_info_list(peak_sink_cb, &scan) < 0)
+		goto exit;
+
+	for (struct pulse_peak_stream *s = scan.streams; s; s = s->next)
+		peak_stream_connect(&scan, s);
+
+	os_sleep_ms((uint32_t)(window_ns / NSEC_PER_MSEC));
+
+	pulse_lock();
+	for (struct pulse_peak_stream *s = scan.streams; s; s = s->next) {
+		if (!s->stream)
+			continue;
+
+		pa_stream_set_read_callback(s->stream, NULL, NULL);
+		pa_stream_disconnect(s->stream);
+		pulse_stream_release(s->stream);
+
+		if (s->slot != (size_t)-1 &&
+		    s->peak > scan.clients[s->slot].peak)
+			scan.clients[s->slot].peak = s->peak;
+	}
+	pulse_unlock();
+
+exit:
+	while (scan.streams) {
+		struct pulse_peak_stream *s = scan.streams;
+		scan.streams = s->next;
+		bfree(s);
+	}
+	while (scan.sinks) {
+		struct pulse_peak_sink *s = scan.sinks;
+		scan.sinks = s->next;
+		bfree(s);
+	}
+
+	if (scan.count > 1)
+		qsort(scan.clients, scan.count,
+		      sizeof(struct pulse_peak_client), peak_client_compare);
+
+	*clients = scan.clients;
+	return scan.count;
+}
+
+size_t pulse_peak_list(struct pulse_peak_client **clients)
+{
+	struct pulse_peak_scan scan;
+	memset(&scan, 0, sizeof(scan));
+	scan.peak = PULSE_PEAK_UNKNOWN;
+
+	if (pulse_get_sink_input_info_list(peak_sink_input_cb, &scan) == 0)
+		pulse_get_client_info_list(peak_client_cb, &scan);
+
+	while (scan.streams) {
+		struct pulse_peak_stream *s = scan.streams;
+		scan.streams = s->next;
+		bfree(s);
+	}
+
+	if (scan.count > 1)
+		qsort(scan.clients, scan.count,
+		      sizeof(struct pulse_peak_client), peak_client_compare);
+
+	*clients = scan.clients;
+	return scan.count;
+}
+
+void pulse_peak_order(struct pulse_peak_client *clients, size_t count,
+		      const struct pulse_peak_client *levels,
+		      size_t level_count)
+{
+	for (size_t n = 0; n < count; n++) {
+		for (size_t l = 0; l < level_count; l++) {
+			if (strcmp(clients[n].name, levels[l].name) == 0) {
+				clients[n].peak = levels[l].peak;
+				break;
+			}
+		}
+	}
+
+	if (count > 1)
+		qsort(clients, count, sizeof(struct pulse_peak_client),
+		      peak_client_compare);
+}
+
+void pulse_peak_free(struct pulse_peak_client *clients, size_t count)
+{
+	for (size_t n = 0; n < count; n++)
+		bfree(clients[n].name);
+	bfree(clients);
+}
@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#pragma once
+
+/**
+ * A client playing audio, with the level of its streams
+ */
+struct pulse_peak_client {
+	char *name;
+	uint_fast32_t sink_inputs;
+	/* highest peak seen on any of its sink-inputs, 0.0 to 1.0, or
+	 * PULSE_PEAK_UNKNOWN */
+	float peak;
+};
+
+/* level of a client that was not metered */
+#define PULSE_PEAK_UNKNOWN -1.0f
+
+/**
+ * Get the clients that have sink-inputs, by name, without their levels
+ *
+ * Only lists the clients and sink-inputs, which takes two round trips to
+ * the server.
+ *
+ * @return number of clients, free the array with pulse_peak_free()
+ *
+ * @warning blocks on the server, never call from the mainloop thread
+ */
+size_t pulse_peak_list(struct pulse_peak_client **clients);
+
+/**
+ * Order clients by the levels of a scan, loudest first
+ *
+ * Clients missing from the scan keep an unknown level and go last.
+ *
+ * @param levels clients as returned by pulse_peak_scan()
+ */
+void pulse_peak_order(struct pulse_peak_client *clients, size_t count,
+		      const struct pulse_peak_client *levels,
+		      size_t level_count);
+
+/**
+ * Get the clients that have sink-inputs, loudest first
+ *
+ * Levels are measured with peak detect monitor streams, which the server
+ * feeds with one float per period at a very low rate, so this is far cheaper
+ * than capturing the audio. Clients with the same name are merged.
+ *
+ * @param window_ns how long to listen for peaks
+ *
+ * @return number of clients, free the array with pulse_peak_free()
+ *
+ * @warning blocks for the window, never call from the mainloop thread
+ */
+size_t pulse_peak_scan(struct pulse_peak_client **clients, uint64_t window_ns);
+
+/**
+ * Free the clients returned by pulse_peak_scan()
+ */
+void pulse_peak_free(struct pulse_peak_client *clients, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,299 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <util/base.h>
+#include <util/threading.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-realtime.h"
+
+static pthread_mutex_t realtime_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_realtime_config realtime_config = {SCHED_OTHER, 0, 0,
+						       false};
+/* serializes loading, callers wait for a load in progress */
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pulse_realtime_loader_t realtime_loader = NULL;
+static bool realtime_loaded = false;
+static volatile long lock_failed = 0;
+
+static const char *pulse_realtime_policy_name(int policy)
+{
+	switch (policy) {
+	case SCHED_FIFO:
+		return "fifo";
+	case SCHED_RR:
+		return "rr";
+	default:
+		return "other";
+	}
+}
+
+void pulse_realtime_configure(const struct pulse_realtime_config *config)
+{
+	pthread_mutex_lock(&realtime_mutex);
+	realtime_config = *config;
+	realtime_loaded = true;
+	pthread_mutex_unlock(&realtime_mutex);
+}
+
+void pulse_realtime_set_loader(pulse_realtime_loader_t load)
+{
+	pthread_mutex_lock(&realtime_mutex);
+	realtime_loader = load;
+	pthread_mutex_unlock(&realtime_mutex);
+}
+
+void pulse_realtime_load()
+{
+	pthread_mutex_lock(&load_mutex);
+
+	pthread_mutex_lock(&realtime_mutex);
+	pulse_realtime_loader_t load = realtime_loaded ? NULL
+						       : realtime_loader;
+	struct pulse_realtime_config config = realtime_config;
+	realtime_loaded = true;
+	pthread_mutex_unlock(&realtime_mutex);
+
+	if (load) {
+		load(&config);
+
+		pthread_mutex_lock(&realtime_mutex);
+		realtime_config = config;
+		pthread_mutex_unlock(&realtime_mutex);
+	}
+
+	pthread_mutex_unlock(&load_mutex);
+}
+
+void pulse_realtime_get(struct pulse_realtime_config *config)
+{
+	pulse_realtime_load();
+
+	pthread_mutex_lock(&realtime_mutex);
+	*config = realtime_config;
+	pthread_mutex_unlock(&realtime_mutex);
+}
+
+/**
+ * Set a realtime policy, falling back to the priority allowed by
+ * RLIMIT_RTPRIO
+ */
+static void pulse_realtime_set_policy(int policy, int priority)
+{
+	int min = sched_get_priority_min(policy);
+	int max = sched_get_priority_max(policy);
+	if (priority < min)
+		priority = min;
+	if (priority > max)
+		priority = max;
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	int ret = pthread_setschedparam(pthread_self(), policy, &param);
+	if (ret == EPERM) {
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+		    limit.rlim_cur != RLIM_INFINITY &&
+		    (rlim_t)priority > limit.rlim_cur &&
+		    (int)limit.rlim_cur >= min) {
+			blog(LOG_WARNING,
+			     "priority %d denied, RLIMIT_RTPRIO allows %d",
+			     priority, (int)limit.rlim_cur);
+			param.sched_priority = (int)limit.rlim_cur;
+			ret = pthread_setschedparam(pthread_self(), policy,
+						    &param);
+		}
+	}
+
+	if (ret != 0) {
+		blog(LOG_WARNING,
+		     "Unable to set %s scheduling, keeping the default: %s",
+		     pulse_realtime_policy_name(policy), strerror(ret));
+		return;
+	}
+
+	blog(LOG_INFO, "mainloop thread uses %s scheduling at priority %d",
+	     pulse_realtime_policy_name(policy), param.sched_priority);
+}
+
+static void pulse_realtime_set_affinity(uint64_t cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu = 0; cpu < 64; cpu++) {
+		if (cpus & (1ULL << cpu))
+			CPU_SET(cpu, &set);
+	}
+
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		blog(LOG_WARNING, "Unable to set cpu affinity: %s",
+		     strerror(ret));
+		return;
+	}
+
+	blog(LOG_INFO, "mainloop thread pinned to cpu mask 0x%" PRIx64,
+	     cpus);
+}
+
+void pulse_realtime_apply()
+{
+	struct pulse_realtime_config config;
+	pulse_realtime_get(&config);
+
+	if (config.policy == SCHED_FIFO || config.policy == SCHED_RR)
+		pulse_realtime_set_policy(config.policy, config.priority);
+	if (config.cpus)
+		pulse_realtime_set_affinity(config.cpus);
+	if (config.lock_memory)
+		blog(LOG_INFO, "audio buffers are locked into memory");
+}
+
+void pulse_realtime_lock(const void *ptr, size_t size)
+{
+	pulse_realtime_load();
+
+	pthread_mutex_lock(&realtime_mutex);
+	bool lock = realtime_config.lock_memory;
+	pthread_mutex_unlock(&realtime_mutex);
+
+	if (!lock || !ptr || !size)
+		return;
+
+	if (mlock(ptr, size) != 0 && os_atomic_set_long(&lock_failed, 1) == 0)
+		blog(LOG_WARNING,
+		     "Unable to lock audio buffers into memory: %s",
+		     strerror(errno));
+}
+
+void pulse_realtime_unlock(const void *ptr, size_t size)
+{
+	pthread_mutex_lock(&realtime_mutex);
+	bool lock = realtime_config.lock_memory;
+	pthread_mutex_unlock(&realtime_mutex);
+
+	// munlock() works on whole pages, so this can also unlock the start
+	// or end of a neighbouring locked buffer, which is fine for what is
+	// only a best effort to begin with
+	if (lock && ptr && size)
+		munlock(ptr, size);
+}
+
+bool pulse_realtime_parse_policy(struct pulse_realtime_config *config,
+				 const char *str)
+{
+	const char *colon = strchr(str, ':');
+	size_t len = colon ? (size_t)(colon - str) : strlen(str);
+
+	if (len == 5 && strncmp(str, "other", len) == 0) {
+		config->policy = SCHED_OTHER;
+		config->priority = 0;
+		return !colon;
+	}
+
+	if (len == 4 && strncmp(str, "fifo", len) == 0)
+		config->policy = SCHED_FIFO;
+	else if (len == 2 && strncmp(str, "rr", len) == 0)
+		config->policy = SCHED_RR;
+	else
+		return false;
+
+	config->priority = 1;
+	if (colon) {
+		char *end;
+		long priority = strtol(colon + 1, &end, 10);
+		if (*end || end == colon + 1 || priority < 1 || priority > 99)
+			return false;
+		config->priority = (int)priority;
+	}
+
+	return true;
+}
+
+bool pulse_realtime_parse_cpus(struct pulse_realtime_config *config,
+			       const char *str)
+{
+	uint64_t cpus = 0;
+	const char *pos = str;
+
+	while (*pos) {
+		char *end;
+		unsigned long first = strtoul(pos, &end, 10);
+		unsigned long last = first;
+		if (end == pos)
+			return false;
+
+		if (*end == '-') {
+			pos = end + 1;
+			last = strtoul(pos, &end, 10);
+			if (end == pos)
+				return false;
+		}
+
+		if (first > last || last > 63)
+			return false;
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			cpus |= 1ULL << cpu;
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return false;
+		pos = end;
+	}
+
+	config->cpus = cpus;
+	return true;
+}
+
+void pulse_realtime_format(const struct pulse_realtime_config *config,
+			   char *policy, size_t policy_size, char *cpus,
+			   size_t cpus_size)
+{
+	if (config->policy == SCHED_FIFO || config->policy == SCHED_RR)
+		snprintf(policy, policy_size, "%s:%d",
+			 pulse_realtime_policy_name(config->policy),
+			 config->priority);
+	else
+		snprintf(policy, policy_size, "other");
+
+	size_t len = 0;
+	cpus[0] = '\0';
+	for (int cpu = 0; cpu < 64; cpu++) {
+		if (!(config->cpus & (1ULL << cpu)))
+			continue;
+
+		int n = snprintf(cpus + len, cpus_size - len, "%s%d",
+				 len ? "," : "", cpu);
+		if (n < 0 || (size_t)n >= cpus_size - len) {
+			cpus[len] = '\0';
+			break;
+		}
+		len += (size_t)n;
+	}
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#pragma once
+
+/**
+ * Scheduling of the pulseaudio mainloop thread
+ *
+ * Everything is opt-in, the default config leaves the thread alone.
+ */
+struct pulse_realtime_config {
+	/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int policy;
+	int priority;
+	/* cpus the thread may run on, 0 keeps the inherited affinity */
+	uint64_t cpus;
+	/* lock the audio buffers into memory */
+	bool lock_memory;
+};
+
+/**
+ * Set the config used by pulse_realtime_apply() and pulse_realtime_lock()
+ *
+ * @note must be called before the mainloop is started by pulse_init()
+ */
+void pulse_realtime_configure(const struct pulse_realtime_config *config);
+
+/**
+ * Fills in the config, starting from the default one
+ */
+typedef void (*pulse_realtime_loader_t)(struct pulse_realtime_config *config);
+
+/**
+ * Set a function that loads the config the first time it is needed
+ *
+ * The loader runs once, from the first pulse_init() or pulse_realtime_get(),
+ * and not at all if pulse_realtime_configure() was called before.
+ */
+void pulse_realtime_set_loader(pulse_realtime_loader_t load);
+
+/**
+ * Run the loader unless it ran already
+ */
+void pulse_realtime_load();
+
+/**
+ * Get the current config, loading it first if needed
+ */
+void pulse_realtime_get(struct pulse_realtime_config *config);
+
+/**
+ * Apply the scheduling policy and affinity to the calling thread
+ *
+ * If the requested priority is denied by RLIMIT_RTPRIO the highest allowed
+ * one is used instead, without any the thread keeps running as before.
+ */
+void pulse_realtime_apply();
+
+/**
+ * Lock a buffer into memory if memory locking is enabled
+ *
+ * This is best effort, a failure is logged once and otherwise ignored.
+ */
+void pulse_realtime_lock(const void *ptr, size_t size);
+
+/**
+ * Unlock a buffer locked with pulse_realtime_lock() before freeing it
+ */
+void pulse_realtime_unlock(const void *ptr, size_t size);
+
+/**
+ * Parse a policy of the form "other", "fifo:<priority>" or "rr:<priority>"
+ */
+bool pulse_realtime_parse_policy(struct pulse_realtime_config *config,
+				 const char *str);
+
+/**
+ * Parse a cpu list like "2,4-5", cpus above 63 are not supported
+ */
+bool pulse_realtime_parse_cpus(struct pulse_realtime_config *config,
+			       const char *str);
+
+/**
+ * Format the policy and cpus in the form accepted by the parse functions
+ */
+void pulse_realtime_format(const struct pulse_realtime_config *config,
+			   char *policy, size_t policy_size, char *cpus,
+			   size_t cpus_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,429 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-realtime.h"
+#include "pulse-shm-ring.h"
+
+#define PULSE_SHM_RING_MAGIC 0x52415050 /* "PPAR" */
+#define PULSE_SHM_RING_VERSION 1
+#define PULSE_SHM_RING_MIN_CAPACITY (64 * 1024)
+#define PULSE_SHM_RING_DATA_OFFSET 256
+
+/**
+ * Shared header at the start of the memfd
+ *
+ * The positions are free running byte counters, the producer and consumer
+ * positions live on separate cache lines.
+ */
+struct pulse_shm_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+
+	/* written by the producer */
+	uint64_t write_pos __attribute__((aligned(64)));
+	uint64_t dropped;
+	uint32_t state_seq;
+	uint32_t status;
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+
+	/* written by the consumer */
+	uint64_t read_pos __attribute__((aligned(64)));
+};
+
+/**
+ * Packet header, packets are padded to a multiple of the header size so a
+ * padding packet always fits in front of the wrap around
+ */
+struct pulse_shm_ring_packet {
+	uint32_t size;
+	uint32_t frames; /* 0 marks padding up to the end of the ring */
+	uint32_t speakers;
+	uint32_t format;
+	uint32_t samples_per_sec;
+	uint32_t bytes;
+	uint64_t timestamp;
+};
+
+struct pulse_shm_ring {
+	int memfd;
+	int eventfd;
+	size_t map_size;
+	struct pulse_shm_ring_header *header;
+	uint8_t *data;
+	uint64_t mask;
+
+	/* size of the packet returned by the last read */
+	uint32_t pending;
+};
+
+static inline uint64_t pulse_shm_ring_align(uint64_t size)
+{
+	const uint64_t align = sizeof(struct pulse_shm_ring_packet);
+	return (size + align - 1) & ~(align - 1);
+}
+
+static struct pulse_shm_ring *pulse_shm_ring_map(int memfd, int eventfd,
+						 size_t map_size)
+{
+	void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 memfd, 0);
+	if (map == MAP_FAILED) {
+		blog(LOG_ERROR, "Unable to map audio ring: %s",
+		     strerror(errno));
+		return NULL;
+	}
+
+	// the lock goes away with the mapping
+	pulse_realtime_lock(map, map_size);
+
+	struct pulse_shm_ring *ring =
+		(struct pulse_shm_ring *)bzalloc(sizeof(struct pulse_shm_ring));
+	ring->memfd = memfd;
+	ring->eventfd = eventfd;
+	ring->map_size = map_size;
+	ring->header = (struct pulse_shm_ring_header *)map;
+	ring->data = (uint8_t *)map + PULSE_SHM_RING_DATA_OFFSET;
+	return ring;
+}
+
+struct pulse_shm_ring *pulse_shm_ring_create(size_t capacity)
+{
+	uint64_t cap = PULSE_SHM_RING_MIN_CAPACITY;
+	while (cap < capacity)
+		cap <<= 1;
+
+	int memfd = memfd_create("obs-pulse-audio-ring",
+				 MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0) {
+		blog(LOG_ERROR, "Unable to create memfd: %s", strerror(errno));
+		return NULL;
+	}
+
+	size_t map_size = PULSE_SHM_RING_DATA_OFFSET + cap;
+	if (ftruncate(memfd, (off_t)map_size) < 0) {
+		blog(LOG_ERROR, "Unable to size memfd: %s", strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+
+	// the reader maps the whole file, it must never shrink under it
+	if (fcntl(memfd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		blog(LOG_ERROR, "Unable to seal memfd: %s", strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+
+	int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		blog(LOG_ERROR, "Unable to create eventfd: %s",
+		     strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+
+	struct pulse_shm_ring *ring =
+		pulse_shm_ring_map(memfd, efd, map_size);
+	if (!ring) {
+		close(efd);
+		close(memfd);
+		return NULL;
+	}
+
+	ring->mask = cap - 1;
+	ring->header->capacity = cap;
+	ring->header->version = PULSE_SHM_RING_VERSION;
+	__atomic_store_n(&ring->header->magic, PULSE_SHM_RING_MAGIC,
+			 __ATOMIC_RELEASE);
+
+	return ring;
+}
+
+struct pulse_shm_ring *pulse_shm_ring_open(int memfd, int eventfd)
+{
+	struct stat st;
+	struct pulse_shm_ring *ring = NULL;
+
+	if (fstat(memfd, &st) < 0 ||
+	    (size_t)st.st_size <= PULSE_SHM_RING_DATA_OFFSET)
+		goto fail;
+
+	// a file that can shrink would fault the mapping instead of failing
+	int seals = fcntl(memfd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		blog(LOG_ERROR, "Audio ring is not sealed against shrinking");
+		goto fail;
+	}
+
+	ring = pulse_shm_ring_map(memfd, eventfd, (size_t)st.st_size);
+	if (!ring)
+		goto fail;
+
+	struct pulse_shm_ring_header *h = ring->header;
+	uint64_t cap = h->capacity;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) !=
+		    PULSE_SHM_RING_MAGIC ||
+	    h->version != PULSE_SHM_RING_VERSION || !cap ||
+	    (cap & (cap - 1)) != 0 ||
+	    PULSE_SHM_RING_DATA_OFFSET + cap > ring->map_size) {
+		blog(LOG_ERROR, "Invalid audio ring");
+		pulse_shm_ring_destroy(ring);
+		return NULL;
+	}
+
+	ring->mask = cap - 1;
+	return ring;
+
+fail:
+	blog(LOG_ERROR, "Unable to open audio ring");
+	close(eventfd);
+	close(memfd);
+	return NULL;
+}
+
+void pulse_shm_ring_destroy(struct pulse_shm_ring *ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->header, ring->map_size);
+	close(ring->eventfd);
+	close(ring->memfd);
+	bfree(ring);
+}
+
+int pulse_shm_ring_memfd(struct pulse_shm_ring *ring)
+{
+	return ring->memfd;
+}
+
+int pulse_shm_ring_eventfd(struct pulse_shm_ring *ring)
+{
+	return ring->eventfd;
+}
+
+bool pulse_shm_ring_write(struct pulse_shm_ring *ring,
+			  const struct obs_source_audio *audio)
+{
+	struct pulse_shm_ring_header *h = ring->header;
+	uint64_t capacity = ring->mask + 1;
+
+	size_t bytes = audio->frames *
+		       get_audio_channels(audio->speakers) *
+		       get_audio_bytes_per_channel(audio->format);
+	uint64_t size =
+		pulse_shm_ring_align(sizeof(struct pulse_shm_ring_packet) +
+				     bytes);
+
+	uint64_t read_pos = __atomic_load_n(&h->read_pos, __ATOMIC_ACQUIRE);
+	uint64_t write_pos = h->write_pos;
+	uint64_t contiguous = capacity - (write_pos & ring->mask);
+	uint64_t padding = size > contiguous ? contiguous : 0;
+
+	if (size > capacity ||
+	    write_pos + padding + size - read_pos > capacity) {
+		__atomic_fetch_add(&h->dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	struct pulse_shm_ring_packet *p;
+	if (padding) {
+		p = (struct pulse_shm_ring_packet *)(ring->data +
+						     (write_pos & ring->mask));
+		p->size = (uint32_t)padding;
+		p->frames = 0;
+		write_pos += padding;
+	}
+
+	p = (struct pulse_shm_ring_packet *)(ring->data +
+					     (write_pos & ring->mask));
+	p->size = (uint32_t)size;
+	p->frames = audio->frames;
+	p->speakers = audio->speakers;
+	p->format = audio->format;
+	p->samples_per_sec = audio->samples_per_sec;
+	p->bytes = (uint32_t)bytes;
+	p->timestamp = audio->timestamp;
+	memcpy(p + 1, audio->data[0], bytes);
+
+	__atomic_store_n(&h->write_pos, write_pos + size, __ATOMIC_RELEASE);
+
+	uint64_t one = 1;
+	if (write(ring->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to signal audio ring: %s",
+		     strerror(errno));
+
+	return true;
+}
+
+/**
+ * Check a packet header written by the other process
+ *
+ * Never trust the other side with our address space: the packet has to fit
+ * in front of the wrap around and its size has to match its format.
+ *
+ * @note only call this on a private copy of the header, the other side can
+ *       change the one in the ring at any time
+ */
+static bool
+pulse_shm_ring_packet_valid(const struct pulse_shm_ring_packet *p,
+			    uint64_t contiguous)
+{
+	if (p->size < sizeof(*p) || p->size > contiguous ||
+	    p->size % sizeof(*p) != 0 || p->bytes > p->size - sizeof(*p))
+		return false;
+
+	if (!p->frames)
+		return true;
+	if (!p->samples_per_sec)
+		return false;
+
+	uint64_t bytes = (uint64_t)p->frames *
+			 get_audio_channels((enum speaker_layout)p->speakers) *
+			 get_audio_bytes_per_channel(
+				 (enum audio_format)p->format);
+	return bytes && bytes == p->bytes;
+}
+
+bool pulse_shm_ring_read(struct pulse_shm_ring *ring,
+			 struct obs_source_audio *audio)
+{
+	struct pulse_shm_ring_header *h = ring->header;
+	uint64_t capacity = ring->mask + 1;
+
+	uint64_t write_pos = __atomic_load_n(&h->write_pos, __ATOMIC_ACQUIRE);
+	uint64_t read_pos = h->read_pos;
+
+	while (read_pos != write_pos) {
+		const uint8_t *pos = ring->data + (read_pos & ring->mask);
+		uint64_t contiguous = capacity - (read_pos & ring->mask);
+
+		// validate and use a copy, so the header can not change
+		// between checking and using it
+		struct pulse_shm_ring_packet packet;
+		memcpy(&packet, pos, sizeof(packet));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const struct pulse_shm_ring_packet *p = &packet;
+
+		if (!pulse_shm_ring_packet_valid(p, contiguous)) {
+			blog(LOG_ERROR, "Corrupted audio ring, resetting");
+			__atomic_store_n(&h->read_pos, write_pos,
+					 __ATOMIC_RELEASE);
+			return false;
+		}
+
+		if (!p->frames) {
+			read_pos += p->size;
+			__atomic_store_n(&h->read_pos, read_pos,
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+
+		memset(audio, 0, sizeof(*audio));
+		audio->data[0] = pos + sizeof(packet);
+		audio->frames = p->frames;
+		audio->speakers = (enum speaker_layout)p->speakers;
+		audio->format = (enum audio_format)p->format;
+		audio->samples_per_sec = p->samples_per_sec;
+		audio->timestamp = p->timestamp;
+		ring->pending = p->size;
+		return true;
+	}
+
+	return false;
+}
+
+void pulse_shm_ring_consume(struct pulse_shm_ring *ring)
+{
+	struct pulse_shm_ring_header *h = ring->header;
+
+	__atomic_store_n(&h->read_pos, h->read_pos + ring->pending,
+			 __ATOMIC_RELEASE);
+	ring->pending = 0;
+}
+
+void pulse_shm_ring_clear_event(struct pulse_shm_ring *ring)
+{
+	uint64_t count;
+	if (read(ring->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		blog(LOG_WARNING, "Unable to clear audio ring event: %s",
+		     strerror(errno));
+}
+
+void pulse_shm_ring_set_state(struct pulse_shm_ring *ring,
+			      const struct pulse_shm_ring_state *state)
+{
+	struct pulse_shm_ring_header *h = ring->header;
+
+	__atomic_fetch_add(&h->state_seq, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&h->status, (uint32_t)state->status,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&h->client_idx, state->client_idx, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sink_input_idx, state->sink_input_idx,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sink_idx, state->sink_idx, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->state_seq, 1, __ATOMIC_RELEASE);
+}
+
+bool pulse_shm_ring_get_state(struct pulse_shm_ring *ring,
+			      struct pulse_shm_ring_state *state)
+{
+	struct pulse_shm_ring_header *h = ring->header;
+
+	// a writer that died mid update leaves the sequence odd forever, so
+	// give up after a while
+	for (int attempt = 0; attempt < 1000; attempt++) {
+		uint32_t seq = __atomic_load_n(&h->state_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		state->status = (enum pulse_shm_ring_status)__atomic_load_n(
+			&h->status, __ATOMIC_RELAXED);
+		state->client_idx =
+			__atomic_load_n(&h->client_idx, __ATOMIC_RELAXED);
+		state->sink_input_idx =
+			__atomic_load_n(&h->sink_input_idx, __ATOMIC_RELAXED);
+		state->sink_idx =
+			__atomic_load_n(&h->sink_idx, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&h->state_seq, __ATOMIC_RELAXED) == seq)
+			return true;
+	}
+
+	return false;
+}
+
+uint64_t pulse_shm_ring_dropped(struct pulse_shm_ring *ring)
+{
+	return __atomic_load_n(&ring->header->dropped, __ATOMIC_RELAXED);
+}
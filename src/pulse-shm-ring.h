@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <obs.h>
+
+#pragma once
+
+/**
+ * Single producer, single consumer audio ring in a memfd
+ *
+ * The ring is created by the capture helper, which writes audio packets, and
+ * mapped by the plugin, which reads them. Positions are only ever advanced
+ * with atomic release stores, so neither side takes a lock. Every write
+ * signals an eventfd the reader can poll on.
+ *
+ * Besides the audio the ring header carries the discovery state of the
+ * capture so the plugin can see what the helper is bound to.
+ */
+struct pulse_shm_ring;
+
+/**
+ * Discovery state published by the writer
+ */
+enum pulse_shm_ring_status {
+	PULSE_SHM_RING_WAITING,
+	PULSE_SHM_RING_BOUND,
+	PULSE_SHM_RING_FAILED,
+};
+
+struct pulse_shm_ring_state {
+	enum pulse_shm_ring_status status;
+	uint32_t client_idx;
+	uint32_t sink_input_idx;
+	uint32_t sink_idx;
+};
+
+/**
+ * Create a new ring
+ *
+ * @param capacity size of the audio area in bytes, rounded up to a power of
+ *                 two
+ *
+ * @return the ring or NULL if the memfd or eventfd could not be created
+ */
+struct pulse_shm_ring *pulse_shm_ring_create(size_t capacity);
+
+/**
+ * Map a ring created by another process
+ *
+ * Takes ownership of both file descriptors.
+ *
+ * @return the ring or NULL if the memfd does not contain a valid ring
+ */
+struct pulse_shm_ring *pulse_shm_ring_open(int memfd, int eventfd);
+
+/**
+ * Unmap the ring and close its file descriptors
+ */
+void pulse_shm_ring_destroy(struct pulse_shm_ring *ring);
+
+/**
+ * Get the memfd backing the ring
+ */
+int pulse_shm_ring_memfd(struct pulse_shm_ring *ring);
+
+/**
+ * Get the eventfd signaled after every write
+ */
+int pulse_shm_ring_eventfd(struct pulse_shm_ring *ring);
+
+/**
+ * Write one audio packet
+ *
+ * @return false if the reader fell behind and the packet was dropped
+ */
+bool pulse_shm_ring_write(struct pulse_shm_ring *ring,
+			  const struct obs_source_audio *audio);
+
+/**
+ * Read the next audio packet
+ *
+ * The packet data points into the ring and stays valid until the next call
+ * to pulse_shm_ring_read() or pulse_shm_ring_consume().
+ *
+ * @return false if the ring is empty
+ */
+bool pulse_shm_ring_read(struct pulse_shm_ring *ring,
+			 struct obs_source_audio *audio);
+
+/**
+ * Release the packet returned by the last read
+ */
+void pulse_shm_ring_consume(struct pulse_shm_ring *ring);
+
+/**
+ * Clear the eventfd after waking up
+ */
+void pulse_shm_ring_clear_event(struct pulse_shm_ring *ring);
+
+/**
+ * Publish the discovery state
+ */
+void pulse_shm_ring_set_state(struct pulse_shm_ring *ring,
+			      const struct pulse_shm_ring_state *state);
+
+/**
+ * Get a consistent snapshot of the discovery state
+ *
+ * @return false if the writer never finished an update, state is undefined
+ *         then
+ */
+bool pulse_shm_ring_get_state(struct pulse_shm_ring *ring,
+			      struct pulse_shm_ring_state *state);
+
+/**
+ * Get the number of packets dropped by the writer
+ */
+uint64_t pulse_shm_ring_dropped(struct pulse_shm_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
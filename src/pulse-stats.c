@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <time.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-stats.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t pulse_stats_cpu_ns()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+void pulse_stats_begin(struct pulse_stats_probe *probe)
+{
+	probe->allocs = bnum_allocs();
+	probe->cpu_ns = pulse_stats_cpu_ns();
+	probe->wall_ns = os_gettime_ns();
+}
+
+void pulse_stats_end(struct pulse_stats *stats,
+		     const struct pulse_stats_probe *probe, uint64_t items)
+{
+	uint64_t wall = os_gettime_ns() - probe->wall_ns;
+	uint64_t cpu = pulse_stats_cpu_ns() - probe->cpu_ns;
+	long allocs = bnum_allocs() - probe->allocs;
+
+	pthread_mutex_lock(&stats_mutex);
+
+	stats->runs++;
+	stats->items += items;
+	stats->wall_total += wall;
+	if (wall > stats->wall_max)
+		stats->wall_max = wall;
+	stats->cpu_total += cpu;
+	stats->allocs_total += allocs;
+
+	pthread_mutex_unlock(&stats_mutex);
+
+	blog(LOG_DEBUG,
+	     "%s: %" PRIu64 " items in %.3f ms, %.3f ms cpu, %ld allocations",
+	     stats->name, items, (double)wall / NSEC_PER_MSEC,
+	     (double)cpu / NSEC_PER_MSEC, allocs);
+}
+
+void pulse_stats_log(struct pulse_stats *stats)
+{
+	pthread_mutex_lock(&stats_mutex);
+
+	if (stats->runs) {
+		blog(LOG_INFO,
+		     "%s: %" PRIu64 " runs over %" PRIu64 " items, "
+		     "avg %.3f ms, max %.3f ms, avg %.3f ms cpu, "
+		     "%ld net allocations",
+		     stats->name, stats->runs, stats->items,
+		     (double)stats->wall_total / stats->runs / NSEC_PER_MSEC,
+		     (double)stats->wall_max / NSEC_PER_MSEC,
+		     (double)stats->cpu_total / stats->runs / NSEC_PER_MSEC,
+		     stats->allocs_total);
+	}
+
+	stats->runs = 0;
+	stats->items = 0;
+	stats->wall_total = 0;
+	stats->wall_max = 0;
+	stats->cpu_total = 0;
+	stats->allocs_total = 0;
+
+	pthread_mutex_unlock(&stats_mutex);
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+#pragma once
+
+/**
+ * Cost of one code path, accumulated over all of its runs
+ */
+struct pulse_stats {
+	const char *name;
+	uint64_t runs;
+	uint64_t items;
+	uint64_t wall_total;
+	uint64_t wall_max;
+	uint64_t cpu_total;
+	long allocs_total;
+};
+
+#define PULSE_STATS_INIT(name)         \
+	{                              \
+		name, 0, 0, 0, 0, 0, 0 \
+	}
+
+/**
+ * Measurements taken at the start of a run
+ */
+struct pulse_stats_probe {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	long allocs;
+};
+
+/**
+ * Start measuring a run on the calling thread
+ */
+void pulse_stats_begin(struct pulse_stats_probe *probe);
+
+/**
+ * Finish a run and add it to the totals
+ *
+ * Records wall time, CPU time of the calling thread and the net number of
+ * bmem allocations made during the run. The allocation count is process
+ * wide, so it also includes whatever other threads allocated meanwhile.
+ *
+ * @param items number of server objects the run looked at
+ */
+void pulse_stats_end(struct pulse_stats *stats,
+		     const struct pulse_stats_probe *probe, uint64_t items);
+
+/**
+ * Log the totals of a code path and reset them
+ */
+void pulse_stats_log(struct pulse_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <util/base.h>
+
+#define PULSE_SYMBOLS_NO_REDIRECT
+#include "plugin-macros.generated.h"
+#include "pulse-symbols.h"
+
+#define PULSE_LIBRARY "libpulse.so.0"
+
+struct pulse_symbols pulse_syms;
+
+static pthread_once_t symbols_once = PTHREAD_ONCE_INIT;
+static bool symbols_loaded = false;
+
+static void pulse_symbols_load_once()
+{
+	void *lib = dlopen(PULSE_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		blog(LOG_WARNING, "Unable to load %s: %s", PULSE_LIBRARY,
+		     dlerror());
+		return;
+	}
+
+#define PULSE_SYMBOL_LOAD(name)                                               \
+	pulse_syms.name = (__typeof__(pulse_syms.name))dlsym(lib, #name);     \
+	if (!pulse_syms.name) {                                               \
+		blog(LOG_WARNING, "%s has no symbol %s", PULSE_LIBRARY,       \
+		     #name);                                                  \
+		dlclose(lib);                                                 \
+		return;                                                       \
+	}
+	PULSE_SYMBOLS(PULSE_SYMBOL_LOAD)
+#undef PULSE_SYMBOL_LOAD
+
+	// the library is never unloaded, mainloop threads may outlive any
+	// reference count we could keep
+	symbols_loaded = true;
+}
+
+bool pulse_symbols_load()
+{
+	pthread_once(&symbols_once, pulse_symbols_load_once);
+	return symbols_loaded;
+}
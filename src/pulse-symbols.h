@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <pulse/pulseaudio.h>
+
+#pragma once
+
+/**
+ * libpulse functions used by the plugin
+ *
+ * libpulse is not linked but loaded with dlopen() the first time a source
+ * needs it, so loading the plugin costs nothing and works on systems without
+ * the library. Every function used anywhere has to be listed here.
+ */
+#define PULSE_SYMBOLS(X)                          \
+	X(pa_context_connect)                     \
+	X(pa_context_disconnect)                  \
+	X(pa_context_get_client_info)             \
+	X(pa_context_get_client_info_list)        \
+	X(pa_context_get_server_info)             \
+	X(pa_context_get_sink_info_by_index)      \
+	X(pa_context_get_sink_info_list)          \
+	X(pa_context_get_sink_input_info)         \
+	X(pa_context_get_sink_input_info_list)    \
+	X(pa_context_get_source_info_by_index)    \
+	X(pa_context_get_source_info_by_name)     \
+	X(pa_context_get_state)                   \
+	X(pa_context_is_local)                    \
+	X(pa_context_load_module)                 \
+	X(pa_context_move_sink_input_by_index)    \
+	X(pa_context_new_with_proplist)           \
+	X(pa_context_rttime_new)                  \
+	X(pa_context_set_state_callback)          \
+	X(pa_context_set_subscribe_callback)      \
+	X(pa_context_subscribe)                   \
+	X(pa_context_unload_module)               \
+	X(pa_context_unref)                       \
+	X(pa_frame_size)                          \
+	X(pa_mainloop_api_once)                   \
+	X(pa_operation_cancel)                    \
+	X(pa_operation_get_state)                 \
+	X(pa_operation_unref)                     \
+	X(pa_proplist_free)                       \
+	X(pa_proplist_new)                        \
+	X(pa_proplist_sets)                       \
+	X(pa_rtclock_now)                         \
+	X(pa_sample_format_to_string)             \
+	X(pa_sample_spec_equal)                   \
+	X(pa_sample_spec_valid)                   \
+	X(pa_stream_connect_playback)             \
+	X(pa_stream_connect_record)               \
+	X(pa_stream_cork)                         \
+	X(pa_stream_disconnect)                   \
+	X(pa_stream_drop)                         \
+	X(pa_stream_flush)                        \
+	X(pa_stream_get_index)                    \
+	X(pa_stream_get_latency)                  \
+	X(pa_stream_get_state)                    \
+	X(pa_stream_get_time)                     \
+	X(pa_stream_new_with_proplist)            \
+	X(pa_stream_peek)                         \
+	X(pa_stream_readable_size)                \
+	X(pa_stream_set_monitor_stream)           \
+	X(pa_stream_set_overflow_callback)        \
+	X(pa_stream_set_read_callback)            \
+	X(pa_stream_set_state_callback)           \
+	X(pa_stream_set_write_callback)           \
+	X(pa_stream_unref)                        \
+	X(pa_stream_write)                        \
+	X(pa_threaded_mainloop_accept)            \
+	X(pa_threaded_mainloop_free)              \
+	X(pa_threaded_mainloop_get_api)           \
+	X(pa_threaded_mainloop_lock)              \
+	X(pa_threaded_mainloop_new)               \
+	X(pa_threaded_mainloop_signal)            \
+	X(pa_threaded_mainloop_start)             \
+	X(pa_threaded_mainloop_stop)              \
+	X(pa_threaded_mainloop_unlock)            \
+	X(pa_threaded_mainloop_wait)              \
+	X(pa_usec_to_bytes)
+
+#define PULSE_SYMBOL_MEMBER(name) __typeof__(name) *name;
+struct pulse_symbols {
+	PULSE_SYMBOLS(PULSE_SYMBOL_MEMBER)
+};
+#undef PULSE_SYMBOL_MEMBER
+
+extern struct pulse_symbols pulse_syms;
+
+/**
+ * Load libpulse and resolve all symbols
+ *
+ * Only the first call does any work, the library stays loaded afterwards.
+ *
+ * @return false if the library or one of the symbols is missing
+ */
+bool pulse_symbols_load();
+
+/* route all calls through the symbol table */
+#ifndef PULSE_SYMBOLS_NO_REDIRECT
+#define pa_context_connect pulse_syms.pa_context_connect
+#define pa_context_disconnect pulse_syms.pa_context_disconnect
+#define pa_context_get_client_info pulse_syms.pa_context_get_client_info
+#define pa_context_get_client_info_list \
+	pulse_syms.pa_context_get_client_info_list
+#define pa_context_get_server_info pulse_syms.pa_context_get_server_info
+#define pa_context_get_sink_info_by_index \
+	pulse_syms.pa_context_get_sink_info_by_index
+#define pa_context_get_sink_info_list pulse_syms.pa_context_get_sink_info_list
+#define pa_context_get_sink_input_info pulse_syms.pa_context_get_sink_input_info
+#define pa_context_get_sink_input_info_list \
+	pulse_syms.pa_context_get_sink_input_info_list
+#define pa_context_get_source_info_by_index \
+	pulse_syms.pa_context_get_source_info_by_index
+#define pa_context_get_source_info_by_name \
+	pulse_syms.pa_context_get_source_info_by_name
+#define pa_context_get_state pulse_syms.pa_context_get_state
+#define pa_context_is_local pulse_syms.pa_context_is_local
+#define pa_context_load_module pulse_syms.pa_context_load_module
+#define pa_context_move_sink_input_by_index \
+	pulse_syms.pa_context_move_sink_input_by_index
+#define pa_context_new_with_proplist pulse_syms.pa_context_new_with_proplist
+#define pa_context_rttime_new pulse_syms.pa_context_rttime_new
+#define pa_context_set_state_callback pulse_syms.pa_context_set_state_callback
+#define pa_context_set_subscribe_callback \
+	pulse_syms.pa_context_set_subscribe_callback
+#define pa_context_subscribe pulse_syms.pa_context_subscribe
+#define pa_context_unload_module pulse_syms.pa_context_unload_module
+#define pa_context_unref pulse_syms.pa_context_unref
+#define pa_frame_size pulse_syms.pa_frame_size
+#define pa_mainloop_api_once pulse_syms.pa_mainloop_api_once
+#define pa_operation_cancel pulse_syms.pa_operation_cancel
+#define pa_operation_get_state pulse_syms.pa_operation_get_state
+#define pa_operation_unref pulse_syms.pa_operation_unref
+#define pa_proplist_free pulse_syms.pa_proplist_free
+#define pa_proplist_new pulse_syms.pa_proplist_new
+#define pa_proplist_sets pulse_syms.pa_proplist_sets
+#define pa_rtclock_now pulse_syms.pa_rtclock_now
+#define pa_sample_format_to_string pulse_syms.pa_sample_format_to_string
+#define pa_sample_spec_equal pulse_syms.pa_sample_spec_equal
+#define pa_sample_spec_valid pulse_syms.pa_sample_spec_valid
+#define pa_stream_connect_playback pulse_syms.pa_stream_connect_playback
+#define pa_stream_connect_record pulse_syms.pa_stream_connect_record
+#define pa_stream_cork pulse_syms.pa_stream_cork
+#define pa_stream_disconnect pulse_syms.pa_stream_disconnect
+#define pa_stream_drop pulse_syms.pa_stream_drop
+#define pa_stream_flush pulse_syms.pa_stream_flush
+#define pa_stream_get_index pulse_syms.pa_stream_get_index
+#define pa_stream_get_latency pulse_syms.pa_stream_get_latency
+#define pa_stream_get_state pulse_syms.pa_stream_get_state
+#define pa_stream_get_time pulse_syms.pa_stream_get_time
+#define pa_stream_new_with_proplist pulse_syms.pa_stream_new_with_proplist
+#define pa_stream_peek pulse_syms.pa_stream_peek
+#define pa_stream_readable_size pulse_syms.pa_stream_readable_size
+#define pa_stream_set_monitor_stream pulse_syms.pa_stream_set_monitor_stream
+#define pa_stream_set_overflow_callback \
+	pulse_syms.pa_stream_set_overflow_callback
+#define pa_stream_set_read_callback pulse_syms.pa_stream_set_read_callback
+#define pa_stream_set_state_callback pulse_syms.pa_stream_set_state_callback
+#define pa_stream_set_write_callback pulse_syms.pa_stream_set_write_callback
+#define pa_stream_unref pulse_syms.pa_stream_unref
+#define pa_stream_write pulse_syms.pa_stream_write
+#define pa_threaded_mainloop_accept pulse_syms.pa_threaded_mainloop_accept
+#define pa_threaded_mainloop_free pulse_syms.pa_threaded_mainloop_free
+#define pa_threaded_mainloop_get_api pulse_syms.pa_threaded_mainloop_get_api
+#define pa_threaded_mainloop_lock pulse_syms.pa_threaded_mainloop_lock
+#define pa_threaded_mainloop_new pulse_syms.pa_threaded_mainloop_new
+#define pa_threaded_mainloop_signal pulse_syms.pa_threaded_mainloop_signal
+#define pa_threaded_mainloop_start pulse_syms.pa_threaded_mainloop_start
+#define pa_threaded_mainloop_stop pulse_syms.pa_threaded_mainloop_stop
+#define pa_threaded_mainloop_unlock pulse_syms.pa_threaded_mainloop_unlock
+#define pa_threaded_mainloop_wait pulse_syms.pa_threaded_mainloop_wait
+#define pa_usec_to_bytes pulse_syms.pa_usec_to_bytes
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,165 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef PULSE_TRACE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "plugin-macros.generated.h"
+#include "pulse-trace.h"
+
+/* the most recent events are kept, older ones are overwritten */
+#define PULSE_TRACE_MAX_EVENTS (1 << 16)
+
+struct pulse_trace_event {
+	const char *cat;
+	const char *name;
+	const char *site;
+	uint64_t start;
+	uint64_t end;
+	pid_t tid;
+};
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pulse_trace_event *trace_events = NULL;
+static uint64_t trace_count = 0;
+static uint64_t trace_epoch = 0;
+
+static pid_t pulse_trace_tid()
+{
+	static __thread pid_t tid = 0;
+
+	if (!tid)
+		tid = (pid_t)syscall(SYS_gettid);
+	return tid;
+}
+
+void pulse_trace_start()
+{
+	pthread_mutex_lock(&trace_mutex);
+
+	if (!trace_events) {
+		trace_events = (struct pulse_trace_event *)bzalloc(
+			sizeof(struct pulse_trace_event) *
+			PULSE_TRACE_MAX_EVENTS);
+		trace_count = 0;
+		trace_epoch = os_gettime_ns();
+	}
+
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+uint64_t pulse_trace_now()
+{
+	return os_gettime_ns();
+}
+
+void pulse_trace_span(const char *cat, const char *name, const char *site,
+		      uint64_t start, uint64_t end)
+{
+	pid_t tid = pulse_trace_tid();
+
+	pthread_mutex_lock(&trace_mutex);
+
+	if (trace_events) {
+		struct pulse_trace_event *ev =
+			&trace_events[trace_count++ % PULSE_TRACE_MAX_EVENTS];
+		ev->cat = cat;
+		ev->name = name;
+		ev->site = site ? site : "";
+		ev->start = start;
+		ev->end = end;
+		ev->tid = tid;
+	}
+
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static void pulse_trace_write(FILE *f, struct pulse_trace_event *events,
+			      uint64_t count, uint64_t epoch)
+{
+	uint64_t first = count > PULSE_TRACE_MAX_EVENTS
+				 ? count - PULSE_TRACE_MAX_EVENTS
+				 : 0;
+	pid_t pid = getpid();
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	for (uint64_t i = first; i < count; i++) {
+		struct pulse_trace_event *ev =
+			&events[i % PULSE_TRACE_MAX_EVENTS];
+		uint64_t start = ev->start > epoch ? ev->start - epoch : 0;
+		uint64_t dur = ev->end > ev->start ? ev->end - ev->start : 0;
+
+		fprintf(f,
+			"%s{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+			"\"args\":{\"site\":\"%s\"}}\n",
+			i == first ? "" : ",", ev->cat, ev->name,
+			(double)start / 1000.0, (double)dur / 1000.0, (int)pid,
+			(int)ev->tid, ev->site);
+	}
+
+	fprintf(f, "]}\n");
+}
+
+void pulse_trace_stop()
+{
+	pthread_mutex_lock(&trace_mutex);
+
+	struct pulse_trace_event *events = trace_events;
+	uint64_t count = trace_count;
+	trace_events = NULL;
+	trace_count = 0;
+
+	pthread_mutex_unlock(&trace_mutex);
+
+	if (!events)
+		return;
+
+	char path[512];
+	const char *env = getenv("OBS_PULSE_TRACE_FILE");
+	if (env && *env)
+		snprintf(path, sizeof(path), "%s", env);
+	else
+		snprintf(path, sizeof(path), "/tmp/obs-pulse-trace-%d.json",
+			 (int)getpid());
+
+	FILE *f = fopen(path, "w");
+	if (f) {
+		pulse_trace_write(f, events, count, trace_epoch);
+		fclose(f);
+		blog(LOG_INFO, "Wrote %" PRIu64 " trace events to '%s'",
+		     count > PULSE_TRACE_MAX_EVENTS ? PULSE_TRACE_MAX_EVENTS
+						     : count,
+		     path);
+	} else {
+		blog(LOG_ERROR, "Unable to open trace file '%s'", path);
+	}
+
+	bfree(events);
+}
+
+#endif
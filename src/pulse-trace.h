@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+#pragma once
+
+#ifdef PULSE_TRACE
+
+/**
+ * Start collecting trace events
+ *
+ * Events are kept in memory and written as Chrome trace JSON (which can also
+ * be loaded by Perfetto) when pulse_trace_stop() is called. The file name is
+ * taken from the OBS_PULSE_TRACE_FILE environment variable and defaults to
+ * /tmp/obs-pulse-trace-<pid>.json
+ */
+void pulse_trace_start();
+
+/**
+ * Write all collected events to the trace file and stop collecting
+ */
+void pulse_trace_stop();
+
+/**
+ * Get the current trace timestamp in nanoseconds
+ */
+uint64_t pulse_trace_now();
+
+/**
+ * Record a completed span
+ *
+ * @param cat the event category (lock, wait, operation, callback)
+ * @param name the event name
+ * @param site the function the event originated from
+ * @param start timestamp as returned by pulse_trace_now()
+ * @param end timestamp as returned by pulse_trace_now()
+ *
+ * @note all strings must have static storage duration
+ */
+void pulse_trace_span(const char *cat, const char *name, const char *site,
+		      uint64_t start, uint64_t end);
+
+#else
+
+static inline void pulse_trace_start() {}
+static inline void pulse_trace_stop() {}
+static inline uint64_t pulse_trace_now()
+{
+	return 0;
+}
+static inline void pulse_trace_span(const char *cat, const char *name,
+				    const char *site, uint64_t start,
+				    uint64_t end)
+{
+	(void)cat;
+	(void)name;
+	(void)site;
+	(void)start;
+	(void)end;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
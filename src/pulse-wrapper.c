@@ -16,13 +16,23 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <pthread.h>
+#include <stdio.h>
+#include <string.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/thread-mainloop.h>
 
 #include <util/base.h>
+#include <util/platform.h>
+#include <util/threading.h>
 #include <obs.h>
 
 #include "pulse-wrapper.h"
+#include "pulse-realtime.h"
+#include "pulse-trace.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000LL
 
 /* global data */
 static uint_fast32_t pulse_refs = 0;
@@ -30,16 +40,98 @@ static pthread_mutex_t pulse_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pa_threaded_mainloop *pulse_mainloop = NULL;
 static pa_context *pulse_context = NULL;
 
+/* event subscribers, protected by the mainloop lock */
+struct pulse_subscriber {
+	pa_context_subscribe_cb_t cb;
+	void *userdata;
+	struct pulse_subscriber *next;
+};
+static struct pulse_subscriber *pulse_subscribers = NULL;
+static bool pulse_subscribed = false;
+
+/* pulseaudio shared memory mappings of the process */
+struct pulse_segments {
+	uint_fast32_t shm;
+	uint_fast32_t memfd;
+};
+
+/* deadlines of the blocking calls */
+#define QUERY_TIMEOUT_NS (2 * NSEC_PER_SEC)
+#define MODULE_TIMEOUT_NS (5 * NSEC_PER_SEC)
+#define CONNECT_TIMEOUT_NS (5 * NSEC_PER_SEC)
+/* operations taking longer than this are counted as slow */
+#define SLOW_OPERATION_NS (100 * NSEC_PER_MSEC)
+
+/**
+ * Deadline of a blocking wait
+ */
+struct pulse_deadline {
+	pa_time_event *timer;
+	bool expired;
+};
+
+/* blocking operation statistics, protected by the mainloop lock */
+static struct pulse_operation_stats pulse_op_stats;
+/* references held by the plugin, protected by the mainloop lock */
+static struct pulse_ref_stats pulse_ref_stats;
+
+/* transport detection, the baseline is protected by the mainloop lock, the
+ * result is shared by all streams of the process */
+static struct pulse_segments pulse_baseline;
+static volatile long pulse_transport = PULSE_TRANSPORT_UNKNOWN;
+static volatile bool pulse_audio_received = false;
+
+#ifdef PULSE_TRACE
+/* per thread lock bookkeeping, the mainloop lock is recursive */
+static __thread uint_fast32_t pulse_lock_depth = 0;
+static __thread uint64_t pulse_lock_start = 0;
+static __thread const char *pulse_lock_site = NULL;
+#endif
+
+/**
+ * Count the pulseaudio shared memory segments mapped into the process
+ */
+static void pulse_count_segments(struct pulse_segments *segments)
+{
+	char line[512];
+
+	segments->shm = 0;
+	segments->memfd = 0;
+
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (!maps)
+		return;
+
+	while (fgets(line, sizeof(line), maps)) {
+		if (strstr(line, "/memfd:pulseaudio"))
+			segments->memfd++;
+		else if (strstr(line, "/dev/shm/pulse-shm-"))
+			segments->shm++;
+	}
+
+	fclose(maps);
+}
+
 /**
  * context status change callback
  *
- * @todo this is currently a noop, we want to reconnect here if the connection
- *       is lost ...
+ * Takes the baseline for the transport detection once the context is ready,
+ * at that point only our own memory pool is mapped.
+ *
+ * @todo we want to reconnect here if the connection is lost ...
  */
 static void pulse_context_state_changed(pa_context *c, void *userdata)
 {
 	UNUSED_PARAMETER(userdata);
-	UNUSED_PARAMETER(c);
+
+	if (pa_context_get_state(c) == PA_CONTEXT_READY) {
+		pulse_count_segments(&pulse_baseline);
+		os_atomic_set_bool(&pulse_audio_received, false);
+		os_atomic_set_long(&pulse_transport,
+				   pa_context_is_local(c) > 0
+					   ? PULSE_TRANSPORT_UNKNOWN
+					   : PULSE_TRANSPORT_SOCKET);
+	}
 
 	pulse_signal(0);
 }
@@ -58,6 +150,17 @@ static pa_proplist *pulse_properties()
 	return p;
 }
 
+/**
+ * Deferred call applying the scheduling config to the mainloop thread
+ */
+static void pulse_realtime_once(pa_mainloop_api *api, void *userdata)
+{
+	UNUSED_PARAMETER(api);
+	UNUSED_PARAMETER(userdata);
+
+	pulse_realtime_apply();
+}
+
 /**
  * Initialize the pulse audio context with properties and callback
  */
@@ -78,8 +181,53 @@ static void pulse_init_context()
 	pulse_unlock();
 }
 
+/**
+ * Deadline timer callback, wakes up the waiting thread
+ */
+static void pulse_deadline_cb(pa_mainloop_api *api, pa_time_event *e,
+			      const struct timeval *tv, void *userdata)
+{
+	UNUSED_PARAMETER(api);
+	UNUSED_PARAMETER(e);
+	UNUSED_PARAMETER(tv);
+
+	struct pulse_deadline *deadline = (struct pulse_deadline *)userdata;
+	deadline->expired = true;
+	pulse_signal(0);
+}
+
+/**
+ * Arm a deadline for a blocking wait
+ *
+ * pa_threaded_mainloop_wait() has no timeout, so a timer on the mainloop
+ * signals the waiting thread when the deadline passed.
+ *
+ * @warning call with an active lock
+ */
+static void pulse_deadline_start(struct pulse_deadline *deadline,
+				 uint64_t timeout_ns)
+{
+	deadline->expired = false;
+	deadline->timer = pa_context_rttime_new(
+		pulse_context, pa_rtclock_now() + timeout_ns / 1000,
+		pulse_deadline_cb, deadline);
+}
+
+/**
+ * @warning call with an active lock
+ */
+static void pulse_deadline_stop(struct pulse_deadline *deadline)
+{
+	if (deadline->timer)
+		pa_threaded_mainloop_get_api(pulse_mainloop)
+			->time_free(deadline->timer);
+	deadline->timer = NULL;
+}
+
 /**
  * wait for context to be ready
+ *
+ * @return negative if the context failed or did not get ready in time
  */
 static int_fast32_t pulse_context_ready()
 {
@@ -90,21 +238,46 @@ static int_fast32_t pulse_context_ready()
 		return -1;
 	}
 
-	while (pa_context_get_state(pulse_context) != PA_CONTEXT_READY)
+	struct pulse_deadline deadline;
+	pa_context_state_t state;
+
+	pulse_deadline_start(&deadline, CONNECT_TIMEOUT_NS);
+	while ((state = pa_context_get_state(pulse_context)) !=
+		       PA_CONTEXT_READY &&
+	       PA_CONTEXT_IS_GOOD(state) && !deadline.expired)
 		pulse_wait();
+	pulse_deadline_stop(&deadline);
+
+	bool ready = state == PA_CONTEXT_READY;
+	if (!ready && deadline.expired)
+		blog(LOG_WARNING, "Timed out connecting to the server");
 
 	pulse_unlock();
-	return 0;
+	return ready ? 0 : -1;
 }
 
 int_fast32_t pulse_init()
 {
 	pthread_mutex_lock(&pulse_mutex);
 
+	if (pulse_refs == 0 && !pulse_symbols_load()) {
+		pthread_mutex_unlock(&pulse_mutex);
+		return -1;
+	}
+
 	if (pulse_refs == 0) {
+		pulse_trace_start();
+		pulse_realtime_load();
+
 		pulse_mainloop = pa_threaded_mainloop_new();
 		pa_threaded_mainloop_start(pulse_mainloop);
 
+		pulse_lock();
+		pa_mainloop_api_once(
+			pa_threaded_mainloop_get_api(pulse_mainloop),
+			pulse_realtime_once, NULL);
+		pulse_unlock();
+
 		pulse_init_context();
 	}
 
@@ -126,6 +299,19 @@ void pulse_unref()
 			pa_context_unref(pulse_context);
 			pulse_context = NULL;
 		}
+		while (pulse_subscribers) {
+			struct pulse_subscriber *s = pulse_subscribers;
+			pulse_subscribers = s->next;
+			bfree(s);
+		}
+		pulse_subscribed = false;
+		os_atomic_set_long(&pulse_transport, PULSE_TRANSPORT_UNKNOWN);
+		if (pulse_ref_stats.streams || pulse_ref_stats.operations)
+			blog(LOG_WARNING,
+			     "%" PRId64 " streams and %" PRId64
+			     " operations were never released",
+			     pulse_ref_stats.streams,
+			     pulse_ref_stats.operations);
 		pulse_unlock();
 
 		if (pulse_mainloop != NULL) {
@@ -133,24 +319,59 @@ void pulse_unref()
 			pa_threaded_mainloop_free(pulse_mainloop);
 			pulse_mainloop = NULL;
 		}
+
+		pulse_trace_stop();
 	}
 
 	pthread_mutex_unlock(&pulse_mutex);
 }
 
-void pulse_lock()
+void pulse_lock_at(const char *site)
 {
+#ifdef PULSE_TRACE
+	uint64_t start = pulse_trace_now();
+	pa_threaded_mainloop_lock(pulse_mainloop);
+
+	if (pulse_lock_depth++ == 0) {
+		pulse_lock_start = pulse_trace_now();
+		pulse_lock_site = site;
+		pulse_trace_span("lock", "acquire", site, start,
+				 pulse_lock_start);
+	}
+#else
+	UNUSED_PARAMETER(site);
 	pa_threaded_mainloop_lock(pulse_mainloop);
+#endif
 }
 
-void pulse_unlock()
+void pulse_unlock_at(const char *site)
 {
+#ifdef PULSE_TRACE
+	if (pulse_lock_depth && --pulse_lock_depth == 0)
+		pulse_trace_span("lock", "hold", pulse_lock_site,
+				 pulse_lock_start, pulse_trace_now());
+#endif
+	UNUSED_PARAMETER(site);
 	pa_threaded_mainloop_unlock(pulse_mainloop);
 }
 
-void pulse_wait()
+void pulse_wait_at(const char *site)
 {
+#ifdef PULSE_TRACE
+	/* the lock is released while waiting, so split the hold span */
+	uint64_t start = pulse_trace_now();
+	if (pulse_lock_depth)
+		pulse_trace_span("lock", "hold", pulse_lock_site,
+				 pulse_lock_start, start);
+
+	pa_threaded_mainloop_wait(pulse_mainloop);
+
+	pulse_lock_start = pulse_trace_now();
+	pulse_trace_span("wait", "wait", site, start, pulse_lock_start);
+#else
+	UNUSED_PARAMETER(site);
 	pa_threaded_mainloop_wait(pulse_mainloop);
+#endif
 }
 
 void pulse_signal(int wait_for_accept)
@@ -163,6 +384,156 @@ void pulse_accept()
 	pa_threaded_mainloop_accept(pulse_mainloop);
 }
 
+void pulse_mark_audio_received()
+{
+	if (!os_atomic_load_bool(&pulse_audio_received))
+		os_atomic_set_bool(&pulse_audio_received, true);
+}
+
+void pulse_detect_transport()
+{
+	if (pulse_get_transport() != PULSE_TRANSPORT_UNKNOWN ||
+	    !os_atomic_load_bool(&pulse_audio_received))
+		return;
+
+	struct pulse_segments baseline, now;
+	pulse_lock();
+	bool ready = pulse_context &&
+		     pa_context_get_state(pulse_context) == PA_CONTEXT_READY;
+	baseline = pulse_baseline;
+	pulse_unlock();
+
+	if (!ready)
+		return;
+
+	pulse_count_segments(&now);
+
+	enum pulse_transport transport = PULSE_TRANSPORT_SOCKET;
+	if (now.memfd > baseline.memfd)
+		transport = PULSE_TRANSPORT_MEMFD;
+	else if (now.shm > baseline.shm)
+		transport = PULSE_TRANSPORT_SHM;
+
+	// a reconnect in the meantime starts over
+	if (!os_atomic_compare_swap_long(&pulse_transport,
+					 PULSE_TRANSPORT_UNKNOWN, transport))
+		return;
+
+	if (transport == PULSE_TRANSPORT_SOCKET)
+		blog(LOG_WARNING, "Audio of all streams is copied through the "
+				  "socket, shared memory is not available");
+	else
+		blog(LOG_INFO, "Audio of all streams is transferred through %s",
+		     pulse_transport_name(transport));
+}
+
+enum pulse_transport pulse_get_transport()
+{
+	return (enum pulse_transport)os_atomic_load_long(&pulse_transport);
+}
+
+const char *pulse_transport_name(enum pulse_transport transport)
+{
+	switch (transport) {
+	case PULSE_TRANSPORT_SOCKET:
+		return "socket";
+	case PULSE_TRANSPORT_SHM:
+		return "shm";
+	case PULSE_TRANSPORT_MEMFD:
+		return "memfd";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Wait for an operation to finish and release it
+ *
+ * An operation still running at the deadline is cancelled, its callback is
+ * not called anymore after that. The time between issuing the operation and
+ * its completion is recorded as the round trip of the calling wrapper when
+ * tracing is enabled.
+ *
+ * @return negative if the operation timed out or failed
+ *
+ * @warning call with an active lock
+ */
+static int_fast32_t pulse_wait_operation(pa_operation *op, const char *site,
+					 uint64_t timeout_ns)
+{
+	uint64_t trace_start = pulse_trace_now();
+	uint64_t start = os_gettime_ns();
+	struct pulse_deadline deadline;
+
+	pulse_operation_track(op);
+	pulse_deadline_start(&deadline, timeout_ns);
+	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING &&
+	       !deadline.expired)
+		pulse_wait_at(site);
+	pulse_deadline_stop(&deadline);
+
+	pa_operation_state_t state = pa_operation_get_state(op);
+	if (state == PA_OPERATION_RUNNING) {
+		pa_operation_cancel(op);
+		blog(LOG_WARNING, "%s timed out after %.0f ms", site,
+		     (double)timeout_ns / NSEC_PER_MSEC);
+	}
+	pulse_operation_release(op);
+
+	uint64_t duration = os_gettime_ns() - start;
+	pulse_op_stats.operations++;
+	if (duration >= SLOW_OPERATION_NS)
+		pulse_op_stats.slow++;
+	if (state == PA_OPERATION_RUNNING)
+		pulse_op_stats.timeouts++;
+	if (duration > pulse_op_stats.max_ns)
+		pulse_op_stats.max_ns = duration;
+
+	pulse_trace_span("operation", site, site, trace_start,
+			 pulse_trace_now());
+
+	return state == PA_OPERATION_DONE ? 0 : -1;
+}
+
+void pulse_get_operation_stats(struct pulse_operation_stats *stats)
+{
+	pthread_mutex_lock(&pulse_mutex);
+	if (pulse_mainloop) {
+		pulse_lock();
+		*stats = pulse_op_stats;
+		pulse_unlock();
+	} else {
+		*stats = pulse_op_stats;
+	}
+	pthread_mutex_unlock(&pulse_mutex);
+}
+
+void pulse_get_ref_stats(struct pulse_ref_stats *stats)
+{
+	pthread_mutex_lock(&pulse_mutex);
+	if (pulse_mainloop) {
+		pulse_lock();
+		*stats = pulse_ref_stats;
+		pulse_unlock();
+	} else {
+		*stats = pulse_ref_stats;
+	}
+	pthread_mutex_unlock(&pulse_mutex);
+}
+
+pa_operation *pulse_operation_track(pa_operation *op)
+{
+	if (op)
+		pulse_ref_stats.operations++;
+	return op;
+}
+
+void pulse_operation_release(pa_operation *op)
+{
+	pa_operation_unref(op);
+	pulse_ref_stats.operations--;
+}
+
 int_fast32_t pulse_get_client_info_list(pa_client_info_cb_t cb, void *userdata)
 {
 	if (pulse_context_ready() < 0)
@@ -176,13 +547,32 @@ int_fast32_t pulse_get_client_info_list(pa_client_info_cb_t cb, void *userdata)
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
+}
+
+int_fast32_t pulse_get_client_info(uint32_t idx, pa_client_info_cb_t cb,
+				   void *userdata)
+{
+	if (pulse_context_ready() < 0)
+		return -1;
+
+	pulse_lock();
+
+	pa_operation *op =
+		pa_context_get_client_info(pulse_context, idx, cb, userdata);
+	if (!op) {
+		pulse_unlock();
+		return -1;
+	}
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
+
+	pulse_unlock();
+
+	return ret;
 }
 
 int_fast32_t pulse_get_source_info_by_idx(pa_source_info_cb_t cb, uint32_t idx,
@@ -199,13 +589,11 @@ int_fast32_t pulse_get_source_info_by_idx(pa_source_info_cb_t cb, uint32_t idx,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_get_source_info_by_name(pa_source_info_cb_t cb,
@@ -222,13 +610,11 @@ int_fast32_t pulse_get_source_info_by_name(pa_source_info_cb_t cb,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_get_server_info(pa_server_info_cb_t cb, void *userdata)
@@ -244,12 +630,10 @@ int_fast32_t pulse_get_server_info(pa_server_info_cb_t cb, void *userdata)
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
-	return 0;
+	return ret;
 }
 
 pa_stream *pulse_stream_new(const char *name, const pa_sample_spec *ss,
@@ -264,11 +648,19 @@ pa_stream *pulse_stream_new(const char *name, const pa_sample_spec *ss,
 	pa_stream *s =
 		pa_stream_new_with_proplist(pulse_context, name, ss, map, p);
 	pa_proplist_free(p);
+	if (s)
+		pulse_ref_stats.streams++;
 
 	pulse_unlock();
 	return s;
 }
 
+void pulse_stream_release(pa_stream *s)
+{
+	pa_stream_unref(s);
+	pulse_ref_stats.streams--;
+}
+
 int_fast32_t pulse_get_sink_input_info_list(pa_sink_input_info_cb_t cb,
 					    void *userdata)
 {
@@ -283,13 +675,33 @@ int_fast32_t pulse_get_sink_input_info_list(pa_sink_input_info_cb_t cb,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
+}
+
+int_fast32_t pulse_get_sink_input_info(uint32_t idx,
+				       pa_sink_input_info_cb_t cb,
+				       void *userdata)
+{
+	if (pulse_context_ready() < 0)
+		return -1;
+
+	pulse_lock();
+
+	pa_operation *op = pa_context_get_sink_input_info(pulse_context, idx,
+							  cb, userdata);
+	if (!op) {
+		pulse_unlock();
+		return -1;
+	}
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
+
+	pulse_unlock();
+
+	return ret;
 }
 
 int_fast32_t pulse_get_sink_info_list(pa_sink_info_cb_t cb, void *userdata)
@@ -305,13 +717,11 @@ int_fast32_t pulse_get_sink_info_list(pa_sink_info_cb_t cb, void *userdata)
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_get_sink_name_by_index(uint32_t idx, pa_sink_info_cb_t cb,
@@ -328,13 +738,11 @@ int_fast32_t pulse_get_sink_name_by_index(uint32_t idx, pa_sink_info_cb_t cb,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_load_new_module(const char *name, const char *argument,
@@ -351,13 +759,12 @@ int_fast32_t pulse_load_new_module(const char *name, const char *argument,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret =
+		pulse_wait_operation(op, __func__, MODULE_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_get_sink_list(pa_sink_info_cb_t cb, void *userdata)
@@ -373,13 +780,11 @@ int_fast32_t pulse_get_sink_list(pa_sink_info_cb_t cb, void *userdata)
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_move_sink_input(uint32_t sink_input_idx,
@@ -397,13 +802,11 @@ int_fast32_t pulse_move_sink_input(uint32_t sink_input_idx,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret = pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 int_fast32_t pulse_unload_module(uint32_t idx, pa_context_success_cb_t cb,
@@ -420,13 +823,12 @@ int_fast32_t pulse_unload_module(uint32_t idx, pa_context_success_cb_t cb,
 		pulse_unlock();
 		return -1;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
+	int_fast32_t ret =
+		pulse_wait_operation(op, __func__, MODULE_TIMEOUT_NS);
 
 	pulse_unlock();
 
-	return 0;
+	return ret;
 }
 
 static void subscribe_cb(pa_context *c, int success, void *userdata)
@@ -438,6 +840,19 @@ static void subscribe_cb(pa_context *c, int success, void *userdata)
 	pulse_signal(0);
 }
 
+/**
+ * forward subscription events to every subscriber
+ */
+static void subscribe_dispatch_cb(pa_context *c,
+				  pa_subscription_event_type_t t, uint32_t idx,
+				  void *userdata)
+{
+	UNUSED_PARAMETER(userdata);
+
+	for (struct pulse_subscriber *s = pulse_subscribers; s; s = s->next)
+		s->cb(c, t, idx, s->userdata);
+}
+
 int_fast32_t pulse_subscribe_events(pa_context_subscribe_cb_t cb,
 				    void *userdata)
 {
@@ -446,32 +861,56 @@ int_fast32_t pulse_subscribe_events(pa_context_subscribe_cb_t cb,
 
 	pulse_lock();
 
-	bool success = true;
+	if (!pulse_subscribed) {
+		bool success = true;
+
+		pa_operation *op = pa_context_subscribe(
+			pulse_context,
+			PA_SUBSCRIPTION_MASK_SINK_INPUT |
+				PA_SUBSCRIPTION_MASK_SINK |
+				PA_SUBSCRIPTION_MASK_CLIENT,
+			subscribe_cb, &success);
+		if (!op) {
+			pulse_unlock();
+			return -1;
+		}
+		if (pulse_wait_operation(op, __func__, QUERY_TIMEOUT_NS) < 0 ||
+		    !success) {
+			pulse_unlock();
+			return -1;
+		}
 
-	pa_operation *op = pa_context_subscribe(
-		pulse_context,
-		PA_SUBSCRIPTION_MASK_SINK_INPUT | PA_SUBSCRIPTION_MASK_SINK,
-		subscribe_cb, &success);
-	if (!op) {
-		pulse_unlock();
-		return -1;
+		pa_context_set_subscribe_callback(pulse_context,
+						  subscribe_dispatch_cb, NULL);
+		pulse_subscribed = true;
 	}
-	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-		pulse_wait();
-	pa_operation_unref(op);
 
-	pulse_unlock();
+	struct pulse_subscriber *s =
+		(struct pulse_subscriber *)bzalloc(sizeof(*s));
+	s->cb = cb;
+	s->userdata = userdata;
+	s->next = pulse_subscribers;
+	pulse_subscribers = s;
 
-	if (success) {
-		if (pulse_context_ready() < 0)
-			return -1;
+	pulse_unlock();
 
-		pulse_lock();
+	return 0;
+}
 
-		pa_context_set_subscribe_callback(pulse_context, cb, userdata);
+void pulse_unsubscribe_events(pa_context_subscribe_cb_t cb, void *userdata)
+{
+	pulse_lock();
 
-		pulse_unlock();
+	struct pulse_subscriber **pos = &pulse_subscribers;
+	while (*pos) {
+		struct pulse_subscriber *s = *pos;
+		if (s->cb == cb && s->userdata == userdata) {
+			*pos = s->next;
+			bfree(s);
+			break;
+		}
+		pos = &s->next;
 	}
 
-	return 0;
+	pulse_unlock();
 }
@@ -25,10 +25,16 @@ extern "C" {
 #include <pulse/introspect.h>
 #include <pulse/subscribe.h>
 
+#include "pulse-symbols.h"
+
 #pragma once
 
 /**
  * Initialize the pulseaudio mainloop and increase the reference count
+ *
+ * libpulse is loaded on the first call.
+ *
+ * @return -1 if libpulse is not available, no reference is taken then
  */
 int_fast32_t pulse_init();
 
@@ -46,25 +52,31 @@ void pulse_unref();
  * using any pulseaudio function that is in any way related to the mainloop or
  * context.
  *
+ * The calling function is recorded as the call site when the plugin is built
+ * with tracing enabled.
+ *
  * @note use of this function may cause deadlocks
  *
  * @warning do not use with pulse_ wrapper functions
  */
-void pulse_lock();
+#define pulse_lock() pulse_lock_at(__func__)
+void pulse_lock_at(const char *site);
 
 /**
  * Unlock the mainloop
  *
  * @see pulse_lock()
  */
-void pulse_unlock();
+#define pulse_unlock() pulse_unlock_at(__func__)
+void pulse_unlock_at(const char *site);
 
 /**
  * Wait for events to happen
  *
  * This function should be called when waiting for an event to happen.
  */
-void pulse_wait();
+#define pulse_wait() pulse_wait_at(__func__)
+void pulse_wait_at(const char *site);
 
 /**
  * Wait for accept signal from calling thread
@@ -84,6 +96,95 @@ void pulse_signal(int wait_for_accept);
  */
 void pulse_accept();
 
+/**
+ * Statistics of the blocking calls
+ *
+ * Every call waiting for the server gives up after a deadline of a few
+ * seconds, cancels its operation and returns an error, so a wedged server
+ * can not block the calling thread forever.
+ */
+struct pulse_operation_stats {
+	uint64_t operations;
+	/* took longer than 100 ms */
+	uint64_t slow;
+	/* cancelled at the deadline */
+	uint64_t timeouts;
+	uint64_t max_ns;
+};
+
+/**
+ * Get the statistics of the blocking calls since the plugin was loaded
+ */
+void pulse_get_operation_stats(struct pulse_operation_stats *stats);
+
+/**
+ * Server objects the plugin currently holds a reference to
+ *
+ * Both are back to zero once every capture stopped, anything left is leaked.
+ */
+struct pulse_ref_stats {
+	int64_t streams;
+	int64_t operations;
+};
+
+/**
+ * Get the number of streams and operations that were not released yet
+ */
+void pulse_get_ref_stats(struct pulse_ref_stats *stats);
+
+/**
+ * How audio data gets from the server into the plugin
+ */
+enum pulse_transport {
+	/* nothing was received yet */
+	PULSE_TRANSPORT_UNKNOWN,
+	/* copied through the socket */
+	PULSE_TRANSPORT_SOCKET,
+	/* posix shared memory in /dev/shm */
+	PULSE_TRANSPORT_SHM,
+	/* memfd shared memory */
+	PULSE_TRANSPORT_MEMFD,
+};
+
+/**
+ * Note that a stream received audio, so the transport can be detected
+ *
+ * @note cheap enough for the read callback
+ */
+void pulse_mark_audio_received();
+
+/**
+ * Detect the transport the server uses for audio data
+ *
+ * libpulse does not tell which transport was negotiated. The server's memory
+ * pool is mapped into the process with the first block it sends through
+ * shared memory though, so the pulseaudio mappings of the process are
+ * compared with the ones present when the context became ready. The
+ * transport is negotiated for the connection, so the result applies to all
+ * streams of the process and is kept until the context goes away. Pools of
+ * other pulseaudio connections in the process, e.g. the ones of the obs
+ * audio sources, that appear after the baseline count as shared memory too.
+ *
+ * Does nothing before a stream received audio or once the transport is
+ * known.
+ *
+ * @warning reads /proc/self/maps, keep it off the audio path and never call
+ *          from the mainloop thread or with an active lock
+ */
+void pulse_detect_transport();
+
+/**
+ * Get the transport detected by pulse_detect_transport()
+ *
+ * @return PULSE_TRANSPORT_UNKNOWN until the transport was detected
+ */
+enum pulse_transport pulse_get_transport();
+
+/**
+ * Get a printable name of a transport
+ */
+const char *pulse_transport_name(enum pulse_transport transport);
+
 /**
  * Request client information
  *
@@ -98,6 +199,21 @@ void pulse_accept();
  */
 int_fast32_t pulse_get_client_info_list(pa_client_info_cb_t cb, void *userdata);
 
+/**
+ * Request information about a single client
+ *
+ * The function will block until the operation was executed and the mainloop
+ * called the provided callback function.
+ *
+ * @return negative on error
+ *
+ * @note The function will block until the server context is ready.
+ *
+ * @warning call without active locks
+ */
+int_fast32_t pulse_get_client_info(uint32_t idx, pa_client_info_cb_t cb,
+				   void *userdata);
+
 int_fast32_t pulse_get_source_info_by_idx(pa_source_info_cb_t cb, uint32_t idx,
 					  void *userdata);
 
@@ -144,9 +260,37 @@ int_fast32_t pulse_get_server_info(pa_server_info_cb_t cb, void *userdata);
 pa_stream *pulse_stream_new(const char *name, const pa_sample_spec *ss,
 			    const pa_channel_map *map);
 
+/**
+ * Drop the reference of a stream created by pulse_stream_new()
+ *
+ * @warning call with an active lock
+ */
+void pulse_stream_release(pa_stream *s);
+
+/**
+ * Take ownership of an operation the caller got from libpulse
+ *
+ * Operations passed through here are counted until they are given back with
+ * pulse_operation_release(), NULL is passed through unchanged.
+ *
+ * @warning call with an active lock
+ */
+pa_operation *pulse_operation_track(pa_operation *op);
+
+/**
+ * Drop the reference of an operation from pulse_operation_track()
+ *
+ * @warning call with an active lock
+ */
+void pulse_operation_release(pa_operation *op);
+
 int_fast32_t pulse_get_sink_input_info_list(pa_sink_input_info_cb_t cb,
 					    void *userdata);
 
+int_fast32_t pulse_get_sink_input_info(uint32_t idx,
+				       pa_sink_input_info_cb_t cb,
+				       void *userdata);
+
 int_fast32_t pulse_get_sink_info_list(pa_sink_info_cb_t cb, void *userdata);
 
 int_fast32_t pulse_get_sink_name_by_index(uint32_t idx, pa_sink_info_cb_t cb,
@@ -164,9 +308,30 @@ int_fast32_t pulse_move_sink_input(uint32_t sink_input_idx,
 int_fast32_t pulse_unload_module(uint32_t idx, pa_context_success_cb_t cb,
 				 void *userdata);
 
+/**
+ * Subscribe to sink, sink input and client events
+ *
+ * Every subscriber is called from the mainloop thread for every event, the
+ * server side subscription is only set up once per context.
+ *
+ * @return negative on error
+ *
+ * @note The function will block until the server context is ready.
+ *
+ * @warning call without active locks
+ */
 int_fast32_t pulse_subscribe_events(pa_context_subscribe_cb_t cb,
 				    void *userdata);
 
+/**
+ * Remove a subscriber added with pulse_subscribe_events()
+ *
+ * After this function returned the callback will not be called again.
+ *
+ * @warning call without active locks
+ */
+void pulse_unsubscribe_events(pa_context_subscribe_cb_t cb, void *userdata);
+
 #ifdef __cplusplus
 }
 #endif
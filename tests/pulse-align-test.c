@@ -0,0 +1,148 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* burst detection and capture alignment on synthetic captures */
+
+#include <math.h>
+
+#include "pulse-align.h"
+#include "pulse-test.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+#define RATE 48000
+#define CHIRP_FRAMES 480
+#define PERIOD_FRAMES (RATE / 2)
+#define BURSTS 40
+/* packets that do not line up with the bursts */
+#define PACKET_FRAMES 441
+
+/* the second capture sees the bursts this much later, and its timestamps
+ * are this far ahead */
+#define DELAY_FRAMES 53
+#define TS_SHIFT_NS (-3 * NSEC_PER_MSEC)
+
+#define BASE_NS (1000 * NSEC_PER_SEC)
+
+static float chirp[CHIRP_FRAMES];
+
+static uint64_t test_random_state = 0x2545f4914f6cdd1dULL;
+
+/* noise well below the onset threshold */
+static float test_noise(void)
+{
+	test_random_state ^= test_random_state << 13;
+	test_random_state ^= test_random_state >> 7;
+	test_random_state ^= test_random_state << 17;
+	return (float)((double)(test_random_state % 2001) / 1000.0 - 1.0) *
+	       0.002f;
+}
+
+/* first frame of a burst in the first capture, not on a packet boundary */
+static uint64_t test_burst_start(uint_fast32_t k)
+{
+	return RATE / 10 + (uint64_t)k * PERIOD_FRAMES + (k * 37) % 480;
+}
+
+/**
+ * Capture the bursts delayed by some frames, with shifted timestamps
+ *
+ * @return number of bursts located, each at the frame it was played at
+ */
+static uint_fast32_t test_capture(uint64_t delay, int64_t ts_shift,
+				  uint64_t *played, uint64_t *ts)
+{
+	static struct pulse_align align;
+	uint64_t frames = test_burst_start(BURSTS) + 2 * CHIRP_FRAMES;
+	uint_fast32_t detected = 0;
+	uint_fast32_t next = 0;
+
+	pulse_align_init(&align, chirp, CHIRP_FRAMES, RATE);
+
+	for (uint64_t pos = 0; pos < frames; pos++) {
+		if (pos % PACKET_FRAMES == 0) {
+			uint64_t packet_ts = BASE_NS + ts_shift +
+					     pos * NSEC_PER_SEC / RATE;
+			pulse_align_packet(&align, PACKET_FRAMES, packet_ts,
+					   packet_ts);
+		}
+
+		float value = test_noise();
+		while (next < BURSTS &&
+		       pos >= test_burst_start(next) + delay + CHIRP_FRAMES)
+			next++;
+		if (next < BURSTS && pos >= test_burst_start(next) + delay)
+			value += chirp[pos - test_burst_start(next) - delay];
+
+		struct pulse_align_burst burst;
+		if (!pulse_align_sample(&align, value, &burst))
+			continue;
+
+		TEST_CHECK(detected < BURSTS);
+		if (detected >= BURSTS)
+			break;
+		TEST_CHECK(burst.start == test_burst_start(detected) + delay);
+
+		// both captures got the burst played at the same time
+		played[detected] = BASE_NS + detected * NSEC_PER_SEC / 2;
+		ts[detected] = burst.ts;
+		detected++;
+	}
+
+	return detected;
+}
+
+int main(void)
+{
+	static uint64_t played_a[BURSTS], ts_a[BURSTS];
+	static uint64_t played_b[BURSTS], ts_b[BURSTS];
+
+	pulse_align_chirp(chirp, CHIRP_FRAMES, RATE, 500.0, 8000.0, 0.5);
+
+	uint_fast32_t a = test_capture(0, 0, played_a, ts_a);
+	uint_fast32_t b =
+		test_capture(DELAY_FRAMES, TS_SHIFT_NS, played_b, ts_b);
+	TEST_CHECK(a == BURSTS);
+	TEST_CHECK(b == BURSTS);
+
+	struct pulse_align_offset offset;
+	pulse_align_offset(played_a, ts_a, a, played_b, ts_b, b,
+			   NSEC_PER_SEC / 4, &offset);
+
+	double expected = (double)DELAY_FRAMES * NSEC_PER_SEC / RATE +
+			  (double)TS_SHIFT_NS;
+	TEST_CHECK(offset.paired == BURSTS);
+	TEST_CHECK(fabs(offset.offset_ns - expected) < 1000.0);
+	TEST_CHECK(offset.jitter_ns < 1000.0);
+	TEST_CHECK(fabs(offset.max_ns - fabs(expected)) < 1000.0);
+	printf("offset %.3f ms, expected %.3f ms\n",
+	       offset.offset_ns / NSEC_PER_MSEC, expected / NSEC_PER_MSEC);
+
+	// a burst missing from the second capture is not paired with the
+	// next one
+	for (uint_fast32_t i = 5; i + 1 < b; i++) {
+		played_b[i] = played_b[i + 1];
+		ts_b[i] = ts_b[i + 1];
+	}
+	pulse_align_offset(played_a, ts_a, a, played_b, ts_b, b - 1,
+			   NSEC_PER_SEC / 4, &offset);
+	TEST_CHECK(offset.paired == BURSTS - 1);
+	TEST_CHECK(fabs(offset.offset_ns - expected) < 1000.0);
+
+	return TEST_RESULT();
+}
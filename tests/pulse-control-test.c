@@ -0,0 +1,144 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* pulse-control scheduling and cancel tests */
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "pulse-control.h"
+#include "pulse-test.h"
+
+struct looper {
+	volatile long runs;
+	volatile long refused;
+	volatile bool started;
+	volatile bool cancelled;
+	/* run again through pulse_control_again() instead */
+	bool again;
+};
+
+/* runs after the cancel for their key returned */
+static volatile long late_runs = 0;
+
+static void test_loop(void *param, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(queued_ns);
+	struct looper *l = (struct looper *)param;
+
+	if (os_atomic_load_bool(&l->cancelled))
+		os_atomic_inc_long(&late_runs);
+
+	/* hold the key on the first run so the cancel arrives meanwhile */
+	if (!os_atomic_set_bool(&l->started, true))
+		os_sleep_ms(50);
+
+	os_atomic_inc_long(&l->runs);
+	if (l->again)
+		pulse_control_again(0);
+	else if (!pulse_control_schedule(l, 0, test_loop, l))
+		os_atomic_inc_long(&l->refused);
+}
+
+/* a callback running itself again while it is being cancelled */
+static void test_cancel(bool again)
+{
+	struct looper *l = bzalloc(sizeof(struct looper));
+	l->again = again;
+
+	pulse_control_schedule(l, 0, test_loop, l);
+	while (!os_atomic_load_bool(&l->started))
+		os_sleep_ms(1);
+
+	pulse_control_cancel(l);
+	os_atomic_set_bool(&l->cancelled, true);
+
+	long runs = os_atomic_load_long(&l->runs);
+	TEST_CHECK(runs == 1);
+	TEST_CHECK(os_atomic_load_long(&l->refused) == (again ? 0 : 1));
+
+	os_sleep_ms(100);
+	TEST_CHECK(os_atomic_load_long(&l->runs) == runs);
+	TEST_CHECK(os_atomic_load_long(&late_runs) == 0);
+
+	/* the key is usable again once the cancel returned */
+	os_atomic_set_bool(&l->cancelled, false);
+	TEST_CHECK(pulse_control_schedule(l, 0, test_loop, l));
+	while (os_atomic_load_long(&l->runs) < runs + 3)
+		os_sleep_ms(1);
+
+	pulse_control_cancel(l);
+	os_atomic_set_bool(&l->cancelled, true);
+	runs = os_atomic_load_long(&l->runs);
+
+	os_sleep_ms(100);
+	TEST_CHECK(os_atomic_load_long(&l->runs) == runs);
+	TEST_CHECK(os_atomic_load_long(&late_runs) == 0);
+
+	bfree(l);
+}
+
+static volatile long order[2];
+static volatile long order_pos = 0;
+
+static void test_order(void *param, uint64_t queued_ns)
+{
+	UNUSED_PARAMETER(queued_ns);
+	long pos = os_atomic_inc_long(&order_pos) - 1;
+	if (pos < 2)
+		order[pos] = (long)(intptr_t)param;
+}
+
+/* pending calls are coalesced by key and run by deadline */
+static void test_coalesce(void)
+{
+	static int a, b;
+
+	TEST_CHECK(pulse_control_schedule(&a, 60000000, test_order,
+					  (void *)(intptr_t)1));
+	TEST_CHECK(!pulse_control_schedule(&a, 500000000, test_order,
+					   (void *)(intptr_t)1));
+	TEST_CHECK(pulse_control_schedule(&b, 20000000, test_order,
+					  (void *)(intptr_t)2));
+
+	os_sleep_ms(200);
+	TEST_CHECK(os_atomic_load_long(&order_pos) == 2);
+	TEST_CHECK(order[0] == 2 && order[1] == 1);
+
+	/* a cancelled call never runs */
+	TEST_CHECK(pulse_control_schedule(&a, 20000000, test_order,
+					  (void *)(intptr_t)1));
+	pulse_control_cancel(&a);
+	os_sleep_ms(60);
+	TEST_CHECK(os_atomic_load_long(&order_pos) == 2);
+}
+
+int main(void)
+{
+	if (pulse_control_init() != 0)
+		return 1;
+
+	test_coalesce();
+	test_cancel(false);
+	test_cancel(true);
+
+	pulse_control_unref();
+
+	TEST_CHECK(bnum_allocs() == 0);
+	return TEST_RESULT();
+}
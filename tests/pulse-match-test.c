@@ -0,0 +1,477 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Binding rules driven by a scripted event feed
+ *
+ * A simulated server produces a day of churn: clients connecting and
+ * leaving, streams starting, stopping, moving and corking, and sink-inputs
+ * vanishing before their removal event arrives. Every event goes through
+ * pulse_match_event() for two sources, reconciliations are scheduled on the
+ * control timers like the plugin does and run from a scripted clock, and
+ * stalls go through pulse_match_stall(). Whenever the feed pauses, the
+ * bindings are checked against the simulated server.
+ */
+
+#include <string.h>
+#include <pulse/def.h>
+#include <pulse/subscribe.h>
+
+#include <util/bmem.h>
+
+#include "pulse-clock.h"
+#include "pulse-control.h"
+#include "pulse-match.h"
+#include "pulse-test.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000L
+
+#define EVENT_WINDOW_NS (50 * NSEC_PER_MSEC)
+/* granularity the scripted clock advances at */
+#define STEP_NS (5 * NSEC_PER_MSEC)
+#define DURATION_NS (24 * 3600 * NSEC_PER_SEC)
+
+#define MAX_CLIENTS 16
+#define MAX_SINK_INPUTS 32
+#define SINKS 4
+#define DELAYED_EVENTS 8
+
+static uint64_t test_now_ns = 0;
+
+static uint64_t test_clock(void)
+{
+	return test_now_ns;
+}
+
+static uint64_t test_random_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t test_random(uint32_t range)
+{
+	test_random_state ^= test_random_state << 13;
+	test_random_state ^= test_random_state >> 7;
+	test_random_state ^= test_random_state << 17;
+	return (uint32_t)(test_random_state % range);
+}
+
+/* the simulated server, lists in server order */
+struct test_client {
+	uint32_t idx;
+	const char *name;
+};
+
+struct test_sink_input {
+	uint32_t idx;
+	uint32_t client;
+	uint32_t sink;
+	bool corked;
+};
+
+static struct test_client clients[MAX_CLIENTS];
+static size_t client_count = 0;
+static struct test_sink_input sink_inputs[MAX_SINK_INPUTS];
+static size_t sink_input_count = 0;
+static uint32_t next_idx = 1;
+
+/* removal events still on their way */
+static uint32_t delayed[DELAYED_EVENTS];
+static size_t delayed_count = 0;
+
+static const char *names[] = {"game", "music", "browser", "voice"};
+
+/* a source as the plugin keeps it */
+struct test_source {
+	const char *client;
+	struct pulse_match_state match;
+	bool capturing;
+	bool stall_suspected;
+	uint64_t reconciles;
+};
+
+#define SOURCES 2
+static struct test_source sources[SOURCES];
+
+static struct test_client *test_find_client(uint32_t idx)
+{
+	for (size_t i = 0; i < client_count; i++) {
+		if (clients[i].idx == idx)
+			return &clients[i];
+	}
+	return NULL;
+}
+
+static struct test_sink_input *test_find_sink_input(uint32_t idx)
+{
+	for (size_t i = 0; i < sink_input_count; i++) {
+		if (sink_inputs[i].idx == idx)
+			return &sink_inputs[i];
+	}
+	return NULL;
+}
+
+/* full resolution against the server, like pulse_rebind() */
+static void test_rebind(struct test_source *src)
+{
+	struct pulse_match m;
+	pulse_match_init(&m, src->client);
+
+	for (size_t i = 0; i < client_count; i++)
+		pulse_match_add_client(&m, clients[i].idx, clients[i].name);
+	src->match.client_idx = m.client_idx;
+
+	for (size_t i = 0; i < sink_input_count; i++)
+		pulse_match_add_sink_input(&m, sink_inputs[i].idx,
+					   sink_inputs[i].client,
+					   sink_inputs[i].sink);
+	src->match.sink_input_idx = m.sink_input_idx;
+	src->match.sink_idx = m.sink_idx;
+	src->capturing = m.sink_input_idx != PA_INVALID_INDEX;
+}
+
+static void test_reconcile(void *param, uint64_t queued_ns)
+{
+	struct test_source *src = (struct test_source *)param;
+
+	/* the clock advances in steps, the deadline is never missed by more
+	 * than one */
+	TEST_CHECK(pulse_clock_now() - queued_ns <= EVENT_WINDOW_NS + STEP_NS);
+	src->reconciles++;
+
+	struct pulse_match_decision d;
+	pulse_match_reconcile(&src->match, src->capturing, &d);
+
+	if (d.drop)
+		src->capturing = false;
+
+	if (src->stall_suspected) {
+		src->stall_suspected = false;
+
+		struct pulse_match_object obj = {0};
+		struct test_sink_input *si =
+			test_find_sink_input(src->match.sink_input_idx);
+		if (si) {
+			obj.found = true;
+			obj.client = si->client;
+			obj.sink = si->sink;
+			obj.corked = si->corked;
+		}
+
+		if (src->capturing &&
+		    pulse_match_stall(&src->match, &obj) ==
+			    PULSE_MATCH_STALL_REBIND)
+			pulse_control_again(EVENT_WINDOW_NS);
+	}
+
+	if (d.step == PULSE_MATCH_CONNECT) {
+		if (test_find_sink_input(d.sink_input_idx)) {
+			src->match.sink_input_idx = d.sink_input_idx;
+			src->match.sink_idx = d.sink_idx;
+			src->capturing = true;
+		} else {
+			src->match.sink_input_idx = PA_INVALID_INDEX;
+			src->match.sink_idx = PA_INVALID_INDEX;
+			test_rebind(src);
+		}
+	} else if (d.step == PULSE_MATCH_REBIND) {
+		test_rebind(src);
+	}
+}
+
+/* deliver a subscription event to all sources, like pulse_process_event() */
+static void test_event(uint32_t facility, uint32_t type, uint32_t idx)
+{
+	uint32_t event = facility | type;
+	struct pulse_match_object obj = {0};
+
+	if (pulse_match_event_query(event, false)) {
+		struct test_client *c = NULL;
+		struct test_sink_input *si = NULL;
+
+		if (facility == PA_SUBSCRIPTION_EVENT_CLIENT)
+			c = test_find_client(idx);
+		else
+			si = test_find_sink_input(idx);
+
+		if (c) {
+			obj.found = true;
+			obj.name = c->name;
+		} else if (si) {
+			obj.found = true;
+			obj.client = si->client;
+			obj.sink = si->sink;
+			obj.corked = si->corked;
+		}
+	}
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct test_source *src = &sources[i];
+		switch (pulse_match_event(&src->match, src->client, event, idx,
+					  &obj)) {
+		case PULSE_MATCH_NONE:
+		case PULSE_MATCH_CLIENT:
+			break;
+		case PULSE_MATCH_NOW:
+			pulse_control_schedule(src, 0, test_reconcile, src);
+			break;
+		case PULSE_MATCH_LATER:
+			pulse_control_schedule(src, EVENT_WINDOW_NS,
+					       test_reconcile, src);
+			break;
+		}
+	}
+}
+
+/**
+ * The watchdog noticed the stream of a sink-input stopped delivering
+ *
+ * @param moved only the streams still recording another sink
+ */
+static void test_stall(uint32_t sink_input_idx, bool moved)
+{
+	struct test_sink_input *si = test_find_sink_input(sink_input_idx);
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct test_source *src = &sources[i];
+		if (!src->capturing ||
+		    src->match.sink_input_idx != sink_input_idx)
+			continue;
+		if (moved && si && si->sink == src->match.sink_idx)
+			continue;
+		src->stall_suspected = true;
+		pulse_control_schedule(src, 0, test_reconcile, src);
+	}
+}
+
+static void test_remove_sink_input(size_t i, bool announce)
+{
+	uint32_t idx = sink_inputs[i].idx;
+
+	memmove(&sink_inputs[i], &sink_inputs[i + 1],
+		sizeof(struct test_sink_input) * (sink_input_count - i - 1));
+	sink_input_count--;
+
+	if (announce)
+		test_event(PA_SUBSCRIPTION_EVENT_SINK_INPUT,
+			   PA_SUBSCRIPTION_EVENT_REMOVE, idx);
+	else
+		delayed[delayed_count++] = idx;
+}
+
+static void test_deliver_delayed(void)
+{
+	for (size_t i = 0; i < delayed_count; i++)
+		test_event(PA_SUBSCRIPTION_EVENT_SINK_INPUT,
+			   PA_SUBSCRIPTION_EVENT_REMOVE, delayed[i]);
+	delayed_count = 0;
+}
+
+/* one step of churn on the simulated server */
+static void test_churn(void)
+{
+	switch (test_random(8)) {
+	case 0: {
+		// a client connects, at most one per name
+		const char *name = names[test_random(4)];
+		for (size_t i = 0; i < client_count; i++) {
+			if (strcmp(clients[i].name, name) == 0)
+				return;
+		}
+		if (client_count == MAX_CLIENTS)
+			return;
+		clients[client_count].idx = next_idx++;
+		clients[client_count].name = name;
+		client_count++;
+		test_event(PA_SUBSCRIPTION_EVENT_CLIENT,
+			   PA_SUBSCRIPTION_EVENT_NEW, next_idx - 1);
+		break;
+	}
+	case 1: {
+		// a client leaves, the server removes its streams first
+		if (!client_count)
+			return;
+		size_t c = test_random((uint32_t)client_count);
+		uint32_t idx = clients[c].idx;
+		for (size_t i = sink_input_count; i > 0; i--) {
+			if (sink_inputs[i - 1].client == idx)
+				test_remove_sink_input(i - 1, true);
+		}
+		memmove(&clients[c], &clients[c + 1],
+			sizeof(struct test_client) * (client_count - c - 1));
+		client_count--;
+		test_event(PA_SUBSCRIPTION_EVENT_CLIENT,
+			   PA_SUBSCRIPTION_EVENT_REMOVE, idx);
+		break;
+	}
+	case 2:
+	case 3: {
+		// a client starts a stream
+		if (!client_count || sink_input_count == MAX_SINK_INPUTS)
+			return;
+		struct test_sink_input *si = &sink_inputs[sink_input_count++];
+		si->idx = next_idx++;
+		si->client = clients[test_random((uint32_t)client_count)].idx;
+		si->sink = test_random(SINKS);
+		si->corked = false;
+		test_event(PA_SUBSCRIPTION_EVENT_SINK_INPUT,
+			   PA_SUBSCRIPTION_EVENT_NEW, si->idx);
+		break;
+	}
+	case 4:
+		// a stream stops
+		if (!sink_input_count)
+			return;
+		test_remove_sink_input(test_random((uint32_t)sink_input_count),
+				       true);
+		break;
+	case 5: {
+		// a stream is moved, the capture stalls
+		if (!sink_input_count)
+			return;
+		struct test_sink_input *si =
+			&sink_inputs[test_random((uint32_t)sink_input_count)];
+		si->sink = (si->sink + 1 + test_random(SINKS - 1)) % SINKS;
+		test_event(PA_SUBSCRIPTION_EVENT_SINK_INPUT,
+			   PA_SUBSCRIPTION_EVENT_CHANGE, si->idx);
+		test_stall(si->idx, false);
+		break;
+	}
+	case 6: {
+		// a stream is corked or uncorked by its client
+		if (!sink_input_count)
+			return;
+		struct test_sink_input *si =
+			&sink_inputs[test_random((uint32_t)sink_input_count)];
+		si->corked = !si->corked;
+		test_event(PA_SUBSCRIPTION_EVENT_SINK_INPUT,
+			   PA_SUBSCRIPTION_EVENT_CHANGE, si->idx);
+		// a stream moved while corked stays silent once uncorked
+		test_stall(si->idx, !si->corked);
+		break;
+	}
+	case 7: {
+		// a stream vanishes, the capture stalls before the removal
+		// event arrives
+		if (!sink_input_count || delayed_count == DELAYED_EVENTS)
+			return;
+		size_t i = test_random((uint32_t)sink_input_count);
+		uint32_t idx = sink_inputs[i].idx;
+		test_remove_sink_input(i, false);
+		test_stall(idx, false);
+		break;
+	}
+	}
+}
+
+static void test_advance(uint64_t ns)
+{
+	uint64_t end = test_now_ns + ns;
+
+	while (test_now_ns < end) {
+		test_now_ns += STEP_NS;
+		if (test_now_ns > end)
+			test_now_ns = end;
+		pulse_control_run_due();
+	}
+}
+
+/* with the feed paused, every source is bound as a full resolution would */
+static void test_check_bindings(void)
+{
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct test_source *src = &sources[i];
+		struct test_source want;
+
+		memset(&want, 0, sizeof(want));
+		want.client = src->client;
+		pulse_match_state_init(&want.match);
+		test_rebind(&want);
+
+		TEST_CHECK(src->match.client_idx == want.match.client_idx);
+		TEST_CHECK(src->capturing == want.capturing);
+		if (!src->capturing || !want.capturing)
+			continue;
+
+		// a later stream of the client does not replace the bound one
+		struct test_sink_input *si =
+			test_find_sink_input(src->match.sink_input_idx);
+		TEST_CHECK(si != NULL);
+		if (!si)
+			continue;
+		TEST_CHECK(si->client == src->match.client_idx);
+		// a corked stream is left alone until it plays again
+		TEST_CHECK(si->corked || si->sink == src->match.sink_idx);
+	}
+}
+
+/* a burst of events is coalesced into one reconciliation per window */
+static void test_burst(void)
+{
+	struct test_source *src = &sources[0];
+	uint64_t reconciles = src->reconciles;
+
+	for (uint32_t i = 0; i < 10; i++) {
+		test_event(PA_SUBSCRIPTION_EVENT_SINK,
+			   PA_SUBSCRIPTION_EVENT_NEW, 1000 + i);
+		test_advance(EVENT_WINDOW_NS / 20);
+	}
+	TEST_CHECK(src->reconciles == reconciles);
+
+	test_advance(EVENT_WINDOW_NS);
+	TEST_CHECK(src->reconciles == reconciles + 1);
+}
+
+int main(void)
+{
+	pulse_clock_set(test_clock);
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		sources[i].client = names[i];
+		pulse_match_state_init(&sources[i].match);
+	}
+
+	test_burst();
+
+	uint64_t steps = 0;
+	while (test_now_ns < DURATION_NS && !test_failures) {
+		test_churn();
+		steps++;
+		test_advance(test_random(500) * NSEC_PER_MSEC);
+
+		if (test_random(16) == 0) {
+			test_deliver_delayed();
+			test_advance(3 * EVENT_WINDOW_NS);
+			test_check_bindings();
+			if (test_failures)
+				fprintf(stderr, "bindings differ after %llu "
+						"events\n",
+					(unsigned long long)steps);
+		}
+	}
+
+	uint64_t reconciles = 0;
+	for (size_t i = 0; i < SOURCES; i++) {
+		pulse_control_cancel(&sources[i]);
+		reconciles += sources[i].reconciles;
+	}
+
+	printf("%llu events, %llu reconciliations over %.0f simulated hours\n",
+	       (unsigned long long)steps, (unsigned long long)reconciles,
+	       (double)test_now_ns / NSEC_PER_SEC / 3600);
+
+	TEST_CHECK(bnum_allocs() == 0);
+	return TEST_RESULT();
+}
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2021 by Joshua Wong <jbwong05@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* minimal checks for the tests, run through ctest */
+
+#include <stdio.h>
+
+#pragma once
+
+static int test_failures = 0;
+
+#define TEST_CHECK(expr)                                                    \
+	do {                                                                \
+		if (!(expr)) {                                              \
+			fprintf(stderr, "%s:%d: check failed: %s\n",        \
+				__FILE__, __LINE__, #expr);                 \
+			test_failures++;                                    \
+		}                                                           \
+	} while (0)
+
+#define TEST_RESULT() (test_failures ? 1 : 0)